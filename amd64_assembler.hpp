@@ -1,6 +1,9 @@
 #pragma once
 
 #include "instruction.hpp"
+#include "vector_instruction.hpp"
+#include "bit_manipulation_instruction.hpp"
+#include "statistics.hpp"
 
 namespace amd64 {
     constexpr auto adc      = arithmetic_instruction<0x15, {0x81,2}, 0x11>{};
@@ -32,18 +35,44 @@ namespace amd64 {
     constexpr auto cmc = opcode_instruction<0xf5>{};
 
     constexpr auto cpuid = opcode_instruction<std::to_array({0x0f, 0xa2})>{};
+    constexpr auto xgetbv = opcode_instruction<std::to_array({0x0f, 0x01, 0xd0})>{};
+
+    // edx:eax = time stamp counter; rdtscp waits for earlier instructions
+    // and sets ecx to the processor id
+    constexpr auto rdtsc  = opcode_instruction<std::to_array({0x0f, 0x31})>{};
+    constexpr auto rdtscp = opcode_instruction<std::to_array({0x0f, 0x01, 0xf9})>{};
+
+    // rcx times from [rsi] to [rdi], or of al/rax to [rdi]
+    constexpr auto rep_movsb = opcode_instruction<std::to_array({0xf3, 0xa4})>{};
+    constexpr auto rep_movsq = opcode_instruction<std::to_array({0xf3, 0x48, 0xa5})>{};
+    constexpr auto rep_stosb = opcode_instruction<std::to_array({0xf3, 0xaa})>{};
+    constexpr auto rep_stosq = opcode_instruction<std::to_array({0xf3, 0x48, 0xab})>{};
 
     constexpr auto nop = opcode_instruction<0x90>{};
 
+    constexpr auto push = reg_in_opcode_instruction<0x50>{};
+    constexpr auto pop  = reg_in_opcode_instruction<0x58>{};
+
     constexpr auto ret = opcode_instruction<0xc3>{};
 
     constexpr auto bit_not = regmem_instruction<{0xf7, 2}>{};
     constexpr auto neg  = regmem_instruction<{0xf7, 3}>{};
     constexpr auto mul  = regmem_instruction<{0xf7, 4}>{};
-    constexpr auto imul = regmem_instruction<{0xf7, 5}>{};
+    constexpr auto imul = cpp_helper::overloads<
+            regmem_instruction<{0xf7, 5}>,
+            imul_reg_instruction
+        >{};
     constexpr auto div  = regmem_instruction<{0xf7, 6}>{};
     constexpr auto idiv = regmem_instruction<{0xf7, 7}>{};
 
+    constexpr auto rol = shift_instruction<0>{};
+    constexpr auto ror = shift_instruction<1>{};
+    constexpr auto rcl = shift_instruction<2>{};
+    constexpr auto rcr = shift_instruction<3>{};
+    constexpr auto shl = shift_instruction<4>{};
+    constexpr auto shr = shift_instruction<5>{};
+    constexpr auto sar = shift_instruction<7>{};
+
     template<bitset<4> Condition_code>
     using jcc_instruction = imm_instruction<bit4{7} + Condition_code, bit8{0x0f} + bit4{8} + Condition_code>;
 
@@ -67,6 +96,46 @@ namespace amd64 {
     constexpr auto jle = jcc_instruction<0xe>{};
     constexpr auto jnle= jcc_instruction<0xf>{};
 
+    template<bitset<4> Condition_code>
+    constexpr auto cmovcc = cmovcc_instruction<Condition_code>{};
+
+    constexpr auto cmovo  = cmovcc_instruction<0x0>{};
+    constexpr auto cmovno = cmovcc_instruction<0x1>{};
+    constexpr auto cmovb  = cmovcc_instruction<0x2>{};
+    constexpr auto cmovnb = cmovcc_instruction<0x3>{};
+    constexpr auto cmovz  = cmovcc_instruction<0x4>{};
+    constexpr auto cmovnz = cmovcc_instruction<0x5>{};
+    constexpr auto cmovbe = cmovcc_instruction<0x6>{};
+    constexpr auto cmovnbe= cmovcc_instruction<0x7>{};
+    constexpr auto cmovs  = cmovcc_instruction<0x8>{};
+    constexpr auto cmovns = cmovcc_instruction<0x9>{};
+    constexpr auto cmovp  = cmovcc_instruction<0xa>{};
+    constexpr auto cmovnp = cmovcc_instruction<0xb>{};
+    constexpr auto cmovl  = cmovcc_instruction<0xc>{};
+    constexpr auto cmovnl = cmovcc_instruction<0xd>{};
+    constexpr auto cmovle = cmovcc_instruction<0xe>{};
+    constexpr auto cmovnle= cmovcc_instruction<0xf>{};
+
+    template<bitset<4> Condition_code>
+    constexpr auto setcc = setcc_instruction<Condition_code>{};
+
+    constexpr auto seto  = setcc_instruction<0x0>{};
+    constexpr auto setno = setcc_instruction<0x1>{};
+    constexpr auto setb  = setcc_instruction<0x2>{};
+    constexpr auto setnb = setcc_instruction<0x3>{};
+    constexpr auto setz  = setcc_instruction<0x4>{};
+    constexpr auto setnz = setcc_instruction<0x5>{};
+    constexpr auto setbe = setcc_instruction<0x6>{};
+    constexpr auto setnbe= setcc_instruction<0x7>{};
+    constexpr auto sets  = setcc_instruction<0x8>{};
+    constexpr auto setns = setcc_instruction<0x9>{};
+    constexpr auto setp  = setcc_instruction<0xa>{};
+    constexpr auto setnp = setcc_instruction<0xb>{};
+    constexpr auto setl  = setcc_instruction<0xc>{};
+    constexpr auto setnl = setcc_instruction<0xd>{};
+    constexpr auto setle = setcc_instruction<0xe>{};
+    constexpr auto setnle= setcc_instruction<0xf>{};
+
     constexpr auto jmp = cpp_helper::overloads<
             imm_instruction<0xeb, 0xe9>,
             regmem_instruction<{0xff, 4}, false>
@@ -87,8 +156,244 @@ namespace amd64 {
 
 }
 
+namespace amd64 {
+    // vex_opcode{pp, map_select, W, opcode}
+    // pp: 0 = none, 1 = 66, 2 = F3, 3 = F2; map_select: 1 = 0F, 2 = 0F 38, 3 = 0F 3A
+
+    constexpr auto vmovups = vex_move_instruction<{0, 1, 0, 0x10}, {0, 1, 0, 0x11}>{};
+    constexpr auto vmovaps = vex_move_instruction<{0, 1, 0, 0x28}, {0, 1, 0, 0x29}>{};
+    constexpr auto vmovupd = vex_move_instruction<{1, 1, 0, 0x10}, {1, 1, 0, 0x11}>{};
+    constexpr auto vmovapd = vex_move_instruction<{1, 1, 0, 0x28}, {1, 1, 0, 0x29}>{};
+    constexpr auto vmovdqu = vex_move_instruction<{2, 1, 0, 0x6f}, {2, 1, 0, 0x7f}>{};
+    constexpr auto vmovdqa = vex_move_instruction<{1, 1, 0, 0x6f}, {1, 1, 0, 0x7f}>{};
+
+    constexpr auto vbroadcastss = vex_rm_instruction<{1, 2, 0, 0x18}, false>{};
+    constexpr auto vpbroadcastd = vex_rm_instruction<{1, 2, 0, 0x58}, false>{};
+    constexpr auto vpbroadcastq = vex_rm_instruction<{1, 2, 0, 0x59}, false>{};
+
+    constexpr auto vpaddb   = vex_rvm_instruction<{1, 1, 0, 0xfc}>{};
+    constexpr auto vpaddw   = vex_rvm_instruction<{1, 1, 0, 0xfd}>{};
+    constexpr auto vpaddd   = vex_rvm_instruction<{1, 1, 0, 0xfe}>{};
+    constexpr auto vpaddq   = vex_rvm_instruction<{1, 1, 0, 0xd4}>{};
+    constexpr auto vpsubb   = vex_rvm_instruction<{1, 1, 0, 0xf8}>{};
+    constexpr auto vpsubw   = vex_rvm_instruction<{1, 1, 0, 0xf9}>{};
+    constexpr auto vpsubd   = vex_rvm_instruction<{1, 1, 0, 0xfa}>{};
+    constexpr auto vpsubq   = vex_rvm_instruction<{1, 1, 0, 0xfb}>{};
+    constexpr auto vpmullw  = vex_rvm_instruction<{1, 1, 0, 0xd5}>{};
+    constexpr auto vpmulld  = vex_rvm_instruction<{1, 2, 0, 0x40}>{};
+    constexpr auto vpmuludq = vex_rvm_instruction<{1, 1, 0, 0xf4}>{};
+
+    constexpr auto vpand  = vex_rvm_instruction<{1, 1, 0, 0xdb}>{};
+    constexpr auto vpandn = vex_rvm_instruction<{1, 1, 0, 0xdf}>{};
+    constexpr auto vpor   = vex_rvm_instruction<{1, 1, 0, 0xeb}>{};
+    constexpr auto vpxor  = vex_rvm_instruction<{1, 1, 0, 0xef}>{};
+    constexpr auto vandps = vex_rvm_instruction<{0, 1, 0, 0x54}>{};
+    constexpr auto vorps  = vex_rvm_instruction<{0, 1, 0, 0x56}>{};
+    constexpr auto vxorps = vex_rvm_instruction<{0, 1, 0, 0x57}>{};
+
+    constexpr auto vaddps = vex_rvm_instruction<{0, 1, 0, 0x58}>{};
+    constexpr auto vaddpd = vex_rvm_instruction<{1, 1, 0, 0x58}>{};
+    constexpr auto vsubps = vex_rvm_instruction<{0, 1, 0, 0x5c}>{};
+    constexpr auto vsubpd = vex_rvm_instruction<{1, 1, 0, 0x5c}>{};
+    constexpr auto vmulps = vex_rvm_instruction<{0, 1, 0, 0x59}>{};
+    constexpr auto vmulpd = vex_rvm_instruction<{1, 1, 0, 0x59}>{};
+    constexpr auto vdivps = vex_rvm_instruction<{0, 1, 0, 0x5e}>{};
+    constexpr auto vdivpd = vex_rvm_instruction<{1, 1, 0, 0x5e}>{};
+    constexpr auto vminps = vex_rvm_instruction<{0, 1, 0, 0x5d}>{};
+    constexpr auto vminpd = vex_rvm_instruction<{1, 1, 0, 0x5d}>{};
+    constexpr auto vmaxps = vex_rvm_instruction<{0, 1, 0, 0x5f}>{};
+    constexpr auto vmaxpd = vex_rvm_instruction<{1, 1, 0, 0x5f}>{};
+    constexpr auto vsqrtps = vex_rm_instruction<{0, 1, 0, 0x51}>{};
+    constexpr auto vsqrtpd = vex_rm_instruction<{1, 1, 0, 0x51}>{};
+
+    constexpr auto vfmadd132ps  = vex_rvm_instruction<{1, 2, 0, 0x98}>{};
+    constexpr auto vfmadd213ps  = vex_rvm_instruction<{1, 2, 0, 0xa8}>{};
+    constexpr auto vfmadd231ps  = vex_rvm_instruction<{1, 2, 0, 0xb8}>{};
+    constexpr auto vfmadd132pd  = vex_rvm_instruction<{1, 2, 1, 0x98}>{};
+    constexpr auto vfmadd213pd  = vex_rvm_instruction<{1, 2, 1, 0xa8}>{};
+    constexpr auto vfmadd231pd  = vex_rvm_instruction<{1, 2, 1, 0xb8}>{};
+    constexpr auto vfmsub231ps  = vex_rvm_instruction<{1, 2, 0, 0xba}>{};
+    constexpr auto vfmsub231pd  = vex_rvm_instruction<{1, 2, 1, 0xba}>{};
+    constexpr auto vfnmadd231ps = vex_rvm_instruction<{1, 2, 0, 0xbc}>{};
+    constexpr auto vfnmadd231pd = vex_rvm_instruction<{1, 2, 1, 0xbc}>{};
+
+    constexpr auto vpshufb     = vex_rvm_instruction<{1, 2, 0, 0x00}>{};
+    constexpr auto vpshufd     = vex_rmi_instruction<{1, 1, 0, 0x70}>{};
+    constexpr auto vshufps     = vex_rvmi_instruction<{0, 1, 0, 0xc6}>{};
+    constexpr auto vshufpd     = vex_rvmi_instruction<{1, 1, 0, 0xc6}>{};
+    constexpr auto vpunpckldq  = vex_rvm_instruction<{1, 1, 0, 0x62}>{};
+    constexpr auto vpunpckhdq  = vex_rvm_instruction<{1, 1, 0, 0x6a}>{};
+    constexpr auto vpunpcklqdq = vex_rvm_instruction<{1, 1, 0, 0x6c}>{};
+    constexpr auto vpunpckhqdq = vex_rvm_instruction<{1, 1, 0, 0x6d}>{};
+    constexpr auto vunpcklps   = vex_rvm_instruction<{0, 1, 0, 0x14}>{};
+    constexpr auto vunpckhps   = vex_rvm_instruction<{0, 1, 0, 0x15}>{};
+    constexpr auto vpermd      = vex_rvm_instruction<{1, 2, 0, 0x36, true}>{};
+    constexpr auto vpermps     = vex_rvm_instruction<{1, 2, 0, 0x16, true}>{};
+    constexpr auto vpermq      = vex_rmi_instruction<{1, 3, 1, 0x00, true}>{};
+    constexpr auto vpermpd     = vex_rmi_instruction<{1, 3, 1, 0x01, true}>{};
+    constexpr auto vperm2f128  = vex_rvmi_instruction<{1, 3, 0, 0x06, true}>{};
+    constexpr auto vperm2i128  = vex_rvmi_instruction<{1, 3, 0, 0x46, true}>{};
+
+    constexpr auto vpcmpeqb = vex_rvm_instruction<{1, 1, 0, 0x74}>{};
+    constexpr auto vpcmpeqw = vex_rvm_instruction<{1, 1, 0, 0x75}>{};
+    constexpr auto vpcmpeqd = vex_rvm_instruction<{1, 1, 0, 0x76}>{};
+    constexpr auto vpcmpeqq = vex_rvm_instruction<{1, 2, 0, 0x29}>{};
+    constexpr auto vpcmpgtb = vex_rvm_instruction<{1, 1, 0, 0x64}>{};
+    constexpr auto vpcmpgtw = vex_rvm_instruction<{1, 1, 0, 0x65}>{};
+    constexpr auto vpcmpgtd = vex_rvm_instruction<{1, 1, 0, 0x66}>{};
+    constexpr auto vpcmpgtq = vex_rvm_instruction<{1, 2, 0, 0x37}>{};
+    // the predicate, like 0 = eq, 1 = lt, 2 = le, 4 = neq, is the immediate
+    constexpr auto vcmpps   = vex_rvmi_instruction<{0, 1, 0, 0xc2}>{};
+    constexpr auto vcmppd   = vex_rvmi_instruction<{1, 1, 0, 0xc2}>{};
+    constexpr auto vptest   = vex_rm_instruction<{1, 2, 0, 0x17}>{};
+    constexpr auto vpmovmskb = vex_movmsk_instruction<{1, 1, 0, 0xd7}>{};
+    constexpr auto vmovmskps = vex_movmsk_instruction<{0, 1, 0, 0x50}>{};
+    constexpr auto vmovmskpd = vex_movmsk_instruction<{1, 1, 0, 0x50}>{};
+
+    constexpr auto vpblendd  = vex_rvmi_instruction<{1, 3, 0, 0x02}>{};
+    constexpr auto vpblendw  = vex_rvmi_instruction<{1, 3, 0, 0x0e}>{};
+    constexpr auto vblendps  = vex_rvmi_instruction<{1, 3, 0, 0x0c}>{};
+    constexpr auto vblendpd  = vex_rvmi_instruction<{1, 3, 0, 0x0d}>{};
+    constexpr auto vblendvps = vex_rvmr_instruction<{1, 3, 0, 0x4a}>{};
+    constexpr auto vblendvpd = vex_rvmr_instruction<{1, 3, 0, 0x4b}>{};
+    constexpr auto vpblendvb = vex_rvmr_instruction<{1, 3, 0, 0x4c}>{};
+
+    constexpr auto vpgatherdd = vex_gather_instruction<{1, 2, 0, 0x90}>{};
+    constexpr auto vpgatherdq = vex_gather_instruction<{1, 2, 1, 0x90}>{};
+    constexpr auto vpgatherqd = vex_gather_instruction<{1, 2, 0, 0x91}>{};
+    constexpr auto vpgatherqq = vex_gather_instruction<{1, 2, 1, 0x91}>{};
+    constexpr auto vgatherdps = vex_gather_instruction<{1, 2, 0, 0x92}>{};
+    constexpr auto vgatherdpd = vex_gather_instruction<{1, 2, 1, 0x92}>{};
+    constexpr auto vgatherqps = vex_gather_instruction<{1, 2, 0, 0x93}>{};
+    constexpr auto vgatherqpd = vex_gather_instruction<{1, 2, 1, 0x93}>{};
+
+    constexpr auto popcnt = bit_count_instruction<0xb8>{};
+    constexpr auto lzcnt  = bit_count_instruction<0xbd>{};
+    constexpr auto tzcnt  = bit_count_instruction<0xbc>{};
+    constexpr auto bsf    = bit_count_instruction<0xbc, false>{};
+    constexpr auto bsr    = bit_count_instruction<0xbd, false>{};
+
+    constexpr auto andn   = vex_gpr_rvm_instruction<{0, 2, 0, 0xf2}>{};
+    constexpr auto bextr  = vex_gpr_rmv_instruction<{0, 2, 0, 0xf7}>{};
+    constexpr auto blsi   = vex_gpr_vm_instruction<{0, 2, 0, 0xf3}, 3>{};
+    constexpr auto blsmsk = vex_gpr_vm_instruction<{0, 2, 0, 0xf3}, 2>{};
+    constexpr auto blsr   = vex_gpr_vm_instruction<{0, 2, 0, 0xf3}, 1>{};
+    constexpr auto bzhi   = vex_gpr_rmv_instruction<{0, 2, 0, 0xf5}>{};
+    constexpr auto pdep   = vex_gpr_rvm_instruction<{3, 2, 0, 0xf5}>{};
+    constexpr auto pext   = vex_gpr_rvm_instruction<{2, 2, 0, 0xf5}>{};
+    // high half, low half, source; multiplies by edx/rdx without touching flags
+    constexpr auto mulx   = vex_gpr_rvm_instruction<{3, 2, 0, 0xf6}>{};
+    constexpr auto rorx   = vex_gpr_rmi_instruction<{3, 3, 0, 0xf0}>{};
+    constexpr auto sarx   = vex_gpr_rmv_instruction<{2, 2, 0, 0xf7}>{};
+    constexpr auto shlx   = vex_gpr_rmv_instruction<{1, 2, 0, 0xf7}>{};
+    constexpr auto shrx   = vex_gpr_rmv_instruction<{3, 2, 0, 0xf7}>{};
+
+    // clear the upper halves of the ymm registers before legacy SSE code
+    constexpr auto vzeroupper = vex_opcode_instruction<{0, 1, 0, 0x77}>{};
+    constexpr auto vzeroall   = vex_opcode_instruction<{0, 1, 0, 0x77}, 1>{};
+}
+
 #include <vector>
+#include "strength_reduction.hpp"
 namespace amd64 {
+    // reg *= multiplier, with shifts and lea instead of imul where possible
+    inline auto multiply_by_constant(register_type::reg<32> reg, uint32_t multiplier) {
+        auto codes = std::vector<uint8_t>{};
+        auto plan = strength_reduction::plan_multiplication(multiplier);
+        // [reg + reg * scale] has no encoding without displacement for these
+        auto lea_encodable = reg.r != register_type::reg32::esp && reg.r != register_type::reg32::ebp;
+        if (plan.zero) {
+            codes.append_range(bit_xor(reg, reg));
+        }
+        else if (plan.use_imul || (!plan.lea_factors.empty() && !lea_encodable)) {
+            if (multiplier < 0x80) {
+                codes.append_range(imul(reg, reg, static_cast<int8_t>(multiplier)));
+            }
+            else {
+                codes.append_range(imul(reg, reg, multiplier));
+            }
+        }
+        else {
+            auto address_reg = static_cast<register_type::reg64>(reg.r);
+            for (auto factor : plan.lea_factors) {
+                auto scale = static_cast<uint8_t>(std::countr_zero(static_cast<uint32_t>(factor - 1)));
+                codes.append_range(lea(reg, mem<64, sib_address>{{address_reg, address_reg, scale}}));
+            }
+            if (plan.shift != 0) {
+                codes.append_range(shl(reg, plan.shift));
+            }
+        }
+        return codes;
+    }
+
+    // reg /= divisor, unsigned, with shifts or a multiplication by the
+    // reciprocal. Clobbers eax and edx, so reg must be neither.
+    inline auto divide_by_constant(register_type::reg<32> reg, uint32_t divisor) {
+        auto codes = std::vector<uint8_t>{};
+        if (divisor == 0) {
+            throw std::runtime_error{"division by zero"};
+        }
+        if (std::has_single_bit(divisor)) {
+            if (divisor != 1) {
+                codes.append_range(shr(reg, static_cast<uint8_t>(std::countr_zero(divisor))));
+            }
+            return codes;
+        }
+        if (reg.r == register_type::reg32::eax || reg.r == register_type::reg32::edx) {
+            throw std::runtime_error{"dividend register is clobbered by mul"};
+        }
+        auto reciprocal = strength_reduction::unsigned_reciprocal(divisor);
+        auto eax_reg = register_type::reg<32>{register_type::reg32::eax};
+        auto edx_reg = register_type::reg<32>{register_type::reg32::edx};
+        codes.append_range(reg_imm_instruction<0xb0, 0xb8>{}(eax_reg, reciprocal.magic));
+        codes.append_range(mul(reg));
+        if (reciprocal.add) {
+            codes.append_range(sub(reg, edx_reg));
+            codes.append_range(shr(reg, uint8_t{1}));
+            codes.append_range(add(reg, edx_reg));
+            codes.append_range(shr(reg, reciprocal.shift));
+        }
+        else {
+            codes.append_range(shr(edx_reg, reciprocal.shift));
+            codes.append_range(mov(reg, edx_reg));
+        }
+        return codes;
+    }
+
+    constexpr size_t max_nop_length = 15;
+
+    // The recommended nop of every length from 1 to 15 bytes: 90, 66 90, and
+    // 0F 1F /0 with longer addressing forms, then more 66 prefixes.
+    inline auto multi_byte_nop(size_t length) {
+        if (length == 0 || length > max_nop_length) {
+            throw std::runtime_error{"nop length must be from 1 to 15"};
+        }
+        auto prefixes = length > 8 ? length - 8 : 0;
+        auto codes = std::vector<uint8_t>(prefixes, 0x66);
+        switch (length - prefixes) {
+        case 1: codes.append_range(std::to_array<uint8_t>({0x90})); break;
+        case 2: codes.append_range(std::to_array<uint8_t>({0x66, 0x90})); break;
+        case 3: codes.append_range(std::to_array<uint8_t>({0x0f, 0x1f, 0x00})); break;
+        case 4: codes.append_range(std::to_array<uint8_t>({0x0f, 0x1f, 0x40, 0x00})); break;
+        case 5: codes.append_range(std::to_array<uint8_t>({0x0f, 0x1f, 0x44, 0x00, 0x00})); break;
+        case 6: codes.append_range(std::to_array<uint8_t>({0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00})); break;
+        case 7: codes.append_range(std::to_array<uint8_t>({0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00})); break;
+        case 8: codes.append_range(std::to_array<uint8_t>({0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00})); break;
+        }
+        return codes;
+    }
+
+    // size bytes of nops in as few instructions as possible
+    inline auto padding(size_t size, size_t max_length = max_nop_length) {
+        auto codes = std::vector<uint8_t>{};
+        while (size > 0) {
+            auto length = std::min(size, max_length);
+            codes.append_range(multi_byte_nop(length));
+            size -= length;
+        }
+        return codes;
+    }
+
     using operands_t = std::variant<
             std::tuple<register_type::reg<32>>,
             std::tuple<register_type::reg<32>, register_type::reg<32>>,
@@ -144,6 +449,38 @@ namespace amd64 {
                 );
         }
         break;
+        case operation::mul:
+        {
+            return std::visit(
+                    cpp_helper::overloads{
+                        [](std::tuple<register_type::reg<32>, uint32_t> operands) {
+                            return multiply_by_constant(std::get<0>(operands), std::get<1>(operands));
+                        },
+                        [](auto operands) {
+                            throw std::runtime_error{"operands error"};
+                            return std::vector<uint8_t>{};
+                        }
+                    },
+                    statement.operands
+                );
+        }
+        break;
+        case operation::div:
+        {
+            return std::visit(
+                    cpp_helper::overloads{
+                        [](std::tuple<register_type::reg<32>, uint32_t> operands) {
+                            return divide_by_constant(std::get<0>(operands), std::get<1>(operands));
+                        },
+                        [](auto operands) {
+                            throw std::runtime_error{"operands error"};
+                            return std::vector<uint8_t>{};
+                        }
+                    },
+                    statement.operands
+                );
+        }
+        break;
         default:
         {
             throw std::runtime_error{"unknown operation"};
@@ -153,12 +490,20 @@ namespace amd64 {
         }
     }
 
-    auto assemble(std::vector<statement> statements) {
+    // Recorder counts statements and bytes and times the phase, see statistics.hpp.
+    auto assemble(std::vector<statement> statements, auto recorder) {
+        [[maybe_unused]] auto timer = recorder.time(statistics::phase::assemble);
         auto codes = std::vector<uint8_t>{};
         for (auto& statement : statements) {
             auto g_codes = assemble(statement);
             codes.append_range(g_codes);
         }
+        recorder.add(&statistics::statistics::statements_encoded, statements.size());
+        recorder.add(&statistics::statistics::bytes_emitted, codes.size());
         return codes;
     }
+
+    auto assemble(std::vector<statement> statements) {
+        return assemble(std::move(statements), statistics::disabled{});
+    }
 }
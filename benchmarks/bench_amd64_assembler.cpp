@@ -0,0 +1,456 @@
+#include "benchmark.hpp"
+
+#include "amd64_assembler.hpp"
+#include "scanner.hpp"
+#include "register_allocation.hpp"
+#include "procedure.hpp"
+#include "program_generator.hpp"
+#include "value_numbering.hpp"
+
+#include <iostream>
+#include <sstream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <charconv>
+
+// Throughput of the encoders, assemble(), the scanner, the register
+// allocator and the inliner, as JSON on stdout. Inputs come from fixed
+// seeds, so runs are comparable across builds.
+//
+// The scaling/ benchmarks run the scanner, assemble(), the register
+// allocator, value numbering and the budgeted inliner over generated
+// programs of 1K instructions and up, ten times larger each step, so
+// superlinear phases show as a growing ns_per_item. Value numbering also
+// reports the instructions it eliminated.
+//
+// bench_amd64_assembler [--filter name] [--scale factor] [--runs count] [--max-size instructions]
+
+template<typename Register, size_t Register_count = std::numeric_limits<Register>::max()>
+struct allocation_instruction {
+    using register_t = Register;
+
+    static constexpr auto register_count = Register_count;
+
+    uint32_t op;
+    std::vector<register_t> reads;
+    std::vector<register_t> writes;
+
+    auto& get_reads() const {
+        return reads;
+    }
+    auto& get_writes() const {
+        return writes;
+    }
+};
+
+struct inline_instruction {
+    uint32_t op;
+    std::vector<uint32_t> reads;
+    std::vector<uint32_t> writes;
+    uint32_t callee;
+};
+
+int main(int argc, const char* argv[]) {
+    using namespace amd64;
+    using namespace amd64::register_type;
+
+    auto filter = std::string{};
+    size_t scale = 1;
+    size_t runs = 5;
+    size_t max_size = 1'000'000;
+    auto usage = [&argv]() {
+        std::cerr << "usage: " << argv[0]
+            << " [--filter name] [--scale factor] [--runs count] [--max-size instructions]" << std::endl;
+        return -1;
+    };
+    // a positive decimal number, all of value
+    auto parse_count = [](std::string_view value, size_t& count) {
+        auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), count);
+        return error == std::errc{} && end == value.data() + value.size() && count > 0;
+    };
+    for (int i = 1; i < argc; i += 2) {
+        auto option = std::string_view{argv[i]};
+        if (i + 1 == argc) {
+            std::cerr << "option " << option << " needs a value" << std::endl;
+            return usage();
+        }
+        auto value = std::string_view{argv[i + 1]};
+        auto valid = true;
+        if (option == "--filter") {
+            filter = value;
+        }
+        else if (option == "--scale") {
+            valid = parse_count(value, scale);
+        }
+        else if (option == "--runs") {
+            valid = parse_count(value, runs);
+        }
+        else if (option == "--max-size") {
+            valid = parse_count(value, max_size);
+        }
+        else {
+            std::cerr << "unknown option " << option << std::endl;
+            return usage();
+        }
+        if (!valid) {
+            std::cerr << "option " << option << " needs a positive number, not " << value << std::endl;
+            return usage();
+        }
+    }
+    auto suite = benchmark::suite{runs, filter};
+    auto random = std::mt19937{42};
+
+    // encoders, one family at a time, over operands drawn in advance
+    {
+        size_t count = 1'000'000 * scale;
+        auto registers = std::vector<reg<32>>{};
+        auto registers_64 = std::vector<reg<64>>{};
+        auto immediates = std::vector<uint32_t>{};
+        for (size_t i = 0; i < count + 2; i++) {
+            registers.emplace_back(static_cast<reg32>(random() % 8));
+            registers_64.emplace_back(static_cast<reg64>(random() % 8));
+            immediates.emplace_back(random() % 2 ? random() % 100 : random());
+        }
+        auto codes = std::vector<uint8_t>{};
+        auto encode_family = [&](std::string name, auto encode) {
+            codes.clear();
+            for (size_t i = 0; i < count; i++) {
+                codes.append_range(encode(i));
+            }
+            auto bytes = codes.size();
+            suite.add("encode/" + name, count, bytes, [&]() {
+                codes.clear();
+                for (size_t i = 0; i < count; i++) {
+                    codes.append_range(encode(i));
+                }
+                benchmark::do_not_optimize(codes.data());
+            });
+        };
+        encode_family("arithmetic_reg_reg", [&](size_t i) { return add(registers[i], registers[i + 1]); });
+        encode_family("arithmetic_reg_imm", [&](size_t i) { return sub(registers[i], immediates[i]); });
+        encode_family("mov", [&](size_t i) { return mov(registers_64[i], registers_64[i + 1]); });
+        encode_family("mov_mem", [&](size_t i) { return mov(mem<32>{modrm_reg64_address::rdi}, registers[i]); });
+        encode_family("shift", [&](size_t i) { return shl(registers[i], static_cast<uint8_t>(immediates[i] % 32)); });
+        encode_family("imul", [&](size_t i) { return imul(registers[i], registers[i + 1], immediates[i]); });
+        // rsp is no index, and rbp no base without a displacement
+        auto address_registers = std::to_array({reg64::rax, reg64::rcx, reg64::rdx, reg64::rbx, reg64::rsi, reg64::rdi});
+        encode_family("lea", [&](size_t i) {
+            auto base = address_registers[immediates[i] % address_registers.size()];
+            auto index = address_registers[immediates[i + 1] % address_registers.size()];
+            return lea(registers[i], mem<64, sib_address>{{base, index, static_cast<uint8_t>(i % 4)}});
+        });
+        encode_family("jcc", [&](size_t i) { return jnz(static_cast<int32_t>(immediates[i])); });
+        encode_family("vex_vector", [&](size_t i) {
+            auto vector = [&](size_t j) { return ymm<>{static_cast<uint8_t>(registers[j].r)}; };
+            return vpaddd(vector(i), vector(i + 1), vector(i + 2));
+        });
+        encode_family("vex_bmi", [&](size_t i) { return andn(registers[i], registers[i + 1], registers[i + 2]); });
+        encode_family("nop_padding", [&](size_t i) { return padding(immediates[i] % 32); });
+    }
+
+    // assemble() over a mix of statements, with strength reduced multiplies and divides
+    {
+        size_t count = 200'000 * scale;
+        auto statements = std::vector<statement>{};
+        // divide_by_constant clobbers eax and edx
+        auto divisible = std::to_array({reg32::ecx, reg32::ebx, reg32::esi, reg32::edi});
+        for (size_t i = 0; i < count; i++) {
+            auto dst = reg<32>{divisible[random() % divisible.size()]};
+            auto src = reg<32>{static_cast<reg32>(random() % 8)};
+            switch (random() % 4) {
+            case 0:
+                statements.emplace_back(operation::add, std::tuple<reg<32>, reg<32>>(dst, src));
+                break;
+            case 1:
+                statements.emplace_back(operation::adc, std::tuple<reg<32>, uint32_t>(dst, random() % 1000));
+                break;
+            case 2:
+                statements.emplace_back(operation::mul, std::tuple<reg<32>, uint32_t>(dst, 1 + random() % 100));
+                break;
+            default:
+                statements.emplace_back(operation::div, std::tuple<reg<32>, uint32_t>(dst, 1 + random() % 100));
+                break;
+            }
+        }
+        auto bytes = assemble(statements).size();
+        suite.add("assemble/statements", count, bytes, [&]() {
+            benchmark::do_not_optimize(assemble(statements).data());
+        });
+    }
+
+    // scanner over assembly text like tests/data/test_scan.s, with many distinct words
+    {
+        size_t size = (4u << 20) * scale;
+        auto text = std::string{};
+        auto mnemonics = std::to_array<std::string_view>({"add", "adc", "sub", "mov", "ret", "imul", "lea"});
+        auto names = std::to_array<std::string_view>({"ax", "rax", "rbx", "rcx", "rdx", "rsi", "rdi"});
+        while (text.size() < size) {
+            text += mnemonics[random() % mnemonics.size()];
+            text += ' ';
+            text += names[random() % names.size()];
+            text += ' ';
+            // labels and constants make the string table grow
+            text += random() % 4 == 0 ? "label_" + std::to_string(random() % 10000) : std::to_string(random() % 1000);
+            text += '\n';
+        }
+        auto scan = [&text]() {
+            auto in = std::istringstream{text};
+            auto scanner = scanner::scanner{in};
+            size_t scanned = 0;
+            while (scanner.next()) {
+                scanned++;
+            }
+            return scanned;
+        };
+        // the words the scanner returns
+        auto tokens = scan();
+        suite.add("scanner/tokens", tokens, text.size(), [&]() {
+            benchmark::do_not_optimize(scan());
+        });
+    }
+
+    // register allocation of a stream with a long live range every few instructions
+    {
+        size_t count = 500'000 * scale;
+        auto in_instructions = std::vector<allocation_instruction<uint32_t>>{};
+        uint32_t next_register = 16;
+        for (size_t i = 0; i < count; i++) {
+            auto recent = [&]() { return static_cast<uint32_t>(next_register - 1 - random() % std::min<uint32_t>(next_register, 8)); };
+            auto old = [&]() { return static_cast<uint32_t>(random() % next_register); };
+            auto reads = std::vector<uint32_t>{recent(), random() % 4 == 0 ? old() : recent()};
+            in_instructions.push_back({static_cast<uint32_t>(i % 8), reads, {next_register++}});
+        }
+        using out_instruction = allocation_instruction<uint8_t, 14>;
+        auto allocate = [&]() {
+            return register_allocation::register_allocate<out_instruction>(in_instructions,
+                    [](const auto& in, auto writes, auto reads) {
+                        return out_instruction{in.op, std::vector<uint8_t>(reads.begin(), reads.end()),
+                            std::vector<uint8_t>(writes.begin(), writes.end())};
+                    },
+                    [](auto pr, auto) { return out_instruction{100, {}, {pr}}; },
+                    [](auto, auto pr) { return out_instruction{101, {pr}, {}}; },
+                    [](auto) { return std::nullopt; });
+        };
+        suite.add("register_allocate/instructions", count, 0, [&]() {
+            benchmark::do_not_optimize(allocate().data());
+        });
+    }
+
+    // inlining a call tree: procedure p calls 2p + 1 and 2p + 2
+    {
+        uint32_t procedure_count = 4095;
+        uint32_t body_size = 16 * static_cast<uint32_t>(scale);
+        constexpr uint32_t call = 0;
+        constexpr uint32_t copy = 1;
+        auto procedures = std::vector<procedure::procedure<inline_instruction>>(procedure_count);
+        for (uint32_t p = 0; p < procedure_count; p++) {
+            auto& instructions = procedures[p].instructions;
+            for (uint32_t i = 0; i < body_size; i++) {
+                instructions.push_back({2, {i % 8, (i + 1) % 8}, {(i + 2) % 8}, 0});
+                for (auto callee : {2 * p + 1, 2 * p + 2}) {
+                    if (i == body_size / 2 && callee < procedure_count) {
+                        instructions.push_back({call, {0, 1}, {2}, callee});
+                    }
+                }
+            }
+        }
+        auto rename = [](auto item, uint32_t offset) {
+            for (auto& r : item.reads) {
+                r += offset;
+            }
+            for (auto& w : item.writes) {
+                w += offset;
+            }
+            return item;
+        };
+        auto rename_registers = cpp_helper::overloads{
+            [rename](inline_instruction instruction, uint32_t offset) { return rename(instruction, offset); },
+            [](std::vector<uint32_t> registers, uint32_t offset) {
+                for (auto& r : registers) {
+                    r += offset;
+                }
+                return registers;
+            },
+        };
+        auto inline_all = [&]() {
+            return procedure::inline_procedures(procedures, 0,
+                    [](const auto& instruction) { return instruction.callee; },
+                    [](std::vector<uint32_t> dests, std::vector<uint32_t> srcs) {
+                        return std::vector{inline_instruction{copy, srcs, dests, 0}};
+                    },
+                    [](const auto& instruction) { return instruction.op == call; },
+                    [](const auto& instruction) { return instruction.reads; },
+                    [](const auto& instruction) { return instruction.writes; },
+                    rename_registers,
+                    [](const auto& instruction) {
+                        uint32_t next = 0;
+                        for (auto r : instruction.reads) {
+                            next = std::max(next, r + 1);
+                        }
+                        for (auto w : instruction.writes) {
+                            next = std::max(next, w + 1);
+                        }
+                        return next;
+                    });
+        };
+        auto emitted = inline_all().size();
+        suite.add("inline_procedures/instructions", emitted, 0, [&]() {
+            benchmark::do_not_optimize(inline_all().data());
+        });
+    }
+
+    // the same phases over generated programs of growing size
+    for (size_t size = 1'000; size <= max_size; size *= 10) {
+        auto cfg = program_generator::config{.seed = 42, .instructions = size};
+        auto name = [size](std::string phase) { return "scaling/" + phase + "/" + std::to_string(size); };
+
+        if (suite.selected(name("scanner"))) {
+            auto text = program_generator::generate_text(cfg);
+            suite.add(name("scanner"), size, text.size(), [&]() {
+                auto in = std::istringstream{text};
+                auto scanner = scanner::scanner{in};
+                size_t scanned = 0;
+                while (scanner.next()) {
+                    scanned++;
+                }
+                benchmark::do_not_optimize(scanned);
+            });
+        }
+        if (suite.selected(name("assemble"))) {
+            auto statements = program_generator::generate_statements(cfg);
+            suite.add(name("assemble"), size, 0, [&]() {
+                benchmark::do_not_optimize(assemble(statements).data());
+            });
+        }
+        if (suite.selected(name("register_allocate"))) {
+            // one procedure, so every instruction is in the stream
+            auto single = cfg;
+            single.call_depth = 0;
+            auto procedures = program_generator::generate_procedures(single);
+            auto in_instructions = std::vector<allocation_instruction<uint32_t>>{};
+            in_instructions.reserve(size);
+            for (auto& instruction : procedures[0].instructions) {
+                in_instructions.push_back({static_cast<uint32_t>(instruction.op),
+                        std::move(instruction.reads), std::move(instruction.writes)});
+            }
+            using out_instruction = allocation_instruction<uint8_t, 14>;
+            suite.add(name("register_allocate"), size, 0, [&]() {
+                auto out = register_allocation::register_allocate<out_instruction>(in_instructions,
+                        [](const auto& in, auto writes, auto reads) {
+                            return out_instruction{in.op, std::vector<uint8_t>(reads.begin(), reads.end()),
+                                std::vector<uint8_t>(writes.begin(), writes.end())};
+                        },
+                        [](auto pr, auto) { return out_instruction{100, {}, {pr}}; },
+                        [](auto, auto pr) { return out_instruction{101, {pr}, {}}; },
+                        [](auto) { return std::nullopt; });
+                benchmark::do_not_optimize(out.data());
+            });
+        }
+        if (suite.selected(name("value_numbering"))) {
+            auto single = cfg;
+            single.call_depth = 0;
+            using program_generator::kind;
+            using generated = program_generator::instruction;
+            auto instructions = std::move(program_generator::generate_procedures(single)[0].instructions);
+            // branches go to instruction indices, which start blocks
+            auto targets = std::vector<bool>(instructions.size());
+            for (const auto& instruction : instructions) {
+                if (instruction.op == kind::branch) {
+                    targets[instruction.target] = true;
+                }
+            }
+            auto number_values = [&]() {
+                return value_numbering::number_values(instructions,
+                        [&](const generated& instruction) {
+                            using control_kind = control_flow::control_kind;
+                            if (instruction.op == kind::branch) {
+                                return control_flow::control{control_kind::conditional_jump, instruction.target, 0x5};
+                            }
+                            if (targets[&instruction - instructions.data()]) {
+                                return control_flow::control{control_kind::label};
+                            }
+                            return control_flow::control{control_kind::other};
+                        },
+                        // generated instructions carry no immediates
+                        [](const generated& instruction) { return static_cast<uint32_t>(instruction.op); },
+                        [](const generated& instruction) {
+                            return effects::effects{
+                                .reads_flags = instruction.op == kind::branch,
+                                .writes_flags = instruction.op != kind::load && instruction.op != kind::store
+                                    && instruction.op != kind::branch,
+                                .read_memories = instruction.read_memories,
+                                .write_memories = instruction.write_memories,
+                                // a divide faults on 0
+                                .has_side_effects = instruction.op == kind::divide,
+                            };
+                        },
+                        [](std::vector<uint32_t> dests, std::vector<uint32_t> srcs) {
+                            return std::vector{generated{.op = kind::register_register, .reads = srcs, .writes = dests}};
+                        });
+            };
+            auto eliminated = number_values().eliminated;
+            suite.add(name("value_numbering"), size, 0, [&]() {
+                benchmark::do_not_optimize(number_values().instructions.data());
+            }, {{"eliminated", eliminated}});
+        }
+        if (suite.selected(name("inline_procedures"))) {
+            using program_generator::kind;
+            using generated = program_generator::instruction;
+            auto procedures = program_generator::generate_procedures(cfg);
+            auto rename = [](generated item, uint32_t offset) {
+                for (auto& r : item.reads) {
+                    r += offset;
+                }
+                for (auto& w : item.writes) {
+                    w += offset;
+                }
+                return item;
+            };
+            auto inline_budgeted = [&]() {
+                return procedure::inline_procedures(procedures, 0, procedure::inline_budget{},
+                        [](const generated& instruction) { return instruction.target; },
+                        [](std::vector<uint32_t> dests, std::vector<uint32_t> srcs) {
+                            return std::vector{generated{.op = kind::register_register, .reads = srcs, .writes = dests}};
+                        },
+                        [](const generated& instruction) { return instruction.op == kind::call; },
+                        [](const generated& instruction) { return instruction.reads; },
+                        [](const generated& instruction) { return instruction.writes; },
+                        cpp_helper::overloads{
+                            rename,
+                            [](std::vector<uint32_t> registers, uint32_t offset) {
+                                for (auto& r : registers) {
+                                    r += offset;
+                                }
+                                return registers;
+                            },
+                        },
+                        [](const generated& instruction) {
+                            uint32_t next = 0;
+                            for (auto r : instruction.reads) {
+                                next = std::max(next, r + 1);
+                            }
+                            for (auto w : instruction.writes) {
+                                next = std::max(next, w + 1);
+                            }
+                            return next;
+                        },
+                        // above every virtual register
+                        [](amd64::system_v::register_index reg) { return 0x80000000u + reg; },
+                        [](generated call, std::vector<uint32_t> arguments, std::vector<uint32_t> results) {
+                            call.reads = arguments;
+                            call.writes = results;
+                            return std::vector{call};
+                        },
+                        // the generator has no ret; a branch stands in for it
+                        []() { return generated{.op = kind::branch}; });
+            };
+            suite.add(name("inline_procedures"), size, 0, [&]() {
+                benchmark::do_not_optimize(inline_budgeted().instructions.data());
+            });
+        }
+    }
+
+    suite.write_json(std::cout);
+    return 0;
+}
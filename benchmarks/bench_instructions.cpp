@@ -0,0 +1,97 @@
+#include "microbenchmark.hpp"
+#include "performance_model.hpp"
+#include "cpu_features.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <tuple>
+
+// Latency and reciprocal throughput of instructions on this host, in core
+// cycles, next to the performance model's numbers. Running them also checks
+// that their encodings execute.
+int main() {
+    using namespace amd64;
+    using namespace amd64::register_type;
+    using cpu_features::feature;
+
+    auto to_vector = [](const auto& codes) {
+        return std::vector<uint8_t>(codes.begin(), codes.end());
+    };
+    // rdi holds the scratch memory, rbp and rsp the loop
+    auto gprs = std::to_array({reg32::eax, reg32::ecx, reg32::edx, reg32::ebx, reg32::esi});
+    auto edi = reg<32>{reg32::edi};
+    auto rdi = reg<64>{reg64::rdi};
+    auto scalar = [&](std::string name, auto encode) {
+        auto benchmark = microbenchmark::instruction_benchmark{name, to_vector(encode(reg<32>{reg32::ecx}, reg<32>{reg32::ecx})), {}};
+        for (auto r : gprs) {
+            benchmark.independent.emplace_back(to_vector(encode(reg<32>{r}, edi)));
+        }
+        return benchmark;
+    };
+    auto ymms = std::tuple{ymm0, ymm1, ymm2, ymm3, ymm4, ymm5, ymm6, ymm7, ymm8, ymm9, ymm10, ymm11};
+    // independent copies write ymm0 to ymm11 from ymm14 and ymm15
+    auto vector = [&](std::string name, auto encode) {
+        auto benchmark = microbenchmark::instruction_benchmark{name, to_vector(encode(ymm0, ymm0, ymm0)), {}};
+        std::apply([&](auto... dst) {
+            (benchmark.independent.emplace_back(to_vector(encode(dst, ymm14, ymm15))), ...);
+        }, ymms);
+        return benchmark;
+    };
+
+    auto features = cpu_features::host_features();
+    auto benchmarks = std::vector<microbenchmark::instruction_benchmark>{
+        scalar("add", [](auto dst, auto src) { return add(dst, src); }),
+        scalar("imul", [](auto dst, auto src) { return imul(dst, src, int8_t{3}); }),
+        scalar("lea", [](auto dst, auto src) {
+            return lea(dst, mem<64, sib_address>{{static_cast<reg64>(src.r), static_cast<reg64>(src.r), 3}});
+        }),
+        scalar("shl", [](auto dst, auto src) { return shl(dst, 3); }),
+        {"load", to_vector(mov(rdi, mem<64>{modrm_reg64_address::rdi})),
+            {to_vector(mov(reg<64>{reg64::rax}, mem<64>{modrm_reg64_address::rdi}))}},
+    };
+    if (features.has(feature::popcnt)) {
+        benchmarks.emplace_back(scalar("popcnt", [](auto dst, auto src) { return popcnt(dst, src); }));
+    }
+    if (features.has(feature::lzcnt)) {
+        benchmarks.emplace_back(scalar("lzcnt", [](auto dst, auto src) { return lzcnt(dst, src); }));
+    }
+    if (features.has(feature::bmi2)) {
+        benchmarks.emplace_back(scalar("pdep", [](auto dst, auto src) { return pdep(dst, src, src); }));
+        benchmarks.emplace_back(scalar("shlx", [](auto dst, auto src) { return shlx(dst, src, src); }));
+    }
+    if (features.has(feature::avx2)) {
+        benchmarks.emplace_back(vector("vpaddd", [](auto dst, auto a, auto b) { return vpaddd(dst, a, b); }));
+        benchmarks.emplace_back(vector("vpmulld", [](auto dst, auto a, auto b) { return vpmulld(dst, a, b); }));
+        benchmarks.emplace_back(vector("vpshufb", [](auto dst, auto a, auto b) { return vpshufb(dst, a, b); }));
+        benchmarks.emplace_back(vector("vpermd", [](auto dst, auto a, auto b) { return vpermd(dst, a, b); }));
+        benchmarks.emplace_back(vector("vaddps", [](auto dst, auto a, auto b) { return vaddps(dst, a, b); }));
+        benchmarks.emplace_back(vector("vmulps", [](auto dst, auto a, auto b) { return vmulps(dst, a, b); }));
+        benchmarks.emplace_back(vector("vdivps", [](auto dst, auto a, auto b) { return vdivps(dst, a, b); }));
+    }
+    if (features.has(feature::fma)) {
+        benchmarks.emplace_back(vector("vfmadd231ps", [](auto dst, auto a, auto b) { return vfmadd231ps(dst, a, b); }));
+    }
+
+    auto ticks_per_cycle = microbenchmark::ticks_per_cycle();
+    std::cout << "time stamp counter ticks per core cycle: " << ticks_per_cycle << std::endl;
+    std::cout << std::left << std::setw(14) << "instruction"
+        << std::right << std::setw(10) << "latency" << std::setw(12) << "throughput"
+        << std::setw(10) << "skylake" << std::setw(12) << "" << std::setw(10) << "zen3" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+    for (const auto& benchmark : benchmarks) {
+        auto measured = microbenchmark::measure(benchmark, ticks_per_cycle);
+        std::cout << std::left << std::setw(14) << benchmark.name
+            << std::right << std::setw(10) << measured.latency << std::setw(12) << measured.reciprocal_throughput;
+        for (const auto& model : {performance_model::skylake, performance_model::zen3}) {
+            auto independent = std::vector<uint8_t>{};
+            for (const auto& copy : benchmark.independent) {
+                independent.append_range(copy);
+            }
+            auto latency = performance_model::analyze(benchmark.chained, model).dependency_bound;
+            auto throughput = performance_model::analyze(independent, model).cycles_per_iteration / benchmark.independent.size();
+            std::cout << std::setw(10) << latency << std::setw(12) << throughput;
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
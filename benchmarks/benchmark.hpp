@@ -0,0 +1,89 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <algorithm>
+
+namespace benchmark {
+    struct result {
+        std::string name;
+        // items and bytes processed by one run
+        uint64_t items;
+        uint64_t bytes;
+        // fastest of the runs
+        double seconds;
+        size_t runs;
+        // what the benchmarked phase reports about its output, by name
+        std::vector<std::pair<std::string, uint64_t>> counters;
+    };
+
+    // Keep a value alive so the work producing it is not optimized away.
+    template<typename T>
+    inline void do_not_optimize(const T& value) {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    class suite {
+    public:
+        // runs of every benchmark, and substring of the names to run
+        suite(size_t runs = 5, std::string filter = {}) : m_runs{runs}, m_filter{std::move(filter)} {}
+
+        // Time run(), which processes items and bytes, keeping the fastest
+        // of the runs.
+        void add(std::string name, uint64_t items, uint64_t bytes, auto run,
+                std::vector<std::pair<std::string, uint64_t>> counters = {}) {
+            if (!selected(name)) {
+                return;
+            }
+            auto fastest = std::numeric_limits<double>::max();
+            for (size_t i = 0; i < m_runs; i++) {
+                auto start = std::chrono::steady_clock::now();
+                run();
+                auto end = std::chrono::steady_clock::now();
+                fastest = std::min(fastest, std::chrono::duration<double>(end - start).count());
+            }
+            m_results.emplace_back(std::move(name), items, bytes, fastest, m_runs, std::move(counters));
+        }
+
+        // whether the filter runs name, to skip building its input
+        bool selected(const std::string& name) const {
+            return m_filter.empty() || name.find(m_filter) != std::string::npos;
+        }
+
+        const auto& results() const {
+            return m_results;
+        }
+
+        // {"benchmarks": [{"name", "items", "bytes", "seconds", "runs",
+        // "items_per_second", "bytes_per_second", "ns_per_item", counters...}]}
+        void write_json(std::ostream& out) const {
+            out << "{\n  \"benchmarks\": [";
+            for (size_t i = 0; i < m_results.size(); i++) {
+                const auto& r = m_results[i];
+                out << (i == 0 ? "\n" : ",\n");
+                out << "    {\"name\": \"" << r.name << "\""
+                    << ", \"items\": " << r.items
+                    << ", \"bytes\": " << r.bytes
+                    << ", \"seconds\": " << r.seconds
+                    << ", \"runs\": " << r.runs
+                    << ", \"items_per_second\": " << r.items / r.seconds
+                    << ", \"bytes_per_second\": " << r.bytes / r.seconds
+                    << ", \"ns_per_item\": " << r.seconds * 1e9 / std::max<uint64_t>(r.items, 1);
+                for (const auto& [counter, value] : r.counters) {
+                    out << ", \"" << counter << "\": " << value;
+                }
+                out << "}";
+            }
+            out << "\n  ]\n}\n";
+        }
+    private:
+        size_t m_runs;
+        std::string m_filter;
+        std::vector<result> m_results;
+    };
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "vector_instruction.hpp"
+
+namespace amd64 {
+    template<bool Repeat_prefix>
+    constexpr auto repeat_prefix() {
+        if constexpr (Repeat_prefix) {
+            return std::array<uint8_t, 1>{0xf3};
+        }
+        else {
+            return std::array<uint8_t, 0>{};
+        }
+    }
+
+    // F3 0F opcode /r, for popcnt, lzcnt and tzcnt, or without F3 for bsf and bsr
+    template<uint8_t Opcode, bool Repeat_prefix = true>
+    struct bit_count_instruction {
+        constexpr static auto operator ()(gpr auto reg, reg_or_mem auto regmem) {
+            static_assert(reg.size() != 8 && reg.size() == regmem.size());
+            return cat(
+                    prefix_for_16(reg),
+                    repeat_prefix<Repeat_prefix>(),
+                    prefix_for_64(reg),
+                    std::array<uint8_t, 2>{0x0f, Opcode},
+                    std::array<uint8_t, 1>{modrm{}.set_reg(reg).set_rm(regmem)},
+                    sib_for(regmem)
+                    );
+        }
+    };
+
+    template<size_t N>
+    constexpr bit4 vex_vvvv(register_type::reg<N> reg) {
+        return static_cast<uint8_t>(reg.r);
+    }
+    template<size_t N>
+    constexpr bit4 vex_vvvv(register_type::ax_r<N>) {
+        return 0;
+    }
+
+    // BMI instructions are VEX.LZ, with W selecting the 64 bit form
+    template<vex_opcode Opcode, size_t N>
+    constexpr auto sized_vex_opcode = vex_opcode{Opcode.pp, Opcode.map_select, N == 64, Opcode.opcode};
+
+    template<size_t N>
+    constexpr auto check_bit_manipulation_size() {
+        static_assert(N == 32 || N == 64);
+    }
+
+    // ModRM.reg = dst, VEX.vvvv = src1, ModRM.rm = src2
+    template<vex_opcode Opcode>
+    struct vex_gpr_rvm_instruction {
+        constexpr static auto operator ()(gpr auto dst, gpr auto src1, reg_or_mem auto src2) {
+            static_assert(dst.size() == src1.size() && dst.size() == src2.size());
+            check_bit_manipulation_size<dst.size()>();
+            return gen_vex_instruction<sized_vex_opcode<Opcode, dst.size()>>(dst, vex_vvvv(src1), 0, src2);
+        }
+    };
+
+    // ModRM.reg = dst, ModRM.rm = src1, VEX.vvvv = src2
+    template<vex_opcode Opcode>
+    struct vex_gpr_rmv_instruction {
+        constexpr static auto operator ()(gpr auto dst, reg_or_mem auto src1, gpr auto src2) {
+            static_assert(dst.size() == src1.size() && dst.size() == src2.size());
+            check_bit_manipulation_size<dst.size()>();
+            return gen_vex_instruction<sized_vex_opcode<Opcode, dst.size()>>(dst, vex_vvvv(src2), 0, src1);
+        }
+    };
+
+    // ModRM.reg = dst, ModRM.rm = src, imm8
+    template<vex_opcode Opcode>
+    struct vex_gpr_rmi_instruction {
+        constexpr static auto operator ()(gpr auto dst, reg_or_mem auto src, uint8_t imm) {
+            static_assert(dst.size() == src.size());
+            check_bit_manipulation_size<dst.size()>();
+            return cat(
+                    gen_vex_instruction<sized_vex_opcode<Opcode, dst.size()>>(dst, 0, 0, src),
+                    to_codes(imm)
+                    );
+        }
+    };
+
+    // VEX.vvvv = dst, ModRM.rm = src, ModRM.reg = opcode extension
+    template<vex_opcode Opcode, bit3 Modrm_reg>
+    struct vex_gpr_vm_instruction {
+        constexpr static auto operator ()(gpr auto dst, reg_or_mem auto src) {
+            static_assert(dst.size() == src.size());
+            check_bit_manipulation_size<dst.size()>();
+            return gen_vex_instruction<sized_vex_opcode<Opcode, dst.size()>>(Modrm_reg, vex_vvvv(dst), 0, src);
+        }
+    };
+}
@@ -0,0 +1,277 @@
+#pragma once
+
+#include "control_flow_graph.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <istream>
+#include <numeric>
+#include <optional>
+#include <algorithm>
+#include <stdexcept>
+
+namespace block_layout {
+    struct options {
+        // blocks run at most this fraction of the entry block's count are
+        // cold, and move after all hot blocks
+        double cold_fraction = 0.0;
+    };
+
+    template<typename Instruction>
+    struct laid_out_instructions {
+        std::vector<Instruction> instructions;
+        // original block indices in their new order
+        std::vector<uint32_t> block_order;
+        // index in block_order of the first cold block
+        size_t cold_start;
+        // jumps taken on the profiled runs, before and after
+        uint64_t taken_before;
+        uint64_t taken_after;
+    };
+
+    // execution counts of the blocks in stream order, whitespace separated
+    inline auto read_counts(std::istream& in) {
+        auto counts = std::vector<uint64_t>{};
+        uint64_t count;
+        while (in >> count) {
+            counts.emplace_back(count);
+        }
+        return counts;
+    }
+
+    // Reorder the basic blocks of a labeled stream so that the most frequent
+    // successor of a block falls through, merging chains of blocks along the
+    // heaviest edges first (Pettis and Hansen), and put cold blocks last.
+    // Blocks start at labels and after jumps and returns; the first block
+    // stays first. block_counts has a count for every block, and taken_counts
+    // is empty or has, for every block ending in a jcc, the times it jumped;
+    // without it an edge weighs the smaller count of its two blocks. Jumps
+    // are dropped, inverted or added so the control flow stays the same;
+    // gen_label makes the labels of blocks that are jumped to but had none.
+    template<typename Instruction>
+    auto layout_blocks(const std::vector<Instruction>& instructions,
+            const std::vector<uint64_t>& block_counts,
+            const std::vector<uint64_t>& taken_counts,
+            auto classify,
+            auto gen_label,
+            auto gen_jump,
+            auto gen_conditional_jump,
+            options opts = {}
+            ) {
+        using kind = control_flow::control_kind;
+        using control_flow_graph::none;
+
+        struct block {
+            std::optional<uint32_t> label;
+            // the ending jump or jcc, if any
+            std::optional<control_flow::control> branch;
+            uint32_t target = none;
+            uint32_t fall_through = none;
+        };
+        auto graph = control_flow_graph::build_graph(instructions, classify);
+        auto blocks = std::vector<block>(graph.size());
+        uint32_t next_label = 0;
+        for (const auto& instruction : instructions) {
+            auto control = classify(instruction);
+            if (control.kind != kind::other && control.kind != kind::ret) {
+                next_label = std::max(next_label, control.label + 1);
+            }
+        }
+        for (uint32_t b = 0; b < graph.size(); b++) {
+            auto& bl = blocks[b];
+            auto first = classify(instructions[graph.first(b)]);
+            if (first.kind == kind::label) {
+                bl.label = first.label;
+            }
+            auto last = classify(instructions[graph.last(b) - 1]);
+            auto successors = graph.successors_of(b);
+            if (last.kind == kind::jump || last.kind == kind::conditional_jump) {
+                bl.branch = last;
+                bl.target = successors.front();
+            }
+            if (last.kind != kind::jump && last.kind != kind::ret && b + 1 < graph.size()) {
+                bl.fall_through = successors.back();
+            }
+        }
+        if (block_counts.size() != blocks.size()) {
+            throw std::runtime_error{"every block needs a count"};
+        }
+        if (!taken_counts.empty() && taken_counts.size() != blocks.size()) {
+            throw std::runtime_error{"every block needs a taken count"};
+        }
+
+        struct edge {
+            uint64_t weight;
+            uint32_t from;
+            uint32_t to;
+        };
+        auto edges = std::vector<edge>{};
+        auto estimate = [&](uint32_t from, uint32_t to) {
+            return std::min(block_counts[from], block_counts[to]);
+        };
+        uint64_t taken_before = 0;
+        for (uint32_t b = 0; b < blocks.size(); b++) {
+            const auto& bl = blocks[b];
+            if (bl.branch && bl.branch->kind == kind::jump) {
+                edges.push_back({block_counts[b], b, bl.target});
+                taken_before += block_counts[b];
+            }
+            else if (bl.branch) {
+                auto taken = taken_counts.empty() ? estimate(b, bl.target) : taken_counts[b];
+                edges.push_back({taken, b, bl.target});
+                taken_before += taken;
+                if (bl.fall_through != none) {
+                    auto not_taken = taken_counts.empty() ? estimate(b, bl.fall_through) : block_counts[b] - std::min(taken, block_counts[b]);
+                    edges.push_back({not_taken, b, bl.fall_through});
+                }
+            }
+            else if (bl.fall_through != none) {
+                edges.push_back({block_counts[b], b, bl.fall_through});
+            }
+        }
+        std::ranges::stable_sort(edges, std::greater{}, &edge::weight);
+
+        // chains of blocks, merged tail to head along the heaviest edges
+        auto chain_of = std::vector<uint32_t>(blocks.size());
+        std::iota(chain_of.begin(), chain_of.end(), 0);
+        auto chains = std::vector<std::vector<uint32_t>>(blocks.size());
+        for (uint32_t b = 0; b < blocks.size(); b++) {
+            chains[b] = {b};
+        }
+        for (auto [weight, from, to] : edges) {
+            auto a = chain_of[from];
+            auto c = chain_of[to];
+            if (a == c || chains[a].back() != from || chains[c].front() != to || to == 0) {
+                continue;
+            }
+            for (auto b : chains[c]) {
+                chain_of[b] = a;
+            }
+            chains[a].append_range(chains[c]);
+            chains[c].clear();
+        }
+
+        // the entry chain, then hot chains by their hottest block, then cold blocks
+        auto is_cold = [&](uint32_t b) {
+            return static_cast<double>(block_counts[b]) <= opts.cold_fraction * static_cast<double>(block_counts[0]);
+        };
+        auto chain_indices = std::vector<uint32_t>{};
+        auto heat = std::vector<uint64_t>(chains.size(), 0);
+        for (uint32_t c = 0; c < chains.size(); c++) {
+            if (!chains[c].empty()) {
+                chain_indices.emplace_back(c);
+                for (auto b : chains[c]) {
+                    heat[c] = std::max(heat[c], block_counts[b]);
+                }
+            }
+        }
+        std::ranges::stable_sort(chain_indices, [&](uint32_t l, uint32_t r) {
+            if ((l == chain_of[0]) != (r == chain_of[0])) {
+                return l == chain_of[0];
+            }
+            return heat[l] > heat[r];
+        });
+        auto result = laid_out_instructions<Instruction>{};
+        auto cold = std::vector<uint32_t>{};
+        for (auto c : chain_indices) {
+            for (auto b : chains[c]) {
+                if (b != 0 && is_cold(b)) {
+                    cold.emplace_back(b);
+                }
+                else {
+                    result.block_order.emplace_back(b);
+                }
+            }
+        }
+        result.cold_start = result.block_order.size();
+        result.block_order.append_range(cold);
+
+        // labels for blocks that are jumped to now, but were only fallen into
+        auto labels = std::vector<std::optional<uint32_t>>(blocks.size());
+        for (uint32_t b = 0; b < blocks.size(); b++) {
+            labels[b] = blocks[b].label;
+        }
+        auto label_of = [&](uint32_t b) {
+            if (!labels[b]) {
+                labels[b] = next_label++;
+            }
+            return *labels[b];
+        };
+        auto placed_after = std::vector<uint32_t>(blocks.size(), none);
+        for (size_t i = 0; i + 1 < result.block_order.size(); i++) {
+            placed_after[result.block_order[i]] = result.block_order[i + 1];
+        }
+        // decide the jumps first, so blocks that need labels have them
+        struct ending {
+            std::optional<control_flow::control> conditional;
+            std::optional<uint32_t> jump;
+        };
+        auto endings = std::vector<ending>(blocks.size());
+        result.taken_after = 0;
+        for (uint32_t b = 0; b < blocks.size(); b++) {
+            const auto& bl = blocks[b];
+            auto next = placed_after[b];
+            auto& e = endings[b];
+            if (bl.branch && bl.branch->kind == kind::jump) {
+                if (next != bl.target) {
+                    e.jump = label_of(bl.target);
+                    result.taken_after += block_counts[b];
+                }
+            }
+            else if (bl.branch) {
+                auto taken = taken_counts.empty() ? estimate(b, bl.target) : taken_counts[b];
+                auto not_taken = block_counts[b] - std::min(taken, block_counts[b]);
+                if (next == bl.fall_through || bl.fall_through == none) {
+                    e.conditional = control_flow::control{kind::conditional_jump, label_of(bl.target), bl.branch->condition};
+                    result.taken_after += taken;
+                }
+                else if (next == bl.target) {
+                    e.conditional = control_flow::control{kind::conditional_jump, label_of(bl.fall_through),
+                        control_flow::negate_condition(bl.branch->condition)};
+                    result.taken_after += not_taken;
+                }
+                else {
+                    e.conditional = control_flow::control{kind::conditional_jump, label_of(bl.target), bl.branch->condition};
+                    e.jump = label_of(bl.fall_through);
+                    result.taken_after += block_counts[b];
+                }
+            }
+            else if (bl.fall_through != none && next != bl.fall_through) {
+                e.jump = label_of(bl.fall_through);
+                result.taken_after += block_counts[b];
+            }
+        }
+        result.taken_before = taken_before;
+
+        result.instructions.reserve(instructions.size() + blocks.size());
+        for (auto b : result.block_order) {
+            const auto& bl = blocks[b];
+            auto first = graph.first(b);
+            if (labels[b] && !bl.label) {
+                result.instructions.emplace_back(gen_label(*labels[b]));
+            }
+            auto last = bl.branch ? graph.last(b) - 1 : graph.last(b);
+            for (auto i = first; i < last; i++) {
+                result.instructions.emplace_back(instructions[i]);
+            }
+            auto& e = endings[b];
+            if (e.conditional) {
+                if (e.conditional->label == bl.branch->label && e.conditional->condition == bl.branch->condition) {
+                    result.instructions.emplace_back(instructions[graph.last(b) - 1]);
+                }
+                else {
+                    result.instructions.emplace_back(gen_conditional_jump(e.conditional->condition, e.conditional->label));
+                }
+            }
+            if (e.jump) {
+                if (bl.branch && bl.branch->kind == kind::jump) {
+                    result.instructions.emplace_back(instructions[graph.last(b) - 1]);
+                }
+                else {
+                    result.instructions.emplace_back(gen_jump(*e.jump));
+                }
+            }
+        }
+        return result;
+    }
+}
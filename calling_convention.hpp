@@ -0,0 +1,129 @@
+#pragma once
+
+#include "amd64_assembler.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <ranges>
+#include <stdexcept>
+
+namespace amd64 {
+    namespace system_v {
+        // Registers are numbered by their encoding, r8 to r15 are 8 to 15.
+        using register_index = uint8_t;
+
+        constexpr auto argument_registers = std::to_array<register_index>({
+            7, // rdi
+            6, // rsi
+            2, // rdx
+            1, // rcx
+            8, // r8
+            9, // r9
+        });
+        constexpr auto return_registers = std::to_array<register_index>({
+            0, // rax
+            2, // rdx
+        });
+        constexpr auto callee_saved_registers = std::to_array<register_index>({
+            3,  // rbx
+            5,  // rbp
+            12, // r12
+            13, // r13
+            14, // r14
+            15, // r15
+        });
+
+        struct call_assignment {
+            std::vector<register_index> argument_registers;
+            // arguments after the register ones, pushed right to left
+            uint32_t stack_arguments;
+            std::vector<register_index> return_registers;
+            // results after the register ones, returned through memory
+            uint32_t memory_returns;
+        };
+
+        // Assign a procedure's reads to argument registers and its writes to
+        // return registers in declaration order, as for INTEGER class values.
+        inline auto assign_registers(size_t argument_count, size_t return_count) {
+            auto assignment = call_assignment{};
+            auto register_argument_count = std::min(argument_count, argument_registers.size());
+            assignment.argument_registers.assign(
+                    argument_registers.begin(), argument_registers.begin() + register_argument_count);
+            assignment.stack_arguments = argument_count - register_argument_count;
+            auto register_return_count = std::min(return_count, return_registers.size());
+            assignment.return_registers.assign(
+                    return_registers.begin(), return_registers.begin() + register_return_count);
+            assignment.memory_returns = return_count - register_return_count;
+            return assignment;
+        }
+
+        template<typename Procedure>
+        auto assign_registers(const Procedure& procedure) {
+            return assign_registers(procedure.reads.size(), procedure.writes.size());
+        }
+
+        // Callee-saved registers written by the instructions, in save order.
+        // Every write has to be a register_index, so registers are allocated.
+        auto clobbered_callee_saved_registers(const auto& instructions) {
+            auto clobbered = std::array<bool, 16>{};
+            for (const auto& instruction : instructions) {
+                for (auto reg : instruction.get_writes()) {
+                    auto index = static_cast<size_t>(reg);
+                    if (index >= clobbered.size()) {
+                        throw std::runtime_error{"write to a register that is not allocated"};
+                    }
+                    clobbered[index] = true;
+                }
+            }
+            auto saved = std::vector<register_index>{};
+            for (auto reg : callee_saved_registers) {
+                if (clobbered[reg]) {
+                    saved.emplace_back(reg);
+                }
+            }
+            return saved;
+        }
+
+        inline auto push_pop_codes(auto instruction, register_index reg) {
+            using namespace register_type;
+            auto codes = std::vector<uint8_t>{};
+            if (reg >= 8) {
+                codes.append_range(instruction(register_type::reg<64, extention::extended>{static_cast<extended_reg64>(reg - 8)}));
+            }
+            else {
+                codes.append_range(instruction(register_type::reg<64>{static_cast<reg64>(reg)}));
+            }
+            return codes;
+        }
+
+        // Keep rsp 16 byte aligned at call sites inside the procedure: the
+        // return address and the saved registers must add up to a multiple of 16.
+        inline auto needs_alignment_padding(const std::vector<register_index>& saved, bool makes_calls) {
+            return makes_calls && saved.size() % 2 == 0;
+        }
+
+        inline auto prologue(const std::vector<register_index>& saved, bool makes_calls) {
+            auto codes = std::vector<uint8_t>{};
+            for (auto reg : saved) {
+                codes.append_range(push_pop_codes(push, reg));
+            }
+            if (needs_alignment_padding(saved, makes_calls)) {
+                codes.append_range(sub(rsp, uint32_t{8}));
+            }
+            return codes;
+        }
+
+        inline auto epilogue(const std::vector<register_index>& saved, bool makes_calls) {
+            auto codes = std::vector<uint8_t>{};
+            if (needs_alignment_padding(saved, makes_calls)) {
+                codes.append_range(add(rsp, uint32_t{8}));
+            }
+            for (auto reg : saved | std::views::reverse) {
+                codes.append_range(push_pop_codes(pop, reg));
+            }
+            codes.append_range(ret());
+            return codes;
+        }
+    }
+}
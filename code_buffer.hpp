@@ -0,0 +1,509 @@
+#pragma once
+
+#include "amd64_assembler.hpp"
+
+#include <vector>
+#include <span>
+#include <map>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+namespace code_buffer {
+    using label = uint32_t;
+
+    struct layout_policy {
+        size_t function_alignment = 16;
+        size_t function_max_skip = 15;
+        // loop headers are labels targeted by backward jumps, aligned by link()
+        bool align_loops = true;
+        size_t loop_alignment = 32;
+        size_t loop_max_skip = 10;
+        // some older cores decode nops longer than 10 or 11 bytes slowly
+        size_t max_nop_length = amd64::max_nop_length;
+        // Skylake derived cores do not cache branches, or macro-fused pairs,
+        // that cross or end on a 32 byte boundary in the uop cache. link()
+        // pads such branch sites to start on the boundary instead.
+        bool mitigate_jcc_erratum = false;
+        size_t jcc_erratum_boundary = 32;
+        // constant pools start on a cache line, kept there by link()
+        size_t constant_pool_alignment = 64;
+    };
+
+    // pages of the linked code, and of the counter array after it
+    constexpr size_t page_size = 4096;
+
+    // Edge profiling: an increment of a 64 bit counter at every label and
+    // function entry, and on the taken edge of every jcc, through a stub
+    // that jumps on to the target. Fall through counts are the difference.
+    // inc keeps the carry flag, but not the others, so flags must not be
+    // live across labels or jcc targets of instrumented code. The counter
+    // array starts on the page after the code, see counters_offset(), and
+    // every increment reaches its counter rip relative.
+    struct profiling {
+        // counters in the array; 0 for no profiling
+        size_t capacity = 0;
+        // lock inc, for code run by several threads at once
+        bool atomic = false;
+    };
+
+    enum class counter_kind {
+        // entries into the block at a label
+        block,
+        // taken jumps of a jcc to a label
+        taken,
+    };
+
+    struct counter {
+        counter_kind kind;
+        label target;
+    };
+
+    // rel32 or disp32 to a label, plus addend, relative to the end of the
+    // instruction
+    struct fixup {
+        size_t offset;
+        size_t end;
+        label target;
+        size_t addend = 0;
+    };
+
+    // A branch, or a flags writing instruction and the jcc it can
+    // macro-fuse with, which are kept adjacent.
+    struct branch_site {
+        size_t start;
+        size_t end;
+    };
+
+    // An offset align() padded to, which layout() keeps aligned.
+    struct aligned {
+        size_t offset;
+        size_t alignment;
+        size_t max_skip;
+    };
+
+    // The first opcode byte, after 66 and REX prefixes, is one of cmp, test,
+    // add, sub, and, inc or dec, which fuse with a following jcc.
+    inline auto is_macro_fusible(const uint8_t* codes, size_t size) {
+        size_t i = 0;
+        while (i < size && (codes[i] == 0x66 || (codes[i] & 0xf0) == 0x40)) {
+            i++;
+        }
+        if (i == size) {
+            return false;
+        }
+        auto opcode = codes[i];
+        auto modrm_reg = i + 1 < size ? (codes[i + 1] >> 3) & 7 : 8;
+        switch (opcode) {
+        case 0x00: case 0x01: case 0x02: case 0x03: case 0x04: case 0x05: // add
+        case 0x20: case 0x21: case 0x22: case 0x23: case 0x24: case 0x25: // and
+        case 0x28: case 0x29: case 0x2a: case 0x2b: case 0x2c: case 0x2d: // sub
+        case 0x38: case 0x39: case 0x3a: case 0x3b: case 0x3c: case 0x3d: // cmp
+        case 0x84: case 0x85: case 0xa8: case 0xa9: // test
+            return true;
+        case 0x80: case 0x81: case 0x83:
+            return modrm_reg == 0 || modrm_reg == 4 || modrm_reg == 5 || modrm_reg == 7;
+        case 0xf6: case 0xf7:
+            return modrm_reg == 0;
+        case 0xfe: case 0xff:
+            return modrm_reg == 0 || modrm_reg == 1;
+        default:
+            return false;
+        }
+    }
+
+    // Code with labels. Jumps and calls to labels are always rel32, so code
+    // can be moved by padding without changing any instruction size.
+    class code_buffer {
+    public:
+        static constexpr auto unbound = std::numeric_limits<size_t>::max();
+
+        code_buffer(layout_policy policy = {}, profiling profile = {}) : m_policy{policy}, m_profiling{profile} {}
+
+        const auto& codes() const {
+            return m_codes;
+        }
+        auto size() const {
+            return m_codes.size();
+        }
+        const auto& policy() const {
+            return m_policy;
+        }
+        // nop bytes added by align() and link()
+        auto padding_size() const {
+            return m_padding_size;
+        }
+        // branch sites moved off a boundary by the last link()
+        auto jcc_erratum_fixes() const {
+            return m_jcc_erratum_fixes;
+        }
+        const auto& branch_sites() const {
+            return m_branch_sites;
+        }
+
+        // One instruction, or a sequence without jumps out of it other than
+        // through labels: link() may pad between appends.
+        void append(const auto& codes) {
+            m_last_start = m_codes.size();
+            m_codes.append_range(codes);
+            m_last_end = m_codes.size();
+        }
+        // ret or an indirect jmp or call
+        void append_branch(const auto& codes) {
+            auto start = m_codes.size();
+            append(codes);
+            m_branch_sites.emplace_back(start, m_codes.size());
+        }
+
+        label new_label() {
+            m_label_offsets.emplace_back(unbound);
+            return static_cast<label>(m_label_offsets.size() - 1);
+        }
+        void bind(label l) {
+            bind_label(l);
+            count(counter_kind::block, l);
+        }
+        auto is_bound(label l) const {
+            return m_label_offsets[l] != unbound;
+        }
+        auto offset(label l) const {
+            return m_label_offsets[l];
+        }
+        auto label_count() const {
+            return m_label_offsets.size();
+        }
+        const auto& fixups() const {
+            return m_fixups;
+        }
+        // entry labels passed to begin_function, in order
+        const auto& functions() const {
+            return m_functions;
+        }
+        // what every profiling counter counts, by index in the array
+        const auto& counters() const {
+            return m_counters;
+        }
+        // of the counter array from the start of the code, once linked
+        size_t counters_offset() const {
+            return (m_codes.size() + page_size - 1) / page_size * page_size;
+        }
+
+        // Pad with nops to a multiple of alignment, unless that takes more
+        // than max_skip bytes. Returns the bytes added.
+        size_t align(size_t alignment, size_t max_skip = std::numeric_limits<size_t>::max()) {
+            auto size = padding_to(m_codes.size(), alignment);
+            if (size > max_skip) {
+                return 0;
+            }
+            m_codes.append_range(amd64::padding(size, m_policy.max_nop_length));
+            m_padding_size += size;
+            m_aligned.emplace_back(m_codes.size(), alignment, max_skip);
+            return size;
+        }
+
+        void begin_function(label l) {
+            align(m_policy.function_alignment, m_policy.function_max_skip);
+            bind(l);
+            m_functions.emplace_back(l);
+        }
+
+        // the disp32 ending at end - trailing bytes, for an instruction ending at end
+        void add_fixup(label target, size_t end, size_t trailing = 0) {
+            m_fixups.emplace_back(end - trailing - 4, end, target);
+        }
+        // an instruction with a mem<N, amd64::rip_address> operand, whose
+        // disp32 is followed by trailing bytes of immediate
+        void append_rip_relative(const auto& codes, label target, size_t trailing = 0) {
+            append(codes);
+            add_fixup(target, m_codes.size(), trailing);
+        }
+
+        // The label of a constant in the pool, one per distinct bytes and
+        // alignment. It is placed by the next emit_constants(), or by link().
+        label constant(std::span<const uint8_t> bytes, size_t alignment) {
+            if (alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment > m_policy.constant_pool_alignment) {
+                throw std::runtime_error{"constant alignment is not a power of two up to the pool's"};
+            }
+            auto key = std::pair{alignment, std::vector<uint8_t>(bytes.begin(), bytes.end())};
+            auto [it, inserted] = m_constant_labels.try_emplace(key, 0);
+            if (inserted) {
+                it->second = new_label();
+                m_pending_constants.emplace_back(it->second, alignment, std::move(key.second));
+            }
+            return it->second;
+        }
+        label constant(std::integral auto value) {
+            auto codes = amd64::to_codes(value);
+            return constant(codes, sizeof(value));
+        }
+        // reg = value: mov r32, imm32 for values that zero extend, mov r/m64,
+        // imm32 for values that sign extend, and otherwise a 7 byte load from
+        // the pool instead of the 10 byte mov r64, imm64
+        void load_constant(amd64::register_type::reg<64> reg, uint64_t value) {
+            if (value <= std::numeric_limits<uint32_t>::max()) {
+                auto low = amd64::register_type::reg<32>{static_cast<amd64::register_type::reg32>(reg.r)};
+                append(amd64::reg_imm_instruction<0xb0, 0xb8>{}(low, static_cast<uint32_t>(value)));
+            }
+            else if (auto as_signed = static_cast<int64_t>(value);
+                    as_signed >= std::numeric_limits<int32_t>::min() && as_signed <= std::numeric_limits<int32_t>::max()) {
+                append(amd64::regmem_imm_instruction<{0xc7, 0}>{}(reg, static_cast<uint32_t>(value)));
+            }
+            else {
+                append_rip_relative(amd64::mov(reg, amd64::mem<64, amd64::rip_address>{}), constant(value));
+            }
+        }
+        // Place the pending constants here, after a function's ret for a pool
+        // per function. The pool starts on a cache line and the most aligned
+        // constants come first, so none crosses a line it fits in.
+        void emit_constants() {
+            if (m_pending_constants.empty()) {
+                return;
+            }
+            std::ranges::stable_sort(m_pending_constants, std::greater{}, &pending_constant::alignment);
+            align(m_policy.constant_pool_alignment);
+            auto start = m_codes.size();
+            for (const auto& c : m_pending_constants) {
+                align(c.alignment);
+                bind_label(c.target);
+                m_codes.append_range(c.bytes);
+            }
+            m_constant_pools.emplace_back(start, m_codes.size());
+            m_pending_constants.clear();
+            m_last_end = unbound;
+        }
+        // (start, end) of every pool placed
+        const auto& constant_pools() const {
+            return m_constant_pools;
+        }
+
+        void jmp(label target) {
+            append_branch(amd64::jmp(int32_t{0}));
+            add_fixup(target, m_codes.size());
+        }
+        // fused with the instruction appended just before, if it can be
+        void jcc(amd64::bitset<4> condition, label target) {
+            auto start = m_codes.size();
+            auto previous = m_last_start;
+            auto fused = m_last_end == start && is_macro_fusible(m_codes.data() + previous, start - previous);
+            if (m_profiling.capacity != 0) {
+                auto stub = new_label();
+                m_taken_stubs.emplace_back(stub, target);
+                target = stub;
+            }
+            append(amd64::cat(
+                        std::to_array<uint8_t>({0x0f, static_cast<uint8_t>(0x80 | condition)}),
+                        amd64::to_codes(int32_t{0})));
+            m_branch_sites.emplace_back(fused ? previous : start, m_codes.size());
+            add_fixup(target, m_codes.size());
+        }
+        void call(label target) {
+            append_branch(amd64::call(int32_t{0}));
+            add_fixup(target, m_codes.size());
+        }
+
+        // Place the remaining constants, align loop headers and constant
+        // pools, pad branch sites off boundaries, then patch every fixup.
+        // Fails on unbound labels.
+        const auto& link() {
+            for (auto [stub, target] : m_taken_stubs) {
+                bind_label(stub);
+                count(counter_kind::taken, target);
+                jmp(target);
+            }
+            m_taken_stubs.clear();
+            emit_constants();
+            layout();
+            if (m_counter_array != unbound) {
+                m_label_offsets[m_counter_array] = counters_offset();
+            }
+            for (const auto& f : m_fixups) {
+                if (!is_bound(f.target)) {
+                    throw std::runtime_error{"jump to an unbound label"};
+                }
+            }
+            for (const auto& f : m_fixups) {
+                auto displacement = static_cast<int64_t>(m_label_offsets[f.target] + f.addend) - static_cast<int64_t>(f.end);
+                if (displacement < std::numeric_limits<int32_t>::min() || displacement > std::numeric_limits<int32_t>::max()) {
+                    throw std::runtime_error{"jump out of rel32 range"};
+                }
+                std::ranges::copy(amd64::to_codes(static_cast<int32_t>(displacement)), m_codes.begin() + f.offset);
+            }
+            return m_codes;
+        }
+    private:
+        void bind_label(label l) {
+            if (m_label_offsets[l] != unbound) {
+                throw std::runtime_error{"label is bound twice"};
+            }
+            m_label_offsets[l] = m_codes.size();
+        }
+        // inc qword [rip + disp32], to counter index of the array, which
+        // link() places after the code
+        void count(counter_kind kind, label target) {
+            if (m_profiling.capacity == 0) {
+                return;
+            }
+            if (m_counters.size() == m_profiling.capacity) {
+                throw std::runtime_error{"too many profiling counters"};
+            }
+            if (m_counter_array == unbound) {
+                m_counter_array = new_label();
+            }
+            auto index = m_counters.size();
+            m_counters.emplace_back(kind, target);
+            auto increment = amd64::cat(
+                    std::to_array<uint8_t>({0x48, 0xff, 0x05}),
+                    amd64::to_codes(int32_t{0}));
+            if (m_profiling.atomic) {
+                append(amd64::cat(std::to_array<uint8_t>({0xf0}), increment));
+            }
+            else {
+                append(increment);
+            }
+            m_fixups.emplace_back(m_codes.size() - 4, m_codes.size(), static_cast<label>(m_counter_array), 8 * index);
+            // inc with a memory operand does not fuse with a jcc
+            m_last_end = unbound;
+        }
+
+        static size_t padding_to(size_t offset, size_t alignment) {
+            return (alignment - offset % alignment) % alignment;
+        }
+
+        // Insert nops before loop headers, offsets align() padded to and
+        // branch sites, in a single sweep in address order, since every insertion moves
+        // what follows it.
+        void layout() {
+            // function entries and constant pools are aligned by align()
+            auto headers = m_aligned;
+            auto in_pool = [this](size_t offset) {
+                auto pool = std::ranges::upper_bound(m_constant_pools, offset, {}, &std::pair<size_t, size_t>::first);
+                return pool != m_constant_pools.begin() && offset < std::prev(pool)->second;
+            };
+            if (m_policy.align_loops) {
+                for (const auto& f : m_fixups) {
+                    auto target = m_label_offsets[f.target];
+                    if (target < f.end && !in_pool(target)) {
+                        headers.emplace_back(target, m_policy.loop_alignment, m_policy.loop_max_skip);
+                    }
+                }
+            }
+            std::ranges::sort(headers, [](const aligned& l, const aligned& r) {
+                return l.offset != r.offset ? l.offset < r.offset : l.alignment > r.alignment;
+            });
+            auto [first, last] = std::ranges::unique(headers, {}, &aligned::offset);
+            headers.erase(first, last);
+            auto sites = std::vector<branch_site>{};
+            if (m_policy.mitigate_jcc_erratum) {
+                sites = m_branch_sites;
+                std::ranges::sort(sites, {}, &branch_site::start);
+            }
+
+            // (old offset, bytes inserted there)
+            auto insertions = std::vector<std::pair<size_t, size_t>>{};
+            size_t shift = 0;
+            m_jcc_erratum_fixes = 0;
+            auto boundary = m_policy.jcc_erratum_boundary;
+            auto header = headers.begin();
+            auto site = sites.begin();
+            while (header != headers.end() || site != sites.end()) {
+                // a header before the branch site starting at it
+                if (header != headers.end() && (site == sites.end() || header->offset <= site->start)) {
+                    auto size = padding_to(header->offset + shift, header->alignment);
+                    if (size != 0 && size <= header->max_skip) {
+                        insertions.emplace_back(header->offset, size);
+                        shift += size;
+                    }
+                    header++;
+                    continue;
+                }
+                auto start = site->start + shift;
+                auto end = site->end + shift;
+                // crossing a boundary, or ending on one
+                if (start / boundary != end / boundary && end - start <= boundary) {
+                    auto size = padding_to(start, boundary);
+                    insertions.emplace_back(site->start, size);
+                    shift += size;
+                    m_jcc_erratum_fixes++;
+                }
+                site++;
+            }
+            if (insertions.empty()) {
+                return;
+            }
+
+            // bytes inserted before every insertion point
+            auto inserted_before = std::vector<size_t>{0};
+            for (auto [at, size] : insertions) {
+                inserted_before.emplace_back(inserted_before.back() + size);
+            }
+            // labels at an insertion point move after the padding, code ending there does not
+            auto moved = [&insertions, &inserted_before](size_t offset, bool after_padding) {
+                auto it = after_padding
+                    ? std::ranges::upper_bound(insertions, offset, {}, &std::pair<size_t, size_t>::first)
+                    : std::ranges::lower_bound(insertions, offset, {}, &std::pair<size_t, size_t>::first);
+                return offset + inserted_before[it - insertions.begin()];
+            };
+            for (auto& f : m_fixups) {
+                f.offset = moved(f.offset, false);
+                f.end = moved(f.end, false);
+            }
+            for (auto& offset : m_label_offsets) {
+                if (offset != unbound) {
+                    offset = moved(offset, true);
+                }
+            }
+            for (auto& site : m_branch_sites) {
+                site.start = moved(site.start, true);
+                site.end = moved(site.end, false);
+            }
+            for (auto& [start, end] : m_constant_pools) {
+                start = moved(start, true);
+                end = moved(end, false);
+            }
+            for (auto& a : m_aligned) {
+                a.offset = moved(a.offset, true);
+            }
+
+            auto codes = std::vector<uint8_t>{};
+            codes.reserve(m_codes.size() + shift);
+            size_t copied = 0;
+            for (auto [at, size] : insertions) {
+                codes.insert(codes.end(), m_codes.begin() + copied, m_codes.begin() + at);
+                codes.append_range(amd64::padding(size, m_policy.max_nop_length));
+                copied = at;
+            }
+            codes.insert(codes.end(), m_codes.begin() + copied, m_codes.end());
+            m_codes = std::move(codes);
+            m_padding_size += shift;
+            m_last_end = unbound;
+        }
+
+        layout_policy m_policy;
+        std::vector<uint8_t> m_codes;
+        std::vector<size_t> m_label_offsets;
+        std::vector<fixup> m_fixups;
+        std::vector<branch_site> m_branch_sites;
+        std::vector<label> m_functions;
+        profiling m_profiling;
+        std::vector<counter> m_counters;
+        // bound by link()
+        size_t m_counter_array = unbound;
+        // (stub, target) of jcc taken edges, emitted by link()
+        std::vector<std::pair<label, label>> m_taken_stubs;
+        struct pending_constant {
+            label target;
+            size_t alignment;
+            std::vector<uint8_t> bytes;
+        };
+        std::vector<pending_constant> m_pending_constants;
+        std::map<std::pair<size_t, std::vector<uint8_t>>, label> m_constant_labels;
+        std::vector<std::pair<size_t, size_t>> m_constant_pools;
+        std::vector<aligned> m_aligned;
+        // the last append, to find the instruction a jcc fuses with
+        size_t m_last_start = 0;
+        size_t m_last_end = unbound;
+        size_t m_padding_size = 0;
+        size_t m_jcc_erratum_fixes = 0;
+    };
+}
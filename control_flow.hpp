@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+
+namespace control_flow {
+    enum class control_kind {
+        label,
+        jump,
+        conditional_jump,
+        ret,
+        other,
+    };
+
+    // How an instruction of a labeled stream affects control flow. label is
+    // the label defined by a label, or the target of a jump; condition is the
+    // amd64 condition code of a conditional jump.
+    struct control {
+        control_kind kind;
+        uint32_t label;
+        uint8_t condition;
+    };
+
+    // amd64 condition codes come in pairs that differ in the lowest bit
+    constexpr uint8_t negate_condition(uint8_t condition) {
+        return condition ^ 1;
+    }
+}
@@ -0,0 +1,311 @@
+#pragma once
+
+#include "control_flow.hpp"
+
+#include <vector>
+#include <span>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+
+namespace control_flow_graph {
+    constexpr uint32_t none = UINT32_MAX;
+
+    // Basic blocks of a labeled stream, with successor and predecessor edges
+    // stored contiguously: the edges of block b are edges[offsets[b]] up to
+    // edges[offsets[b + 1]]. A block ending in a jump or jcc has the jump
+    // target as its first successor, and a block that can fall through has
+    // the next block as its last one. Block 0 is the entry.
+    struct graph {
+        // first instruction of every block, and the instruction count
+        std::vector<uint32_t> starts;
+        std::vector<uint32_t> successor_offsets;
+        std::vector<uint32_t> successors;
+        std::vector<uint32_t> predecessor_offsets;
+        std::vector<uint32_t> predecessors;
+
+        uint32_t size() const {
+            return static_cast<uint32_t>(starts.size()) - 1;
+        }
+        uint32_t first(uint32_t block) const {
+            return starts[block];
+        }
+        uint32_t last(uint32_t block) const {
+            return starts[block + 1];
+        }
+        std::span<const uint32_t> successors_of(uint32_t block) const {
+            return std::span{successors}.subspan(successor_offsets[block], successor_offsets[block + 1] - successor_offsets[block]);
+        }
+        std::span<const uint32_t> predecessors_of(uint32_t block) const {
+            return std::span{predecessors}.subspan(predecessor_offsets[block], predecessor_offsets[block + 1] - predecessor_offsets[block]);
+        }
+    };
+
+    // Blocks start at labels and after jumps, jccs and returns; classify
+    // returns a control_flow::control. Linear in the instructions and the
+    // largest label.
+    template<typename Instruction>
+    auto build_graph(const std::vector<Instruction>& instructions,
+            auto classify
+            ) {
+        using kind = control_flow::control_kind;
+        auto g = graph{};
+
+        auto controls = std::vector<control_flow::control>{};
+        controls.reserve(instructions.size());
+        uint32_t label_count = 0;
+        bool ended = true;
+        for (uint32_t i = 0; i < instructions.size(); i++) {
+            auto control = classify(instructions[i]);
+            if (control.kind == kind::label || ended) {
+                g.starts.emplace_back(i);
+            }
+            if (control.kind == kind::label || control.kind == kind::jump || control.kind == kind::conditional_jump) {
+                label_count = std::max(label_count, control.label + 1);
+            }
+            ended = control.kind == kind::jump || control.kind == kind::conditional_jump || control.kind == kind::ret;
+            controls.emplace_back(control);
+        }
+        g.starts.emplace_back(static_cast<uint32_t>(instructions.size()));
+
+        auto block_of_label = std::vector<uint32_t>(label_count, none);
+        for (uint32_t b = 0; b < g.size(); b++) {
+            const auto& control = controls[g.first(b)];
+            if (control.kind == kind::label) {
+                block_of_label[control.label] = b;
+            }
+        }
+
+        g.successor_offsets.reserve(g.size() + 1);
+        g.successors.reserve(2 * g.size());
+        for (uint32_t b = 0; b < g.size(); b++) {
+            g.successor_offsets.emplace_back(static_cast<uint32_t>(g.successors.size()));
+            const auto& control = controls[g.last(b) - 1];
+            if (control.kind == kind::jump || control.kind == kind::conditional_jump) {
+                auto target = block_of_label[control.label];
+                if (target == none) {
+                    throw std::runtime_error{"jump to an undefined label"};
+                }
+                g.successors.emplace_back(target);
+            }
+            if (control.kind != kind::jump && control.kind != kind::ret && b + 1 < g.size()) {
+                g.successors.emplace_back(b + 1);
+            }
+        }
+        g.successor_offsets.emplace_back(static_cast<uint32_t>(g.successors.size()));
+
+        // counting sort of the edges by their target
+        g.predecessor_offsets.assign(g.size() + 1, 0);
+        for (auto s : g.successors) {
+            g.predecessor_offsets[s + 1]++;
+        }
+        for (uint32_t b = 0; b < g.size(); b++) {
+            g.predecessor_offsets[b + 1] += g.predecessor_offsets[b];
+        }
+        g.predecessors.resize(g.successors.size());
+        auto next = std::vector<uint32_t>(g.predecessor_offsets.begin(), g.predecessor_offsets.end() - 1);
+        for (uint32_t b = 0; b < g.size(); b++) {
+            for (auto s : g.successors_of(b)) {
+                g.predecessors[next[s]++] = b;
+            }
+        }
+        return g;
+    }
+
+    struct dominator_tree {
+        // of every block reachable from the entry; the entry is its own, and
+        // unreachable blocks have none
+        std::vector<uint32_t> immediate_dominator;
+        // reachable blocks, every block before its successors except along back edges
+        std::vector<uint32_t> reverse_postorder;
+        // of the dominator tree, to answer dominates in constant time
+        std::vector<uint32_t> preorder;
+        std::vector<uint32_t> postorder;
+
+        bool reachable(uint32_t block) const {
+            return immediate_dominator[block] != none;
+        }
+        // every path from the entry to b passes through a
+        bool dominates(uint32_t a, uint32_t b) const {
+            return reachable(a) && reachable(b) &&
+                preorder[a] <= preorder[b] && postorder[b] <= postorder[a];
+        }
+    };
+
+    // Cooper, Harvey and Kennedy's iterative algorithm over reverse postorder.
+    inline auto build_dominator_tree(const graph& g) {
+        auto tree = dominator_tree{};
+        tree.immediate_dominator.assign(g.size(), none);
+        if (g.size() == 0) {
+            return tree;
+        }
+
+        // depth first with an explicit stack, as in procedure::build_call_graph
+        auto visited = std::vector<bool>(g.size(), false);
+        auto stack = std::vector<std::pair<uint32_t, uint32_t>>{{0, 0}};
+        visited[0] = true;
+        while (!stack.empty()) {
+            auto& [b, edge] = stack.back();
+            auto successors = g.successors_of(b);
+            if (edge < successors.size()) {
+                auto s = successors[edge++];
+                if (!visited[s]) {
+                    visited[s] = true;
+                    stack.emplace_back(s, 0);
+                }
+                continue;
+            }
+            tree.reverse_postorder.emplace_back(b);
+            stack.pop_back();
+        }
+        std::ranges::reverse(tree.reverse_postorder);
+        auto order = std::vector<uint32_t>(g.size(), none);
+        for (uint32_t i = 0; i < tree.reverse_postorder.size(); i++) {
+            order[tree.reverse_postorder[i]] = i;
+        }
+
+        auto& idom = tree.immediate_dominator;
+        auto intersect = [&](uint32_t a, uint32_t b) {
+            while (a != b) {
+                while (order[a] > order[b]) {
+                    a = idom[a];
+                }
+                while (order[b] > order[a]) {
+                    b = idom[b];
+                }
+            }
+            return a;
+        };
+        idom[0] = 0;
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (auto b : std::span{tree.reverse_postorder}.subspan(1)) {
+                auto dominator = none;
+                for (auto p : g.predecessors_of(b)) {
+                    if (idom[p] == none) {
+                        continue;
+                    }
+                    dominator = dominator == none ? p : intersect(p, dominator);
+                }
+                if (idom[b] != dominator) {
+                    idom[b] = dominator;
+                    changed = true;
+                }
+            }
+        }
+
+        // number the tree; children come after their parent in reverse postorder
+        auto child_offsets = std::vector<uint32_t>(g.size() + 1, 0);
+        for (auto b : std::span{tree.reverse_postorder}.subspan(1)) {
+            child_offsets[idom[b] + 1]++;
+        }
+        for (uint32_t b = 0; b < g.size(); b++) {
+            child_offsets[b + 1] += child_offsets[b];
+        }
+        auto children = std::vector<uint32_t>(tree.reverse_postorder.size() - 1);
+        auto next = std::vector<uint32_t>(child_offsets.begin(), child_offsets.end() - 1);
+        for (auto b : std::span{tree.reverse_postorder}.subspan(1)) {
+            children[next[idom[b]]++] = b;
+        }
+        tree.preorder.assign(g.size(), none);
+        tree.postorder.assign(g.size(), none);
+        uint32_t pre = 0;
+        uint32_t post = 0;
+        stack.emplace_back(0, child_offsets[0]);
+        tree.preorder[0] = pre++;
+        while (!stack.empty()) {
+            auto& [b, child] = stack.back();
+            if (child < child_offsets[b + 1]) {
+                auto c = children[child++];
+                tree.preorder[c] = pre++;
+                stack.emplace_back(c, child_offsets[c]);
+                continue;
+            }
+            tree.postorder[b] = post++;
+            stack.pop_back();
+        }
+        return tree;
+    }
+
+    struct loop {
+        uint32_t header;
+        // sorted, the header included
+        std::vector<uint32_t> blocks;
+        // blocks with a back edge to the header
+        std::vector<uint32_t> latches;
+        // innermost enclosing loop, or none
+        uint32_t parent;
+        // 1 for outermost loops
+        uint32_t depth;
+    };
+
+    struct loop_forest {
+        // enclosing loops before the loops they contain
+        std::vector<loop> loops;
+        // innermost loop of every block, or none
+        std::vector<uint32_t> innermost;
+
+        uint32_t depth(uint32_t block) const {
+            return innermost[block] == none ? 0 : loops[innermost[block]].depth;
+        }
+    };
+
+    // Natural loops: the blocks that reach a back edge, an edge to a block
+    // that dominates its source, without passing the header. Back edges to
+    // the same header form one loop. Cycles entered at more than one block
+    // have no back edge and are not loops.
+    inline auto find_loops(const graph& g, const dominator_tree& dominators) {
+        auto forest = loop_forest{};
+        forest.innermost.assign(g.size(), none);
+
+        auto in_loop = std::vector<uint32_t>(g.size(), none);
+        auto work = std::vector<uint32_t>{};
+        for (auto header : dominators.reverse_postorder) {
+            auto l = loop{header, {header}, {}, none, 0};
+            for (auto p : g.predecessors_of(header)) {
+                if (dominators.dominates(header, p)) {
+                    l.latches.emplace_back(p);
+                }
+            }
+            if (l.latches.empty()) {
+                continue;
+            }
+            auto stamp = static_cast<uint32_t>(forest.loops.size());
+            in_loop[header] = stamp;
+            for (auto latch : l.latches) {
+                if (in_loop[latch] != stamp) {
+                    in_loop[latch] = stamp;
+                    l.blocks.emplace_back(latch);
+                    work.emplace_back(latch);
+                }
+            }
+            while (!work.empty()) {
+                auto b = work.back();
+                work.pop_back();
+                for (auto p : g.predecessors_of(b)) {
+                    if (dominators.reachable(p) && in_loop[p] != stamp) {
+                        in_loop[p] = stamp;
+                        l.blocks.emplace_back(p);
+                        work.emplace_back(p);
+                    }
+                }
+            }
+            std::ranges::sort(l.blocks);
+            forest.loops.emplace_back(std::move(l));
+        }
+
+        // a loop contains the loops it strictly contains the header of, and
+        // those are smaller
+        std::ranges::stable_sort(forest.loops, std::greater{}, [](const loop& l) { return l.blocks.size(); });
+        for (uint32_t i = 0; i < forest.loops.size(); i++) {
+            auto& l = forest.loops[i];
+            l.parent = forest.innermost[l.header];
+            l.depth = l.parent == none ? 1 : forest.loops[l.parent].depth + 1;
+            for (auto b : l.blocks) {
+                forest.innermost[b] = i;
+            }
+        }
+        return forest;
+    }
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include "control_flow.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <ranges>
+
+namespace copy_propagation {
+    // Rewrite reads through the copies before them. A copy instruction
+    // (is_copy) copies reads[i] to writes[i] for every i, all at once.
+    // Copies left copying registers to themselves are removed.
+    // translate_registers has the same signature as the one of
+    // register_allocation::register_allocate. Copies are only followed
+    // within straight-line code: classify returns a control_flow::control,
+    // and nothing is known at a label, as it can be reached from elsewhere.
+    template<
+        typename Instruction,
+        typename Register = Instruction::register_t>
+    auto propagate_copies(const std::vector<Instruction>& instructions, auto classify, auto is_copy, auto translate_registers) {
+        auto out_instructions = std::vector<Instruction>{};
+        out_instructions.reserve(instructions.size());
+
+        // register -> register it is a copy of
+        auto copy_of = std::unordered_map<Register, Register>{};
+        // register -> registers that are copies of it
+        auto copies = std::unordered_map<Register, std::vector<Register>>{};
+
+        auto resolve = [&copy_of](Register reg) {
+            auto it = copy_of.find(reg);
+            return it != copy_of.end() ? it->second : reg;
+        };
+        auto kill = [&copy_of, &copies](Register reg) {
+            copy_of.erase(reg);
+            if (auto it = copies.find(reg); it != copies.end()) {
+                for (auto copy : it->second) {
+                    if (auto source = copy_of.find(copy); source != copy_of.end() && source->second == reg) {
+                        copy_of.erase(source);
+                    }
+                }
+                copies.erase(it);
+            }
+        };
+
+        auto reads = std::vector<Register>{};
+        auto writes = std::vector<Register>{};
+        for (const auto& instruction : instructions) {
+            if (classify(instruction).kind == control_flow::control_kind::label) {
+                copy_of.clear();
+                copies.clear();
+            }
+            reads.clear();
+            for (const auto& reg : instruction.get_reads()) {
+                reads.emplace_back(resolve(reg));
+            }
+            const auto& instruction_writes = instruction.get_writes();
+            for (const auto& reg : instruction_writes) {
+                kill(reg);
+            }
+
+            if (!is_copy(instruction)) {
+                writes.assign(instruction_writes.begin(), instruction_writes.end());
+                out_instructions.emplace_back(translate_registers(instruction, writes, reads));
+                continue;
+            }
+
+            auto copy_reads = std::vector<Register>{};
+            writes.clear();
+            for (size_t i = 0; i < instruction_writes.size(); i++) {
+                auto dst = instruction_writes[i];
+                auto src = reads[i];
+                if (dst == src) {
+                    continue;
+                }
+                writes.emplace_back(dst);
+                copy_reads.emplace_back(src);
+                // a source overwritten by this same copy no longer holds its old value
+                if (!std::ranges::contains(instruction_writes, src)) {
+                    copy_of[dst] = src;
+                    copies[src].emplace_back(dst);
+                }
+            }
+            if (!writes.empty()) {
+                out_instructions.emplace_back(translate_registers(instruction, writes, copy_reads));
+            }
+        }
+        return out_instructions;
+    }
+
+    // Remove pure instructions, and the parts of copies, whose results are
+    // never read before being overwritten and are not in live_out. live_out
+    // is live at the end and at every return. Jump targets are not
+    // followed, so every register is live before a jump or jcc, up to the
+    // previous return.
+    template<
+        typename Instruction,
+        typename Register = Instruction::register_t>
+    auto eliminate_dead_code(const std::vector<Instruction>& instructions, const std::vector<Register>& live_out,
+            auto classify, auto is_copy, auto is_pure, auto translate_registers) {
+        using kind = control_flow::control_kind;
+        auto live = std::unordered_set<Register>(live_out.begin(), live_out.end());
+        bool all_live = false;
+        auto kept = std::vector<Instruction>{};
+
+        auto reads = std::vector<Register>{};
+        auto writes = std::vector<Register>{};
+        for (const auto& instruction : instructions | std::views::reverse) {
+            const auto& instruction_reads = instruction.get_reads();
+            const auto& instruction_writes = instruction.get_writes();
+            auto control = classify(instruction).kind;
+            if (control == kind::ret) {
+                live.clear();
+                live.insert(live_out.begin(), live_out.end());
+                all_live = false;
+            }
+            else if (control == kind::jump || control == kind::conditional_jump) {
+                all_live = true;
+            }
+            if (all_live || control != kind::other) {
+                live.insert(instruction_reads.begin(), instruction_reads.end());
+                kept.emplace_back(instruction);
+                continue;
+            }
+            if (is_copy(instruction)) {
+                reads.clear();
+                writes.clear();
+                for (size_t i = 0; i < instruction_writes.size(); i++) {
+                    if (live.contains(instruction_writes[i])) {
+                        writes.emplace_back(instruction_writes[i]);
+                        reads.emplace_back(instruction_reads[i]);
+                    }
+                }
+                if (writes.empty()) {
+                    continue;
+                }
+                for (auto reg : writes) {
+                    live.erase(reg);
+                }
+                live.insert(reads.begin(), reads.end());
+                if (writes.size() == instruction_writes.size()) {
+                    kept.emplace_back(instruction);
+                }
+                else {
+                    kept.emplace_back(translate_registers(instruction, writes, reads));
+                }
+                continue;
+            }
+
+            auto is_live = std::ranges::any_of(instruction_writes,
+                    [&live](auto reg) { return live.contains(reg); });
+            if (!is_live && is_pure(instruction)) {
+                continue;
+            }
+            for (auto reg : instruction_writes) {
+                live.erase(reg);
+            }
+            live.insert(instruction_reads.begin(), instruction_reads.end());
+            kept.emplace_back(instruction);
+        }
+        std::ranges::reverse(kept);
+        return kept;
+    }
+}
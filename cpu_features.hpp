@@ -0,0 +1,219 @@
+#pragma once
+
+#include "amd64_assembler.hpp"
+#include "executable_memory.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <initializer_list>
+
+namespace cpu_features {
+    struct cpuid_result {
+        uint32_t eax;
+        uint32_t ebx;
+        uint32_t ecx;
+        uint32_t edx;
+    };
+
+    // void (uint32_t leaf, uint32_t subleaf, cpuid_result* result), System V
+    inline auto gen_cpuid_probe() {
+        using namespace amd64;
+        using namespace amd64::register_type;
+        auto result = mem<32>{modrm_reg64_address::rdi};
+        auto codes = std::vector<uint8_t>{};
+        // rbx is callee-saved
+        codes.append_range(push(reg<64>{reg64::rbx}));
+        codes.append_range(mov(reg<32>{reg32::eax}, reg<32>{reg32::edi}));
+        codes.append_range(mov(reg<32>{reg32::ecx}, reg<32>{reg32::esi}));
+        codes.append_range(mov(reg<64>{reg64::rdi}, reg<64>{reg64::rdx}));
+        codes.append_range(cpuid());
+        for (auto value : {reg32::eax, reg32::ebx, reg32::ecx, reg32::edx}) {
+            codes.append_range(mov(result, reg<32>{value}));
+            codes.append_range(add(reg<64>{reg64::rdi}, uint32_t{4}));
+        }
+        codes.append_range(pop(reg<64>{reg64::rbx}));
+        codes.append_range(ret());
+        return codes;
+    }
+
+    class cpuid_probe {
+    public:
+        cpuid_probe() : m_code{gen_cpuid_probe()} {}
+
+        auto operator ()(uint32_t leaf, uint32_t subleaf = 0) const {
+            auto result = cpuid_result{};
+            m_code.get<void(uint32_t, uint32_t, cpuid_result*)>()(leaf, subleaf, &result);
+            return result;
+        }
+    private:
+        executable_memory::executable_memory m_code;
+    };
+
+    // uint64_t (uint32_t xcr), only valid when cpuid reports osxsave
+    inline auto gen_xgetbv_probe() {
+        using namespace amd64;
+        using namespace amd64::register_type;
+        auto codes = std::vector<uint8_t>{};
+        codes.append_range(mov(reg<32>{reg32::ecx}, reg<32>{reg32::edi}));
+        codes.append_range(xgetbv());
+        codes.append_range(shl(reg<64>{reg64::rdx}, 32));
+        codes.append_range(bit_or(reg<64>{reg64::rax}, reg<64>{reg64::rdx}));
+        codes.append_range(ret());
+        return codes;
+    }
+
+    enum class feature : uint8_t {
+        sse4_2,
+        popcnt,
+        movbe,
+        // avx, avx2, fma and avx512f also need the os to save their registers
+        avx,
+        fma,
+        avx2,
+        avx512f,
+        // andn, bextr, blsr, tzcnt
+        bmi1,
+        // bzhi, pdep, pext, rorx, sarx, shlx, shrx
+        bmi2,
+        lzcnt,
+        // enhanced rep movsb/stosb
+        erms,
+        // fast short rep movsb
+        fsrm,
+        clzero,
+        rdtscp,
+    };
+
+    class feature_mask {
+    public:
+        constexpr feature_mask() = default;
+        constexpr explicit feature_mask(uint64_t bits) : m_bits{bits} {}
+        constexpr feature_mask(std::initializer_list<feature> features) {
+            for (auto f : features) {
+                set(f);
+            }
+        }
+
+        constexpr auto has(feature f) const {
+            return (m_bits >> static_cast<uint8_t>(f) & 1) != 0;
+        }
+        constexpr feature_mask& set(feature f, bool value = true) {
+            auto bit = uint64_t{1} << static_cast<uint8_t>(f);
+            m_bits = value ? m_bits | bit : m_bits & ~bit;
+            return *this;
+        }
+        constexpr auto bits() const {
+            return m_bits;
+        }
+    private:
+        uint64_t m_bits = 0;
+    };
+
+    inline auto detect_features(const cpuid_probe& probe) {
+        auto features = feature_mask{};
+        auto max_leaf = probe(0).eax;
+        auto max_extended_leaf = probe(0x80000000).eax;
+
+        // xmm, ymm and zmm state enabled in XCR0
+        bool ymm_state = false;
+        bool zmm_state = false;
+        if (max_leaf >= 1) {
+            auto leaf_1 = probe(1);
+            features.set(feature::sse4_2, leaf_1.ecx >> 20 & 1);
+            features.set(feature::movbe, leaf_1.ecx >> 22 & 1);
+            features.set(feature::popcnt, leaf_1.ecx >> 23 & 1);
+            auto osxsave = leaf_1.ecx >> 27 & 1;
+            if (osxsave) {
+                auto code = executable_memory::executable_memory{gen_xgetbv_probe()};
+                auto xcr0 = code.get<uint64_t(uint32_t)>()(0);
+                ymm_state = (xcr0 & 0x6) == 0x6;
+                zmm_state = (xcr0 & 0xe6) == 0xe6;
+            }
+            features.set(feature::avx, ymm_state && (leaf_1.ecx >> 28 & 1));
+            features.set(feature::fma, ymm_state && (leaf_1.ecx >> 12 & 1));
+        }
+        if (max_leaf >= 7) {
+            auto leaf_7 = probe(7, 0);
+            features.set(feature::bmi1, leaf_7.ebx >> 3 & 1);
+            features.set(feature::avx2, ymm_state && (leaf_7.ebx >> 5 & 1));
+            features.set(feature::bmi2, leaf_7.ebx >> 8 & 1);
+            features.set(feature::erms, leaf_7.ebx >> 9 & 1);
+            features.set(feature::avx512f, zmm_state && (leaf_7.ebx >> 16 & 1));
+            features.set(feature::fsrm, leaf_7.edx >> 4 & 1);
+        }
+        if (max_extended_leaf >= 0x80000001) {
+            auto extended_leaf_1 = probe(0x80000001);
+            features.set(feature::lzcnt, extended_leaf_1.ecx >> 5 & 1);
+            features.set(feature::rdtscp, extended_leaf_1.edx >> 27 & 1);
+        }
+        if (max_extended_leaf >= 0x80000008) {
+            features.set(feature::clzero, probe(0x80000008).ebx & 1);
+        }
+        return features;
+    }
+
+    // Features of the host, detected on first use and kept for the process.
+    inline auto host_features() {
+        static const auto features = detect_features(cpuid_probe{});
+        return features;
+    }
+}
+
+// Code generation choosing the best sequence for a set of features,
+// the host's by default.
+namespace cpu_features {
+    // dst = number of leading zero bits of src, 32 for 0
+    inline auto count_leading_zeros(amd64::register_type::reg<32> dst, amd64::register_type::reg<32> src,
+            feature_mask features = host_features()) {
+        using namespace amd64;
+        auto codes = std::vector<uint8_t>{};
+        if (features.has(feature::lzcnt)) {
+            codes.append_range(lzcnt(dst, src));
+            return codes;
+        }
+        // bsr leaves dst unchanged for 0, 63 ^ 31 = 32 and index ^ 31 = 31 - index
+        auto set_63 = reg_imm_instruction<0xb0, 0xb8>{}(dst, uint32_t{63});
+        codes.append_range(bsr(dst, src));
+        codes.append_range(jnz(static_cast<uint8_t>(set_63.size())));
+        codes.append_range(set_63);
+        codes.append_range(bit_xor(dst, uint32_t{31}));
+        return codes;
+    }
+
+    // dst = number of trailing zero bits of src, 32 for 0
+    inline auto count_trailing_zeros(amd64::register_type::reg<32> dst, amd64::register_type::reg<32> src,
+            feature_mask features = host_features()) {
+        using namespace amd64;
+        auto codes = std::vector<uint8_t>{};
+        if (features.has(feature::bmi1)) {
+            codes.append_range(tzcnt(dst, src));
+            return codes;
+        }
+        auto set_32 = reg_imm_instruction<0xb0, 0xb8>{}(dst, uint32_t{32});
+        codes.append_range(bsf(dst, src));
+        codes.append_range(jnz(static_cast<uint8_t>(set_32.size())));
+        codes.append_range(set_32);
+        return codes;
+    }
+
+    // Copy rcx bytes from [rsi] to [rdi]. Without fast rep movsb, bytes are
+    // moved 8 at a time first, which clobbers rdx.
+    inline auto copy_memory(feature_mask features = host_features()) {
+        using namespace amd64;
+        using namespace amd64::register_type;
+        auto codes = std::vector<uint8_t>{};
+        if (features.has(feature::fsrm) || features.has(feature::erms)) {
+            codes.append_range(rep_movsb());
+            return codes;
+        }
+        auto rcx = reg<64>{reg64::rcx};
+        auto rdx = reg<64>{reg64::rdx};
+        codes.append_range(mov(rdx, rcx));
+        codes.append_range(shr(rcx, 3));
+        codes.append_range(rep_movsq());
+        codes.append_range(mov(rcx, rdx));
+        codes.append_range(bit_and(rcx, uint32_t{7}));
+        codes.append_range(rep_movsb());
+        return codes;
+    }
+}
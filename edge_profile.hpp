@@ -0,0 +1,56 @@
+#pragma once
+
+#include "code_buffer.hpp"
+#include "executable_memory.hpp"
+
+#include <vector>
+#include <span>
+#include <cstdint>
+#include <ostream>
+#include <algorithm>
+
+namespace edge_profile {
+    // The linked code of a code_buffer with profiling, and its counter array
+    // on the writable pages executable_memory maps right after the code.
+    class counters {
+    public:
+        explicit counters(const code_buffer::code_buffer& buffer)
+            : m_memory{buffer.codes(), buffer.counters_offset(), buffer.counters().size() * sizeof(uint64_t)} {}
+
+        const auto& memory() const {
+            return m_memory;
+        }
+        std::span<const uint64_t> values() const {
+            auto data = m_memory.writable_data();
+            return {reinterpret_cast<const uint64_t*>(data.data()), data.size() / sizeof(uint64_t)};
+        }
+        void reset() {
+            std::ranges::fill(m_memory.writable_data(), 0);
+        }
+    private:
+        executable_memory::executable_memory m_memory;
+    };
+
+    struct count {
+        code_buffer::counter counter;
+        uint64_t value;
+    };
+
+    // the counters of buffer, after running its code
+    inline auto read(const counters& array, const code_buffer::code_buffer& buffer) {
+        auto values = array.values();
+        auto result = std::vector<count>{};
+        for (size_t i = 0; i < buffer.counters().size(); i++) {
+            result.emplace_back(buffer.counters()[i], values[i]);
+        }
+        return result;
+    }
+
+    // "block <label> <count>" and "taken <label> <count>" lines
+    inline void write(std::ostream& out, const std::vector<count>& counts) {
+        for (const auto& [counter, value] : counts) {
+            out << (counter.kind == code_buffer::counter_kind::block ? "block " : "taken ")
+                << counter.target << ' ' << value << '\n';
+        }
+    }
+}
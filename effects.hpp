@@ -0,0 +1,18 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+namespace effects {
+    // What an instruction touches besides its registers, as the passes that
+    // move or remove instructions need to know.
+    struct effects {
+        bool reads_flags = false;
+        bool writes_flags = false;
+        // memory locations, named as in read_memories/write_memories
+        std::vector<uint32_t> read_memories;
+        std::vector<uint32_t> write_memories;
+        // calls, I/O and accesses to memory that cannot be named
+        bool has_side_effects = false;
+    };
+}
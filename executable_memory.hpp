@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <utility>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace executable_memory {
+    // Machine code copied to pages of its own, which are then made read and
+    // execute only, optionally followed by zeroed data pages that stay
+    // writable, in reach of rip relative addressing from the code.
+    class executable_memory {
+    public:
+        executable_memory() = default;
+        explicit executable_memory(const std::ranges::contiguous_range auto& codes)
+            : executable_memory{codes, std::ranges::size(codes), 0} {}
+        // data_size bytes of data at data_offset, a page boundary after the code
+        executable_memory(const std::ranges::contiguous_range auto& codes, size_t data_offset, size_t data_size)
+            : m_size{data_offset + data_size}, m_data_offset{data_offset} {
+            if (data_offset < std::ranges::size(codes) || (data_size != 0 && data_offset % static_cast<size_t>(sysconf(_SC_PAGESIZE)) != 0)) {
+                throw std::runtime_error{"data does not start on a page after the code"};
+            }
+            auto address = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (address == MAP_FAILED) {
+                throw std::runtime_error{"can not map memory for code"};
+            }
+            m_address = address;
+            std::memcpy(m_address, std::ranges::data(codes), std::ranges::size(codes));
+            if (mprotect(m_address, data_offset, PROT_READ | PROT_EXEC) != 0) {
+                munmap(m_address, m_size);
+                throw std::runtime_error{"can not make code executable"};
+            }
+        }
+        executable_memory(const executable_memory&) = delete;
+        executable_memory& operator=(const executable_memory&) = delete;
+        executable_memory(executable_memory&& other) noexcept
+            : m_address{std::exchange(other.m_address, nullptr)}, m_size{std::exchange(other.m_size, 0)},
+              m_data_offset{std::exchange(other.m_data_offset, 0)} {}
+        executable_memory& operator=(executable_memory&& other) noexcept {
+            std::swap(m_address, other.m_address);
+            std::swap(m_size, other.m_size);
+            std::swap(m_data_offset, other.m_data_offset);
+            return *this;
+        }
+        ~executable_memory() {
+            if (m_address != nullptr) {
+                munmap(m_address, m_size);
+            }
+        }
+
+        template<typename Function>
+        auto get() const {
+            return reinterpret_cast<Function*>(m_address);
+        }
+        auto data() const {
+            return static_cast<const uint8_t*>(m_address);
+        }
+        auto size() const {
+            return m_size;
+        }
+        // the data pages after the code
+        std::span<uint8_t> writable_data() const {
+            return {static_cast<uint8_t*>(m_address) + m_data_offset, m_size - m_data_offset};
+        }
+    private:
+        void* m_address = nullptr;
+        size_t m_size = 0;
+        size_t m_data_offset = 0;
+    };
+}
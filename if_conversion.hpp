@@ -0,0 +1,123 @@
+#pragma once
+
+#include "control_flow.hpp"
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+namespace if_conversion {
+    template<typename Instruction>
+    struct converted_instructions {
+        std::vector<Instruction> instructions;
+        // branches replaced by conditional moves
+        std::size_t converted;
+    };
+
+    // Replace small branches over register moves by conditional moves:
+    //
+    //     jcc else            jcc end
+    //     then moves          then moves
+    //     jmp end           end:
+    //   else:
+    //     else moves
+    //   end:
+    //
+    // The then moves become conditional on the negated condition and the
+    // else moves on the condition; cmov leaves the flags alone, so all of them
+    // see the flags of the jcc. is_move must only accept moves that are safe
+    // to execute on both paths (no faulting loads), since cmov always reads
+    // its source. A cmov keeps its destination when the condition is false,
+    // so gen_conditional_move must list the destination among its reads,
+    // or dead code elimination and register allocation take the first cmov
+    // of a diamond for dead. classify returns a control_flow::control.
+    template<typename Instruction>
+    auto convert_branches(const std::vector<Instruction>& instructions, std::size_t max_moves,
+            auto classify,
+            auto is_move,
+            auto gen_conditional_move
+            ) {
+        using kind = control_flow::control_kind;
+
+        auto controls = std::vector<control_flow::control>{};
+        controls.reserve(instructions.size());
+        auto references = std::unordered_map<uint32_t, std::size_t>{};
+        for (const auto& instruction : instructions) {
+            auto control = classify(instruction);
+            if (control.kind == kind::jump || control.kind == kind::conditional_jump) {
+                references[control.label]++;
+            }
+            controls.emplace_back(control);
+        }
+
+        auto result = converted_instructions<Instruction>{};
+        result.converted = 0;
+        result.instructions.reserve(instructions.size());
+
+        auto count_moves = [&](std::size_t first) {
+            auto last = first;
+            while (last < instructions.size() && last - first < max_moves &&
+                    controls[last].kind == kind::other && is_move(instructions[last])) {
+                last++;
+            }
+            return last;
+        };
+        auto is_label = [&](std::size_t i, uint32_t label) {
+            return i < instructions.size() && controls[i].kind == kind::label && controls[i].label == label;
+        };
+        auto append_moves = [&](std::size_t first, std::size_t last, uint8_t condition) {
+            for (auto i = first; i < last; i++) {
+                result.instructions.emplace_back(gen_conditional_move(instructions[i], condition));
+            }
+        };
+
+        std::size_t i = 0;
+        while (i < instructions.size()) {
+            const auto& control = controls[i];
+            if (control.kind != kind::conditional_jump) {
+                result.instructions.emplace_back(instructions[i]);
+                i++;
+                continue;
+            }
+            auto condition = control.condition;
+            auto then_end = count_moves(i + 1);
+
+            // triangle
+            if (is_label(then_end, control.label) && then_end > i + 1) {
+                append_moves(i + 1, then_end, control_flow::negate_condition(condition));
+                if (references[control.label] > 1) {
+                    result.instructions.emplace_back(instructions[then_end]);
+                }
+                references[control.label]--;
+                result.converted++;
+                i = then_end + 1;
+                continue;
+            }
+
+            // diamond, the else label must only be reached from the jcc
+            auto is_diamond = then_end < instructions.size() && controls[then_end].kind == kind::jump &&
+                is_label(then_end + 1, control.label) && references[control.label] == 1;
+            if (is_diamond) {
+                auto end_label = controls[then_end].label;
+                auto else_end = count_moves(then_end + 2);
+                if (is_label(else_end, end_label) && end_label != control.label) {
+                    append_moves(i + 1, then_end, control_flow::negate_condition(condition));
+                    append_moves(then_end + 2, else_end, condition);
+                    if (references[end_label] > 1) {
+                        result.instructions.emplace_back(instructions[else_end]);
+                    }
+                    references[end_label]--;
+                    references[control.label]--;
+                    result.converted++;
+                    i = else_end + 1;
+                    continue;
+                }
+            }
+
+            result.instructions.emplace_back(instructions[i]);
+            i++;
+        }
+        return result;
+    }
+}
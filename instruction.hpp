@@ -48,6 +48,19 @@ namespace amd64 {
 
     using mem8 = mem<8>;
 
+    // [base + index * 2^scale]
+    struct sib_address {
+        register_type::reg64 base;
+        register_type::reg64 index;
+        bitset<2> scale;
+    };
+
+    // [rip + displacement], relative to the end of the instruction; the
+    // displacement is usually left 0 for a code_buffer fixup to patch
+    struct rip_address {
+        int32_t displacement = 0;
+    };
+
     template<typename T>
     struct is_memory {
         constexpr static bool value = false;
@@ -101,6 +114,10 @@ namespace amd64 {
         auto set_reg(register_type::reg64 reg) && {
             return modrm{3, static_cast<uint8_t>(reg), m_rm};
         }
+        template<size_t N>
+        auto set_reg(register_type::ax_r<N> reg) && {
+            return modrm{3, 0, m_rm};
+        }
 
         template<size_t N>
         auto set_rm(register_type::ax_r<N> r) && {
@@ -111,9 +128,19 @@ namespace amd64 {
             return modrm{3, m_reg, static_cast<uint8_t>(r.r)};
         }
 
-        auto set_rm(mem8 dst) &&{
+        template<size_t N>
+        auto set_rm(mem<N> dst) &&{
             return modrm{0, m_reg, static_cast<uint8_t>(dst.m_ref)};
         }
+        template<size_t N>
+        auto set_rm(mem<N, sib_address> dst) &&{
+            return modrm{0, m_reg, 4};
+        }
+        // without a SIB byte, mod 00 and rm 101 is rip relative with a disp32
+        template<size_t N>
+        auto set_rm(mem<N, rip_address> dst) &&{
+            return modrm{0, m_reg, 5};
+        }
     private:
         bit3 m_rm;
         bit3 m_reg;
@@ -175,12 +202,99 @@ namespace amd64 {
         bit1 m_w;
     };
 
+    // R, X, B and vvvv hold the register bits as they are; they are
+    // inverted when encoded.
+    // map_select: 1 = 0F, 2 = 0F 38, 3 = 0F 3A
+    // pp: 0 = none, 1 = 66, 2 = F3, 3 = F2
+    class vex {
+    public:
+        vex() = default;
+        vex(bit1 r, bit1 x, bit1 b, bit5 map_select, bit1 w, bit4 vvvv, bit1 l, bit2 pp)
+            : m_r{r}, m_x{x}, m_b{b}, m_map_select{map_select}, m_w{w}, m_vvvv{vvvv}, m_l{l}, m_pp{pp} {}
+
+        // C5, only for map 0F with X, B and W clear
+        auto two_byte() const {
+            return std::array<uint8_t, 2>{
+                0xc5,
+                static_cast<uint8_t>(((m_r ^ 1) << 7) | ((m_vvvv ^ 0xf) << 3) | (m_l << 2) | m_pp)
+            };
+        }
+        // C4
+        auto three_byte() const {
+            return std::array<uint8_t, 3>{
+                0xc4,
+                static_cast<uint8_t>(((m_r ^ 1) << 7) | ((m_x ^ 1) << 6) | ((m_b ^ 1) << 5) | m_map_select),
+                static_cast<uint8_t>((m_w << 7) | ((m_vvvv ^ 0xf) << 3) | (m_l << 2) | m_pp)
+            };
+        }
+
+        auto r() const {
+            return m_r;
+        }
+        auto x() const {
+            return m_x;
+        }
+        auto b() const {
+            return m_b;
+        }
+        auto map_select() const {
+            return m_map_select;
+        }
+        auto w() const {
+            return m_w;
+        }
+        auto vvvv() const {
+            return m_vvvv;
+        }
+        auto l() const {
+            return m_l;
+        }
+        auto pp() const {
+            return m_pp;
+        }
+    private:
+        bit1 m_r;
+        bit1 m_x;
+        bit1 m_b;
+        bit5 m_map_select;
+        bit1 m_w;
+        bit4 m_vvvv;
+        bit1 m_l;
+        bit2 m_pp;
+    };
+
     constexpr auto sib_for(gpr auto reg) {
         return std::array<uint8_t, 0>{};
     }
-    constexpr auto sib_for(mem8) {
+    template<size_t N>
+    constexpr auto sib_for(mem<N>) {
         return std::array<uint8_t, 0>{};
     }
+    template<size_t N>
+    constexpr auto sib_for(mem<N, sib_address> address) {
+        // these encodings mean no index, and rip or no base with a displacement
+        if (address.m_ref.index == register_type::reg64::rsp) {
+            throw std::runtime_error{"rsp can not be an index register"};
+        }
+        if (address.m_ref.base == register_type::reg64::rbp) {
+            throw std::runtime_error{"rbp can not be a base register without displacement"};
+        }
+        return std::array<uint8_t, 1>{
+            sib{address.m_ref.scale, static_cast<uint8_t>(address.m_ref.index), static_cast<uint8_t>(address.m_ref.base)}
+        };
+    }
+
+    // no SIB byte, but the disp32 that follows the ModRM byte all the same
+    template<size_t N>
+    constexpr auto sib_for(mem<N, rip_address> address) {
+        auto codes = std::array<uint8_t, 4>{};
+        auto displacement = static_cast<uint32_t>(address.m_ref.displacement);
+        for (auto& code : codes) {
+            code = static_cast<uint8_t>(displacement & 0xff);
+            displacement >>= 8;
+        }
+        return codes;
+    }
 
     template<size_t N1, size_t N2>
     constexpr auto cat(std::array<uint8_t, N1> first, std::array<uint8_t, N2> second) {
@@ -216,12 +330,26 @@ namespace amd64 {
     auto prefix_for_16(register_type::reg<16> reg) {
         return std::array<uint8_t, 1>{ 0x66 };
     }
+    auto prefix_for_16(register_type::ax_r<16> reg) {
+        return std::array<uint8_t, 1>{ 0x66 };
+    }
+    template<typename Ref>
+    auto prefix_for_16(mem<16, Ref> regmem) {
+        return std::array<uint8_t, 1>{ 0x66 };
+    }
     auto prefix_for_64(auto reg) {
         return std::array<uint8_t, 0>{};
     }
     auto prefix_for_64(register_type::reg<64> reg) {
         return std::array<uint8_t, 1>{ rex{}.set_w(1) };
     }
+    auto prefix_for_64(register_type::ax_r<64> reg) {
+        return std::array<uint8_t, 1>{ rex{}.set_w(1) };
+    }
+    template<typename Ref>
+    auto prefix_for_64(mem<64, Ref> regmem) {
+        return std::array<uint8_t, 1>{ rex{}.set_w(1) };
+    }
     template<size_t N>
     struct imm_for {
         using type = imm_t<N>;
@@ -257,17 +385,43 @@ namespace amd64 {
         [std::to_underlying(operation::adc)] = 0x15,
     });
 
-    template<uint8_t Opcode>
+    template<size_t N>
+    constexpr auto bitset_codes(bitset<N> opcode) {
+        auto codes = std::array<uint8_t, (N + 7) / 8>{};
+        for (size_t i = 0; i < codes.size(); i++) {
+            codes[i] = static_cast<uint8_t>(static_cast<uint64_t>(opcode) >> (8 * (codes.size() - 1 - i)));
+        }
+        return codes;
+    }
+
+    // a single opcode byte, an array of them like 0F A2,
+    // or a bitset like 0F 8 cc, most significant byte first
+    template<auto Opcode>
+    constexpr auto opcode_codes() {
+        if constexpr (std::integral<decltype(Opcode)>) {
+            return std::array<uint8_t, 1>{Opcode};
+        }
+        else if constexpr (requires { Opcode.size(); }) {
+            auto codes = std::array<uint8_t, Opcode.size()>{};
+            std::ranges::transform(Opcode, codes.begin(), [](auto code) { return static_cast<uint8_t>(code); });
+            return codes;
+        }
+        else {
+            return bitset_codes(Opcode);
+        }
+    }
+
+    template<auto Opcode>
     constexpr auto gen_imm_instruction(std::integral auto imm) {
         return cat(
                 prefix_for_16(imm),
                 prefix_for_64(imm),
-                std::array<uint8_t,1>{Opcode},
+                opcode_codes<Opcode>(),
                 to_codes(imm)
                 );
     }
 
-    template<uint8_t Opcode_for_8, auto Opcode>
+    template<auto Opcode_for_8, auto Opcode>
     struct imm_instruction {
         template<typename Int>
             requires (std::integral<Int> && sizeof(Int) == 1)
@@ -338,12 +492,12 @@ namespace amd64 {
     template<uint8_t Opcode>
     constexpr auto gen_reg_imm_instruction(gpr auto reg, std::integral auto imm) {
         imm_for_reg_t<std::remove_cvref_t<decltype(reg)>> i = imm;
-        auto reg_encode = static_cast<uint8_t>(reg);
+        auto reg_encode = static_cast<uint8_t>(reg.r);
         assert(reg_encode < 0x10);
         return cat(
                     prefix_for_16(reg),
                     prefix_for_64(reg),
-                    std::array<uint8_t,1>{Opcode + (reg_encode & 0xf)},
+                    std::array<uint8_t,1>{static_cast<uint8_t>(Opcode + (reg_encode & 0x7))},
                     to_codes(i)
                 );
     }
@@ -367,9 +521,27 @@ namespace amd64 {
             >;
     };
 
+    template<uint8_t Opcode>
+    struct reg_in_opcode_instruction {
+        constexpr static auto operator ()(register_type::reg<64> reg) {
+            return std::array<uint8_t,1>{static_cast<uint8_t>(Opcode + static_cast<uint8_t>(reg.r))};
+        }
+        constexpr static auto operator ()(register_type::ax_r<64> reg) {
+            return std::array<uint8_t,1>{Opcode};
+        }
+        // r8 to r15, selected by REX.B
+        constexpr static auto operator ()(register_type::reg<64, register_type::extention::extended> reg) {
+            return std::array<uint8_t,2>{rex{0, 0, 0, 1}, static_cast<uint8_t>(Opcode + (static_cast<uint8_t>(reg.r) & 0x7))};
+        }
+
+        using support_argument_types = types::types<
+                std::tuple<register_type::reg<64>>
+            >;
+    };
+
     template<opcode_modrm_reg Opcode>
     constexpr auto gen_regmem_imm_instruction(reg_or_mem auto regmem, std::integral auto imm) {
-            imm_for_reg_t<std::remove_cvref_t<decltype(regmem)>> i = imm;
+            imm_for_t<std::remove_cvref_t<decltype(regmem)>::size()> i = imm;
             return cat(
                     prefix_for_16(regmem),
                     prefix_for_64(regmem),
@@ -439,7 +611,7 @@ namespace amd64 {
         return cat(
                 prefix_for_16(imm),
                 prefix_for_64(imm),
-                Opcode,
+                std::array<uint8_t, 1>{Opcode},
                 to_codes(imm)
                 );
     }
@@ -454,8 +626,8 @@ namespace amd64 {
             return cat(
                     prefix_for_16(target),
                     prefix_for_64(target),
-                    Opcode_regmem.opcode,
-                    modrm{}.set_reg(Opcode_regmem.modrm_reg).set_rm(target),
+                    std::array<uint8_t, 1>{Opcode_regmem.opcode},
+                    std::array<uint8_t, 1>{modrm{}.set_reg(Opcode_regmem.modrm_reg).set_rm(target)},
                     sib_for(target)
                     );
         }
@@ -468,7 +640,7 @@ namespace amd64 {
             return cat(
                     prefix_for_16(imm_t<N>{}),
                     prefix_for_64(imm_t<N>{}),
-                    std::array<uint8_t,1>{Opcode}
+                    opcode_codes<Opcode>()
                     );
         }
     };
@@ -546,3 +718,133 @@ namespace amd64 {
         }
     };
 }
+
+namespace amd64 {
+    namespace register_type {
+        // cl as the count operand of shifts and rotates
+        struct cl_r {
+            static constexpr auto size() { return 8; }
+        };
+    }
+    constexpr auto cl = register_type::cl_r{};
+
+    template<opcode_modrm_reg Opcode_regmem, opcode_modrm_reg Opcode_regmem_for_8 = {Opcode_regmem.opcode^1, Opcode_regmem.modrm_reg}>
+    constexpr auto gen_regmem_instruction_sized(reg_or_mem auto regmem) {
+        if constexpr (regmem.size() == 8) {
+            return gen_regmem_instruction<Opcode_regmem_for_8>(regmem);
+        }
+        else {
+            return gen_regmem_instruction<Opcode_regmem>(regmem);
+        }
+    }
+
+    // C0/C1 /n ib, D0/D1 /n, D2/D3 /n
+    template<bit3 Modrm_reg>
+    struct shift_instruction {
+        template<typename T>
+            requires reg_or_mem<T>
+        constexpr static auto operator ()(T regmem) {
+            return gen_regmem_instruction_sized<{0xd1, Modrm_reg}>(regmem);
+        }
+        template<typename T>
+            requires reg_or_mem<T>
+        constexpr static auto operator ()(T regmem, register_type::cl_r) {
+            return gen_regmem_instruction_sized<{0xd3, Modrm_reg}>(regmem);
+        }
+        template<typename T>
+            requires reg_or_mem<T>
+        constexpr static auto operator ()(T regmem, uint8_t imm) {
+            return cat(
+                    gen_regmem_instruction_sized<{0xc1, Modrm_reg}>(regmem),
+                    to_codes(imm)
+                    );
+        }
+
+        using support_argument_types = types::types<
+                std::tuple<register_type::reg<8>>,
+                std::tuple<register_type::reg<16>>,
+                std::tuple<register_type::reg<32>>,
+                std::tuple<register_type::reg<64>>,
+                std::tuple<register_type::reg<8>, register_type::cl_r>,
+                std::tuple<register_type::reg<16>, register_type::cl_r>,
+                std::tuple<register_type::reg<32>, register_type::cl_r>,
+                std::tuple<register_type::reg<64>, register_type::cl_r>,
+                std::tuple<register_type::reg<8>, uint8_t>,
+                std::tuple<register_type::reg<16>, uint8_t>,
+                std::tuple<register_type::reg<32>, uint8_t>,
+                std::tuple<register_type::reg<64>, uint8_t>
+            >;
+    };
+
+    // 0F AF /r, 6B /r ib, 69 /r iw/id
+    struct imul_reg_instruction {
+        constexpr static auto operator ()(gpr auto reg, reg_or_mem auto regmem) {
+            static_assert(reg.size() != 8 && reg.size() == regmem.size());
+            return cat(
+                    prefix_for_16(reg),
+                    prefix_for_64(reg),
+                    std::array<uint8_t, 2>{0x0f, 0xaf},
+                    std::array<uint8_t, 1>{modrm{}.set_reg(reg).set_rm(regmem)},
+                    sib_for(regmem)
+                    );
+        }
+        template<typename Int>
+            requires (std::integral<Int> && sizeof(Int) == 1)
+        constexpr static auto operator ()(gpr auto reg, reg_or_mem auto regmem, Int imm) {
+            static_assert(reg.size() != 8 && reg.size() == regmem.size());
+            return cat(
+                    prefix_for_16(reg),
+                    prefix_for_64(reg),
+                    std::array<uint8_t, 1>{0x6b},
+                    std::array<uint8_t, 1>{modrm{}.set_reg(reg).set_rm(regmem)},
+                    sib_for(regmem),
+                    to_codes(static_cast<uint8_t>(imm))
+                    );
+        }
+        template<typename Int>
+            requires (std::integral<Int> && sizeof(Int) != 1)
+        constexpr static auto operator ()(gpr auto reg, reg_or_mem auto regmem, Int imm) {
+            static_assert(reg.size() != 8 && reg.size() == regmem.size());
+            imm_for_t<reg.size()> i = imm;
+            return cat(
+                    prefix_for_16(reg),
+                    prefix_for_64(reg),
+                    std::array<uint8_t, 1>{0x69},
+                    std::array<uint8_t, 1>{modrm{}.set_reg(reg).set_rm(regmem)},
+                    sib_for(regmem),
+                    to_codes(i)
+                    );
+        }
+    };
+}
+
+namespace amd64 {
+    // 0F 40+cc /r
+    template<bitset<4> Condition_code>
+    struct cmovcc_instruction {
+        constexpr static auto operator ()(gpr auto reg, reg_or_mem auto regmem) {
+            static_assert(reg.size() != 8 && reg.size() == regmem.size());
+            return cat(
+                    prefix_for_16(reg),
+                    prefix_for_64(reg),
+                    std::array<uint8_t, 2>{0x0f, static_cast<uint8_t>(bit4{4} + Condition_code)},
+                    std::array<uint8_t, 1>{modrm{}.set_reg(reg).set_rm(regmem)},
+                    sib_for(regmem)
+                    );
+        }
+    };
+
+    // 0F 90+cc /0
+    template<bitset<4> Condition_code>
+    struct setcc_instruction {
+        template<typename T>
+            requires (reg_or_mem<T> && T::size() == 8)
+        constexpr static auto operator ()(T regmem) {
+            return cat(
+                    std::array<uint8_t, 2>{0x0f, static_cast<uint8_t>(bit4{9} + Condition_code)},
+                    std::array<uint8_t, 1>{modrm{}.set_reg(0).set_rm(regmem)},
+                    sib_for(regmem)
+                    );
+        }
+    };
+}
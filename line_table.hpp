@@ -0,0 +1,259 @@
+#pragma once
+
+#include "amd64_assembler.hpp"
+#include "scanner.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string_view>
+#include <algorithm>
+#include <stdexcept>
+
+namespace line_table {
+    struct row {
+        size_t offset;
+        scanner::position position;
+    };
+
+    inline void append_uleb128(std::vector<uint8_t>& bytes, uint64_t value) {
+        do {
+            auto byte = static_cast<uint8_t>(value & 0x7f);
+            value >>= 7;
+            bytes.emplace_back(value != 0 ? byte | 0x80 : byte);
+        } while (value != 0);
+    }
+    inline void append_sleb128(std::vector<uint8_t>& bytes, int64_t value) {
+        while (true) {
+            auto byte = static_cast<uint8_t>(value & 0x7f);
+            value >>= 7;
+            if ((value == 0 && (byte & 0x40) == 0) || (value == -1 && (byte & 0x40) != 0)) {
+                bytes.emplace_back(byte);
+                return;
+            }
+            bytes.emplace_back(byte | 0x80);
+        }
+    }
+    inline uint64_t read_uleb128(const std::vector<uint8_t>& bytes, size_t& i) {
+        uint64_t value = 0;
+        uint32_t shift = 0;
+        uint8_t byte;
+        do {
+            byte = bytes[i++];
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        return value;
+    }
+    inline int64_t read_sleb128(const std::vector<uint8_t>& bytes, size_t& i) {
+        int64_t value = 0;
+        uint32_t shift = 0;
+        uint8_t byte;
+        do {
+            byte = bytes[i++];
+            value |= static_cast<int64_t>(byte & 0x7f) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        if (shift < 64 && (byte & 0x40)) {
+            value |= -(int64_t{1} << shift);
+        }
+        return value;
+    }
+
+    // Source positions of output bytes: a row gives the position of the
+    // bytes from its offset to the next row's. Rows are stored as LEB128
+    // deltas from the row before, usually three bytes a row, with a full
+    // row every checkpoint_interval rows to start lookups from.
+    class line_table {
+    public:
+        static constexpr size_t checkpoint_interval = 64;
+
+        // Rows come in order of offset. A row at the offset of the row
+        // before hides it, and a row at the same position is dropped.
+        void add(size_t offset, scanner::position position) {
+            if (m_size != 0 && offset < m_last.offset) {
+                throw std::runtime_error{"line table rows out of order"};
+            }
+            if (m_size != 0 && position == m_last.position) {
+                return;
+            }
+            auto previous = m_size == 0 ? row{0, {}} : m_last;
+            append_uleb128(m_encoded, offset - previous.offset);
+            append_sleb128(m_encoded, static_cast<int64_t>(position.line) - previous.position.line);
+            append_sleb128(m_encoded, static_cast<int64_t>(position.column) - previous.position.column);
+            m_last = row{offset, position};
+            if (m_size % checkpoint_interval == 0) {
+                m_checkpoints.emplace_back(m_last, m_encoded.size());
+            }
+            m_size++;
+        }
+        // bytes at and after end have no position
+        void set_end(size_t end) {
+            m_end = end;
+        }
+        auto end() const {
+            return m_end;
+        }
+        auto size() const {
+            return m_size;
+        }
+        auto encoded_size() const {
+            return m_encoded.size();
+        }
+
+        std::vector<row> rows() const {
+            auto result = std::vector<row>{};
+            result.reserve(m_size);
+            auto r = row{0, {}};
+            size_t i = 0;
+            while (i < m_encoded.size()) {
+                r = decode(r, i);
+                result.emplace_back(r);
+            }
+            return result;
+        }
+
+        // position of the byte at offset, from the last row at or before it
+        std::optional<scanner::position> lookup(size_t offset) const {
+            if (offset >= m_end) {
+                return std::nullopt;
+            }
+            auto checkpoint = std::ranges::upper_bound(m_checkpoints, offset,
+                    std::less{}, [](const auto& c) { return c.first.offset; });
+            if (checkpoint == m_checkpoints.begin()) {
+                return std::nullopt;
+            }
+            checkpoint--;
+            auto [found, i] = *checkpoint;
+            while (i < m_encoded.size()) {
+                auto next_i = i;
+                auto next = decode(found, next_i);
+                if (next.offset > offset) {
+                    break;
+                }
+                found = next;
+                i = next_i;
+            }
+            return found.position;
+        }
+    private:
+        row decode(row previous, size_t& i) const {
+            auto offset = previous.offset + read_uleb128(m_encoded, i);
+            auto line = static_cast<int64_t>(previous.position.line) + read_sleb128(m_encoded, i);
+            auto column = static_cast<int64_t>(previous.position.column) + read_sleb128(m_encoded, i);
+            return row{offset, {static_cast<uint32_t>(line), static_cast<uint32_t>(column)}};
+        }
+
+        std::vector<uint8_t> m_encoded;
+        // a full row, and the index of the encoding of the row after it
+        std::vector<std::pair<row, size_t>> m_checkpoints;
+        row m_last = {};
+        size_t m_size = 0;
+        size_t m_end = std::numeric_limits<size_t>::max();
+    };
+
+    // assemble() that also maps the bytes of every statement to its position
+    inline auto assemble(const std::vector<amd64::statement>& statements,
+            const std::vector<scanner::position>& positions) {
+        if (positions.size() != statements.size()) {
+            throw std::runtime_error{"every statement needs a position"};
+        }
+        auto codes = std::vector<uint8_t>{};
+        auto table = line_table{};
+        for (size_t i = 0; i < statements.size(); i++) {
+            table.add(codes.size(), positions[i]);
+            codes.append_range(amd64::assemble(statements[i]));
+        }
+        table.set_end(codes.size());
+        return std::pair{codes, table};
+    }
+
+    // A DWARF 4 .debug_line section for the table's rows in one file, the
+    // code starting at address: a relocation to the text section in an
+    // object file, or the code's address for JIT code. The table needs an end.
+    inline auto write_debug_line(const line_table& table, std::string_view file, uint64_t address = 0) {
+        if (table.end() == std::numeric_limits<size_t>::max()) {
+            throw std::runtime_error{"line table without an end"};
+        }
+        constexpr int8_t line_base = -5;
+        constexpr uint8_t line_range = 14;
+        constexpr uint8_t opcode_base = 13;
+        enum : uint8_t {
+            extended = 0,
+            copy = 1,
+            advance_pc = 2,
+            advance_line = 3,
+            set_column = 5,
+        };
+        enum : uint8_t {
+            end_sequence = 1,
+            set_address = 2,
+        };
+
+        auto header = std::vector<uint8_t>{
+            1, // minimum instruction length
+            1, // maximum operations per instruction
+            1, // default is_stmt
+            static_cast<uint8_t>(line_base),
+            line_range,
+            opcode_base,
+            0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1, // operands of the standard opcodes
+            0, // no include directories
+        };
+        header.append_range(file);
+        header.append_range(std::to_array<uint8_t>({0, 0, 0, 0, 0})); // directory, time, size, end of files
+
+        auto program = std::vector<uint8_t>{extended, 9, set_address};
+        program.append_range(amd64::to_codes(address));
+        // the state machine starts at line 1, column 0
+        auto state = row{0, {1, 0}};
+        auto rows = table.rows();
+        for (size_t i = 0; i < rows.size(); i++) {
+            const auto& r = rows[i];
+            if (r.offset >= table.end()) {
+                break;
+            }
+            if (i + 1 < rows.size() && rows[i + 1].offset == r.offset) {
+                continue;
+            }
+            if (r.position.column != state.position.column) {
+                program.emplace_back(set_column);
+                append_uleb128(program, r.position.column);
+            }
+            auto line_delta = static_cast<int64_t>(r.position.line) - state.position.line;
+            auto address_delta = r.offset - state.offset;
+            if (line_delta < line_base || line_delta >= line_base + line_range) {
+                program.emplace_back(advance_line);
+                append_sleb128(program, line_delta);
+                line_delta = 0;
+            }
+            auto special = (line_delta - line_base) + line_range * address_delta + opcode_base;
+            if (special <= 255) {
+                program.emplace_back(static_cast<uint8_t>(special));
+            }
+            else {
+                program.emplace_back(advance_pc);
+                append_uleb128(program, address_delta);
+                if (line_delta != 0) {
+                    program.emplace_back(advance_line);
+                    append_sleb128(program, line_delta);
+                }
+                program.emplace_back(copy);
+            }
+            state = r;
+        }
+        program.emplace_back(advance_pc);
+        append_uleb128(program, table.end() - state.offset);
+        program.append_range(std::to_array<uint8_t>({extended, 1, end_sequence}));
+
+        auto section = std::vector<uint8_t>{};
+        auto unit_length = static_cast<uint32_t>(2 + 4 + header.size() + program.size());
+        section.append_range(amd64::to_codes(unit_length));
+        section.append_range(amd64::to_codes(uint16_t{4}));
+        section.append_range(amd64::to_codes(static_cast<uint32_t>(header.size())));
+        section.append_range(header);
+        section.append_range(program);
+        return section;
+    }
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include "code_buffer.hpp"
+#include "executable_memory.hpp"
+#include "cpu_features.hpp"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <ranges>
+
+namespace microbenchmark {
+    struct options {
+        // instructions per loop iteration
+        size_t unroll = 64;
+        uint32_t iterations = 1000;
+        // runs of the loop, the fastest of which is kept
+        size_t runs = 16;
+    };
+
+    // uint64_t (uint64_t* scratch): time stamp counter ticks taken by
+    // iterations of body, timed between cpuid and rdtsc, and rdtscp and
+    // cpuid, so nothing before or after runs during the timing. Without
+    // rdtscp the end is timed between cpuid and rdtsc too. The body gets
+    // scratch in rdi and must leave rbp and rsp alone; it may use every
+    // other register, as the callee-saved ones are saved around the loop.
+    // With avx, the upper halves of the ymm registers are cleared before
+    // returning.
+    inline auto gen_timed_loop(const std::vector<uint8_t>& body, uint32_t iterations,
+            cpu_features::feature_mask features = cpu_features::host_features()) {
+        using namespace amd64;
+        using namespace amd64::register_type;
+        auto rax = reg<64>{reg64::rax};
+        auto rdx = reg<64>{reg64::rdx};
+        auto rbx = reg<64>{reg64::rbx};
+        auto rbp = reg<64>{reg64::rbp};
+        auto eax_reg = reg<32>{reg32::eax};
+
+        auto buffer = code_buffer::code_buffer{};
+        auto entry = buffer.new_label();
+        auto loop = buffer.new_label();
+        auto serialize = [&]() {
+            buffer.append(bit_xor(eax_reg, eax_reg));
+            buffer.append(cpuid());
+        };
+        auto combine_edx_eax = [&]() {
+            buffer.append(shl(rdx, 32));
+            buffer.append(bit_or(rax, rdx));
+        };
+
+        // r12 to r15
+        auto extended = std::to_array({
+            reg<64, extention::extended>{extended_reg64{4}},
+            reg<64, extention::extended>{extended_reg64{5}},
+            reg<64, extention::extended>{extended_reg64{6}},
+            reg<64, extention::extended>{extended_reg64{7}},
+        });
+
+        buffer.begin_function(entry);
+        // rbx is clobbered by cpuid, rbp counts the iterations, and the
+        // body may use r12 to r15
+        buffer.append(push(rbx));
+        buffer.append(push(rbp));
+        for (auto r : extended) {
+            buffer.append(push(r));
+        }
+        serialize();
+        buffer.append(rdtsc());
+        combine_edx_eax();
+        buffer.append(push(rax));
+        buffer.append(reg_imm_instruction<0xb0, 0xb8>{}(reg<32>{reg32::ebp}, iterations));
+
+        buffer.bind(loop);
+        buffer.append(body);
+        buffer.append(sub(rbp, uint32_t{1}));
+        buffer.jcc(0x5, loop);
+
+        if (features.has(cpu_features::feature::rdtscp)) {
+            buffer.append(rdtscp());
+        }
+        else {
+            serialize();
+            buffer.append(rdtsc());
+        }
+        combine_edx_eax();
+        buffer.append(mov(rbp, rax));
+        serialize();
+        if (features.has(cpu_features::feature::avx)) {
+            buffer.append(vzeroupper());
+        }
+        buffer.append(mov(rax, rbp));
+        buffer.append(pop(rdx));
+        buffer.append(sub(rax, rdx));
+        for (auto r : extended | std::views::reverse) {
+            buffer.append(pop(r));
+        }
+        buffer.append(pop(rbp));
+        buffer.append(pop(rbx));
+        buffer.append_branch(ret());
+        return buffer.link();
+    }
+
+    // 4 KiB for loads and stores of the body; the first quadword points to
+    // itself, so mov rdi, [rdi] is a chain of loads.
+    class scratch {
+    public:
+        scratch() : m_memory(512, 0) {
+            m_memory[0] = reinterpret_cast<uint64_t>(m_memory.data());
+        }
+        auto data() {
+            return m_memory.data();
+        }
+    private:
+        std::vector<uint64_t> m_memory;
+    };
+
+    // fewest ticks of runs of the loop around body
+    inline uint64_t time_loop(const std::vector<uint8_t>& body, uint32_t iterations, size_t runs) {
+        auto code = executable_memory::executable_memory{gen_timed_loop(body, iterations)};
+        auto function = code.get<uint64_t(uint64_t*)>();
+        auto memory = scratch{};
+        auto fastest = std::numeric_limits<uint64_t>::max();
+        for (size_t run = 0; run < runs; run++) {
+            fastest = std::min(fastest, function(memory.data()));
+        }
+        return fastest;
+    }
+
+    // Ticks per instruction of copies, repeated in turn to fill the loop
+    // body, less the ticks of the empty loop.
+    inline double measure(const std::vector<std::vector<uint8_t>>& copies, options opts = {}) {
+        auto body = std::vector<uint8_t>{};
+        for (size_t i = 0; i < opts.unroll; i++) {
+            body.append_range(copies[i % copies.size()]);
+        }
+        auto ticks = time_loop(body, opts.iterations, opts.runs);
+        auto overhead = time_loop({}, opts.iterations, opts.runs);
+        auto instructions = static_cast<double>(opts.iterations) * opts.unroll;
+        return (static_cast<double>(ticks) - static_cast<double>(std::min(ticks, overhead))) / instructions;
+    }
+
+    // The time stamp counter runs at a fixed rate, not at the core clock.
+    // A chain of adds takes a core cycle each, which gives the ratio.
+    inline double ticks_per_cycle(options opts = {}) {
+        using namespace amd64;
+        using namespace amd64::register_type;
+        auto add_eax = add(reg<32>{reg32::eax}, reg<32>{reg32::eax});
+        return measure({std::vector<uint8_t>(add_eax.begin(), add_eax.end())}, opts);
+    }
+
+    struct instruction_benchmark {
+        std::string name;
+        // reads its own result, so its copies form a dependency chain
+        std::vector<uint8_t> chained;
+        // copies without dependencies between them, enough to cover the
+        // latency at full throughput
+        std::vector<std::vector<uint8_t>> independent;
+    };
+
+    // in core cycles
+    struct result {
+        double latency;
+        double reciprocal_throughput;
+    };
+
+    inline auto measure(const instruction_benchmark& benchmark, double ticks_per_cycle, options opts = {}) {
+        return result{
+            .latency = measure({benchmark.chained}, opts) / ticks_per_cycle,
+            .reciprocal_throughput = measure(benchmark.independent, opts) / ticks_per_cycle,
+        };
+    }
+}
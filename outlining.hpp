@@ -0,0 +1,315 @@
+#pragma once
+
+#include "control_flow.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <numeric>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+
+namespace outlining {
+    struct key_hash {
+        size_t operator()(const std::vector<uint8_t>& key) const noexcept {
+            size_t h = key.size();
+            for (auto k : key) {
+                h ^= std::hash<uint8_t>{}(k) + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2);
+            }
+            return h;
+        }
+    };
+
+    struct options {
+        // bytes of a call rel32 and of a ret
+        size_t call_size = 5;
+        size_t return_size = 1;
+        // bytes every call has to save on top of its own, to pay for its
+        // cycles: 0 outlines whatever makes the code smaller, larger values
+        // outline less and only the longer or more frequent sequences
+        size_t call_penalty = 0;
+        // instructions of an outlined sequence
+        size_t min_length = 2;
+        size_t max_length = 64;
+    };
+
+    // Why an instruction cannot move into an outlined function, whatever
+    // can_outline says.
+    struct hazards {
+        // rip-relative operands and rel8/rel32 jumps and calls: the same
+        // bytes reach another target from another address, and before
+        // code_buffer::link() their displacements are all 0
+        bool position_relative = false;
+        // calls, push, pop and rsp-relative operands: an outlined body runs
+        // with rsp 8 lower, so calls in it would be misaligned
+        bool uses_stack = false;
+        // data below rsp: the return address of any outlined call would
+        // overwrite it, so nothing of the function is outlined
+        bool uses_red_zone = false;
+    };
+
+    template<typename Instruction>
+    struct outlined_instructions {
+        // the functions, with outlined sequences replaced by calls
+        std::vector<std::vector<Instruction>> functions;
+        // the shared functions called, each ending in a ret
+        std::vector<std::vector<Instruction>> outlined;
+        size_t bytes_before;
+        size_t bytes_after;
+    };
+
+    // Suffix array of a string of integers below alphabet_size, by prefix
+    // doubling with counting sorts, in O(n log n).
+    inline auto build_suffix_array(const std::vector<uint32_t>& string, uint32_t alphabet_size) {
+        auto n = static_cast<uint32_t>(string.size());
+        auto sa = std::vector<uint32_t>(n);
+        auto rank = std::vector<uint32_t>(string.begin(), string.end());
+        auto next_rank = std::vector<uint32_t>(n);
+        auto by_second = std::vector<uint32_t>(n);
+        auto counts = std::vector<uint32_t>{};
+        auto counting_sort = [&](const std::vector<uint32_t>& in, std::vector<uint32_t>& out, uint32_t values, auto key) {
+            counts.assign(values + 1, 0);
+            for (auto i : in) {
+                counts[key(i) + 1]++;
+            }
+            for (uint32_t v = 0; v < values; v++) {
+                counts[v + 1] += counts[v];
+            }
+            for (auto i : in) {
+                out[counts[key(i)]++] = i;
+            }
+        };
+
+        std::iota(by_second.begin(), by_second.end(), 0);
+        counting_sort(by_second, sa, alphabet_size, [&](uint32_t i) { return rank[i]; });
+        uint32_t values = alphabet_size;
+        for (uint32_t k = 1; n > 1; k *= 2) {
+            // the second halves are ranked by sa already, those past the end first
+            uint32_t j = 0;
+            for (auto i = n - std::min(k, n); i < n; i++) {
+                by_second[j++] = i;
+            }
+            for (auto i : sa) {
+                if (i >= k) {
+                    by_second[j++] = i - k;
+                }
+            }
+            counting_sort(by_second, sa, values, [&](uint32_t i) { return rank[i]; });
+
+            auto second = [&](uint32_t i) { return i + k < n ? rank[i + k] + 1 : 0; };
+            next_rank[sa[0]] = 0;
+            for (uint32_t i = 1; i < n; i++) {
+                auto same = rank[sa[i]] == rank[sa[i - 1]] && second(sa[i]) == second(sa[i - 1]);
+                next_rank[sa[i]] = next_rank[sa[i - 1]] + (same ? 0 : 1);
+            }
+            std::swap(rank, next_rank);
+            values = rank[sa[n - 1]] + 1;
+            if (values == n) {
+                break;
+            }
+        }
+        return sa;
+    }
+
+    // lcp[i] is the common prefix of the suffixes at sa[i - 1] and sa[i]
+    // (Kasai et al.), lcp[0] is 0
+    inline auto build_lcp_array(const std::vector<uint32_t>& string, const std::vector<uint32_t>& sa) {
+        auto n = static_cast<uint32_t>(string.size());
+        auto rank = std::vector<uint32_t>(n);
+        for (uint32_t i = 0; i < n; i++) {
+            rank[sa[i]] = i;
+        }
+        auto lcp = std::vector<uint32_t>(n, 0);
+        uint32_t h = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            if (rank[i] == 0) {
+                h = 0;
+                continue;
+            }
+            auto j = sa[rank[i] - 1];
+            while (i + h < n && j + h < n && string[i + h] == string[j + h]) {
+                h++;
+            }
+            lcp[rank[i]] = h;
+            if (h > 0) {
+                h--;
+            }
+        }
+        return lcp;
+    }
+
+    // Replace instruction sequences that repeat across the functions by calls
+    // to a shared copy. Equal sequences are found with a suffix array over
+    // the instructions' encodings: get_encoding returns the bytes of an
+    // instruction, and instructions with the same bytes are the same. A
+    // sequence does not contain labels, jumps or returns (classify returns a
+    // control_flow::control), nor instructions with hazards (get_hazards
+    // returns a hazards) or rejected by can_outline, which keeps hot code
+    // inline, as a call costs cycles on every execution. Each sequence is
+    // outlined when it saves bytes after the calls and the ret, the most
+    // saving ones first.
+    //
+    // The hazards are the caller's to report. What remains: an outlined
+    // body has no unwind or line information of its own, so debuggers and
+    // profilers stopping in it cannot walk back to the function it came from.
+    template<typename Instruction>
+    auto outline_sequences(const std::vector<std::vector<Instruction>>& functions,
+            auto classify,
+            auto get_hazards,
+            auto can_outline,
+            auto get_encoding,
+            auto gen_call,
+            auto gen_ret,
+            options opts = {}
+            ) {
+        // one string of all functions; every instruction that must stay is a
+        // symbol of its own, so no repeat reaches over it
+        auto string = std::vector<uint32_t>{};
+        auto instruction_of = std::vector<std::pair<uint32_t, uint32_t>>{};
+        auto bytes = std::vector<size_t>{0};
+        auto symbols = std::unordered_map<std::vector<uint8_t>, uint32_t, key_hash>{};
+        auto unique = std::vector<uint32_t>{};
+        for (uint32_t f = 0; f < functions.size(); f++) {
+            auto uses_red_zone = std::ranges::any_of(functions[f], [&](const Instruction& instruction) {
+                return get_hazards(instruction).uses_red_zone;
+            });
+            for (uint32_t i = 0; i < functions[f].size(); i++) {
+                const auto& instruction = functions[f][i];
+                auto encoding = std::vector<uint8_t>{};
+                encoding.append_range(get_encoding(instruction));
+                bytes.emplace_back(bytes.back() + encoding.size());
+                instruction_of.emplace_back(f, i);
+                auto h = get_hazards(instruction);
+                if (uses_red_zone || h.position_relative || h.uses_stack ||
+                        classify(instruction).kind != control_flow::control_kind::other || !can_outline(instruction)) {
+                    unique.emplace_back(static_cast<uint32_t>(string.size()));
+                    string.emplace_back(0);
+                    continue;
+                }
+                auto [it, inserted] = symbols.try_emplace(std::move(encoding), static_cast<uint32_t>(symbols.size()));
+                string.emplace_back(it->second);
+            }
+            unique.emplace_back(static_cast<uint32_t>(string.size()));
+            string.emplace_back(0);
+            bytes.emplace_back(bytes.back());
+            instruction_of.emplace_back(f, static_cast<uint32_t>(functions[f].size()));
+        }
+        auto alphabet_size = static_cast<uint32_t>(symbols.size());
+        for (auto i : unique) {
+            string[i] = alphabet_size++;
+        }
+
+        auto result = outlined_instructions<Instruction>{};
+        result.bytes_before = bytes.back();
+
+        auto n = static_cast<uint32_t>(string.size());
+        auto sa = build_suffix_array(string, alphabet_size);
+        auto lcp = build_lcp_array(string, sa);
+
+        auto sequence_bytes = [&](uint32_t start, uint32_t length) {
+            return bytes[start + length] - bytes[start];
+        };
+        auto saving = [&](size_t occurrences, size_t size) -> int64_t {
+            return static_cast<int64_t>(occurrences * size) -
+                static_cast<int64_t>(occurrences * (opts.call_size + opts.call_penalty) + size + opts.return_size);
+        };
+        // starts that do not overlap, left to right
+        auto take_disjoint = [](std::vector<uint32_t>& starts, uint32_t length, auto is_free) {
+            std::ranges::sort(starts);
+            size_t kept = 0;
+            uint32_t end = 0;
+            for (auto s : starts) {
+                if ((kept == 0 || s >= end) && is_free(s)) {
+                    starts[kept++] = s;
+                    end = s + length;
+                }
+            }
+            starts.resize(kept);
+        };
+
+        // every interval of the suffix array sharing a prefix is a repeat
+        struct candidate {
+            uint32_t length;
+            std::vector<uint32_t> starts;
+            int64_t saving;
+        };
+        auto candidates = std::vector<candidate>{};
+        auto add_candidate = [&](uint32_t length, uint32_t lb, uint32_t rb) {
+            auto starts = std::vector<uint32_t>(sa.begin() + lb, sa.begin() + rb + 1);
+            take_disjoint(starts, length, [](uint32_t) { return true; });
+            auto s = saving(starts.size(), sequence_bytes(starts.front(), length));
+            if (starts.size() > 1 && s > 0) {
+                candidates.emplace_back(length, std::move(starts), s);
+            }
+        };
+        // (lcp, left bound)
+        auto intervals = std::vector<std::pair<uint32_t, uint32_t>>{{0, 0}};
+        for (uint32_t i = 1; i <= n; i++) {
+            auto current = i < n ? lcp[i] : 0;
+            auto lb = i - 1;
+            while (current < intervals.back().first) {
+                auto [length, left] = intervals.back();
+                intervals.pop_back();
+                lb = left;
+                auto parent = std::max(current, intervals.back().first);
+                // longer repeats are only taken up to max_length, once
+                auto clamped = std::min<uint32_t>(length, opts.max_length);
+                if (clamped >= opts.min_length && parent < clamped) {
+                    add_candidate(clamped, left, i - 1);
+                }
+            }
+            if (current > intervals.back().first) {
+                intervals.emplace_back(current, lb);
+            }
+        }
+
+        std::ranges::stable_sort(candidates, std::greater{}, &candidate::saving);
+        auto used = std::vector<bool>(n, false);
+        // outlined function of the sequences starting at an instruction
+        auto call_at = std::vector<uint32_t>(n, UINT32_MAX);
+        auto lengths = std::vector<uint32_t>{};
+        for (auto& [length, starts, s] : candidates) {
+            take_disjoint(starts, length, [&](uint32_t start) {
+                return std::none_of(used.begin() + start, used.begin() + start + length, std::identity{});
+            });
+            if (starts.size() < 2 || saving(starts.size(), sequence_bytes(starts.front(), length)) <= 0) {
+                continue;
+            }
+            auto index = static_cast<uint32_t>(result.outlined.size());
+            auto [f, first] = instruction_of[starts.front()];
+            auto& body = result.outlined.emplace_back(functions[f].begin() + first, functions[f].begin() + first + length);
+            body.emplace_back(gen_ret());
+            lengths.emplace_back(length);
+            for (auto start : starts) {
+                std::fill(used.begin() + start, used.begin() + start + length, true);
+                call_at[start] = index;
+            }
+        }
+
+        result.bytes_after = 0;
+        for (const auto& body : result.outlined) {
+            for (const auto& instruction : body) {
+                result.bytes_after += std::ranges::size(get_encoding(instruction));
+            }
+        }
+        result.functions.resize(functions.size());
+        for (uint32_t position = 0; position < n;) {
+            auto [f, i] = instruction_of[position];
+            if (i == functions[f].size()) {
+                position++;
+                continue;
+            }
+            if (call_at[position] != UINT32_MAX) {
+                auto index = call_at[position];
+                result.functions[f].emplace_back(gen_call(index));
+                result.bytes_after += std::ranges::size(get_encoding(result.functions[f].back()));
+                position += lengths[index];
+                continue;
+            }
+            result.functions[f].emplace_back(functions[f][i]);
+            result.bytes_after += sequence_bytes(position, 1);
+            position++;
+        }
+        return result;
+    }
+}
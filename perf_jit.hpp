@@ -0,0 +1,214 @@
+#pragma once
+
+#include "code_buffer.hpp"
+#include "executable_memory.hpp"
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <span>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+// Names for generated code in perf: a perf map, which perf report reads
+// for symbols, and a jitdump, which perf inject turns into an ELF image per
+// function so perf annotate shows the instructions. Both are buffered.
+namespace perf_jit {
+    // nanoseconds on the clock of perf record -k mono
+    inline uint64_t timestamp() {
+        auto time = timespec{};
+        clock_gettime(CLOCK_MONOTONIC, &time);
+        return static_cast<uint64_t>(time.tv_sec) * 1'000'000'000 + static_cast<uint64_t>(time.tv_nsec);
+    }
+
+    // Written out when the buffer fills, on flush() and on destruction.
+    class buffered_file {
+    public:
+        buffered_file(const std::string& path, int flags, size_t capacity) : m_capacity{capacity} {
+            m_descriptor = open(path.c_str(), flags | O_CLOEXEC, 0644);
+            if (m_descriptor < 0) {
+                throw std::runtime_error{"can not open perf file"};
+            }
+            m_buffer.reserve(capacity);
+        }
+        buffered_file(const buffered_file&) = delete;
+        buffered_file& operator=(const buffered_file&) = delete;
+        ~buffered_file() {
+            flush();
+            close(m_descriptor);
+        }
+
+        void append(const void* data, size_t size) {
+            auto bytes = static_cast<const uint8_t*>(data);
+            m_buffer.insert(m_buffer.end(), bytes, bytes + size);
+            if (m_buffer.size() >= m_capacity) {
+                flush();
+            }
+        }
+        void append(std::string_view text) {
+            append(text.data(), text.size());
+        }
+        // a trivially copyable value, in host byte order as perf expects
+        void append_value(const auto& value) {
+            static_assert(std::is_trivially_copyable_v<std::remove_cvref_t<decltype(value)>>);
+            append(&value, sizeof(value));
+        }
+        void flush() {
+            size_t written = 0;
+            while (written < m_buffer.size()) {
+                auto n = write(m_descriptor, m_buffer.data() + written, m_buffer.size() - written);
+                if (n <= 0) {
+                    break;
+                }
+                written += static_cast<size_t>(n);
+            }
+            m_buffer.clear();
+        }
+        int descriptor() const {
+            return m_descriptor;
+        }
+    private:
+        int m_descriptor = -1;
+        size_t m_capacity;
+        std::vector<uint8_t> m_buffer;
+    };
+
+    // directory/perf-<pid>.map: "start size name" lines, in hex
+    class perf_map {
+    public:
+        explicit perf_map(const std::string& directory = "/tmp", size_t buffer_size = 1 << 16)
+            : m_file{directory + "/perf-" + std::to_string(getpid()) + ".map",
+                O_WRONLY | O_CREAT | O_APPEND, buffer_size} {}
+
+        void add(const void* address, size_t size, std::string_view name) {
+            char line[2 * 16 + 2];
+            auto end = std::to_chars(line, line + sizeof(line), reinterpret_cast<uintptr_t>(address), 16).ptr;
+            *end++ = ' ';
+            end = std::to_chars(end, line + sizeof(line), size, 16).ptr;
+            *end++ = ' ';
+            m_file.append(line, end - line);
+            m_file.append(name);
+            m_file.append("\n");
+        }
+        void flush() {
+            m_file.flush();
+        }
+    private:
+        buffered_file m_file;
+    };
+
+    // source line of the instruction at offset from the start of a function
+    struct line_entry {
+        size_t offset;
+        uint32_t line;
+        std::string_view file;
+    };
+
+    // directory/jit-<pid>.dump, for perf inject --jit after perf record -k mono
+    class jitdump {
+    public:
+        explicit jitdump(const std::string& directory = "/tmp", size_t buffer_size = 1 << 16)
+            : m_file{directory + "/jit-" + std::to_string(getpid()) + ".dump",
+                O_RDWR | O_CREAT | O_TRUNC, buffer_size} {
+            // perf record finds the dump through an executable mapping of it
+            m_marker_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            m_marker = mmap(nullptr, m_marker_size, PROT_READ | PROT_EXEC, MAP_PRIVATE, m_file.descriptor(), 0);
+            if (m_marker == MAP_FAILED) {
+                throw std::runtime_error{"can not map jitdump file"};
+            }
+            m_file.append_value(uint32_t{0x4a695444}); // magic "JiTD"
+            m_file.append_value(uint32_t{1}); // version
+            m_file.append_value(uint32_t{40}); // header size
+            m_file.append_value(uint32_t{62}); // EM_X86_64
+            m_file.append_value(uint32_t{0});
+            m_file.append_value(static_cast<uint32_t>(getpid()));
+            m_file.append_value(timestamp());
+            m_file.append_value(uint64_t{0}); // flags
+        }
+        jitdump(const jitdump&) = delete;
+        jitdump& operator=(const jitdump&) = delete;
+        ~jitdump() {
+            record_header(code_close, 0);
+            m_file.flush();
+            munmap(m_marker, m_marker_size);
+        }
+
+        // A code load record with a copy of the code, after its line
+        // numbers if there are any.
+        void add(const void* address, size_t size, std::string_view name, std::span<const line_entry> lines = {}) {
+            auto start = reinterpret_cast<uint64_t>(address);
+            if (!lines.empty()) {
+                size_t entries_size = 0;
+                for (const auto& l : lines) {
+                    entries_size += 16 + l.file.size() + 1;
+                }
+                record_header(code_debug_info, 16 + entries_size);
+                m_file.append_value(start);
+                m_file.append_value(static_cast<uint64_t>(lines.size()));
+                for (const auto& l : lines) {
+                    m_file.append_value(start + l.offset);
+                    m_file.append_value(l.line);
+                    m_file.append_value(uint32_t{0}); // discriminator
+                    m_file.append(l.file);
+                    m_file.append("", 1);
+                }
+            }
+            record_header(code_load, 40 + name.size() + 1 + size);
+            m_file.append_value(static_cast<uint32_t>(getpid()));
+            m_file.append_value(static_cast<uint32_t>(syscall(SYS_gettid)));
+            m_file.append_value(start); // vma
+            m_file.append_value(start);
+            m_file.append_value(static_cast<uint64_t>(size));
+            m_file.append_value(m_code_index++);
+            m_file.append(name);
+            m_file.append("", 1);
+            m_file.append(address, size);
+        }
+        void flush() {
+            m_file.flush();
+        }
+    private:
+        enum record_id : uint32_t {
+            code_load = 0,
+            code_debug_info = 2,
+            code_close = 3,
+        };
+        void record_header(record_id id, size_t body_size) {
+            m_file.append_value(static_cast<uint32_t>(id));
+            m_file.append_value(static_cast<uint32_t>(16 + body_size));
+            m_file.append_value(timestamp());
+        }
+
+        buffered_file m_file;
+        void* m_marker = nullptr;
+        size_t m_marker_size = 0;
+        uint64_t m_code_index = 0;
+    };
+
+    // Every function begun in buffer, now in memory, to a perf_map or
+    // jitdump; names are in the order of buffer.functions(). A function
+    // runs to the start of the next one.
+    inline void add_functions(auto& writer,
+            const executable_memory::executable_memory& memory,
+            const code_buffer::code_buffer& buffer,
+            const std::vector<std::string>& names) {
+        const auto& functions = buffer.functions();
+        if (names.size() != functions.size()) {
+            throw std::runtime_error{"every function needs a name"};
+        }
+        for (size_t i = 0; i < functions.size(); i++) {
+            auto start = buffer.offset(functions[i]);
+            auto end = i + 1 < functions.size() ? buffer.offset(functions[i + 1]) : memory.size();
+            writer.add(memory.data() + start, end - start, names[i]);
+        }
+    }
+}
@@ -0,0 +1,996 @@
+#pragma once
+
+#include "amd64_assembler.hpp"
+#include "scheduling.hpp"
+
+#include <vector>
+#include <array>
+#include <span>
+#include <cstdint>
+#include <string_view>
+#include <algorithm>
+#include <stdexcept>
+#include <tuple>
+#include <bit>
+
+namespace performance_model {
+    enum class instruction_class : uint8_t {
+        nop,
+        // xor or sub of a register with itself, handled at rename
+        zero_idiom,
+        // register to register, eliminated at rename; loads and stores only
+        // use the load and store ports
+        move,
+        move_immediate,
+        alu,
+        // adc, sbb
+        alu_carry,
+        shift,
+        lea,
+        imul,
+        // mul and imul with the result in rdx:rax
+        mul_wide,
+        div32,
+        div64,
+        // popcnt, lzcnt, tzcnt, bsf, bsr
+        bit_count,
+        // andn, blsi, blsmsk, blsr, bzhi, rorx, sarx, shlx, shrx
+        bmi,
+        bextr,
+        pdep_pext,
+        mulx,
+        cmov,
+        setcc,
+        branch,
+        call,
+        ret,
+        push,
+        pop,
+        // rep movs and rep stos
+        string,
+        // cpuid, xgetbv, clzero, rdtsc and rdtscp
+        serializing,
+        vec_move,
+        vec_alu,
+        vec_shuffle,
+        // shuffles crossing 128 bit lanes
+        vec_lane_shuffle,
+        vec_imul,
+        vec_imul32,
+        vec_fp_add,
+        vec_fp_mul,
+        vec_fma,
+        vec_div,
+        vec_sqrt,
+        vec_blendv,
+        // movmsk
+        vec_to_gpr,
+        vec_test,
+        vec_broadcast,
+        gather,
+        vzeroupper,
+        count,
+    };
+    constexpr auto class_count = static_cast<size_t>(instruction_class::count);
+
+    // Registers and flags as bits: general purpose register i is bit i,
+    // vector register i is bit 16 + i, and the flags are bit 32.
+    using resources = uint64_t;
+    constexpr resources gpr_bit(unsigned i) {
+        return resources{1} << i;
+    }
+    constexpr resources vec_bit(unsigned i) {
+        return resources{1} << (16 + i);
+    }
+    constexpr resources flags = resources{1} << 32;
+
+    struct decoded_instruction {
+        size_t offset;
+        size_t length;
+        instruction_class kind;
+        resources reads;
+        resources writes;
+        bool loads;
+        bool stores;
+    };
+
+    enum access : uint8_t {
+        no_access = 0,
+        read = 1,
+        write = 2,
+        read_write = 3,
+    };
+
+    // How an opcode uses its ModRM, VEX.vvvv and implicit operands.
+    struct operand_form {
+        instruction_class kind;
+        bool has_modrm = false;
+        access reg = no_access;
+        access rm = no_access;
+        access vvvv = no_access;
+        // bytes of immediate, or of displacement for branches
+        uint8_t imm = 0;
+        bool vector_reg = false;
+        bool vector_rm = false;
+        bool vector_vvvv = false;
+        // lea and nop compute an address without reading memory
+        bool address_only = false;
+        // the index of the memory operand is a vector register
+        bool vsib = false;
+        // the last immediate byte names a vector register, as for vblendvps
+        bool is4 = false;
+        resources implicit_reads = 0;
+        resources implicit_writes = 0;
+        bool loads = false;
+        bool stores = false;
+    };
+
+    struct encoding {
+        // 0 = one byte opcodes, 1 = 0F, 2 = 0F 38, 3 = 0F 3A
+        unsigned map;
+        bool vex;
+        // 0 = none, 1 = 66, 2 = F3, 3 = F2
+        unsigned pp;
+        bool w;
+        bool l;
+        bool rep;
+        bool operand_16;
+        uint8_t opcode;
+    };
+
+    inline auto unknown_instruction() {
+        return std::runtime_error{"unknown instruction"};
+    }
+
+    inline operand_form legacy_form(const encoding& e, unsigned modrm_reg) {
+        auto op = e.opcode;
+        uint8_t imm_z = e.operand_16 ? 2 : 4;
+        if (op < 0x40 && (op & 7) < 6) {
+            // add, or, adc, sbb, and, sub, xor, cmp
+            auto group = op >> 3;
+            auto dst = group == 7 ? read : read_write;
+            auto form = operand_form{
+                .kind = group == 2 || group == 3 ? instruction_class::alu_carry : instruction_class::alu,
+                .implicit_reads = group == 2 || group == 3 ? flags : 0,
+                .implicit_writes = flags,
+            };
+            switch (op & 7) {
+            case 0: case 1:
+                form.has_modrm = true;
+                form.reg = read;
+                form.rm = dst;
+                break;
+            case 2: case 3:
+                form.has_modrm = true;
+                form.reg = dst;
+                form.rm = read;
+                break;
+            default:
+                form.imm = (op & 7) == 4 ? 1 : imm_z;
+                form.implicit_reads |= gpr_bit(0);
+                form.implicit_writes |= dst & write ? gpr_bit(0) : 0;
+                break;
+            }
+            return form;
+        }
+        if (op >= 0x70 && op <= 0x7f) {
+            return {.kind = instruction_class::branch, .imm = 1, .implicit_reads = flags};
+        }
+        // the register is in the opcode, decode() adds it
+        if (op >= 0x50 && op <= 0x5f) {
+            auto push = op < 0x58;
+            return {.kind = push ? instruction_class::push : instruction_class::pop,
+                .implicit_reads = gpr_bit(4), .implicit_writes = gpr_bit(4), .loads = !push, .stores = push};
+        }
+        if (op >= 0xb0 && op <= 0xbf) {
+            return {.kind = instruction_class::move_immediate, .imm = static_cast<uint8_t>(op < 0xb8 ? 1 : e.w ? 8 : imm_z)};
+        }
+        switch (op) {
+        case 0x69: case 0x6b:
+            return {.kind = instruction_class::imul, .has_modrm = true, .reg = write, .rm = read,
+                .imm = static_cast<uint8_t>(op == 0x6b ? 1 : imm_z), .implicit_writes = flags};
+        case 0x80: case 0x81: case 0x83:
+            return {
+                .kind = modrm_reg == 2 || modrm_reg == 3 ? instruction_class::alu_carry : instruction_class::alu,
+                .has_modrm = true,
+                .rm = modrm_reg == 7 ? read : read_write,
+                .imm = static_cast<uint8_t>(op == 0x81 ? imm_z : 1),
+                .implicit_reads = modrm_reg == 2 || modrm_reg == 3 ? flags : 0,
+                .implicit_writes = flags};
+        case 0x84: case 0x85:
+            return {.kind = instruction_class::alu, .has_modrm = true, .reg = read, .rm = read, .implicit_writes = flags};
+        case 0x88: case 0x89:
+            return {.kind = instruction_class::move, .has_modrm = true, .reg = read, .rm = write};
+        case 0x8a: case 0x8b:
+            return {.kind = instruction_class::move, .has_modrm = true, .reg = write, .rm = read};
+        case 0x8d:
+            return {.kind = instruction_class::lea, .has_modrm = true, .reg = write, .address_only = true};
+        case 0x90:
+            return {.kind = instruction_class::nop};
+        case 0x98:
+            return {.kind = instruction_class::alu, .implicit_reads = gpr_bit(0), .implicit_writes = gpr_bit(0)};
+        case 0x99:
+            return {.kind = instruction_class::alu, .implicit_reads = gpr_bit(0), .implicit_writes = gpr_bit(2)};
+        // mov between al/eax/rax and a 64 bit absolute address
+        case 0xa0: case 0xa1:
+            return {.kind = instruction_class::move, .imm = 8, .implicit_writes = gpr_bit(0), .loads = true};
+        case 0xa2: case 0xa3:
+            return {.kind = instruction_class::move, .imm = 8, .implicit_reads = gpr_bit(0), .stores = true};
+        // movs and stos, with rcx as the count when repeated
+        case 0xa4: case 0xa5:
+        {
+            auto used = gpr_bit(6) | gpr_bit(7) | (e.rep ? gpr_bit(1) : 0);
+            return {.kind = e.rep ? instruction_class::string : instruction_class::move,
+                .implicit_reads = used, .implicit_writes = used, .loads = true, .stores = true};
+        }
+        case 0xaa: case 0xab:
+        {
+            auto used = gpr_bit(7) | (e.rep ? gpr_bit(1) : 0);
+            return {.kind = e.rep ? instruction_class::string : instruction_class::move,
+                .implicit_reads = used | gpr_bit(0), .implicit_writes = used, .stores = true};
+        }
+        case 0xa8: case 0xa9:
+            return {.kind = instruction_class::alu, .imm = static_cast<uint8_t>(op == 0xa8 ? 1 : imm_z),
+                .implicit_reads = gpr_bit(0), .implicit_writes = flags};
+        case 0xc0: case 0xc1: case 0xd0: case 0xd1: case 0xd2: case 0xd3:
+        {
+            // rcl and rcr rotate through the carry flag
+            auto carry = modrm_reg == 2 || modrm_reg == 3 ? flags : 0;
+            return {.kind = instruction_class::shift, .has_modrm = true, .rm = read_write,
+                .imm = static_cast<uint8_t>(op == 0xc0 || op == 0xc1 ? 1 : 0),
+                .implicit_reads = carry | (op == 0xd2 || op == 0xd3 ? gpr_bit(1) : 0), .implicit_writes = flags};
+        }
+        case 0xc3:
+            return {.kind = instruction_class::ret, .implicit_reads = gpr_bit(4), .implicit_writes = gpr_bit(4), .loads = true};
+        case 0xc6: case 0xc7:
+            return {.kind = instruction_class::move_immediate, .has_modrm = true, .rm = write,
+                .imm = static_cast<uint8_t>(op == 0xc6 ? 1 : imm_z)};
+        case 0xe8:
+            return {.kind = instruction_class::call, .imm = 4, .implicit_reads = gpr_bit(4), .implicit_writes = gpr_bit(4), .stores = true};
+        case 0xe9: case 0xeb:
+            return {.kind = instruction_class::branch, .imm = static_cast<uint8_t>(op == 0xeb ? 1 : 4)};
+        case 0xf5:
+            return {.kind = instruction_class::alu, .implicit_reads = flags, .implicit_writes = flags};
+        case 0xf8: case 0xfc:
+            return {.kind = instruction_class::alu, .implicit_writes = flags};
+        case 0xf6: case 0xf7:
+            switch (modrm_reg) {
+            case 0:
+                return {.kind = instruction_class::alu, .has_modrm = true, .rm = read,
+                    .imm = static_cast<uint8_t>(op == 0xf6 ? 1 : imm_z), .implicit_writes = flags};
+            case 2:
+                return {.kind = instruction_class::alu, .has_modrm = true, .rm = read_write};
+            case 3:
+                return {.kind = instruction_class::alu, .has_modrm = true, .rm = read_write, .implicit_writes = flags};
+            case 4: case 5:
+                return {.kind = instruction_class::mul_wide, .has_modrm = true, .rm = read,
+                    .implicit_reads = gpr_bit(0), .implicit_writes = gpr_bit(0) | (op == 0xf7 ? gpr_bit(2) : 0) | flags};
+            case 6: case 7:
+                return {.kind = e.w ? instruction_class::div64 : instruction_class::div32, .has_modrm = true, .rm = read,
+                    .implicit_reads = gpr_bit(0) | gpr_bit(2), .implicit_writes = gpr_bit(0) | gpr_bit(2) | flags};
+            default:
+                throw unknown_instruction();
+            }
+        case 0xfe: case 0xff:
+            switch (modrm_reg) {
+            case 0: case 1:
+                return {.kind = instruction_class::alu, .has_modrm = true, .rm = read_write, .implicit_writes = flags};
+            case 2:
+                return {.kind = instruction_class::call, .has_modrm = true, .rm = read,
+                    .implicit_reads = gpr_bit(4), .implicit_writes = gpr_bit(4), .stores = true};
+            case 4:
+                return {.kind = instruction_class::branch, .has_modrm = true, .rm = read};
+            case 6:
+                return {.kind = instruction_class::push, .has_modrm = true, .rm = read,
+                    .implicit_reads = gpr_bit(4), .implicit_writes = gpr_bit(4), .stores = true};
+            default:
+                throw unknown_instruction();
+            }
+        default:
+            throw unknown_instruction();
+        }
+    }
+
+    inline operand_form legacy_0f_form(const encoding& e) {
+        auto op = e.opcode;
+        if (op >= 0x40 && op <= 0x4f) {
+            return {.kind = instruction_class::cmov, .has_modrm = true, .reg = read_write, .rm = read, .implicit_reads = flags};
+        }
+        if (op >= 0x80 && op <= 0x8f) {
+            return {.kind = instruction_class::branch, .imm = 4, .implicit_reads = flags};
+        }
+        if (op >= 0x90 && op <= 0x9f) {
+            return {.kind = instruction_class::setcc, .has_modrm = true, .rm = write, .implicit_reads = flags};
+        }
+        switch (op) {
+        // xgetbv, rdtscp and clzero, told apart by decode() from the ModRM byte
+        case 0x01:
+            return {.kind = instruction_class::serializing, .has_modrm = true};
+        case 0x1f:
+            return {.kind = instruction_class::nop, .has_modrm = true, .address_only = true};
+        case 0x31:
+            return {.kind = instruction_class::serializing, .implicit_writes = gpr_bit(0) | gpr_bit(2)};
+        case 0xa2:
+            return {.kind = instruction_class::serializing, .implicit_reads = gpr_bit(0) | gpr_bit(1),
+                .implicit_writes = gpr_bit(0) | gpr_bit(1) | gpr_bit(2) | gpr_bit(3)};
+        case 0xaf:
+            return {.kind = instruction_class::imul, .has_modrm = true, .reg = read_write, .rm = read, .implicit_writes = flags};
+        case 0xb8:
+            if (e.pp != 2) {
+                throw unknown_instruction();
+            }
+            return {.kind = instruction_class::bit_count, .has_modrm = true, .reg = write, .rm = read, .implicit_writes = flags};
+        case 0xbc: case 0xbd:
+            // bsf and bsr leave the destination unchanged for 0, tzcnt and lzcnt do not
+            return {.kind = instruction_class::bit_count, .has_modrm = true,
+                .reg = e.pp == 2 ? write : read_write, .rm = read, .implicit_writes = flags};
+        default:
+            throw unknown_instruction();
+        }
+    }
+
+    inline operand_form vex_form(const encoding& e, unsigned modrm_reg) {
+        auto op = e.opcode;
+        auto vector = [](instruction_class kind, access reg, access vvvv, access rm, uint8_t imm = 0) {
+            return operand_form{.kind = kind, .has_modrm = true, .reg = reg, .rm = rm, .vvvv = vvvv, .imm = imm,
+                .vector_reg = true, .vector_rm = true, .vector_vvvv = true};
+        };
+        auto rvm = [&vector](instruction_class kind, uint8_t imm = 0) {
+            return vector(kind, write, read, read, imm);
+        };
+        auto rm = [&vector](instruction_class kind, uint8_t imm = 0) {
+            return vector(kind, write, no_access, read, imm);
+        };
+        auto gpr_form = [](instruction_class kind, access reg, access vvvv, access rm, resources implicit_writes = 0) {
+            return operand_form{.kind = kind, .has_modrm = true, .reg = reg, .rm = rm, .vvvv = vvvv,
+                .implicit_writes = implicit_writes};
+        };
+        if (e.map == 1) {
+            switch (op) {
+            case 0x10: case 0x28: case 0x6f:
+                return rm(instruction_class::vec_move);
+            case 0x11: case 0x29: case 0x7f:
+                return vector(instruction_class::vec_move, read, no_access, write);
+            case 0x14: case 0x15: case 0x62: case 0x6a: case 0x6c: case 0x6d:
+                return rvm(instruction_class::vec_shuffle);
+            case 0x50: case 0xd7:
+            {
+                auto form = rm(instruction_class::vec_to_gpr);
+                form.vector_reg = false;
+                return form;
+            }
+            case 0x51:
+                return rm(instruction_class::vec_sqrt);
+            case 0x54: case 0x56: case 0x57:
+            case 0x64: case 0x65: case 0x66: case 0x74: case 0x75: case 0x76:
+            case 0xd4: case 0xdb: case 0xdf: case 0xeb: case 0xef:
+            case 0xf8: case 0xf9: case 0xfa: case 0xfb: case 0xfc: case 0xfd: case 0xfe:
+                return rvm(instruction_class::vec_alu);
+            case 0x58: case 0x5c: case 0x5d: case 0x5f:
+                return rvm(instruction_class::vec_fp_add);
+            case 0xc2:
+                return rvm(instruction_class::vec_fp_add, 1);
+            case 0x59:
+                return rvm(instruction_class::vec_fp_mul);
+            case 0x5e:
+                return rvm(instruction_class::vec_div);
+            case 0x70:
+                return rm(instruction_class::vec_shuffle, 1);
+            case 0x77:
+            {
+                // vzeroall clears every register, vzeroupper only the upper halves
+                auto all = resources{0xffff} << 16;
+                return {.kind = instruction_class::vzeroupper, .implicit_writes = e.l ? all : 0};
+            }
+            case 0xc6:
+                return rvm(instruction_class::vec_shuffle, 1);
+            case 0xd5: case 0xf4:
+                return rvm(instruction_class::vec_imul);
+            default:
+                throw unknown_instruction();
+            }
+        }
+        if (e.map == 2) {
+            switch (op) {
+            case 0x00:
+                return rvm(instruction_class::vec_shuffle);
+            case 0x16: case 0x36:
+                return rvm(instruction_class::vec_lane_shuffle);
+            case 0x17:
+            {
+                auto form = vector(instruction_class::vec_test, read, no_access, read);
+                form.implicit_writes = flags;
+                return form;
+            }
+            case 0x18: case 0x58: case 0x59:
+                return rm(instruction_class::vec_broadcast);
+            case 0x29: case 0x37:
+                return rvm(instruction_class::vec_alu);
+            case 0x40:
+                return rvm(instruction_class::vec_imul32);
+            // the destination is merged under the mask, and the mask cleared
+            case 0x90: case 0x91: case 0x92: case 0x93:
+            {
+                auto form = vector(instruction_class::gather, read_write, read_write, read);
+                form.vsib = true;
+                return form;
+            }
+            case 0x98: case 0xa8: case 0xb8: case 0xba: case 0xbc:
+                return vector(instruction_class::vec_fma, read_write, read, read);
+            case 0xf2:
+                return gpr_form(instruction_class::bmi, write, read, read, flags);
+            case 0xf3:
+                if (modrm_reg < 1 || modrm_reg > 3) {
+                    throw unknown_instruction();
+                }
+                return gpr_form(instruction_class::bmi, no_access, write, read, flags);
+            case 0xf5:
+                if (e.pp == 0) {
+                    return gpr_form(instruction_class::bmi, write, read, read, flags);
+                }
+                return gpr_form(instruction_class::pdep_pext, write, read, read);
+            case 0xf6:
+            {
+                auto form = gpr_form(instruction_class::mulx, write, write, read);
+                form.implicit_reads = gpr_bit(2);
+                return form;
+            }
+            case 0xf7:
+                if (e.pp == 0) {
+                    return gpr_form(instruction_class::bextr, write, read, read, flags);
+                }
+                return gpr_form(instruction_class::bmi, write, read, read);
+            default:
+                throw unknown_instruction();
+            }
+        }
+        switch (op) {
+        case 0x00: case 0x01:
+            return rm(instruction_class::vec_lane_shuffle, 1);
+        case 0x02: case 0x0c: case 0x0d: case 0x0e:
+            return rvm(instruction_class::vec_alu, 1);
+        case 0x06: case 0x46:
+            return rvm(instruction_class::vec_lane_shuffle, 1);
+        case 0x4a: case 0x4b: case 0x4c:
+        {
+            auto form = rvm(instruction_class::vec_blendv, 1);
+            form.is4 = true;
+            return form;
+        }
+        case 0xf0:
+        {
+            auto form = gpr_form(instruction_class::bmi, write, no_access, read);
+            form.imm = 1;
+            return form;
+        }
+        default:
+            throw unknown_instruction();
+        }
+    }
+
+    // Decode one instruction of the forms the encoders of this assembler
+    // produce. Fails on anything else.
+    inline auto decode_instruction(std::span<const uint8_t> codes, size_t offset = 0) {
+        size_t i = offset;
+        auto next = [&codes, &i]() {
+            if (i >= codes.size()) {
+                throw std::runtime_error{"truncated instruction"};
+            }
+            return codes[i++];
+        };
+        auto e = encoding{};
+        bool rex_r = false, rex_x = false, rex_b = false;
+        unsigned vvvv = 0;
+
+        auto byte = next();
+        while (byte == 0x66 || byte == 0xf2 || byte == 0xf3) {
+            e.operand_16 |= byte == 0x66;
+            e.rep |= byte == 0xf3;
+            e.pp = byte == 0x66 ? 1 : byte == 0xf3 ? 2 : 3;
+            byte = next();
+        }
+        if (byte == 0xc4 || byte == 0xc5) {
+            e.vex = true;
+            auto b1 = next();
+            rex_r = !(b1 & 0x80);
+            auto b2 = b1;
+            if (byte == 0xc4) {
+                rex_x = !(b1 & 0x40);
+                rex_b = !(b1 & 0x20);
+                e.map = b1 & 0x1f;
+                b2 = next();
+                e.w = b2 >> 7;
+            }
+            else {
+                e.map = 1;
+            }
+            vvvv = ~b2 >> 3 & 0xf;
+            e.l = b2 >> 2 & 1;
+            e.pp = b2 & 3;
+            if (e.map < 1 || e.map > 3) {
+                throw unknown_instruction();
+            }
+            byte = next();
+        }
+        else {
+            if ((byte & 0xf0) == 0x40) {
+                rex_b = byte & 1;
+                rex_x = byte >> 1 & 1;
+                rex_r = byte >> 2 & 1;
+                e.w = byte >> 3 & 1;
+                byte = next();
+            }
+            if (byte == 0x0f) {
+                e.map = 1;
+                byte = next();
+                if (byte == 0x38 || byte == 0x3a) {
+                    throw unknown_instruction();
+                }
+            }
+        }
+        e.opcode = byte;
+
+        // the ModRM byte is read ahead for opcodes whose form depends on it
+        auto peek_reg = [&codes, &i]() -> unsigned {
+            return i < codes.size() ? codes[i] >> 3 & 7 : 0;
+        };
+        auto form = e.vex ? vex_form(e, peek_reg())
+            : e.map == 1 ? legacy_0f_form(e)
+            : legacy_form(e, peek_reg());
+        auto d = decoded_instruction{
+            .offset = offset,
+            .kind = form.kind,
+            .reads = form.implicit_reads,
+            .writes = form.implicit_writes,
+            .loads = form.loads,
+            .stores = form.stores,
+        };
+        auto add = [&d](access a, resources r) {
+            if (a & read) {
+                d.reads |= r;
+            }
+            if (a & write) {
+                d.writes |= r;
+            }
+        };
+        auto reg_of = [](bool vector, unsigned index) {
+            return vector ? vec_bit(index) : gpr_bit(index);
+        };
+
+        if (!e.vex && e.map == 0) {
+            // registers in the opcode
+            auto r = (e.opcode & 7) | (rex_b << 3);
+            if (e.opcode >= 0x50 && e.opcode <= 0x57) {
+                d.reads |= gpr_bit(r);
+            }
+            else if ((e.opcode >= 0x58 && e.opcode <= 0x5f) || (e.opcode >= 0xb0 && e.opcode <= 0xbf)) {
+                d.writes |= gpr_bit(r);
+            }
+        }
+        if (e.vex) {
+            add(form.vvvv, reg_of(form.vector_vvvv, vvvv));
+        }
+        if (form.has_modrm) {
+            auto modrm = next();
+            auto mod = modrm >> 6;
+            auto reg = (modrm >> 3 & 7) | (rex_r << 3);
+            auto rm = (modrm & 7) | (rex_b << 3);
+            add(form.reg, reg_of(form.vector_reg, reg));
+            if (!e.vex && e.map == 1 && e.opcode == 0x01) {
+                if (modrm == 0xd0) {
+                    d.reads |= gpr_bit(1);
+                    d.writes |= gpr_bit(0) | gpr_bit(2);
+                }
+                else if (modrm == 0xf9) {
+                    d.writes |= gpr_bit(0) | gpr_bit(1) | gpr_bit(2);
+                }
+                else if (modrm == 0xfc) {
+                    d.reads |= gpr_bit(0);
+                    d.stores = true;
+                }
+                else {
+                    throw unknown_instruction();
+                }
+            }
+            else if (mod == 3) {
+                add(form.rm, reg_of(form.vector_rm, rm));
+            }
+            else {
+                size_t displacement = mod == 1 ? 1 : mod == 2 ? 4 : 0;
+                if ((modrm & 7) == 4) {
+                    auto sib = next();
+                    auto index = (sib >> 3 & 7) | (rex_x << 3);
+                    auto base = (sib & 7) | (rex_b << 3);
+                    if (form.vsib) {
+                        d.reads |= vec_bit(index);
+                    }
+                    else if (index != 4) {
+                        d.reads |= gpr_bit(index);
+                    }
+                    if ((sib & 7) == 5 && mod == 0) {
+                        displacement = 4;
+                    }
+                    else {
+                        d.reads |= gpr_bit(base);
+                    }
+                }
+                else if ((modrm & 7) == 5 && mod == 0) {
+                    // rip relative
+                    displacement = 4;
+                }
+                else {
+                    d.reads |= gpr_bit(rm);
+                }
+                i += displacement;
+                if (!form.address_only) {
+                    d.loads |= (form.rm & read) != 0;
+                    d.stores |= (form.rm & write) != 0;
+                }
+            }
+        }
+        if (form.is4 && i < codes.size()) {
+            d.reads |= vec_bit(codes[i] >> 4);
+        }
+        i += form.imm;
+        if (i > codes.size()) {
+            throw std::runtime_error{"truncated instruction"};
+        }
+        d.length = i - offset;
+
+        // xor, sub or compare of a register with itself depends on nothing
+        auto zeroing = (!e.vex && e.map == 0 && (e.opcode == 0x31 || e.opcode == 0x33 || e.opcode == 0x29 || e.opcode == 0x2b))
+            || (e.vex && e.map == 1 && (e.opcode == 0x57 || e.opcode == 0xef || (e.opcode >= 0xf8 && e.opcode <= 0xfb)
+                        || (e.opcode >= 0x64 && e.opcode <= 0x66)));
+        if (zeroing && !d.loads && std::has_single_bit(d.reads & ~flags)) {
+            d.kind = instruction_class::zero_idiom;
+            d.reads = 0;
+        }
+        return d;
+    }
+
+    inline auto decode(std::span<const uint8_t> codes) {
+        auto instructions = std::vector<decoded_instruction>{};
+        size_t offset = 0;
+        while (offset < codes.size()) {
+            instructions.emplace_back(decode_instruction(codes, offset));
+            offset += instructions.back().length;
+        }
+        return instructions;
+    }
+}
+
+namespace performance_model {
+    // ports: the execution ports, as bits, any one of which can take each
+    // uop; 0 for instructions done at rename. port_cycles: cycles the
+    // ports are busy, more than uops for unpipelined units like dividers.
+    struct class_timing {
+        uint32_t latency = 1;
+        uint32_t ports = 0;
+        uint32_t uops = 1;
+        uint32_t port_cycles = 1;
+    };
+
+    struct microarchitecture {
+        std::string_view name;
+        uint32_t issue_width;
+        uint32_t port_count;
+        // a load adds its latency and a load uop; a store adds a store
+        // address and a store data uop
+        uint32_t load_latency;
+        uint32_t load_ports;
+        uint32_t store_address_ports;
+        uint32_t store_data_ports;
+        std::array<class_timing, class_count> timings;
+
+        constexpr const auto& timing(instruction_class kind) const {
+            return timings[static_cast<size_t>(kind)];
+        }
+    };
+
+    constexpr auto make_timings(auto timing_of) {
+        auto timings = std::array<class_timing, class_count>{};
+        for (size_t i = 0; i < class_count; i++) {
+            timings[i] = timing_of(static_cast<instruction_class>(i));
+        }
+        return timings;
+    }
+
+    // Numbers are rounded from published measurements of the 64 bit and
+    // 256 bit forms; they are good for comparing code sequences, not for
+    // predicting exact cycles.
+    constexpr auto skylake_timing(instruction_class kind) {
+        constexpr uint32_t p0 = 1, p1 = 2, p5 = 32, p6 = 64;
+        using enum instruction_class;
+        switch (kind) {
+        case nop: case zero_idiom: case move: case vec_move: case push: case pop: case vzeroupper:
+            return class_timing{0, 0};
+        case move_immediate: case alu:
+            return class_timing{1, p0 | p1 | p5 | p6};
+        case alu_carry: case shift: case cmov: case setcc: case branch:
+            return class_timing{1, p0 | p6};
+        case lea:
+            return class_timing{1, p1 | p5};
+        case imul:
+            return class_timing{3, p1};
+        case mul_wide:
+            return class_timing{4, p1 | p5, 2, 2};
+        case div32:
+            return class_timing{26, p0, 10, 6};
+        case div64:
+            return class_timing{42, p0, 36, 21};
+        case bit_count: case pdep_pext:
+            return class_timing{3, p1};
+        case bmi:
+            return class_timing{1, p0 | p1 | p5 | p6};
+        case bextr:
+            return class_timing{2, p0 | p1 | p5 | p6, 2, 2};
+        case mulx:
+            return class_timing{4, p1 | p5, 2, 2};
+        case call: case ret:
+            return class_timing{1, p6};
+        case string:
+            return class_timing{20, p0 | p1 | p5 | p6, 20, 20};
+        case serializing:
+            return class_timing{100, p0 | p1 | p5 | p6, 100, 100};
+        case vec_alu:
+            return class_timing{1, p0 | p1 | p5};
+        case vec_shuffle:
+            return class_timing{1, p5};
+        case vec_lane_shuffle: case vec_broadcast:
+            return class_timing{3, p5};
+        case vec_imul:
+            return class_timing{5, p0 | p1};
+        case vec_imul32:
+            return class_timing{10, p0 | p1, 2, 2};
+        case vec_fp_add: case vec_fp_mul: case vec_fma:
+            return class_timing{4, p0 | p1};
+        case vec_div:
+            return class_timing{11, p0, 1, 5};
+        case vec_sqrt:
+            return class_timing{12, p0, 1, 6};
+        case vec_blendv:
+            return class_timing{2, p0 | p1 | p5, 2, 2};
+        case vec_to_gpr:
+            return class_timing{2, p0};
+        case vec_test:
+            return class_timing{3, p0 | p5, 2, 2};
+        case gather:
+            return class_timing{22, p0 | p1 | p5, 4, 4};
+        default:
+            return class_timing{};
+        }
+    }
+
+    constexpr auto skylake = microarchitecture{
+        .name = "skylake",
+        .issue_width = 4,
+        .port_count = 8,
+        .load_latency = 5,
+        .load_ports = 0b0000'1100,
+        .store_address_ports = 0b1000'1100,
+        .store_data_ports = 0b0001'0000,
+        .timings = make_timings(skylake_timing),
+    };
+
+    // ports 0 to 3 are the integer ALUs, 4 to 6 the address units, 7 and 8
+    // store data, 9 to 12 the floating point and vector pipes
+    constexpr auto zen3_timing(instruction_class kind) {
+        constexpr uint32_t alus = 0xf, alu0 = 1, alu1 = 2, alu2 = 4, alu3 = 8;
+        constexpr uint32_t fp0 = 1 << 9, fp1 = 1 << 10, fp2 = 1 << 11, fp3 = 1 << 12;
+        using enum instruction_class;
+        switch (kind) {
+        case nop: case zero_idiom: case move: case vec_move: case push: case pop: case vzeroupper:
+            return class_timing{0, 0};
+        case move_immediate: case alu_carry: case lea: case cmov: case setcc:
+        case bit_count: case bmi: case bextr:
+        case alu:
+            return class_timing{1, alus};
+        case shift:
+            return class_timing{1, alu1 | alu2};
+        case branch: case call: case ret:
+            return class_timing{1, alu0 | alu3};
+        case imul: case pdep_pext:
+            return class_timing{3, alu1};
+        case mul_wide:
+            return class_timing{3, alu1, 2, 2};
+        case div32:
+            return class_timing{12, alu2, 2, 9};
+        case div64:
+            return class_timing{17, alu2, 2, 14};
+        case mulx:
+            return class_timing{4, alu1, 2, 2};
+        case string:
+            return class_timing{20, alus, 20, 20};
+        case serializing:
+            return class_timing{100, alus, 100, 100};
+        case vec_alu:
+            return class_timing{1, fp0 | fp1 | fp2 | fp3};
+        case vec_shuffle: case vec_broadcast:
+            return class_timing{1, fp1 | fp2};
+        case vec_lane_shuffle:
+            return class_timing{3, fp1 | fp2};
+        case vec_imul:
+            return class_timing{3, fp0 | fp3};
+        case vec_imul32:
+            return class_timing{4, fp0 | fp3};
+        case vec_fp_add:
+            return class_timing{3, fp2 | fp3};
+        case vec_fp_mul:
+            return class_timing{3, fp0 | fp1};
+        case vec_fma:
+            return class_timing{4, fp0 | fp1};
+        case vec_div:
+            return class_timing{11, fp1, 1, 5};
+        case vec_sqrt:
+            return class_timing{14, fp1, 1, 7};
+        case vec_blendv:
+            return class_timing{1, fp0 | fp1};
+        case vec_to_gpr:
+            return class_timing{3, fp2};
+        case vec_test:
+            return class_timing{2, fp0 | fp3, 2, 2};
+        case gather:
+            return class_timing{25, fp0 | fp1 | fp2 | fp3, 8, 8};
+        default:
+            return class_timing{};
+        }
+    }
+
+    constexpr auto zen3 = microarchitecture{
+        .name = "zen3",
+        .issue_width = 6,
+        .port_count = 13,
+        .load_latency = 4,
+        .load_ports = 0b111'0000,
+        .store_address_ports = 0b110'0000,
+        .store_data_ports = 0b1'1000'0000,
+        .timings = make_timings(zen3_timing),
+    };
+
+    // For scheduling::schedule_instructions, with loads counted in the latency.
+    constexpr auto scheduling_timing(const microarchitecture& model, instruction_class kind, bool loads = false) {
+        const auto& t = model.timing(kind);
+        return scheduling::timing{t.latency + (loads ? model.load_latency : 0), t.ports};
+    }
+}
+
+namespace performance_model {
+    struct analysis {
+        size_t instructions;
+        uint64_t uops;
+        // the larger of the throughput and dependency bounds
+        double cycles_per_iteration;
+        // cycles to issue the uops, or for the busiest port to execute its share
+        double throughput_bound;
+        // cycles per iteration of the longest dependency carried from one
+        // iteration to the next
+        double dependency_bound;
+        // longest dependency chain of one iteration
+        uint64_t critical_path;
+        // busy cycles of every port per iteration
+        std::vector<double> port_pressure;
+    };
+
+    // Add amount busy cycles to the least busy of ports, leveling them.
+    inline void distribute(std::vector<double>& pressure, uint32_t ports, double amount) {
+        auto candidates = std::vector<size_t>{};
+        for (size_t p = 0; p < pressure.size(); p++) {
+            if (ports >> p & 1) {
+                candidates.emplace_back(p);
+            }
+        }
+        std::ranges::sort(candidates, {}, [&pressure](size_t p) { return pressure[p]; });
+        // raise the k least busy together, until they reach the next one
+        double sum = 0;
+        for (size_t k = 1; k <= candidates.size(); k++) {
+            sum += pressure[candidates[k - 1]];
+            auto level = (sum + amount) / k;
+            if (k == candidates.size() || level <= pressure[candidates[k]]) {
+                for (size_t j = 0; j < k; j++) {
+                    pressure[candidates[j]] = level;
+                }
+                return;
+            }
+        }
+    }
+
+    // Estimate the cost of running the block in a loop, like llvm-mca: the
+    // ports are shared out evenly, memory is assumed not to alias, and
+    // branches are predicted.
+    inline auto analyze(const std::vector<decoded_instruction>& block, const microarchitecture& model) {
+        auto result = analysis{};
+        result.instructions = block.size();
+        result.uops = 0;
+        result.port_pressure.assign(model.port_count, 0);
+
+        // ports with the fewest choices first, so the flexible uops fill in around them
+        auto demands = std::vector<std::pair<uint32_t, double>>{};
+        for (const auto& instruction : block) {
+            const auto& t = model.timing(instruction.kind);
+            result.uops += t.uops;
+            demands.emplace_back(t.ports, t.port_cycles);
+            if (instruction.loads) {
+                demands.emplace_back(model.load_ports, 1);
+            }
+            if (instruction.stores) {
+                demands.emplace_back(model.store_address_ports, 1);
+                demands.emplace_back(model.store_data_ports, 1);
+            }
+        }
+        std::ranges::stable_sort(demands, {}, [](const auto& demand) { return std::popcount(demand.first); });
+        for (auto [ports, cycles] : demands) {
+            distribute(result.port_pressure, ports, cycles);
+        }
+        auto busiest = std::ranges::max(result.port_pressure);
+        result.throughput_bound = std::max(static_cast<double>(result.uops) / model.issue_width, busiest);
+
+        // when every register and the flags are ready, iteration after iteration
+        auto ready = std::array<uint64_t, 33>{};
+        auto run_iteration = [&ready, &block, &model]() {
+            uint64_t finish = 0;
+            for (const auto& instruction : block) {
+                uint64_t start = 0;
+                for (size_t r = 0; r < ready.size(); r++) {
+                    if (instruction.reads >> r & 1) {
+                        start = std::max(start, ready[r]);
+                    }
+                }
+                auto done = start + model.timing(instruction.kind).latency
+                    + (instruction.loads ? model.load_latency : 0);
+                for (size_t r = 0; r < ready.size(); r++) {
+                    if (instruction.writes >> r & 1) {
+                        ready[r] = done;
+                    }
+                }
+                finish = std::max(finish, done);
+            }
+            return finish;
+        };
+        result.critical_path = run_iteration();
+        // chains carried through iterations move the ready times by their
+        // length every iteration
+        constexpr auto warm_up = 4;
+        constexpr auto measured = 16;
+        for (auto iteration = 1; iteration < warm_up; iteration++) {
+            run_iteration();
+        }
+        auto before = std::ranges::max(ready);
+        for (auto iteration = 0; iteration < measured; iteration++) {
+            run_iteration();
+        }
+        auto after = std::ranges::max(ready);
+        result.dependency_bound = static_cast<double>(after - before) / measured;
+        result.cycles_per_iteration = std::max(result.throughput_bound, result.dependency_bound);
+        return result;
+    }
+
+    inline auto analyze(std::span<const uint8_t> codes, const microarchitecture& model) {
+        return analyze(decode(codes), model);
+    }
+
+    inline auto analyze(const std::vector<amd64::statement>& statements, const microarchitecture& model) {
+        return analyze(amd64::assemble(statements), model);
+    }
+
+    // Index of the alternative with the fewest cycles per iteration, then
+    // the shortest critical path, then the fewest bytes.
+    inline size_t choose_cheapest(const std::vector<std::vector<uint8_t>>& alternatives, const microarchitecture& model) {
+        if (alternatives.empty()) {
+            throw std::runtime_error{"no alternatives"};
+        }
+        auto cost = [&model](const std::vector<uint8_t>& codes) {
+            auto a = analyze(codes, model);
+            return std::tuple{a.cycles_per_iteration, a.critical_path, codes.size()};
+        };
+        size_t best = 0;
+        auto best_cost = cost(alternatives[0]);
+        for (size_t i = 1; i < alternatives.size(); i++) {
+            auto c = cost(alternatives[i]);
+            if (c < best_cost) {
+                best = i;
+                best_cost = c;
+            }
+        }
+        return best;
+    }
+}
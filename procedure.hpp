@@ -1,7 +1,15 @@
 #pragma once
 
+#include "statistics.hpp"
+#include "calling_convention.hpp"
+
 #include <vector>
 #include <cstdint>
+#include <variant>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <tuple>
 
 namespace procedure {
     template<typename Instruction>
@@ -12,67 +20,417 @@ namespace procedure {
         std::vector<Instruction> instructions;
     };
 
+    struct call_graph {
+        // unique callees of every procedure
+        std::vector<std::vector<uint32_t>> callees;
+        // procedures reachable from the root, every callee before its callers
+        std::vector<uint32_t> order;
+        // strongly connected component of every reachable procedure
+        std::vector<uint32_t> component;
+        // procedure can reach itself through calls
+        std::vector<bool> recursive;
+    };
+
+    template<typename Instruction>
+    auto build_call_graph(const std::vector<procedure<Instruction>>& procedures, uint32_t root,
+            auto get_callee,
+            auto is_call
+            ) {
+        constexpr auto unvisited = UINT32_MAX;
+        auto graph = call_graph{};
+        graph.callees.resize(procedures.size());
+        graph.component.assign(procedures.size(), unvisited);
+        graph.recursive.assign(procedures.size(), false);
+
+        // the procedure that last listed each callee, so every call is
+        // deduplicated in constant time
+        auto last_seen = std::vector<uint32_t>(procedures.size(), unvisited);
+        for (uint32_t p = 0; p < procedures.size(); p++) {
+            auto& callees = graph.callees[p];
+            for (const auto& instruction : procedures[p].instructions) {
+                if (is_call(instruction)) {
+                    uint32_t callee = get_callee(instruction);
+                    if (callee == p) {
+                        graph.recursive[p] = true;
+                    }
+                    if (last_seen[callee] != p) {
+                        last_seen[callee] = p;
+                        callees.emplace_back(callee);
+                    }
+                }
+            }
+        }
+
+        // Tarjan's algorithm with an explicit stack, so deep call chains do not
+        // overflow the native one. Components are completed callees first.
+        auto index = std::vector<uint32_t>(procedures.size(), unvisited);
+        auto low_link = std::vector<uint32_t>(procedures.size(), 0);
+        auto on_stack = std::vector<bool>(procedures.size(), false);
+        auto component_stack = std::vector<uint32_t>{};
+        auto dfs_stack = std::vector<std::pair<uint32_t, uint32_t>>{};
+        uint32_t next_index = 0;
+        uint32_t next_component = 0;
+
+        auto visit = [&](uint32_t p) {
+            index[p] = low_link[p] = next_index++;
+            component_stack.emplace_back(p);
+            on_stack[p] = true;
+            dfs_stack.emplace_back(p, 0);
+        };
+        visit(root);
+        while (!dfs_stack.empty()) {
+            auto& [p, edge] = dfs_stack.back();
+            if (edge < graph.callees[p].size()) {
+                auto callee = graph.callees[p][edge++];
+                if (index[callee] == unvisited) {
+                    visit(callee);
+                }
+                else if (on_stack[callee]) {
+                    low_link[p] = std::min(low_link[p], index[callee]);
+                }
+                continue;
+            }
+            auto finished = p;
+            dfs_stack.pop_back();
+            if (!dfs_stack.empty()) {
+                auto caller = dfs_stack.back().first;
+                low_link[caller] = std::min(low_link[caller], low_link[finished]);
+            }
+            if (low_link[finished] == index[finished]) {
+                auto first = component_stack.size();
+                do {
+                    first--;
+                } while (component_stack[first] != finished);
+                auto is_cycle = component_stack.size() - first > 1;
+                for (auto i = first; i < component_stack.size(); i++) {
+                    auto member = component_stack[i];
+                    on_stack[member] = false;
+                    graph.component[member] = next_component;
+                    graph.recursive[member] = graph.recursive[member] || is_cycle;
+                    graph.order.emplace_back(member);
+                }
+                component_stack.resize(first);
+                next_component++;
+            }
+        }
+        return graph;
+    }
+
+    // Fully inlined body of a procedure, kept in the procedure's own register
+    // numbering. Inlined callees are not copied in: a splice refers to the
+    // callee's cached expansion and the register offset it is placed at, which
+    // is only applied when the final instruction stream is emitted.
+    template<typename Instruction>
+    struct expansion {
+        struct splice {
+            uint32_t callee;
+            uint32_t register_offset;
+        };
+        std::vector<std::variant<Instruction, splice>> items;
+        uint32_t register_count = 0;
+        size_t instruction_count = 0;
+        // of instruction_count, argument and result copies
+        size_t copy_count = 0;
+    };
+
     template<typename Instruction>
-    auto inline_procedures(std::vector<procedure<Instruction>> procedures, uint32_t start_procedure_index,
+    auto expand_procedure(const std::vector<procedure<Instruction>>& procedures, uint32_t procedure_index,
+            const std::vector<expansion<Instruction>>& expansions,
+            const std::vector<bool>& inlined,
             auto get_callee,
             auto gen_copy_instructions,
             auto is_call,
             auto get_call_reads,
             auto get_call_writes,
             auto rename_registers,
-            auto next_register
+            auto next_register,
+            auto gen_call
+            ) {
+        const auto& procedure = procedures[procedure_index];
+        auto result = expansion<Instruction>{};
+
+        auto registers_end = [](const std::vector<uint32_t>& registers) {
+            return std::ranges::fold_left(registers, 0u,
+                    [](auto l, auto r) { return std::max(l, r + 1); });
+        };
+        // every callee is placed above the registers of this procedure; calls
+        // are sequential, so all of them may share that range
+        uint32_t own_register_count = std::max(registers_end(procedure.reads), registers_end(procedure.writes));
+        for (const auto& instruction : procedure.instructions) {
+            if (is_call(instruction)) {
+                own_register_count = std::max({
+                        own_register_count,
+                        registers_end(get_call_reads(instruction)),
+                        registers_end(get_call_writes(instruction))});
+            }
+            else {
+                own_register_count = std::max<uint32_t>(own_register_count, next_register(instruction));
+            }
+        }
+        result.register_count = own_register_count;
+
+        auto append_instructions = [&result](auto&& instructions) {
+            for (auto& instruction : instructions) {
+                result.items.emplace_back(std::move(instruction));
+                result.instruction_count++;
+            }
+        };
+        auto append_copies = [&result, &append_instructions](auto&& copies) {
+            auto start = result.instruction_count;
+            append_instructions(copies);
+            result.copy_count += result.instruction_count - start;
+        };
+        for (const auto& instruction : procedure.instructions) {
+            if (is_call(instruction) && !inlined[get_callee(instruction)]) {
+                append_instructions(gen_call(instruction));
+            }
+            else if (is_call(instruction)) {
+                uint32_t callee = get_callee(instruction);
+                const auto& callee_expansion = expansions[callee];
+                append_copies(gen_copy_instructions(
+                            rename_registers(procedures[callee].reads, own_register_count),
+                            get_call_reads(instruction)));
+                result.items.emplace_back(typename expansion<Instruction>::splice{callee, own_register_count});
+                result.instruction_count += callee_expansion.instruction_count;
+                result.copy_count += callee_expansion.copy_count;
+                append_copies(gen_copy_instructions(
+                            get_call_writes(instruction),
+                            rename_registers(procedures[callee].writes, own_register_count)));
+                result.register_count = std::max(result.register_count, own_register_count + callee_expansion.register_count);
+            }
+            else {
+                result.items.emplace_back(instruction);
+                result.instruction_count++;
+            }
+        }
+        return result;
+    }
+
+    template<typename Instruction>
+    auto emit_expansion(const std::vector<expansion<Instruction>>& expansions, uint32_t procedure_index,
+            auto rename_registers
             ) {
         auto instructions = std::vector<Instruction>{};
+        instructions.reserve(expansions[procedure_index].instruction_count);
 
-        auto procedure_index = start_procedure_index;
-        uint32_t instruction_index = 0;
-        uint32_t start_register = 0;
-        uint32_t next_start_register = 0;
+        // (procedure, item index, register offset)
+        auto stack = std::vector<std::tuple<uint32_t, uint32_t, uint32_t>>{{procedure_index, 0, 0}};
+        while (!stack.empty()) {
+            auto& [proc, item_index, offset] = stack.back();
+            const auto& items = expansions[proc].items;
+            if (item_index == items.size()) {
+                stack.pop_back();
+                continue;
+            }
+            const auto& item = items[item_index++];
+            if (auto instruction = std::get_if<Instruction>(&item)) {
+                instructions.emplace_back(rename_registers(*instruction, offset));
+            }
+            else {
+                auto splice = std::get<typename expansion<Instruction>::splice>(item);
+                stack.emplace_back(splice.callee, 0, offset + splice.register_offset);
+            }
+        }
+        return instructions;
+    }
 
-        std::vector<std::tuple<uint32_t, uint32_t, uint32_t, uint32_t>> call_stack{};
+    // Inline every call reachable from start_procedure_index.
+    // Procedures are expanded once, callees before callers, so the work is
+    // proportional to the size of the output rather than to the size times
+    // the call depth. Recursive call graphs cannot be fully inlined and throw.
+    template<typename Instruction, typename Recorder = statistics::disabled>
+    auto inline_procedures(const std::vector<procedure<Instruction>>& procedures, uint32_t start_procedure_index,
+            auto get_callee,
+            auto gen_copy_instructions,
+            auto is_call,
+            auto get_call_reads,
+            auto get_call_writes,
+            auto rename_registers,
+            auto next_register,
+            Recorder recorder = {}
+            ) {
+        [[maybe_unused]] auto timer = recorder.time(statistics::phase::inlining);
+        auto graph = build_call_graph(procedures, start_procedure_index, get_callee, is_call);
 
-        while (true) {
-            const auto& procedure = procedures[procedure_index];
-            if (instruction_index == procedure.instructions.size()) {
-                if (call_stack.empty()) {
-                    break;
-                }
-                else {
-                    auto callee_writes = rename_registers(procedure.writes, start_register);
-                    auto [proc, i, r, m] = call_stack.back();call_stack.pop_back();
-                    procedure_index = proc;
-                    instruction_index = i;
-                    start_register = r;
-                    next_start_register = m;
-
-                    const auto& instruction = procedures[procedure_index].instructions[instruction_index];
+        auto expansions = std::vector<expansion<Instruction>>(procedures.size());
+        auto inlined = std::vector<bool>(procedures.size(), true);
+        for (auto procedure_index : graph.order) {
+            if (graph.recursive[procedure_index]) {
+                throw std::runtime_error{"recursive call in procedure " + std::to_string(procedure_index)};
+            }
+            expansions[procedure_index] = expand_procedure(procedures, procedure_index, expansions, inlined,
+                    get_callee, gen_copy_instructions, is_call, get_call_reads, get_call_writes,
+                    rename_registers, next_register,
+                    [](const auto&) { return std::vector<Instruction>{}; });
+        }
+
+        const auto& start = expansions[start_procedure_index];
+        recorder.add(&statistics::statistics::inline_copies, start.copy_count);
+        recorder.maximum(&statistics::statistics::peak_virtual_registers, start.register_count);
+        return emit_expansion(expansions, start_procedure_index, rename_registers);
+    }
+
+    struct inline_budget {
+        // callees whose expanded body is larger are only inlined at a single call site
+        size_t max_callee_size = 64;
+        // instructions that inlining may add to the whole program
+        size_t max_growth = 4096;
+    };
+
+    template<typename Instruction>
+    struct inlined_procedures {
+        // procedures that remain out of line, the start procedure first
+        std::vector<uint32_t> procedure_indices;
+        std::vector<std::vector<Instruction>> instructions;
+        // of every procedure in procedure_indices, for system_v::prologue
+        // and system_v::epilogue once its registers are allocated
+        std::vector<amd64::system_v::call_assignment> assignments;
+        std::vector<bool> makes_calls;
+    };
+
+    // Inline calls while they fit in the budget. A callee is inlined at all of
+    // its call sites or at none: the others become real calls and the callee
+    // is emitted once, in its own register numbering. Calls inside a
+    // recursive component are never inlined, and callees whose arguments or
+    // results do not all fit in registers always are.
+    //
+    // Out of line calls follow system_v::assign_registers: the arguments
+    // are copied to the argument registers, gen_call(call, arguments,
+    // results) makes the call reading and writing those registers, and the
+    // results are copied back from the return registers. Every out of line
+    // callee but the start procedure copies its arguments in on entry, and
+    // its results out before gen_ret(). physical_register returns the
+    // register of the Instruction numbering that is precolored to a
+    // system_v::register_index, apart from every virtual register, for the
+    // precolor of register_allocation::register_allocate. Saving the
+    // callee-saved registers is left to after register allocation.
+    template<typename Instruction, typename Recorder = statistics::disabled>
+    auto inline_procedures(const std::vector<procedure<Instruction>>& procedures, uint32_t start_procedure_index,
+            inline_budget budget,
+            auto get_callee,
+            auto gen_copy_instructions,
+            auto is_call,
+            auto get_call_reads,
+            auto get_call_writes,
+            auto rename_registers,
+            auto next_register,
+            auto physical_register,
+            auto gen_call,
+            auto gen_ret,
+            Recorder recorder = {}
+            ) {
+        [[maybe_unused]] auto timer = recorder.time(statistics::phase::inlining);
+        auto graph = build_call_graph(procedures, start_procedure_index, get_callee, is_call);
+
+        // calls to every procedure, and the argument and result copies they
+        // would take inlined, which expand_procedure counts in copy_count
+        auto call_sites = std::vector<size_t>(procedures.size(), 0);
+        auto site_copies = std::vector<size_t>(procedures.size(), 0);
+        for (auto procedure_index : graph.order) {
+            for (const auto& instruction : procedures[procedure_index].instructions) {
+                if (is_call(instruction)) {
                     auto callee = get_callee(instruction);
-                    auto writes = get_call_writes(instruction);
-                    instructions.append_range(gen_copy_instructions(writes, callee_writes));
+                    call_sites[callee]++;
+                    site_copies[callee] +=
+                        gen_copy_instructions(procedures[callee].reads, get_call_reads(instruction)).size() +
+                        gen_copy_instructions(get_call_writes(instruction), procedures[callee].writes).size();
+                }
+            }
+        }
 
-                    instruction_index++;
-                    continue;
+        auto assignments = std::vector<amd64::system_v::call_assignment>(procedures.size());
+        for (auto procedure_index : graph.order) {
+            assignments[procedure_index] = amd64::system_v::assign_registers(procedures[procedure_index]);
+        }
+        auto fits_registers = [&assignments](uint32_t procedure_index) {
+            const auto& assignment = assignments[procedure_index];
+            return assignment.stack_arguments == 0 && assignment.memory_returns == 0;
+        };
+        auto physical_registers = [&physical_register](const std::vector<amd64::system_v::register_index>& registers) {
+            auto result = std::vector<uint32_t>{};
+            for (auto reg : registers) {
+                result.emplace_back(physical_register(reg));
+            }
+            return result;
+        };
+        auto lower_call = [&](const Instruction& call) {
+            const auto& assignment = assignments[get_callee(call)];
+            auto arguments = physical_registers(assignment.argument_registers);
+            auto results = physical_registers(assignment.return_registers);
+            auto instructions = std::vector<Instruction>{};
+            instructions.append_range(gen_copy_instructions(arguments, get_call_reads(call)));
+            instructions.append_range(gen_call(call, arguments, results));
+            instructions.append_range(gen_copy_instructions(get_call_writes(call), results));
+            return instructions;
+        };
+
+        auto expansions = std::vector<expansion<Instruction>>(procedures.size());
+        auto inlined = std::vector<bool>(procedures.size(), false);
+        size_t growth = 0;
+        for (auto procedure_index : graph.order) {
+            expansions[procedure_index] = expand_procedure(procedures, procedure_index, expansions, inlined,
+                    get_callee, gen_copy_instructions, is_call, get_call_reads, get_call_writes,
+                    rename_registers, next_register, lower_call);
+
+            if (procedure_index == start_procedure_index) {
+                continue;
+            }
+            if (graph.recursive[procedure_index]) {
+                if (!fits_registers(procedure_index)) {
+                    throw std::runtime_error{"arguments of recursive procedure " + std::to_string(procedure_index) + " do not fit in registers"};
                 }
+                continue;
             }
-            const auto& instruction = procedure.instructions[instruction_index];
-            if (is_call(instruction)) {
-                auto callee = get_callee(instruction);
-                auto reads = get_call_reads(instruction);
-                auto writes = get_call_writes(instruction);
-                instructions.append_range(gen_copy_instructions(rename_registers(procedures[callee].reads, next_start_register), reads));
-                call_stack.emplace_back(procedure_index, instruction_index, start_register, next_start_register);
-                procedure_index = callee;
-                instruction_index = 0;
-                start_register = next_start_register;
+            auto size = expansions[procedure_index].instruction_count;
+            auto sites = call_sites[procedure_index];
+            // every call site gets the body and its copies, and the out of
+            // line copy disappears once every call site is inlined
+            auto added = size * (sites - 1) + site_copies[procedure_index];
+            if (!fits_registers(procedure_index) ||
+                    ((sites == 1 || size <= budget.max_callee_size) && growth + added <= budget.max_growth)) {
+                inlined[procedure_index] = true;
+                growth += added;
             }
-            else {
-                auto out_instruction = rename_registers(instruction, start_register);
-                next_start_register = std::max(next_register(out_instruction),next_start_register);
-                instructions.emplace_back(out_instruction);
-                instruction_index++;
+        }
+
+        // callees first, so an inlined callee's calls are known
+        auto makes_calls = std::vector<bool>(procedures.size(), false);
+        for (auto procedure_index : graph.order) {
+            for (const auto& instruction : procedures[procedure_index].instructions) {
+                if (is_call(instruction)) {
+                    auto callee = get_callee(instruction);
+                    makes_calls[procedure_index] = makes_calls[procedure_index] || !inlined[callee] || makes_calls[callee];
+                }
             }
         }
 
-        return instructions;
+        auto result = inlined_procedures<Instruction>{};
+        result.procedure_indices.emplace_back(start_procedure_index);
+        for (auto procedure_index : graph.order) {
+            if (!inlined[procedure_index] && procedure_index != start_procedure_index) {
+                result.procedure_indices.emplace_back(procedure_index);
+            }
+        }
+        for (auto procedure_index : result.procedure_indices) {
+            const auto& emitted = expansions[procedure_index];
+            recorder.add(&statistics::statistics::inline_copies, emitted.copy_count);
+            recorder.maximum(&statistics::statistics::peak_virtual_registers, emitted.register_count);
+            const auto& assignment = assignments[procedure_index];
+            result.assignments.emplace_back(assignment);
+            result.makes_calls.emplace_back(makes_calls[procedure_index]);
+            auto body = emit_expansion(expansions, procedure_index, rename_registers);
+            if (procedure_index == start_procedure_index) {
+                result.instructions.emplace_back(std::move(body));
+                continue;
+            }
+            const auto& procedure = procedures[procedure_index];
+            auto& instructions = result.instructions.emplace_back(
+                    gen_copy_instructions(procedure.reads, physical_registers(assignment.argument_registers)));
+            instructions.append_range(body);
+            auto results = physical_registers(assignment.return_registers);
+            instructions.append_range(gen_copy_instructions(results, procedure.writes));
+            instructions.emplace_back(gen_ret());
+        }
+        return result;
     }
 }
@@ -0,0 +1,309 @@
+#pragma once
+
+#include "amd64_assembler.hpp"
+#include "procedure.hpp"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <random>
+#include <ostream>
+#include <sstream>
+#include <array>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+
+namespace program_generator {
+    // relative weights of the kinds of instructions
+    struct operand_mix {
+        uint32_t register_register = 4;
+        uint32_t register_immediate = 3;
+        // loads and stores; statements have no memory operands and skip them
+        uint32_t memory = 2;
+        uint32_t multiply = 1;
+        uint32_t divide = 1;
+    };
+
+    struct config {
+        uint64_t seed = 1;
+        // instructions of the program, over all procedures
+        size_t instructions = 1000;
+        // registers live at once: instructions read from the last ones written
+        uint32_t register_pressure = 8;
+        // levels of procedures below the entry; level d only calls level d + 1
+        uint32_t call_depth = 3;
+        // procedures on every level
+        uint32_t procedures_per_level = 4;
+        // calls and branches per instruction, adding up to less than 1
+        double call_density = 0.02;
+        double branch_density = 0.1;
+        operand_mix mix = {};
+    };
+
+    enum class kind : uint8_t {
+        register_register,
+        register_immediate,
+        load,
+        store,
+        multiply,
+        divide,
+        branch,
+        call,
+    };
+
+    // Deterministic for a config: the same seed gives the same program.
+    class generator {
+    public:
+        explicit generator(const config& cfg) : m_config{cfg}, m_random{cfg.seed} {
+            auto& mix = m_config.mix;
+            m_weights = {mix.register_register, mix.register_immediate, mix.memory, mix.multiply, mix.divide};
+            if (std::accumulate(m_weights.begin(), m_weights.end(), 0u) == 0) {
+                throw std::runtime_error{"empty operand mix"};
+            }
+            // negated, so NaN fails too
+            if (!(cfg.call_density >= 0 && cfg.branch_density >= 0 && cfg.call_density + cfg.branch_density < 1)) {
+                throw std::runtime_error{"call and branch densities must add up to less than 1"};
+            }
+        }
+
+        // the next instruction kind; calls only where allowed
+        kind next_kind(bool calls = true) {
+            if (calls && chance(m_config.call_density)) {
+                return kind::call;
+            }
+            if (chance(m_config.branch_density)) {
+                return kind::branch;
+            }
+            auto total = std::accumulate(m_weights.begin(), m_weights.end(), 0u);
+            auto pick = uniform(total);
+            for (uint32_t i = 0; i < m_weights.size(); i++) {
+                if (pick < m_weights[i]) {
+                    if (i == 2) {
+                        return uniform(2) == 0 ? kind::load : kind::store;
+                    }
+                    return i < 2 ? static_cast<kind>(i) : static_cast<kind>(i + 2);
+                }
+                pick -= m_weights[i];
+            }
+            return kind::register_register;
+        }
+        bool chance(double probability) {
+            return std::uniform_real_distribution<double>{0, 1}(m_random) < probability;
+        }
+        uint32_t uniform(uint32_t bound) {
+            return static_cast<uint32_t>(m_random() % bound);
+        }
+        // small immediates more often than large ones, as in real code
+        uint32_t immediate() {
+            return uniform(4) == 0 ? static_cast<uint32_t>(m_random()) : uniform(256);
+        }
+        const auto& settings() const {
+            return m_config;
+        }
+    private:
+        config m_config;
+        std::mt19937_64 m_random;
+        std::array<uint32_t, 5> m_weights;
+    };
+
+    // Assembly text in the word format scanner::scanner reads, one
+    // instruction a line: "add rax 1", "mov rbx [rdi]", "jnz label_3",
+    // "label_3:". Written to out as it is generated, so any size fits.
+    inline void write_text(std::ostream& out, const config& cfg) {
+        auto gen = generator{cfg};
+        static constexpr auto registers = std::to_array<const char*>({
+                "rax", "rcx", "rdx", "rbx", "rsi", "rdi", "r8", "r9",
+                "r10", "r11", "r12", "r13", "r14", "r15", "rbp"});
+        auto live = std::min<uint32_t>(std::max<uint32_t>(cfg.register_pressure, 1), registers.size());
+        auto reg = [&]() {
+            return registers[gen.uniform(live)];
+        };
+        uint32_t labels = 0;
+        for (size_t i = 0; i < cfg.instructions; i++) {
+            switch (gen.next_kind()) {
+            case kind::register_register:
+                out << (gen.uniform(2) ? "add " : "sub ") << reg() << ' ' << reg() << '\n';
+                break;
+            case kind::register_immediate:
+                out << (gen.uniform(2) ? "add " : "and ") << reg() << ' ' << gen.immediate() << '\n';
+                break;
+            case kind::load:
+                out << "mov " << reg() << " [" << reg() << "]\n";
+                break;
+            case kind::store:
+                out << "mov [" << reg() << "] " << reg() << '\n';
+                break;
+            case kind::multiply:
+                out << "imul " << reg() << ' ' << reg() << '\n';
+                break;
+            case kind::divide:
+                out << "div " << reg() << '\n';
+                break;
+            case kind::branch:
+                // forward to a label placed a few lines later, or back to an earlier one
+                if (labels != 0 && gen.uniform(2) == 0) {
+                    out << "jnz label_" << gen.uniform(labels) << '\n';
+                }
+                else {
+                    out << "label_" << labels++ << ":\n";
+                }
+                break;
+            case kind::call:
+                out << "call function_" << gen.uniform(std::max<uint32_t>(cfg.procedures_per_level, 1)) << '\n';
+                break;
+            }
+        }
+        out << "ret\n";
+    }
+
+    inline auto generate_text(const config& cfg) {
+        auto out = std::ostringstream{};
+        write_text(out, cfg);
+        return std::move(out).str();
+    }
+
+    // Statements for amd64::assemble, passed to emit one at a time.
+    // Registers are the first register_pressure of ecx, ebx, esi, edi, eax,
+    // edx; multiplies and divides by constants use neither eax nor edx,
+    // which they may clobber.
+    inline void for_each_statement(const config& cfg, auto emit) {
+        using namespace amd64;
+        using namespace amd64::register_type;
+        auto gen = generator{cfg};
+        auto& mix = cfg.mix;
+        if (mix.register_register + mix.register_immediate + mix.multiply + mix.divide == 0) {
+            throw std::runtime_error{"operand mix has no statements"};
+        }
+        static constexpr auto registers = std::to_array({
+                reg32::ecx, reg32::ebx, reg32::esi, reg32::edi, reg32::eax, reg32::edx});
+        auto live = std::min<uint32_t>(std::max<uint32_t>(cfg.register_pressure, 1), registers.size());
+        auto reg = [&](uint32_t count) {
+            return register_type::reg<32>{registers[gen.uniform(count)]};
+        };
+        for (size_t i = 0; i < cfg.instructions;) {
+            switch (gen.next_kind(false)) {
+            case kind::register_register:
+            {
+                auto dst = reg(live);
+                emit(statement{operation::add, std::tuple<register_type::reg<32>, register_type::reg<32>>(dst, reg(live))});
+                break;
+            }
+            case kind::register_immediate:
+            {
+                auto dst = reg(live);
+                emit(statement{operation::adc, std::tuple<register_type::reg<32>, uint32_t>(dst, gen.immediate())});
+                break;
+            }
+            case kind::multiply:
+            {
+                auto dst = reg(std::min<uint32_t>(live, 4));
+                emit(statement{operation::mul, std::tuple<register_type::reg<32>, uint32_t>(dst, 1 + gen.uniform(1000))});
+                break;
+            }
+            case kind::divide:
+            {
+                auto dst = reg(std::min<uint32_t>(live, 4));
+                emit(statement{operation::div, std::tuple<register_type::reg<32>, uint32_t>(dst, 1 + gen.uniform(1000))});
+                break;
+            }
+            default:
+                continue;
+            }
+            i++;
+        }
+    }
+
+    inline auto generate_statements(const config& cfg) {
+        auto statements = std::vector<amd64::statement>{};
+        statements.reserve(cfg.instructions);
+        for_each_statement(cfg, [&statements](amd64::statement s) { statements.emplace_back(std::move(s)); });
+        return statements;
+    }
+
+    // Virtual register instruction, like the ones the passes are tested with.
+    struct instruction {
+        using register_t = uint32_t;
+
+        kind op;
+        std::vector<register_t> reads;
+        std::vector<register_t> writes;
+
+        std::vector<uint32_t> read_memories;
+        std::vector<uint32_t> write_memories;
+
+        // procedure called, or instruction branched to
+        uint32_t target = 0;
+
+        auto& get_reads() const {
+            return reads;
+        }
+        auto& get_writes() const {
+            return writes;
+        }
+    };
+
+    // Procedures in levels, the entry procedure 0 on level 0 and
+    // procedures_per_level on each of the call_depth levels below, every
+    // one calling only the level below. Instructions are split evenly
+    // between procedures. Every instruction writes a new register and reads
+    // from the last register_pressure written; procedures read registers
+    // 0 and 1 and write their last register.
+    inline auto generate_procedures(const config& cfg) {
+        auto gen = generator{cfg};
+        uint32_t per_level = std::max<uint32_t>(cfg.procedures_per_level, 1);
+        uint32_t procedure_count = 1 + cfg.call_depth * per_level;
+        auto level_of = [per_level](uint32_t p) {
+            return p == 0 ? 0 : 1 + (p - 1) / per_level;
+        };
+        auto procedures = std::vector<procedure::procedure<instruction>>(procedure_count);
+        auto pressure = std::max<uint32_t>(cfg.register_pressure, 2);
+        uint32_t memories = std::max<uint32_t>(pressure / 2, 1);
+
+        for (uint32_t p = 0; p < procedure_count; p++) {
+            auto& proc = procedures[p];
+            proc.reads = {0, 1};
+            auto size = cfg.instructions / procedure_count + (p < cfg.instructions % procedure_count ? 1 : 0);
+            auto can_call = level_of(p) < cfg.call_depth;
+            uint32_t next_register = 2;
+            auto recent = [&]() {
+                return next_register - 1 - gen.uniform(std::min(next_register, pressure));
+            };
+            for (size_t i = 0; i < size; i++) {
+                auto k = gen.next_kind(can_call);
+                auto inst = instruction{.op = k};
+                switch (k) {
+                case kind::register_register: case kind::multiply: case kind::divide:
+                    inst.reads = {recent(), recent()};
+                    inst.writes = {next_register++};
+                    break;
+                case kind::register_immediate:
+                    inst.reads = {recent()};
+                    inst.writes = {next_register++};
+                    break;
+                case kind::load:
+                    inst.reads = {recent()};
+                    inst.writes = {next_register++};
+                    inst.read_memories = {gen.uniform(memories)};
+                    break;
+                case kind::store:
+                    inst.reads = {recent(), recent()};
+                    inst.write_memories = {gen.uniform(memories)};
+                    break;
+                case kind::branch:
+                    inst.reads = {recent()};
+                    inst.target = static_cast<uint32_t>(gen.uniform(static_cast<uint32_t>(size)));
+                    break;
+                case kind::call:
+                    inst.reads = {recent(), recent()};
+                    inst.writes = {next_register++};
+                    inst.target = 1 + level_of(p) * per_level + gen.uniform(per_level);
+                    break;
+                }
+                proc.instructions.emplace_back(std::move(inst));
+            }
+            proc.writes = {next_register - 1};
+        }
+        return procedures;
+    }
+}
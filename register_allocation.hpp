@@ -1,5 +1,7 @@
 #pragma once
 
+#include "statistics.hpp"
+
 #include <vector>
 #include <cstdint>
 #include <unordered_map>
@@ -7,6 +9,12 @@
 #include <iostream>
 #include <cassert>
 #include <numeric>
+#include <limits>
+#include <algorithm>
+#include <array>
+#include <optional>
+#include <stdexcept>
+#include <string>
 
 namespace register_allocation {
     using memory_t = uint32_t;
@@ -15,13 +23,21 @@ namespace register_allocation {
         return reg;
     }
 
+    // Allocate physical registers to virtual registers in order, spilling
+    // round robin. precolor returns the physical register a virtual register
+    // must be in, for calling conventions, or std::nullopt; physical
+    // registers some virtual register is precolored to are never given to
+    // the others.
     template<
         typename Out_instruction,
         typename In_instruction,
         typename Physical_register = Out_instruction::register_t,
         size_t Physical_register_count = Out_instruction::register_count,
-        typename Virtual_register = In_instruction::register_t>
-    std::vector<Out_instruction> register_allocate(std::vector<In_instruction> in_instructions, auto translate_registers, auto load_instruction, auto store_instruction) {
+        typename Virtual_register = In_instruction::register_t,
+        typename Recorder = statistics::disabled>
+    std::vector<Out_instruction> register_allocate(const std::vector<In_instruction>& in_instructions, auto translate_registers, auto load_instruction, auto store_instruction,
+            auto precolor, Recorder recorder = {}) {
+        [[maybe_unused]] auto timer = recorder.time(statistics::phase::register_allocation);
         auto out_instructions = std::vector<Out_instruction>{};
         //out_instructions.reserve(in_instructions.size());
 
@@ -31,23 +47,94 @@ namespace register_allocation {
         auto physical_to_virtual_register = 
             std::array<virtual_register_t, Physical_register_count>{};
         std::ranges::iota(physical_to_virtual_register, 0);
+
+        // indexed by virtual register, so keep virtual registers dense,
+        // see register_renumbering::renumber_registers. Registers much
+        // sparser than the operands are numbered densely here instead, in
+        // order of appearance after the first Physical_register_count.
+        constexpr auto no_physical_register = std::numeric_limits<physical_register_t>::max();
+        static_assert(Physical_register_count <= no_physical_register);
+        size_t virtual_register_count = Physical_register_count;
+        size_t operand_count = 0;
+        for (const auto& instruction : in_instructions) {
+            for (const auto& vr : instruction.get_reads()) {
+                virtual_register_count = std::max<size_t>(virtual_register_count, vr + 1);
+            }
+            for (const auto& vr : instruction.get_writes()) {
+                virtual_register_count = std::max<size_t>(virtual_register_count, vr + 1);
+            }
+            operand_count += instruction.get_reads().size() + instruction.get_writes().size();
+        }
+        auto sparse = virtual_register_count > 2 * (operand_count + Physical_register_count);
+        auto dense_indices = std::unordered_map<virtual_register_t, virtual_register_t>{};
+        auto sparse_registers = std::vector<virtual_register_t>(Physical_register_count);
+        if (sparse) {
+            std::ranges::iota(sparse_registers, 0);
+            for (auto vr : sparse_registers) {
+                dense_indices.emplace(vr, vr);
+            }
+            auto number = [&](virtual_register_t vr) {
+                if (dense_indices.try_emplace(vr, static_cast<virtual_register_t>(sparse_registers.size())).second) {
+                    sparse_registers.emplace_back(vr);
+                }
+            };
+            for (const auto& instruction : in_instructions) {
+                for (const auto& vr : instruction.get_reads()) {
+                    number(vr);
+                }
+                for (const auto& vr : instruction.get_writes()) {
+                    number(vr);
+                }
+            }
+            virtual_register_count = sparse_registers.size();
+        }
+        auto dense_index = [sparse, &dense_indices](virtual_register_t vr) {
+            return sparse ? dense_indices.find(vr)->second : vr;
+        };
+        auto memory_of = [sparse, &sparse_registers](virtual_register_t index) {
+            return virtual_register_to_memory(sparse ? sparse_registers[index] : index);
+        };
+        recorder.maximum(&statistics::statistics::peak_virtual_registers, virtual_register_count);
+
+        auto precolors = std::vector<physical_register_t>(virtual_register_count, no_physical_register);
+        auto reserved = std::array<bool, Physical_register_count>{};
+        for (size_t vr = 0; vr < virtual_register_count; vr++) {
+            auto vr_t = static_cast<virtual_register_t>(vr);
+            if (std::optional<physical_register_t> pr = precolor(sparse ? sparse_registers[vr] : vr_t)) {
+                if (*pr >= Physical_register_count) {
+                    throw std::runtime_error{"virtual register precolored to missing physical register " + std::to_string(*pr)};
+                }
+                precolors[vr] = *pr;
+                reserved[*pr] = true;
+            }
+        }
+        if (std::ranges::count(reserved, true) == Physical_register_count) {
+            throw std::runtime_error{"every physical register is precolored"};
+        }
+
         auto virtual_to_physical_register =
-            std::unordered_map<virtual_register_t, physical_register_t>{};
+            std::vector<physical_register_t>(virtual_register_count, no_physical_register);
         for (auto i : physical_to_virtual_register) {
-            virtual_to_physical_register[i] = i;
+            // a virtual register starts in its own physical register, but
+            // not in one reserved for another
+            if (!reserved[i] || precolors[i] == i) {
+                virtual_to_physical_register[i] = i;
+            }
         }
         auto physical_dirty =
             std::array<bool, Physical_register_count>{};
 
         auto insert_load_instruction =
-            [&out_instructions, &load_instruction](physical_register_t pr, memory_t mem) {
+            [&out_instructions, &load_instruction, recorder](physical_register_t pr, memory_t mem) {
+                recorder.add(&statistics::statistics::reloads, 1);
                 auto load = load_instruction(pr, mem);
                 out_instructions.emplace_back(
                         load
                         );
             };
         auto insert_store_instruction =
-            [&out_instructions, &store_instruction](memory_t mem, physical_register_t pr) {
+            [&out_instructions, &store_instruction, recorder](memory_t mem, physical_register_t pr) {
+                recorder.add(&statistics::statistics::spills, 1);
                 auto store = store_instruction(mem, pr);
                 out_instructions.emplace_back(
                         store
@@ -58,10 +145,11 @@ namespace register_allocation {
             [
             &physical_dirty,
             &physical_to_virtual_register,
-            &insert_store_instruction
+            &insert_store_instruction,
+            &memory_of
             ](physical_register_t reg) {
             if (physical_dirty[reg]) {
-                const auto& physical_register_memory = virtual_register_to_memory(physical_to_virtual_register[reg]);
+                const auto& physical_register_memory = memory_of(physical_to_virtual_register[reg]);
                 insert_store_instruction(physical_register_memory, reg);
                 physical_dirty[reg] = false;
             }
@@ -71,49 +159,59 @@ namespace register_allocation {
             &physical_to_virtual_register,
             &virtual_to_physical_register,
             &spill_physical_register,
-            &insert_load_instruction
+            &insert_load_instruction,
+            &memory_of
             ]
          (physical_register_t pr, virtual_register_t vr, bool is_read) {
             spill_physical_register(pr);
             if (is_read) {
-                const auto& vr_memory = virtual_register_to_memory(vr);
+                const auto& vr_memory = memory_of(vr);
                 insert_load_instruction(pr, vr_memory);
             }
 
             auto prev_vr = physical_to_virtual_register[pr];
-            virtual_to_physical_register.erase(prev_vr);
+            if (virtual_to_physical_register[prev_vr] == pr) {
+                virtual_to_physical_register[prev_vr] = no_physical_register;
+            }
             physical_to_virtual_register[pr] = vr;
             virtual_to_physical_register[vr] = pr;
         };
 
         auto next_physical_register =
-            [&current_physical_register]
+            [&current_physical_register, &reserved]
             () {
-                auto reg = current_physical_register;
-                current_physical_register = current_physical_register == Physical_register_count - 1 ? 0 : current_physical_register + 1;
+                uint32_t reg;
+                do {
+                    reg = current_physical_register;
+                    current_physical_register = current_physical_register == Physical_register_count - 1 ? 0 : current_physical_register + 1;
+                } while (reserved[reg]);
                 return reg;
         };
 
         auto make_virtual_register_resident =
             [&virtual_to_physical_register,
+             &precolors,
              &assign_physical_virtual_register,
              &next_physical_register
             ](virtual_register_t vr, bool is_read) {
-                if (!virtual_to_physical_register.contains(vr)) {
-                    assign_physical_virtual_register(next_physical_register(), vr, is_read);
+                if (virtual_to_physical_register[vr] == no_physical_register) {
+                    auto pr = precolors[vr] != no_physical_register ? precolors[vr] : next_physical_register();
+                    assign_physical_virtual_register(pr, vr, is_read);
                 }
         };
 
         for (const auto& instruction : in_instructions) {
             auto read_prs = std::vector<physical_register_t>();
-            for (const auto& vr : instruction.get_reads()) {
+            for (const auto& read : instruction.get_reads()) {
+                auto vr = dense_index(read);
                 make_virtual_register_resident(vr, true);
                 read_prs.emplace_back(virtual_to_physical_register[vr]);
             }
             auto write_prs = std::vector<physical_register_t>();
-            for (const auto& vr : instruction.get_writes()) {
+            for (const auto& write : instruction.get_writes()) {
+                auto vr = dense_index(write);
                 make_virtual_register_resident(vr, false);
-                assert(virtual_to_physical_register.contains(vr));
+                assert(virtual_to_physical_register[vr] != no_physical_register);
                 assert(physical_to_virtual_register[virtual_to_physical_register[vr]] == vr);
                 auto pr = virtual_to_physical_register[vr];
                 write_prs.emplace_back(pr);
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+namespace register_renumbering {
+    enum class renumbering {
+        // every original register keeps a single new register
+        dense,
+        // every write defines a new register, as in SSA form of straight-line code
+        single_definition,
+    };
+
+    template<typename Instruction, typename Register>
+    struct renumbered_instructions {
+        std::vector<Instruction> instructions;
+        // original register of every new register, indexed by the new register
+        std::vector<Register> original_registers;
+        // new register holding the final value of every original register
+        std::unordered_map<Register, Register> final_registers;
+
+        auto register_count() const {
+            return original_registers.size();
+        }
+    };
+
+    // Renumber the virtual registers of instructions to the dense range
+    // [0, register_count()), in order of first appearance, so later passes
+    // can index by register with flat arrays. translate_registers has the same
+    // signature as the one of register_allocation::register_allocate.
+    template<
+        typename Instruction,
+        typename Register = Instruction::register_t>
+    auto renumber_registers(const std::vector<Instruction>& instructions, auto translate_registers,
+            renumbering mode = renumbering::dense) {
+        auto result = renumbered_instructions<Instruction, Register>{};
+        result.instructions.reserve(instructions.size());
+
+        auto& current = result.final_registers;
+        auto new_register = [&result, &current](Register original) {
+            auto reg = static_cast<Register>(result.original_registers.size());
+            result.original_registers.emplace_back(original);
+            current[original] = reg;
+            return reg;
+        };
+
+        auto reads = std::vector<Register>{};
+        auto writes = std::vector<Register>{};
+        for (const auto& instruction : instructions) {
+            reads.clear();
+            for (const auto& reg : instruction.get_reads()) {
+                auto it = current.find(reg);
+                reads.emplace_back(it != current.end() ? it->second : new_register(reg));
+            }
+            writes.clear();
+            for (const auto& reg : instruction.get_writes()) {
+                auto it = current.find(reg);
+                if (mode == renumbering::dense && it != current.end()) {
+                    writes.emplace_back(it->second);
+                }
+                else {
+                    writes.emplace_back(new_register(reg));
+                }
+            }
+            result.instructions.emplace_back(translate_registers(instruction, writes, reads));
+        }
+        return result;
+    }
+}
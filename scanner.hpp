@@ -1,9 +1,12 @@
 #pragma once
 
+#include "statistics.hpp"
+
 #include <iostream>
 #include <optional>
 #include <vector>
 #include <cctype>
+#include <cstdint>
 #include <unordered_map>
 
 template<>
@@ -20,22 +23,46 @@ struct std::hash<std::vector<char>> {
 };
 
 namespace scanner {
+    // 1 based line and column of a character
+    struct position {
+        uint32_t line = 1;
+        uint32_t column = 1;
+
+        bool operator==(const position&) const = default;
+    };
+
     struct word_splitter {
         std::istream& in;
+        // of the next character, and of the first character of the last word
+        position current = {};
+        position word_start = {};
+
+        int get() {
+            auto ch = in.get();
+            if (ch == '\n') {
+                current.line++;
+                current.column = 1;
+            }
+            else if (ch != std::char_traits<char>::eof()) {
+                current.column++;
+            }
+            return ch;
+        }
 
         std::optional<std::vector<char>> next() {
             std::vector<char> str{};
 
             auto ch = in.peek();
             while (in) {
-                ch = in.get();
+                word_start = current;
+                ch = get();
                 if (!isspace(ch)) {
                     break;
                 }
             }
             while (in) {
                 str.emplace_back(ch);
-                ch = in.get();
+                ch = get();
                 if (isspace(ch)) {
                     break;
                 }
@@ -46,11 +73,19 @@ namespace scanner {
             return str;
         }
     };
-    struct scanner {
+    // Counts tokens and unique strings into Recorder, see statistics.hpp;
+    // the caller times the scan, as a clock read per token would dominate it.
+    template<typename Recorder = statistics::disabled>
+    struct basic_scanner {
         word_splitter splitter;
         std::vector<std::vector<char>> strings;
         std::unordered_map<std::vector<char>, size_t> string_indices;
+        [[no_unique_address]] Recorder recorder = {};
 
+        // where the token last returned by next() starts
+        auto last_position() const {
+            return splitter.word_start;
+        }
         const auto& get_string(size_t i) const {
             return strings[i];
         }
@@ -74,12 +109,15 @@ namespace scanner {
             }
             else {
                 auto word = word_opt.value();
+                recorder.add(&statistics::statistics::tokens_scanned, 1);
                 if (!contains(word)) {
                     add_string(word);
+                    recorder.add(&statistics::statistics::unique_strings, 1);
                 }
                 auto i = string_index(word);
                 return i;
             }
         }
     };
+    using scanner = basic_scanner<>;
 }
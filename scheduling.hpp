@@ -0,0 +1,407 @@
+#pragma once
+
+#include "effects.hpp"
+#include "control_flow.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <map>
+#include <queue>
+#include <functional>
+#include <algorithm>
+#include <limits>
+#include <ranges>
+
+namespace scheduling {
+    // Latency of an instruction's results, and the execution ports it can
+    // issue to as a bit mask, 0 for any port.
+    struct timing {
+        uint32_t latency = 1;
+        uint32_t ports = 0;
+    };
+
+    enum class phase {
+        // virtual registers: keep register pressure from growing
+        before_register_allocation,
+        // physical registers: only hide latency
+        after_register_allocation,
+    };
+
+    struct options {
+        phase when = phase::after_register_allocation;
+        // instructions issued per cycle
+        uint32_t issue_width = 4;
+        // live values above which, before register allocation, instructions
+        // ending live ranges are preferred over the critical path
+        size_t max_register_pressure = 12;
+    };
+
+    struct dependency {
+        uint32_t to;
+        uint32_t latency;
+    };
+
+    struct dependency_graph {
+        std::vector<std::vector<dependency>> successors;
+        std::vector<uint32_t> predecessor_counts;
+        // values, numbered per write, defined and read by every instruction;
+        // reads of values defined before the block are not listed
+        std::vector<std::vector<uint32_t>> defined_values;
+        std::vector<std::vector<uint32_t>> used_values;
+        std::vector<uint32_t> use_counts;
+    };
+
+    // Dependencies of a basic block: register, flags and named memory reads
+    // after writes with the writer's latency, and writes after reads or
+    // writes to keep their order. Instructions with side effects are
+    // ordered against every memory access and each other.
+    template<
+        typename Instruction,
+        typename Register = Instruction::register_t>
+    auto build_dependency_graph(const std::vector<Instruction>& block,
+            const std::vector<effects::effects>& block_effects,
+            const std::vector<timing>& timings) {
+        constexpr auto none = std::numeric_limits<uint32_t>::max();
+        auto graph = dependency_graph{};
+        graph.successors.resize(block.size());
+        graph.predecessor_counts.assign(block.size(), 0);
+        graph.defined_values.resize(block.size());
+        graph.used_values.resize(block.size());
+
+        auto add_edge = [&graph](uint32_t from, uint32_t to, uint32_t latency) {
+            if (from != none && from != to) {
+                graph.successors[from].emplace_back(to, latency);
+                graph.predecessor_counts[to]++;
+            }
+        };
+        // last writer and readers since, of a register, the flags or a memory
+        struct location {
+            uint32_t writer = none;
+            uint32_t value = none;
+            std::vector<uint32_t> readers;
+        };
+        auto read = [&](location& l, uint32_t i) {
+            add_edge(l.writer, i, l.writer == none ? 0 : timings[l.writer].latency);
+            l.readers.emplace_back(i);
+        };
+        auto write = [&](location& l, uint32_t i) {
+            for (auto reader : l.readers) {
+                add_edge(reader, i, 0);
+            }
+            add_edge(l.writer, i, 0);
+            l.writer = i;
+            l.readers.clear();
+        };
+
+        auto registers = std::unordered_map<Register, location>{};
+        auto flags = location{};
+        auto memories = std::unordered_map<uint32_t, location>{};
+        auto side_effect = none;
+        auto memory_accesses = std::vector<uint32_t>{};
+
+        for (uint32_t i = 0; i < block.size(); i++) {
+            const auto& e = block_effects[i];
+            for (const auto& reg : block[i].get_reads()) {
+                auto& l = registers[reg];
+                read(l, i);
+                if (l.value != none) {
+                    graph.used_values[i].emplace_back(l.value);
+                    graph.use_counts[l.value]++;
+                }
+            }
+            if (e.reads_flags) {
+                read(flags, i);
+            }
+            for (auto memory : e.read_memories) {
+                read(memories[memory], i);
+                add_edge(side_effect, i, 0);
+                memory_accesses.emplace_back(i);
+            }
+            for (const auto& reg : block[i].get_writes()) {
+                auto& l = registers[reg];
+                write(l, i);
+                l.value = static_cast<uint32_t>(graph.use_counts.size());
+                graph.defined_values[i].emplace_back(l.value);
+                graph.use_counts.emplace_back(0);
+            }
+            if (e.writes_flags) {
+                write(flags, i);
+            }
+            for (auto memory : e.write_memories) {
+                write(memories[memory], i);
+                add_edge(side_effect, i, 0);
+                memory_accesses.emplace_back(i);
+            }
+            if (e.has_side_effects) {
+                for (auto access : memory_accesses) {
+                    add_edge(access, i, 0);
+                }
+                memory_accesses.clear();
+                add_edge(side_effect, i, 0);
+                side_effect = i;
+            }
+        }
+        return graph;
+    }
+
+    // Cycle by cycle list scheduling of a basic block. Returns the order of
+    // the instructions and the cycles until the last result is ready.
+    // Instructions whose predecessors have issued wait on a heap for their
+    // operands, then on heaps by height, one per register pressure delta and
+    // set of ports, so an issue slot costs a logarithm of the block rather
+    // than a scan.
+    template<typename Instruction>
+    auto schedule_block(const std::vector<Instruction>& block,
+            const std::vector<effects::effects>& block_effects,
+            const std::vector<timing>& timings,
+            options opts) {
+        auto graph = build_dependency_graph(block, block_effects, timings);
+        auto n = static_cast<uint32_t>(block.size());
+
+        // longest latency path to the end of the block
+        auto heights = std::vector<uint64_t>(n, 0);
+        for (size_t i = n; i-- > 0;) {
+            heights[i] = timings[i].latency;
+            for (auto [to, latency] : graph.successors[i]) {
+                heights[i] = std::max(heights[i], latency + heights[to]);
+            }
+        }
+
+        auto remaining_predecessors = graph.predecessor_counts;
+        auto earliest = std::vector<uint64_t>(n, 0);
+        auto remaining_uses = graph.use_counts;
+        size_t live_values = 0;
+        auto limit_pressure = opts.when == phase::before_register_allocation;
+
+        // instructions using every value, each once, of which the unissued
+        // ones remain; an instruction ends the live ranges of the values
+        // only it still uses
+        auto users = std::vector<std::vector<uint32_t>>(graph.use_counts.size());
+        for (uint32_t i = 0; i < n; i++) {
+            for (auto value : graph.used_values[i]) {
+                if (users[value].empty() || users[value].back() != i) {
+                    users[value].emplace_back(i);
+                }
+            }
+        }
+        auto remaining_users = std::vector<uint32_t>(users.size());
+        auto last_uses = std::vector<uint32_t>(n, 0);
+        for (size_t value = 0; value < users.size(); value++) {
+            remaining_users[value] = static_cast<uint32_t>(users[value].size());
+            if (remaining_users[value] == 1) {
+                last_uses[users[value][0]]++;
+            }
+        }
+        // values this instruction defines, minus values whose last use it is
+        auto pressure_delta = [&](uint32_t i) {
+            if (!limit_pressure) {
+                return int64_t{0};
+            }
+            return static_cast<int64_t>(graph.defined_values[i].size()) - static_cast<int64_t>(last_uses[i]);
+        };
+
+        enum class state : uint8_t {
+            blocked,
+            // on the cycle its operands are ready
+            waiting,
+            ready,
+            issued,
+        };
+        auto states = std::vector<state>(n, state::blocked);
+        struct candidate {
+            uint64_t height;
+            uint32_t index;
+            int64_t delta;
+        };
+        // the higher, and the earlier in the block of the same height, first
+        auto lower_priority = [](const candidate& l, const candidate& r) {
+            return l.height != r.height ? l.height < r.height : l.index > r.index;
+        };
+        using ready_heap = std::priority_queue<candidate, std::vector<candidate>, decltype(lower_priority)>;
+        // by delta and ports; entries of issued instructions, or of an old
+        // delta, are skipped
+        auto ready = std::map<std::pair<int64_t, uint32_t>, ready_heap>{};
+        auto waiting = std::priority_queue<std::pair<uint64_t, uint32_t>,
+             std::vector<std::pair<uint64_t, uint32_t>>, std::greater<>>{};
+        // waiting instructions that would not add to the pressure
+        size_t waiting_relieving = 0;
+
+        auto make_ready = [&](uint32_t i) {
+            states[i] = state::ready;
+            auto delta = pressure_delta(i);
+            ready[{delta, timings[i].ports}].emplace(heights[i], i, delta);
+        };
+        uint64_t cycle = 0;
+        auto release = [&](uint32_t i) {
+            if (earliest[i] <= cycle) {
+                make_ready(i);
+                return;
+            }
+            states[i] = state::waiting;
+            waiting.emplace(earliest[i], i);
+            if (pressure_delta(i) <= 0) {
+                waiting_relieving++;
+            }
+        };
+        auto end_live_range = [&](uint32_t i) {
+            auto before = pressure_delta(i);
+            last_uses[i]++;
+            if (!limit_pressure) {
+                return;
+            }
+            if (states[i] == state::waiting && before > 0 && pressure_delta(i) <= 0) {
+                waiting_relieving++;
+            }
+            if (states[i] == state::ready) {
+                auto delta = pressure_delta(i);
+                ready[{delta, timings[i].ports}].emplace(heights[i], i, delta);
+            }
+        };
+        for (uint32_t i = 0; i < n; i++) {
+            if (remaining_predecessors[i] == 0) {
+                release(i);
+            }
+        }
+
+        auto order = std::vector<uint32_t>{};
+        order.reserve(n);
+        uint64_t finish = 0;
+        while (order.size() < n) {
+            while (!waiting.empty() && waiting.top().first <= cycle) {
+                auto i = waiting.top().second;
+                waiting.pop();
+                if (pressure_delta(i) <= 0) {
+                    waiting_relieving--;
+                }
+                make_ready(i);
+            }
+
+            uint32_t issued = 0;
+            uint32_t ports_used = 0;
+            while (issued < opts.issue_width) {
+                // the highest, or under pressure, the highest of the lowest delta
+                auto under_pressure = limit_pressure && live_values >= opts.max_register_pressure;
+                ready_heap* best_heap = nullptr;
+                for (auto& [key, heap] : ready) {
+                    auto [delta, ports] = key;
+                    if (under_pressure && best_heap != nullptr && delta != best_heap->top().delta) {
+                        break;
+                    }
+                    if (ports != 0 && (ports & ~ports_used) == 0) {
+                        continue;
+                    }
+                    while (!heap.empty() && (states[heap.top().index] != state::ready
+                                || heap.top().delta != pressure_delta(heap.top().index))) {
+                        heap.pop();
+                    }
+                    if (!heap.empty() && (best_heap == nullptr || lower_priority(best_heap->top(), heap.top()))) {
+                        best_heap = &heap;
+                    }
+                }
+                if (best_heap == nullptr) {
+                    break;
+                }
+                auto best = best_heap->top().index;
+                // rather stall than start a new live range, if a waiting
+                // instruction will end one
+                if (under_pressure && pressure_delta(best) > 0 && waiting_relieving != 0) {
+                    break;
+                }
+                best_heap->pop();
+
+                if (timings[best].ports != 0) {
+                    auto free = timings[best].ports & ~ports_used;
+                    ports_used |= free & (~free + 1);
+                }
+                live_values += graph.defined_values[best].size();
+                for (auto value : graph.used_values[best]) {
+                    if (--remaining_uses[value] == 0) {
+                        live_values--;
+                    }
+                }
+                states[best] = state::issued;
+                const auto& used = graph.used_values[best];
+                for (size_t u = 0; u < used.size(); u++) {
+                    auto value = used[u];
+                    if (std::ranges::find(used, value) - used.begin() != static_cast<int64_t>(u)) {
+                        continue;
+                    }
+                    if (--remaining_users[value] == 1) {
+                        end_live_range(*std::ranges::find_if(users[value],
+                                    [&states](uint32_t i) { return states[i] != state::issued; }));
+                    }
+                }
+                order.emplace_back(best);
+                finish = std::max(finish, cycle + timings[best].latency);
+                for (auto [to, latency] : graph.successors[best]) {
+                    earliest[to] = std::max(earliest[to], cycle + latency);
+                    if (--remaining_predecessors[to] == 0) {
+                        release(to);
+                    }
+                }
+                issued++;
+            }
+
+            // nothing changes before the next instruction stops waiting
+            if (issued == 0 && !waiting.empty()) {
+                cycle = std::max(cycle + 1, waiting.top().first);
+            }
+            else {
+                cycle++;
+            }
+        }
+        return std::pair{order, finish};
+    }
+
+    template<typename Instruction>
+    struct scheduled_instructions {
+        std::vector<Instruction> instructions;
+        // estimated cycles of all blocks, one after the other
+        uint64_t cycles;
+    };
+
+    // Reorder the instructions of every basic block. Labels stay first and
+    // jumps and returns last; classify returns a control_flow::control.
+    template<typename Instruction>
+    auto schedule_instructions(const std::vector<Instruction>& instructions,
+            auto classify,
+            auto get_effects,
+            auto get_timing,
+            options opts = {}
+            ) {
+        auto result = scheduled_instructions<Instruction>{};
+        result.instructions.reserve(instructions.size());
+        result.cycles = 0;
+
+        auto block = std::vector<Instruction>{};
+        auto block_effects = std::vector<effects::effects>{};
+        auto timings = std::vector<timing>{};
+        auto flush = [&]() {
+            if (block.empty()) {
+                return;
+            }
+            auto [order, cycles] = schedule_block(block, block_effects, timings, opts);
+            for (auto i : order) {
+                result.instructions.emplace_back(std::move(block[i]));
+            }
+            result.cycles += cycles;
+            block.clear();
+            block_effects.clear();
+            timings.clear();
+        };
+        for (const auto& instruction : instructions) {
+            auto kind = classify(instruction).kind;
+            if (kind == control_flow::control_kind::other) {
+                block.emplace_back(instruction);
+                block_effects.emplace_back(get_effects(instruction));
+                timings.emplace_back(get_timing(instruction));
+                continue;
+            }
+            flush();
+            result.instructions.emplace_back(instruction);
+        }
+        flush();
+        return result;
+    }
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+#include <algorithm>
+
+namespace statistics {
+    enum class phase : uint32_t {
+        scan,
+        assemble,
+        register_allocation,
+        inlining,
+        count,
+    };
+
+    constexpr auto phase_names = std::to_array<std::string_view>({
+            "scan", "assemble", "register_allocation", "inlining"});
+    static_assert(phase_names.size() == static_cast<size_t>(phase::count));
+
+    struct statistics {
+        uint64_t tokens_scanned = 0;
+        uint64_t unique_strings = 0;
+        uint64_t statements_encoded = 0;
+        uint64_t bytes_emitted = 0;
+        // stores of dirty registers evicted by the register allocator, and loads back
+        uint64_t spills = 0;
+        uint64_t reloads = 0;
+        // argument and result copies in the inlined instructions
+        uint64_t inline_copies = 0;
+        // most virtual registers of a register allocation or inlined program
+        uint64_t peak_virtual_registers = 0;
+        // wall time in each phase
+        std::array<double, static_cast<size_t>(phase::count)> seconds{};
+    };
+
+    struct counter {
+        std::string_view name;
+        uint64_t statistics::* value;
+        // counters only grow, gauges are the largest value seen
+        bool gauge;
+    };
+
+    constexpr auto counters = std::to_array<counter>({
+            {"tokens_scanned", &statistics::tokens_scanned, false},
+            {"unique_strings", &statistics::unique_strings, false},
+            {"statements_encoded", &statistics::statements_encoded, false},
+            {"bytes_emitted", &statistics::bytes_emitted, false},
+            {"spills", &statistics::spills, false},
+            {"reloads", &statistics::reloads, false},
+            {"inline_copies", &statistics::inline_copies, false},
+            {"peak_virtual_registers", &statistics::peak_virtual_registers, true},
+            });
+
+    // The recorder the passes take by default. Every call is empty, so
+    // with statistics disabled nothing is counted and the clock is never read.
+    struct disabled {
+        struct timer {};
+
+        void add(uint64_t statistics::*, uint64_t) const {}
+        void maximum(uint64_t statistics::*, uint64_t) const {}
+        timer time(phase) const {
+            return {};
+        }
+    };
+
+    // Records into a statistics the caller owns, which may be shared by
+    // several passes. Copies record into the same statistics.
+    class recorder {
+    public:
+        // adds the wall time from its construction to its destruction to a phase
+        class timer {
+        public:
+            explicit timer(double& seconds) : m_seconds{&seconds}, m_start{std::chrono::steady_clock::now()} {}
+            timer(const timer&) = delete;
+            timer& operator=(const timer&) = delete;
+            ~timer() {
+                *m_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+            }
+        private:
+            double* m_seconds;
+            std::chrono::steady_clock::time_point m_start;
+        };
+
+        explicit recorder(statistics& stats) : m_statistics{&stats} {}
+
+        void add(uint64_t statistics::* value, uint64_t amount) const {
+            m_statistics->*value += amount;
+        }
+        void maximum(uint64_t statistics::* value, uint64_t amount) const {
+            m_statistics->*value = std::max(m_statistics->*value, amount);
+        }
+        timer time(phase p) const {
+            return timer{m_statistics->seconds[static_cast<size_t>(p)]};
+        }
+    private:
+        statistics* m_statistics;
+    };
+
+    // {"tokens_scanned": ..., "peak_virtual_registers": ...,
+    // "phase_seconds": {"scan": ..., "inlining": ...}}
+    inline void write_json(std::ostream& out, const statistics& stats) {
+        out << '{';
+        for (const auto& c : counters) {
+            out << "\n  \"" << c.name << "\": " << stats.*c.value << ',';
+        }
+        out << "\n  \"phase_seconds\": {";
+        for (size_t p = 0; p < phase_names.size(); p++) {
+            out << (p == 0 ? "" : ", ") << '"' << phase_names[p] << "\": " << stats.seconds[p];
+        }
+        out << "}\n}\n";
+    }
+
+    // Prometheus text exposition format, every metric name starting with prefix.
+    inline void write_prometheus(std::ostream& out, const statistics& stats,
+            std::string_view prefix = "amd64_assembler") {
+        for (const auto& c : counters) {
+            auto suffix = c.gauge ? "" : "_total";
+            out << "# TYPE " << prefix << '_' << c.name << suffix << (c.gauge ? " gauge\n" : " counter\n");
+            out << prefix << '_' << c.name << suffix << ' ' << stats.*c.value << '\n';
+        }
+        out << "# TYPE " << prefix << "_phase_seconds_total counter\n";
+        for (size_t p = 0; p < phase_names.size(); p++) {
+            out << prefix << "_phase_seconds_total{phase=\"" << phase_names[p] << "\"} " << stats.seconds[p] << '\n';
+        }
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <bit>
+
+namespace strength_reduction {
+    // x * multiplier as lea multiplies by 3, 5 or 9 followed by a shift,
+    // or an imul when the multiplier does not factor that way.
+    struct multiplication {
+        bool zero;
+        bool use_imul;
+        std::vector<uint8_t> lea_factors;
+        uint8_t shift;
+    };
+
+    // more lea steps are slower than a 3 cycle imul
+    constexpr auto max_lea_factors = 2;
+
+    inline auto plan_multiplication(uint32_t multiplier) {
+        auto plan = multiplication{};
+        if (multiplier == 0) {
+            plan.zero = true;
+            return plan;
+        }
+        plan.shift = std::countr_zero(multiplier);
+        auto rest = multiplier >> plan.shift;
+        for (uint8_t factor : {9, 5, 3}) {
+            while (rest % factor == 0 && plan.lea_factors.size() < max_lea_factors) {
+                plan.lea_factors.emplace_back(factor);
+                rest /= factor;
+            }
+        }
+        if (rest != 1) {
+            plan = multiplication{.use_imul = true};
+        }
+        return plan;
+    }
+
+    // x / divisor == mulhi(x, magic) >> shift, or when the magic number
+    // needs 33 bits, (((x - t) >> 1) + t) >> shift with t = mulhi(x, magic).
+    struct reciprocal {
+        uint32_t magic;
+        uint8_t shift;
+        bool add;
+    };
+
+    // unsigned 32 bit division by a divisor that is not a power of two,
+    // as libdivide computes it
+    inline auto unsigned_reciprocal(uint32_t divisor) {
+        auto floor_log2 = static_cast<uint8_t>(31 - std::countl_zero(divisor));
+        auto dividend = uint64_t{1} << (32 + floor_log2);
+        auto proposed = static_cast<uint32_t>(dividend / divisor);
+        auto remainder = static_cast<uint32_t>(dividend % divisor);
+        auto error = divisor - remainder;
+
+        if (error < (uint32_t{1} << floor_log2)) {
+            return reciprocal{proposed + 1, floor_log2, false};
+        }
+        proposed += proposed;
+        auto twice_remainder = remainder + remainder;
+        if (twice_remainder >= divisor || twice_remainder < remainder) {
+            proposed += 1;
+        }
+        return reciprocal{proposed + 1, floor_log2, true};
+    }
+}
@@ -6,6 +6,7 @@
 #include <tuple>
 #include <unordered_set>
 #include <unordered_map>
+#include <bit>
 
 namespace use_virtual_register {
     using namespace amd64;
@@ -178,6 +179,98 @@ int main() {
                 )
               );
 
+        auto ecx = register_type::reg<32>{ reg32::ecx };
+        assert(std::ranges::equal(shl(ecx, 3), std::array<uint8_t, 3>{0xc1, 0xe1, 3}));
+        assert(std::ranges::equal(shl(ecx), std::array<uint8_t, 2>{0xd1, 0xe1}));
+        assert(std::ranges::equal(
+                    sar(register_type::reg<64>{ reg64::rdx }, cl),
+                    std::array<uint8_t, 3>{0x48, 0xd3, 0xfa}));
+        assert(std::ranges::equal(
+                    ror(register_type::reg<8>{ reg8::bl }, 2),
+                    std::array<uint8_t, 3>{0xc0, 0xcb, 2}));
+        assert(std::ranges::equal(imul(ecx, ebx, int8_t{10}), std::array<uint8_t, 3>{0x6b, 0xcb, 10}));
+        assert(std::ranges::equal(imul(ecx, ecx, 1000), std::array<uint8_t, 6>{0x69, 0xc9, 0xe8, 3, 0, 0}));
+        assert(std::ranges::equal(
+                    lea(ecx, mem<64, sib_address>{{reg64::rcx, reg64::rcx, 3}}),
+                    std::array<uint8_t, 3>{0x8d, 0x0c, 0xc9}));
+        assert(std::ranges::equal(
+                    mov(register_type::reg<64>{ reg64::rax }, mem<64, rip_address>{{0x10}}),
+                    std::array<uint8_t, 7>{0x48, 0x8b, 0x05, 0x10, 0, 0, 0}));
+        assert(std::ranges::equal(
+                    lea(register_type::reg<64>{ reg64::rcx }, mem<64, rip_address>{{-4}}),
+                    std::array<uint8_t, 7>{0x48, 0x8d, 0x0d, 0xfc, 0xff, 0xff, 0xff}));
+        assert(std::ranges::equal(
+                    add(mem<32, rip_address>{}, uint32_t{1}),
+                    std::array<uint8_t, 10>{0x81, 0x05, 0, 0, 0, 0, 1, 0, 0, 0}));
+        // push rbx; push r12; pop r15
+        assert(std::ranges::equal(push(register_type::reg<64>{ reg64::rbx }), std::array<uint8_t, 1>{0x53}));
+        assert(std::ranges::equal(
+                    push(register_type::reg<64, register_type::extention::extended>{ register_type::extended_reg64{4} }),
+                    std::array<uint8_t, 2>{0x41, 0x54}));
+        assert(std::ranges::equal(
+                    pop(register_type::reg<64, register_type::extention::extended>{ register_type::extended_reg64{7} }),
+                    std::array<uint8_t, 2>{0x41, 0x5f}));
+
+        assert(std::ranges::equal(cmovz(ecx, ebx), std::array<uint8_t, 3>{0x0f, 0x44, 0xcb}));
+        assert(std::ranges::equal(
+                    cmovcc<0xc>(register_type::reg<64>{ reg64::rdx }, register_type::reg<64>{ reg64::rsi }),
+                    std::array<uint8_t, 4>{0x48, 0x0f, 0x4c, 0xd6}));
+        assert(std::ranges::equal(
+                    setb(register_type::reg<8>{ reg8::cl }),
+                    std::array<uint8_t, 3>{0x0f, 0x92, 0xc1}));
+
+        // multiplications and divisions by constants are strength reduced
+        auto reduced = assemble(
+            std::vector{
+            statement{ operation::mul, std::tuple<register_type::reg<32>, uint32_t>(ecx, 24) },
+            statement{ operation::div, std::tuple<register_type::reg<32>, uint32_t>(ecx, 16) },
+            statement{ operation::div, std::tuple<register_type::reg<32>, uint32_t>(ecx, 3) },
+            }
+        );
+        assert(
+                std::ranges::equal(
+                    reduced,
+                    std::vector<uint8_t>{
+                        0x8d, 0x0c, 0x49,               // lea ecx, [rcx + rcx*2]
+                        0xc1, 0xe1, 3,                  // shl ecx, 3
+                        0xc1, 0xe9, 4,                  // shr ecx, 4
+                        0xb8, 0xab, 0xaa, 0xaa, 0xaa,   // mov eax, 0xaaaaaaab
+                        0xf7, 0xe1,                     // mul ecx
+                        0xc1, 0xea, 1,                  // shr edx, 1
+                        0x89, 0xd1,                     // mov ecx, edx
+                    }
+                )
+              );
+        // powers of two are shifts instead
+        for (uint32_t divisor = 3; divisor < 100000; divisor++) {
+            if (std::has_single_bit(divisor)) {
+                continue;
+            }
+            auto reciprocal = strength_reduction::unsigned_reciprocal(divisor);
+            for (uint32_t x : {0u, divisor - 1, divisor, 0x7fffffffu, 0xffffffffu}) {
+                uint32_t t = (uint64_t{x} * reciprocal.magic) >> 32;
+                uint32_t q = reciprocal.add ? ((((x - t) >> 1) + t) >> reciprocal.shift) : (t >> reciprocal.shift);
+                assert(q == x / divisor);
+            }
+        }
+
+        // the two byte VEX prefix is used unless X, B, W or the map need the three byte one
+        auto vector_memory = mem<256>{ modrm_reg64_address::rdi };
+        assert(std::ranges::equal(vmovdqu(ymm1, vector_memory), std::array<uint8_t, 4>{0xc5, 0xfe, 0x6f, 0x0f}));
+        assert(std::ranges::equal(vmovdqu(vector_memory, ymm9), std::array<uint8_t, 4>{0xc5, 0x7e, 0x7f, 0x0f}));
+        assert(std::ranges::equal(vpaddd(ymm0, ymm1, ymm2), std::array<uint8_t, 4>{0xc5, 0xf5, 0xfe, 0xc2}));
+        assert(std::ranges::equal(vpaddd(ymm8, ymm9, ymm10), std::array<uint8_t, 5>{0xc4, 0x41, 0x35, 0xfe, 0xc2}));
+        assert(std::ranges::equal(vfmadd231pd(ymm0, ymm1, ymm11), std::array<uint8_t, 5>{0xc4, 0xc2, 0xf5, 0xb8, 0xc3}));
+        assert(std::ranges::equal(vpshufd(xmm0, xmm1, 0x1b), std::array<uint8_t, 5>{0xc5, 0xf9, 0x70, 0xc1, 0x1b}));
+        assert(std::ranges::equal(vcmpps(ymm0, ymm1, ymm2, 1), std::array<uint8_t, 5>{0xc5, 0xf4, 0xc2, 0xc2, 1}));
+        assert(std::ranges::equal(
+                    vblendvps(ymm0, ymm1, ymm2, ymm3),
+                    std::array<uint8_t, 6>{0xc4, 0xe3, 0x75, 0x4a, 0xc2, 0x30}));
+        assert(std::ranges::equal(
+                    vpgatherdd(ymm0, mem<32, vsib_address<ymm<>>>{{reg64::rdi, ymm1, 2}}, ymm2),
+                    std::array<uint8_t, 6>{0xc4, 0xe2, 0x6d, 0x90, 0x04, 0x8f}));
+        assert(std::ranges::equal(vzeroupper(), std::array<uint8_t, 3>{0xc5, 0xf8, 0x77}));
+
     }
     catch (std::exception& except) {
         std::cout << except.what() << std::endl;
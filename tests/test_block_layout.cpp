@@ -0,0 +1,177 @@
+#include "block_layout.hpp"
+
+#include <cassert>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+enum op_t : uint32_t {
+    label,
+    jmp,
+    jcc,
+    // sets the flag from the outcome script of its target
+    cmp,
+    // marks the block of its target as run
+    mov,
+    ret,
+};
+
+struct instruction {
+    op_t op;
+    std::vector<uint32_t> reads;
+    std::vector<uint32_t> writes;
+    // label defined or jumped to
+    uint32_t target;
+    uint8_t condition;
+};
+
+auto classify(const instruction& instruction) {
+    using kind = control_flow::control_kind;
+    switch (instruction.op) {
+    case label: return control_flow::control{kind::label, instruction.target};
+    case jmp: return control_flow::control{kind::jump, instruction.target};
+    case jcc: return control_flow::control{kind::conditional_jump, instruction.target, instruction.condition};
+    case ret: return control_flow::control{kind::ret};
+    default: return control_flow::control{kind::other};
+    }
+}
+
+// the marked blocks in the order they run, and the number of jumps taken
+auto run(const std::vector<instruction>& instructions, auto outcome) {
+    auto labels = std::vector<size_t>(16);
+    for (size_t i = 0; i < instructions.size(); i++) {
+        if (instructions[i].op == label) {
+            labels[instructions[i].target] = i;
+        }
+    }
+    auto trace = std::vector<uint32_t>{};
+    auto runs = std::vector<uint32_t>(3);
+    uint64_t taken = 0;
+    bool flag = false;
+    size_t pc = 0;
+    while (instructions[pc].op != ret) {
+        const auto& i = instructions[pc++];
+        switch (i.op) {
+        case mov:
+            trace.emplace_back(i.target);
+            break;
+        case cmp:
+            flag = outcome(i.target, runs[i.target]++);
+            break;
+        case jmp:
+            pc = labels[i.target];
+            taken++;
+            break;
+        case jcc:
+            // condition codes that differ in the lowest bit are opposites
+            if (((i.condition & 1) == 0) == flag) {
+                pc = labels[i.target];
+                taken++;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return std::pair{trace, taken};
+}
+
+int main() {
+    constexpr uint8_t l = 0xc;
+
+    // a loop of 100 iterations with a rare error path and a branch that
+    // usually skips a block
+    auto instructions = std::vector<instruction>{
+        {mov, {}, {}, 0},
+        {jmp, {}, {}, 1},
+        {label, {}, {}, 2},
+        {mov, {}, {}, 1},
+        {ret},
+        {label, {}, {}, 1},
+        {mov, {}, {}, 2},
+        {cmp, {}, {}, 0},
+        {jcc, {}, {}, 2, l},
+        {mov, {}, {}, 3},
+        {cmp, {}, {}, 1},
+        {jcc, {}, {}, 3, l},
+        {mov, {}, {}, 4},
+        {label, {}, {}, 3},
+        {mov, {}, {}, 5},
+        {cmp, {}, {}, 2},
+        {jcc, {}, {}, 1, l},
+        {mov, {}, {}, 6},
+        {ret},
+    };
+    auto outcome = [](uint32_t cmp, uint32_t n) {
+        switch (cmp) {
+        case 0: return false;
+        case 1: return n % 10 != 0;
+        default: return n < 99;
+        }
+    };
+    auto [trace, taken_before] = run(instructions, outcome);
+    auto counts = std::vector<uint64_t>(7);
+    for (auto block : trace) {
+        counts[block]++;
+    }
+    assert(counts == std::vector<uint64_t>({1, 0, 100, 100, 10, 100, 1}));
+
+    auto gen_label = [](uint32_t l) { return instruction{label, {}, {}, l}; };
+    auto gen_jump = [](uint32_t l) { return instruction{jmp, {}, {}, l}; };
+    auto gen_conditional_jump = [](uint8_t condition, uint32_t l) { return instruction{jcc, {}, {}, l, condition}; };
+
+    // with taken counts
+    {
+        auto taken = std::vector<uint64_t>{0, 0, 0, 90, 0, 99, 0};
+        auto laid_out = block_layout::layout_blocks(instructions, counts, taken,
+                classify, gen_label, gen_jump, gen_conditional_jump);
+        for (const auto& instruction : laid_out.instructions) {
+            std::cout << instruction.op << "(" << instruction.target << "," << (int)instruction.condition << ")" << std::endl;
+        }
+        // the loop back edge falls through, and the error block is last
+        assert(laid_out.block_order == std::vector<uint32_t>({0, 5, 2, 3, 4, 6, 1}));
+        assert(laid_out.cold_start == 6);
+        assert(laid_out.taken_before == taken_before);
+
+        auto [new_trace, taken_after] = run(laid_out.instructions, outcome);
+        assert(new_trace == trace);
+        assert(taken_after == laid_out.taken_after);
+        assert(taken_after < taken_before);
+        std::cout << "taken jumps: " << taken_before << " -> " << taken_after << std::endl;
+
+        // the loop condition is inverted to leave the loop
+        assert(std::ranges::count(laid_out.instructions, l ^ 1, &instruction::condition) == 1);
+    }
+
+    // edges estimated from the block counts alone
+    {
+        auto laid_out = block_layout::layout_blocks(instructions, counts, {},
+                classify, gen_label, gen_jump, gen_conditional_jump);
+        assert(laid_out.block_order.front() == 0 && laid_out.block_order.back() == 1);
+        assert(run(laid_out.instructions, outcome).first == trace);
+    }
+
+    // counts from a file; hot only above a tenth of the entry
+    {
+        auto in = std::istringstream{"10 0 1000\n1000 100 1000 10"};
+        auto file_counts = block_layout::read_counts(in);
+        assert(file_counts.size() == 7);
+        auto laid_out = block_layout::layout_blocks(instructions, file_counts, {},
+                classify, gen_label, gen_jump, gen_conditional_jump, {.cold_fraction = 1});
+        assert(laid_out.cold_start < laid_out.block_order.size());
+        assert(run(laid_out.instructions, outcome).first == trace);
+
+        bool thrown = false;
+        try {
+            file_counts.pop_back();
+            block_layout::layout_blocks(instructions, file_counts, {},
+                    classify, gen_label, gen_jump, gen_conditional_jump);
+        }
+        catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+
+    return 0;
+}
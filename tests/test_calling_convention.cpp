@@ -0,0 +1,56 @@
+#include "calling_convention.hpp"
+
+#include <cassert>
+#include <iostream>
+
+struct instruction {
+    std::vector<uint8_t> writes;
+
+    auto& get_writes() const {
+        return writes;
+    }
+};
+
+int main() {
+    using namespace amd64;
+
+    auto assignment = system_v::assign_registers(8, 3);
+    assert((assignment.argument_registers == std::vector<system_v::register_index>{7, 6, 2, 1, 8, 9}));
+    assert(assignment.stack_arguments == 2);
+    assert((assignment.return_registers == std::vector<system_v::register_index>{0, 2}));
+    assert(assignment.memory_returns == 1);
+
+    auto instructions = std::vector<instruction>{
+        {{0, 3}},
+        {{12, 1}},
+    };
+    auto saved = system_v::clobbered_callee_saved_registers(instructions);
+    assert((saved == std::vector<system_v::register_index>{3, 12}));
+
+    // push rbx; push r12; sub rsp, 8
+    assert(std::ranges::equal(
+                system_v::prologue(saved, true),
+                std::vector<uint8_t>{0x53, 0x41, 0x54, 0x48, 0x81, 0xec, 8, 0, 0, 0}));
+    // add rsp, 8; pop r12; pop rbx; ret
+    assert(std::ranges::equal(
+                system_v::epilogue(saved, true),
+                std::vector<uint8_t>{0x48, 0x81, 0xc4, 8, 0, 0, 0, 0x41, 0x5c, 0x5b, 0xc3}));
+    assert(std::ranges::equal(
+                system_v::epilogue({}, false),
+                std::vector<uint8_t>{0xc3}));
+    // push r13; push r14; push r15
+    assert(std::ranges::equal(
+                system_v::prologue({13, 14, 15}, true),
+                std::vector<uint8_t>{0x41, 0x55, 0x41, 0x56, 0x41, 0x57}));
+
+    bool thrown = false;
+    try {
+        system_v::clobbered_callee_saved_registers(std::vector<instruction>{{{3, 16}}});
+    }
+    catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    return 0;
+}
@@ -0,0 +1,201 @@
+#include "code_buffer.hpp"
+#include "executable_memory.hpp"
+
+#include <cassert>
+#include <iostream>
+
+// uint32_t (uint32_t n): n + (n - 1) + ... + 1
+auto gen_sum(code_buffer::code_buffer& buffer, size_t prologue_nops) {
+    using namespace amd64;
+    using namespace amd64::register_type;
+    auto eax_reg = reg<32>{ reg32::eax };
+    auto edi = reg<32>{ reg32::edi };
+
+    auto entry = buffer.new_label();
+    auto loop = buffer.new_label();
+    auto done = buffer.new_label();
+    buffer.begin_function(entry);
+    buffer.append(bit_xor(eax_reg, eax_reg));
+    buffer.append(padding(prologue_nops));
+    buffer.append(test(edi, edi));
+    buffer.jcc(0x4, done);
+    buffer.bind(loop);
+    buffer.append(add(eax_reg, edi));
+    buffer.append(sub(edi, uint32_t{1}));
+    buffer.jcc(0x5, loop);
+    buffer.bind(done);
+    buffer.append_branch(ret());
+    return std::tuple{entry, loop};
+}
+
+int main() {
+    for (size_t length = 1; length <= amd64::max_nop_length; length++) {
+        assert(amd64::multi_byte_nop(length).size() == length);
+    }
+    assert((amd64::multi_byte_nop(5) == std::vector<uint8_t>{0x0f, 0x1f, 0x44, 0x00, 0x00}));
+    assert((amd64::multi_byte_nop(11) == std::vector<uint8_t>{0x66, 0x66, 0x66, 0x0f, 0x1f, 0x84, 0, 0, 0, 0, 0}));
+    // 31 bytes in three instructions rather than 31
+    assert(amd64::padding(31).size() == 31);
+    assert(amd64::padding(31)[15] == 0x66 && amd64::padding(31)[30] == 0x90);
+
+    {
+        auto buffer = code_buffer::code_buffer{};
+        buffer.append(amd64::ret());
+        assert(buffer.align(16, 10) == 0);
+        assert(buffer.size() == 1);
+        assert(buffer.align(16) == 15);
+        assert(buffer.size() == 16);
+    }
+
+    for (size_t prologue_nops : {0, 3, 22, 30}) {
+        auto buffer = code_buffer::code_buffer{};
+        // a function before, so the entry is aligned too
+        buffer.append(amd64::ret());
+        auto [entry, loop] = gen_sum(buffer, prologue_nops);
+        auto loop_offset = buffer.offset(loop);
+        const auto& codes = buffer.link();
+        assert(buffer.offset(entry) % 16 == 0);
+        // padded only when it takes at most loop_max_skip bytes
+        auto skip = (32 - loop_offset % 32) % 32;
+        auto aligned = skip <= buffer.policy().loop_max_skip;
+        assert((buffer.offset(loop) % 32 == 0) == aligned || skip == 0);
+        std::cout << "loop at " << loop_offset << " -> " << buffer.offset(loop)
+            << ", padding " << buffer.padding_size() << std::endl;
+
+        auto code = executable_memory::executable_memory{codes};
+        auto sum = reinterpret_cast<uint32_t(*)(uint32_t)>(code.data() + buffer.offset(entry));
+        assert(sum(0) == 0);
+        assert(sum(10) == 55);
+        assert(sum(1000) == 500500);
+    }
+
+    // a function after a padded loop stays aligned
+    for (size_t prologue_nops = 0; prologue_nops < 32; prologue_nops++) {
+        auto buffer = code_buffer::code_buffer{};
+        auto [first, first_loop] = gen_sum(buffer, prologue_nops);
+        auto [second, second_loop] = gen_sum(buffer, 0);
+        buffer.align(64);
+        auto end = buffer.new_label();
+        buffer.bind(end);
+        buffer.append(amd64::ret());
+        const auto& codes = buffer.link();
+        assert(buffer.offset(first) % 16 == 0 && buffer.offset(second) % 16 == 0);
+        assert(buffer.offset(end) % 64 == 0);
+
+        auto code = executable_memory::executable_memory{codes};
+        auto sum = reinterpret_cast<uint32_t(*)(uint32_t)>(code.data() + buffer.offset(second));
+        assert(sum(10) == 55);
+    }
+
+    {
+        using namespace amd64;
+        using namespace amd64::register_type;
+        auto buffer = code_buffer::code_buffer{{ .mitigate_jcc_erratum = true }};
+        auto target = buffer.new_label();
+        buffer.bind(target);
+        buffer.append(padding(28));
+        // cmp ecx, ebx; jz would take 28 to 36
+        buffer.append(cmp(reg<32>{ reg32::ecx }, reg<32>{ reg32::ebx }));
+        buffer.jcc(0x4, target);
+        assert(buffer.branch_sites().back().start == 28);
+        buffer.link();
+        assert(buffer.jcc_erratum_fixes() == 1);
+        // the pair moved to the boundary together
+        assert(buffer.codes()[32] == 0x39 && buffer.codes()[34] == 0x0f && buffer.codes()[35] == 0x84);
+        assert(buffer.offset(target) == 0);
+    }
+
+    for (size_t prologue_nops = 0; prologue_nops < 64; prologue_nops++) {
+        auto buffer = code_buffer::code_buffer{{ .mitigate_jcc_erratum = true }};
+        auto [entry, loop] = gen_sum(buffer, prologue_nops);
+        const auto& codes = buffer.link();
+        for (auto site : buffer.branch_sites()) {
+            assert(site.start / 32 == site.end / 32);
+        }
+        auto code = executable_memory::executable_memory{codes};
+        auto sum = reinterpret_cast<uint32_t(*)(uint32_t)>(code.data() + buffer.offset(entry));
+        assert(sum(0) == 0);
+        assert(sum(100) == 5050);
+    }
+
+    // constants loaded from pools, shared between uses
+    {
+        using namespace amd64;
+        using namespace amd64::register_type;
+        auto rax = reg<64>{ reg64::rax };
+        auto rdx = reg<64>{ reg64::rdx };
+        auto large = uint64_t{0x123456789abcdef0};
+        auto buffer = code_buffer::code_buffer{};
+        // loop padding moves the pools after it
+        auto [sum_entry, loop] = gen_sum(buffer, 3);
+
+        auto first = buffer.new_label();
+        buffer.begin_function(first);
+        buffer.load_constant(rax, large);
+        auto size = buffer.size();
+        buffer.load_constant(rdx, large);
+        assert(buffer.size() - size == 7);
+        buffer.append(add(rax, rdx));
+        size = buffer.size();
+        buffer.load_constant(rdx, 7);
+        assert(buffer.size() - size == 5);
+        buffer.append(add(rax, rdx));
+        size = buffer.size();
+        buffer.load_constant(rdx, static_cast<uint64_t>(-2));
+        assert(buffer.size() - size == 7);
+        buffer.append(add(rax, rdx));
+        buffer.append_branch(ret());
+        buffer.emit_constants();
+        assert(buffer.constant_pools().size() == 1);
+
+        // the constant of the first pool, and one placed by link()
+        auto second = buffer.new_label();
+        buffer.begin_function(second);
+        buffer.load_constant(rax, large);
+        auto pair = std::to_array<uint8_t>({1, 0, 0, 0, 0, 0, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0});
+        auto pair_label = buffer.constant(pair, 16);
+        assert(buffer.constant(pair, 16) == pair_label && buffer.constant(pair, 8) != pair_label);
+        buffer.append_rip_relative(lea(rdx, mem<64, rip_address>{}), pair_label);
+        buffer.append(mov(rdx, mem<64>{modrm_reg64_address::rdx}));
+        buffer.append(add(rax, rdx));
+        buffer.append_branch(ret());
+
+        const auto& codes = buffer.link();
+        assert(buffer.constant_pools().size() == 2);
+        for (auto [start, end] : buffer.constant_pools()) {
+            assert(start % buffer.policy().constant_pool_alignment == 0);
+        }
+        assert(buffer.offset(pair_label) % 16 == 0);
+        assert(buffer.offset(first) % 16 == 0 && buffer.offset(second) % 16 == 0);
+        auto large_bytes = to_codes(large);
+        assert(std::ranges::distance(std::ranges::search(codes, large_bytes)) == 8);
+        assert(std::ranges::search(std::ranges::subrange(std::ranges::search(codes, large_bytes).end(), codes.end()), large_bytes).empty());
+
+        auto code = executable_memory::executable_memory{codes};
+        auto sum = reinterpret_cast<uint32_t(*)(uint32_t)>(code.data() + buffer.offset(sum_entry));
+        auto f = reinterpret_cast<uint64_t(*)()>(code.data() + buffer.offset(first));
+        auto g = reinterpret_cast<uint64_t(*)()>(code.data() + buffer.offset(second));
+        assert(sum(10) == 55);
+        assert(f() == 2 * large + 7 - 2);
+        assert(g() == large + 1);
+
+        bool thrown = false;
+        try {
+            buffer.constant(pair, 3);
+        }
+        catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+
+    try {
+        auto buffer = code_buffer::code_buffer{};
+        buffer.jmp(buffer.new_label());
+        buffer.link();
+        assert(false);
+    }
+    catch (std::runtime_error&) {
+    }
+    return 0;
+}
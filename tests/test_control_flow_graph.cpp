@@ -0,0 +1,142 @@
+#include "control_flow_graph.hpp"
+
+#include <cassert>
+#include <iostream>
+#include <vector>
+
+enum op_t : uint32_t {
+    label,
+    jmp,
+    jcc,
+    mov,
+    ret,
+};
+
+struct instruction {
+    op_t op;
+    std::vector<uint32_t> reads;
+    std::vector<uint32_t> writes;
+    // label defined or jumped to
+    uint32_t target;
+    uint8_t condition;
+};
+
+auto classify(const instruction& instruction) {
+    using kind = control_flow::control_kind;
+    switch (instruction.op) {
+    case label: return control_flow::control{kind::label, instruction.target};
+    case jmp: return control_flow::control{kind::jump, instruction.target};
+    case jcc: return control_flow::control{kind::conditional_jump, instruction.target, instruction.condition};
+    case ret: return control_flow::control{kind::ret};
+    default: return control_flow::control{kind::other};
+    }
+}
+
+auto to_vector(std::span<const uint32_t> s) {
+    return std::vector<uint32_t>(s.begin(), s.end());
+}
+
+int main() {
+    using control_flow_graph::none;
+    constexpr uint8_t l = 0xc;
+
+    // a loop nest, its exit, and an unreachable loop
+    {
+        auto instructions = std::vector<instruction>{
+            {mov, {}, {0}},
+            {label, {}, {}, 0},
+            {mov, {0}, {1}},
+            {jcc, {}, {}, 3, l},
+            {mov, {1}, {2}},
+            {label, {}, {}, 1},
+            {mov, {2}, {2}},
+            {jcc, {}, {}, 1, l},
+            {mov, {2}, {0}},
+            {jmp, {}, {}, 0},
+            {label, {}, {}, 3},
+            {ret},
+            {label, {}, {}, 4},
+            {mov, {0}, {0}},
+            {jmp, {}, {}, 4},
+        };
+        auto graph = control_flow_graph::build_graph(instructions, classify);
+        assert(graph.size() == 7);
+        assert(graph.starts == std::vector<uint32_t>({0, 1, 4, 5, 8, 10, 12, 15}));
+        auto successors = std::vector<std::vector<uint32_t>>{{1}, {5, 2}, {3}, {3, 4}, {1}, {}, {6}};
+        auto predecessors = std::vector<std::vector<uint32_t>>{{}, {0, 4}, {1}, {2, 3}, {3}, {1}, {6}};
+        for (uint32_t b = 0; b < graph.size(); b++) {
+            assert(to_vector(graph.successors_of(b)) == successors[b]);
+            assert(to_vector(graph.predecessors_of(b)) == predecessors[b]);
+        }
+
+        auto dominators = control_flow_graph::build_dominator_tree(graph);
+        assert(dominators.immediate_dominator == std::vector<uint32_t>({0, 0, 1, 2, 3, 1, none}));
+        assert(dominators.reverse_postorder.front() == 0 && dominators.reverse_postorder.size() == 6);
+        assert(dominators.dominates(0, 4) && dominators.dominates(1, 4) && dominators.dominates(4, 4));
+        assert(!dominators.dominates(4, 1) && !dominators.dominates(2, 5) && !dominators.dominates(0, 6));
+
+        auto forest = control_flow_graph::find_loops(graph, dominators);
+        assert(forest.loops.size() == 2);
+        const auto& outer = forest.loops[0];
+        assert(outer.header == 1 && outer.blocks == std::vector<uint32_t>({1, 2, 3, 4}));
+        assert(outer.latches == std::vector<uint32_t>({4}) && outer.parent == none && outer.depth == 1);
+        const auto& inner = forest.loops[1];
+        assert(inner.header == 3 && inner.blocks == std::vector<uint32_t>({3}));
+        assert(inner.latches == std::vector<uint32_t>({3}) && inner.parent == 0 && inner.depth == 2);
+        auto depths = std::vector<uint32_t>{};
+        for (uint32_t b = 0; b < graph.size(); b++) {
+            depths.emplace_back(forest.depth(b));
+        }
+        assert(depths == std::vector<uint32_t>({0, 1, 1, 2, 1, 0, 0}));
+    }
+
+    // a cycle entered at two blocks is not a natural loop
+    {
+        auto instructions = std::vector<instruction>{
+            {jcc, {}, {}, 1, l},
+            {label, {}, {}, 0},
+            {mov, {0}, {0}},
+            {label, {}, {}, 1},
+            {jcc, {}, {}, 0, l},
+            {ret},
+        };
+        auto graph = control_flow_graph::build_graph(instructions, classify);
+        auto dominators = control_flow_graph::build_dominator_tree(graph);
+        assert(dominators.immediate_dominator == std::vector<uint32_t>({0, 0, 0, 2}));
+        assert(control_flow_graph::find_loops(graph, dominators).loops.empty());
+    }
+
+    // long chains of loops do not recurse
+    {
+        constexpr uint32_t count = 100000;
+        auto instructions = std::vector<instruction>{};
+        for (uint32_t i = 0; i < count; i++) {
+            instructions.push_back({label, {}, {}, i});
+            instructions.push_back({mov, {0}, {0}});
+            instructions.push_back({jcc, {}, {}, i, l});
+        }
+        instructions.push_back({ret});
+        auto graph = control_flow_graph::build_graph(instructions, classify);
+        auto dominators = control_flow_graph::build_dominator_tree(graph);
+        auto forest = control_flow_graph::find_loops(graph, dominators);
+        std::cout << graph.size() << " blocks, " << forest.loops.size() << " loops" << std::endl;
+        assert(graph.size() == count + 1);
+        assert(forest.loops.size() == count);
+        assert(dominators.immediate_dominator[count] == count - 1);
+        assert(forest.depth(count - 1) == 1 && forest.depth(count) == 0);
+    }
+
+    {
+        auto instructions = std::vector<instruction>{{jmp, {}, {}, 7}, {label, {}, {}, 0}, {ret}};
+        bool thrown = false;
+        try {
+            control_flow_graph::build_graph(instructions, classify);
+        }
+        catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include "copy_propagation.hpp"
+
+#include <cassert>
+#include <iostream>
+
+struct instruction {
+    using register_t = uint32_t;
+
+    uint32_t op;
+    std::vector<register_t> reads;
+    std::vector<register_t> writes;
+
+    auto& get_reads() const {
+        return reads;
+    }
+    auto& get_writes() const {
+        return writes;
+    }
+};
+
+constexpr uint32_t copy = 1;
+constexpr uint32_t store = 2;
+constexpr uint32_t label = 6;
+constexpr uint32_t jmp = 7;
+constexpr uint32_t ret = 8;
+
+auto classify(const instruction& instruction) {
+    using kind = control_flow::control_kind;
+    switch (instruction.op) {
+    case label: return control_flow::control{kind::label, 0};
+    case jmp: return control_flow::control{kind::jump, 0};
+    case ret: return control_flow::control{kind::ret};
+    default: return control_flow::control{kind::other};
+    }
+}
+
+void print(const std::vector<instruction>& instructions) {
+    for (const auto& instruction : instructions) {
+        std::cout << instruction.op << ":";
+        for (auto reg : instruction.reads) {
+            std::cout << reg << ", ";
+        }
+        std::cout << "->";
+        for (auto reg : instruction.writes) {
+            std::cout << reg << ", ";
+        }
+        std::cout << std::endl;
+    }
+    std::cout << std::endl;
+}
+
+int main() {
+    using namespace copy_propagation;
+
+    // the shape inline_procedures produces: copy in, callee body, copy out
+    auto in_instructions = std::vector<instruction>{
+        {.op = 0, .writes = {0, 1}},
+        {.op = copy, .reads = {0, 1}, .writes = {8, 9}},
+        {.op = 3, .reads = {8, 9}, .writes = {10}},
+        {.op = 4, .reads = {8}, .writes = {11}},
+        {.op = copy, .reads = {10, 11}, .writes = {2, 3}},
+        {.op = store, .reads = {2}},
+        // swap through a parallel copy
+        {.op = copy, .reads = {0, 1}, .writes = {1, 0}},
+        {.op = 5, .reads = {0, 1}, .writes = {4}},
+    };
+    auto is_copy = [](const auto& instruction) { return instruction.op == copy; };
+    auto is_pure = [](const auto& instruction) { return instruction.op != store; };
+    auto translate_registers = [](auto in_instruction, auto writes, auto reads) {
+        return instruction{in_instruction.op, reads, writes};
+    };
+
+    auto propagated = propagate_copies(in_instructions, classify, is_copy, translate_registers);
+    print(propagated);
+    assert((propagated[2].reads == std::vector<uint32_t>{0, 1}));
+    assert((propagated[3].reads == std::vector<uint32_t>{0}));
+    assert((propagated[5].reads == std::vector<uint32_t>{10}));
+    // the swapped registers must not be forwarded to their old values
+    assert((propagated[7].reads == std::vector<uint32_t>{0, 1}));
+
+    auto optimized = eliminate_dead_code(propagated, std::vector<uint32_t>{4}, classify, is_copy, is_pure, translate_registers);
+    print(optimized);
+    assert(optimized.size() == 5);
+    assert(std::ranges::count(optimized, copy, &instruction::op) == 1);
+    assert(std::ranges::count(optimized, 4u, &instruction::op) == 0);
+
+    // copies are not followed past a label, and are live before a jump
+    {
+        auto branchy = std::vector<instruction>{
+            {.op = 0, .writes = {0}},
+            {.op = copy, .reads = {0}, .writes = {1}},
+            {.op = label},
+            {.op = 3, .reads = {1}, .writes = {2}},
+            {.op = copy, .reads = {2}, .writes = {5}},
+            {.op = jmp},
+            {.op = label},
+            {.op = 9, .writes = {7}},
+            {.op = ret},
+        };
+        auto propagated = propagate_copies(branchy, classify, is_copy, translate_registers);
+        assert(propagated.size() == branchy.size());
+        assert((propagated[3].reads == std::vector<uint32_t>{1}));
+        auto optimized = eliminate_dead_code(propagated, std::vector<uint32_t>{}, classify, is_copy, is_pure, translate_registers);
+        print(optimized);
+        assert(optimized.size() == branchy.size() - 1);
+        assert(std::ranges::count(optimized, copy, &instruction::op) == 2);
+        assert(std::ranges::count(optimized, 9u, &instruction::op) == 0);
+    }
+
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include "cpu_features.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <bit>
+
+#include <cpuid.h>
+
+int main() {
+    using namespace amd64;
+    using namespace amd64::register_type;
+
+    auto probe = cpu_features::cpuid_probe{};
+
+    // the generated probe agrees with the compiler's cpuid
+    for (auto [leaf, subleaf] : {std::pair{0u, 0u}, {1u, 0u}, {7u, 0u}, {0x80000000u, 0u}}) {
+        unsigned eax, ebx, ecx, edx;
+        __cpuid_count(leaf, subleaf, eax, ebx, ecx, edx);
+        auto result = probe(leaf, subleaf);
+        assert(result.eax == eax && result.ebx == ebx && result.ecx == ecx && result.edx == edx);
+    }
+
+    auto vendor = probe(0);
+    auto vendor_name = std::string(12, ' ');
+    std::memcpy(vendor_name.data(), &vendor.ebx, 4);
+    std::memcpy(vendor_name.data() + 4, &vendor.edx, 4);
+    std::memcpy(vendor_name.data() + 8, &vendor.ecx, 4);
+
+    using cpu_features::feature;
+    auto features = cpu_features::host_features();
+    std::cout << vendor_name << std::hex << " features " << features.bits() << std::dec << std::endl;
+    auto names = std::to_array<std::pair<feature, const char*>>({
+            {feature::sse4_2, "sse4.2"}, {feature::popcnt, "popcnt"}, {feature::movbe, "movbe"},
+            {feature::avx, "avx"}, {feature::fma, "fma"}, {feature::avx2, "avx2"},
+            {feature::avx512f, "avx512f"}, {feature::bmi1, "bmi1"}, {feature::bmi2, "bmi2"},
+            {feature::lzcnt, "lzcnt"}, {feature::erms, "erms"}, {feature::fsrm, "fsrm"},
+            {feature::clzero, "clzero"}, {feature::rdtscp, "rdtscp"},
+            });
+    for (auto [f, name] : names) {
+        std::cout << name << " " << features.has(f) << std::endl;
+    }
+    assert(features.has(feature::sse4_2) == bool(__builtin_cpu_supports("sse4.2")));
+    assert(features.has(feature::popcnt) == bool(__builtin_cpu_supports("popcnt")));
+    assert(features.has(feature::avx2) == bool(__builtin_cpu_supports("avx2")));
+    assert(features.has(feature::avx512f) == bool(__builtin_cpu_supports("avx512f")));
+    assert(features.has(feature::bmi2) == bool(__builtin_cpu_supports("bmi2")));
+    // detected once per process
+    assert(cpu_features::host_features().bits() == features.bits());
+
+    auto ecx = reg<32>{ reg32::ecx };
+    auto ebx = reg<32>{ reg32::ebx };
+    auto edx = reg<32>{ reg32::edx };
+    assert(std::ranges::equal(popcnt(ecx, ebx), std::array<uint8_t, 4>{0xf3, 0x0f, 0xb8, 0xcb}));
+    assert(std::ranges::equal(
+                tzcnt(reg<64>{ reg64::rcx }, reg<64>{ reg64::rsi }),
+                std::array<uint8_t, 5>{0xf3, 0x48, 0x0f, 0xbc, 0xce}));
+    assert(std::ranges::equal(andn(ecx, ebx, edx), std::array<uint8_t, 5>{0xc4, 0xe2, 0x60, 0xf2, 0xca}));
+    assert(std::ranges::equal(blsr(ecx, ebx), std::array<uint8_t, 5>{0xc4, 0xe2, 0x70, 0xf3, 0xcb}));
+    assert(std::ranges::equal(
+                pdep(reg<64>{ reg64::rcx }, reg<64>{ reg64::rbx }, reg<64>{ reg64::rsi }),
+                std::array<uint8_t, 5>{0xc4, 0xe2, 0xe3, 0xf5, 0xce}));
+    assert(std::ranges::equal(shlx(ecx, ebx, edx), std::array<uint8_t, 5>{0xc4, 0xe2, 0x69, 0xf7, 0xcb}));
+
+    // run the instructions the host supports
+    if (features.has(feature::popcnt) && features.has(feature::bmi2)) {
+        // uint64_t (uint64_t x, uint64_t mask): popcnt(pext(x, mask))
+        auto codes = std::vector<uint8_t>{};
+        codes.append_range(pext(reg<64>{ reg64::rdi }, reg<64>{ reg64::rdi }, reg<64>{ reg64::rsi }));
+        codes.append_range(popcnt(reg<64>{ reg64::rax }, reg<64>{ reg64::rdi }));
+        codes.append_range(ret());
+        auto code = executable_memory::executable_memory{codes};
+        auto function = code.get<uint64_t(uint64_t, uint64_t)>();
+        assert(function(0b1011'0110, 0b1111'0000) == 3);
+    }
+
+    // the generic sequences, and the ones for the host
+    for (auto mask : {cpu_features::feature_mask{}, features}) {
+        auto eax = reg<32>{ reg32::eax };
+        auto edi = reg<32>{ reg32::edi };
+        auto clz_codes = cpu_features::count_leading_zeros(eax, edi, mask);
+        clz_codes.append_range(ret());
+        auto clz = executable_memory::executable_memory{clz_codes};
+        auto ctz_codes = cpu_features::count_trailing_zeros(eax, edi, mask);
+        ctz_codes.append_range(ret());
+        auto ctz = executable_memory::executable_memory{ctz_codes};
+        for (uint32_t x : {0u, 1u, 0x00f0'0000u, 0x8000'0000u, 0xffff'ffffu}) {
+            assert(clz.get<uint32_t(uint32_t)>()(x) == static_cast<uint32_t>(std::countl_zero(x)));
+            assert(ctz.get<uint32_t(uint32_t)>()(x) == static_cast<uint32_t>(std::countr_zero(x)));
+        }
+
+        // void (void* dst, const void* src, size_t size)
+        auto copy_codes = std::vector<uint8_t>{};
+        copy_codes.append_range(mov(reg<64>{ reg64::rcx }, reg<64>{ reg64::rdx }));
+        copy_codes.append_range(cpu_features::copy_memory(mask));
+        copy_codes.append_range(ret());
+        auto copy = executable_memory::executable_memory{copy_codes};
+        auto source = std::string{"multiversioned code generation"};
+        auto destination = std::string(source.size(), ' ');
+        copy.get<void(void*, const void*, size_t)>()(destination.data(), source.data(), source.size());
+        assert(destination == source);
+    }
+    return 0;
+}
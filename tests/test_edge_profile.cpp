@@ -0,0 +1,104 @@
+#include "edge_profile.hpp"
+#include "executable_memory.hpp"
+
+#include <cassert>
+#include <iostream>
+#include <sstream>
+#include <cstring>
+
+// uint32_t (uint32_t n): n + (n - 1) + ... + 1
+auto gen_sum(code_buffer::code_buffer& buffer) {
+    using namespace amd64;
+    using namespace amd64::register_type;
+    auto eax_reg = reg<32>{ reg32::eax };
+    auto edi = reg<32>{ reg32::edi };
+
+    auto entry = buffer.new_label();
+    auto loop = buffer.new_label();
+    auto done = buffer.new_label();
+    buffer.begin_function(entry);
+    buffer.append(bit_xor(eax_reg, eax_reg));
+    buffer.append(test(edi, edi));
+    buffer.jcc(0x4, done);
+    buffer.bind(loop);
+    buffer.append(add(eax_reg, edi));
+    buffer.append(sub(edi, uint32_t{1}));
+    buffer.jcc(0x5, loop);
+    buffer.bind(done);
+    buffer.append_branch(ret());
+    return std::tuple{entry, loop, done};
+}
+
+int main() {
+    using code_buffer::counter_kind;
+
+    for (auto atomic : {false, true}) {
+        auto buffer = code_buffer::code_buffer{{}, {.capacity = 16, .atomic = atomic}};
+        auto [entry, loop, done] = gen_sum(buffer);
+        buffer.link();
+        auto counters = edge_profile::counters{buffer};
+        auto sum = counters.memory().get<uint32_t(uint32_t)>();
+
+        // three blocks and two taken edges
+        auto& sites = buffer.counters();
+        assert(sites.size() == 5);
+        assert(sites[0].kind == counter_kind::block && sites[0].target == entry);
+        assert(sites[1].kind == counter_kind::block && sites[1].target == loop);
+        assert(sites[2].kind == counter_kind::block && sites[2].target == done);
+        assert(sites[3].kind == counter_kind::taken && sites[3].target == done);
+        assert(sites[4].kind == counter_kind::taken && sites[4].target == loop);
+
+        // lock inc qword [rip + disp32], to the first counter on the page after the code
+        auto increment = std::vector<uint8_t>{0x48, 0xff, 0x05};
+        if (atomic) {
+            increment.insert(increment.begin(), 0xf0);
+        }
+        assert(std::ranges::equal(std::span{buffer.codes()}.subspan(buffer.offset(entry), increment.size()), increment));
+        auto disp32_offset = buffer.offset(entry) + increment.size();
+        auto disp32 = int32_t{};
+        std::memcpy(&disp32, buffer.codes().data() + disp32_offset, sizeof(disp32));
+        assert(disp32_offset + 4 + disp32 == buffer.counters_offset());
+        assert(buffer.counters_offset() >= buffer.size() && buffer.counters_offset() % code_buffer::page_size == 0);
+
+        assert(sum(10) == 55);
+        assert(sum(0) == 0);
+        assert(sum(3) == 6);
+
+        auto counts = edge_profile::read(counters, buffer);
+        auto values = std::vector<uint64_t>{};
+        for (const auto& c : counts) {
+            values.emplace_back(c.value);
+        }
+        // entries 3, loop entered 10 + 3 times, of which 9 + 2 from the back edge
+        assert(values == std::vector<uint64_t>({3, 13, 3, 1, 11}));
+
+        auto out = std::ostringstream{};
+        edge_profile::write(out, counts);
+        std::cout << out.str();
+        assert(out.str().starts_with("block 0 3\nblock 1 13\n"));
+
+        counters.reset();
+        assert(std::ranges::all_of(counters.values(), [](auto v) { return v == 0; }));
+    }
+
+    // without profiling, nothing is inserted
+    {
+        auto plain = code_buffer::code_buffer{};
+        gen_sum(plain);
+        plain.link();
+        assert(plain.counters().empty());
+
+        auto buffer = code_buffer::code_buffer{{}, {.capacity = 2}};
+        bool thrown = false;
+        try {
+            gen_sum(buffer);
+            buffer.link();
+        }
+        catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+
+    return 0;
+}
@@ -0,0 +1,124 @@
+#include "if_conversion.hpp"
+#include "copy_propagation.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <vector>
+
+enum op_t : uint32_t {
+    label,
+    jmp,
+    jcc,
+    mov,
+    cmov,
+    add,
+    ret,
+};
+
+struct instruction {
+    using register_t = uint32_t;
+
+    op_t op;
+    std::vector<uint32_t> reads;
+    std::vector<uint32_t> writes;
+    // label defined or jumped to
+    uint32_t target;
+    uint8_t condition;
+
+    auto& get_reads() const {
+        return reads;
+    }
+    auto& get_writes() const {
+        return writes;
+    }
+};
+
+auto classify(const instruction& instruction) {
+    using kind = control_flow::control_kind;
+    switch (instruction.op) {
+    case label: return control_flow::control{kind::label, instruction.target};
+    case jmp: return control_flow::control{kind::jump, instruction.target};
+    case jcc: return control_flow::control{kind::conditional_jump, instruction.target, instruction.condition};
+    case ret: return control_flow::control{kind::ret};
+    default: return control_flow::control{kind::other};
+    }
+}
+
+int main() {
+    constexpr uint8_t l = 0xc;
+
+    auto instructions = std::vector<instruction>{
+        // diamond: r2 = r0 < r1 ? r1 : r0
+        {jcc, {}, {}, 0, l},
+        {mov, {0}, {2}},
+        {jmp, {}, {}, 1},
+        {label, {}, {}, 0},
+        {mov, {1}, {2}},
+        {label, {}, {}, 1},
+        // triangle: if (!(r0 < r1)) r3 = r2
+        {jcc, {}, {}, 2, l},
+        {mov, {2}, {3}},
+        {label, {}, {}, 2},
+        // not convertible: add is not a move
+        {jcc, {}, {}, 3, l},
+        {add, {0, 1}, {4}},
+        {label, {}, {}, 3},
+        // the else label is reached from another jump as well
+        {jcc, {}, {}, 4, l},
+        {mov, {0}, {5}},
+        {jmp, {}, {}, 5},
+        {label, {}, {}, 4},
+        {mov, {1}, {5}},
+        {label, {}, {}, 5},
+        {jmp, {}, {}, 4},
+        {ret},
+    };
+
+    auto converted = if_conversion::convert_branches(instructions, 4, classify,
+            [](const instruction& instruction) { return instruction.op == mov; },
+            // the destination keeps its value when the condition is false
+            [](instruction move, uint8_t condition) {
+                move.op = cmov;
+                move.condition = condition;
+                move.reads.append_range(move.writes);
+                return move;
+            });
+
+    for (const auto& instruction : converted.instructions) {
+        std::cout << instruction.op << "(" << instruction.target << "," << (int)instruction.condition << "):";
+        for (auto reg : instruction.reads) {
+            std::cout << reg << ", ";
+        }
+        std::cout << "->";
+        for (auto reg : instruction.writes) {
+            std::cout << reg << ", ";
+        }
+        std::cout << std::endl;
+    }
+
+    assert(converted.converted == 2);
+    assert(converted.instructions.size() == instructions.size() - 6);
+    assert(converted.instructions[0].op == cmov && converted.instructions[0].condition == (l ^ 1));
+    assert(converted.instructions[1].op == cmov && converted.instructions[1].condition == l);
+    assert(converted.instructions[2].op == cmov && converted.instructions[2].reads[0] == 2);
+    assert(converted.instructions[3].op == jcc);
+    assert(std::ranges::count(converted.instructions, cmov, &instruction::op) == 3);
+
+    // both cmovs of the diamond stay live through dead code elimination
+    {
+        auto diamond = std::vector<instruction>{converted.instructions[0], converted.instructions[1], {ret}};
+        auto is_copy = [](const instruction& instruction) { return instruction.op == mov; };
+        auto translate_registers = [](instruction in, auto writes, auto reads) {
+            in.reads.assign(reads.begin(), reads.end());
+            in.writes.assign(writes.begin(), writes.end());
+            return in;
+        };
+        auto propagated = copy_propagation::propagate_copies(diamond, classify, is_copy, translate_registers);
+        auto optimized = copy_propagation::eliminate_dead_code(propagated, std::vector<uint32_t>{2}, classify, is_copy,
+                [](const instruction&) { return true; }, translate_registers);
+        assert(std::ranges::count(optimized, cmov, &instruction::op) == 2);
+    }
+
+    return 0;
+}
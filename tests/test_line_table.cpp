@@ -0,0 +1,169 @@
+#include "line_table.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+// rows of a DWARF 4 line program with one sequence, as (address, line, column)
+auto run_line_program(const std::vector<uint8_t>& section) {
+    auto read = [&](size_t offset, size_t size) {
+        uint64_t value = 0;
+        std::memcpy(&value, section.data() + offset, size);
+        return value;
+    };
+    assert(read(0, 4) + 4 == section.size());
+    assert(read(4, 2) == 4);
+    auto header_length = read(6, 4);
+    auto line_base = static_cast<int8_t>(section[13]);
+    auto line_range = section[14];
+    auto opcode_base = section[15];
+    size_t i = 10 + header_length;
+
+    auto rows = std::vector<std::tuple<uint64_t, uint32_t, uint32_t>>{};
+    uint64_t address = 0;
+    int64_t line = 1;
+    uint64_t column = 0;
+    bool ended = false;
+    while (i < section.size()) {
+        auto opcode = section[i++];
+        if (opcode >= opcode_base) {
+            auto adjusted = opcode - opcode_base;
+            address += adjusted / line_range;
+            line += line_base + adjusted % line_range;
+            rows.emplace_back(address, line, column);
+            continue;
+        }
+        switch (opcode) {
+        case 0:
+        {
+            auto length = line_table::read_uleb128(section, i);
+            auto sub = section[i];
+            if (sub == 2) {
+                address = read(i + 1, 8);
+            }
+            else if (sub == 1) {
+                ended = true;
+            }
+            i += length;
+            break;
+        }
+        case 1:
+            rows.emplace_back(address, line, column);
+            break;
+        case 2:
+            address += line_table::read_uleb128(section, i);
+            break;
+        case 3:
+            line += line_table::read_sleb128(section, i);
+            break;
+        case 5:
+            column = line_table::read_uleb128(section, i);
+            break;
+        default:
+            assert(false);
+        }
+    }
+    assert(ended);
+    return std::pair{rows, address};
+}
+
+int main() {
+    // the scanner keeps the line and column of every token
+    {
+        auto in = std::istringstream{"add ax 1\n  ret\n\n\tmov  rbx 2"};
+        auto scanner = scanner::scanner{in};
+        auto positions = std::vector<scanner::position>{};
+        while (scanner.next()) {
+            positions.emplace_back(scanner.last_position());
+        }
+        auto expected = std::vector<scanner::position>{{1, 1}, {1, 5}, {1, 8}, {2, 3}, {4, 2}, {4, 7}, {4, 11}};
+        assert(positions == expected);
+    }
+
+    // lookups across checkpoints agree with the rows
+    {
+        auto table = line_table::line_table{};
+        auto rows = std::vector<line_table::row>{};
+        size_t offset = 0;
+        for (uint32_t i = 0; i < 1000; i++) {
+            auto position = scanner::position{1 + i + i / 7, 1 + i % 5};
+            table.add(offset, position);
+            rows.push_back({offset, position});
+            offset += 1 + i % 9;
+        }
+        table.set_end(offset);
+        assert(table.size() == 1000);
+        std::cout << "encoded size: " << table.encoded_size() << " for " << table.size() << " rows" << std::endl;
+        assert(table.encoded_size() <= 3 * table.size());
+        auto decoded = table.rows();
+        assert(decoded.size() == rows.size());
+        for (size_t i = 0; i < rows.size(); i++) {
+            assert(decoded[i].offset == rows[i].offset && decoded[i].position == rows[i].position);
+        }
+        size_t r = 0;
+        for (size_t o = 0; o < offset; o++) {
+            while (r + 1 < rows.size() && rows[r + 1].offset <= o) {
+                r++;
+            }
+            assert(table.lookup(o) == rows[r].position);
+        }
+        assert(!table.lookup(offset));
+
+        bool thrown = false;
+        try {
+            table.add(0, {1, 1});
+        }
+        catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+
+    // statements map to their positions, and a later row at an offset hides earlier ones
+    {
+        using namespace amd64::register_type;
+        auto statements = std::vector<amd64::statement>{
+            {amd64::operation::add, std::tuple<reg<32>, reg<32>>(reg<32>{reg32::ecx}, reg<32>{reg32::ebx})},
+            {amd64::operation::add, std::tuple<reg<32>, reg<32>, reg<32>>(reg<32>{reg32::ecx}, reg<32>{reg32::ebx}, reg<32>{reg32::esi})},
+            {amd64::operation::adc, std::tuple<reg<32>, uint32_t>(reg<32>{reg32::ecx}, 1000)},
+            {amd64::operation::div, std::tuple<reg<32>, uint32_t>(reg<32>{reg32::ecx}, 7)},
+        };
+        auto positions = std::vector<scanner::position>{{1, 1}, {2, 1}, {3, 5}, {4, 1}};
+        auto [codes, table] = line_table::assemble(statements, positions);
+        assert(codes == amd64::assemble(statements));
+        auto first_size = amd64::assemble(statements[0]).size();
+        auto adc_offset = first_size;
+        // the second statement encodes nothing, so its row is hidden
+        assert(table.lookup(0) == (scanner::position{1, 1}));
+        assert(table.lookup(first_size - 1) == (scanner::position{1, 1}));
+        assert(table.lookup(adc_offset) == (scanner::position{3, 5}));
+        assert(table.lookup(codes.size() - 1) == (scanner::position{4, 1}));
+
+        // .debug_line runs back to the same rows
+        uint64_t base = 0x401000;
+        auto section = line_table::write_debug_line(table, "test.s", base);
+        auto [program_rows, end_address] = run_line_program(section);
+        assert(end_address == base + codes.size());
+        auto expected = std::vector<std::tuple<uint64_t, uint32_t, uint32_t>>{
+            {base, 1, 1}, {base + adc_offset, 3, 5}, {base + adc_offset + amd64::assemble(statements[2]).size(), 4, 1}};
+        assert(program_rows == expected);
+        auto file = std::string_view{reinterpret_cast<const char*>(section.data()) + 10 + 6 + 12 + 1, 6};
+        assert(file == "test.s");
+    }
+
+    // large line steps and long statements leave the special opcode range
+    {
+        auto table = line_table::line_table{};
+        table.add(0, {1, 1});
+        table.add(300, {1000, 2});
+        table.add(301, {10, 3});
+        table.set_end(302);
+        auto [program_rows, end_address] = run_line_program(line_table::write_debug_line(table, "a.s"));
+        auto expected = std::vector<std::tuple<uint64_t, uint32_t, uint32_t>>{{0, 1, 1}, {300, 1000, 2}, {301, 10, 3}};
+        assert(program_rows == expected);
+        assert(end_address == 302);
+    }
+
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include "microbenchmark.hpp"
+#include "performance_model.hpp"
+
+#include <cassert>
+#include <iostream>
+
+int main() {
+    using namespace amd64;
+    using namespace amd64::register_type;
+
+    auto to_vector = [](const auto& codes) {
+        return std::vector<uint8_t>(codes.begin(), codes.end());
+    };
+
+    // the timed loop is made of instructions the model knows
+    auto body = to_vector(add(reg<32>{reg32::eax}, reg<32>{reg32::ecx}));
+    auto serializing = [](const auto& loop) {
+        auto decoded = performance_model::decode(loop);
+        return std::ranges::count(decoded, performance_model::instruction_class::serializing, &performance_model::decoded_instruction::kind);
+    };
+    auto vzerouppers = [](const auto& loop) {
+        auto decoded = performance_model::decode(loop);
+        return std::ranges::count(decoded, performance_model::instruction_class::vzeroupper, &performance_model::decoded_instruction::kind);
+    };
+    using cpu_features::feature;
+    // cpuid, rdtsc, rdtscp and cpuid, or one more cpuid without rdtscp
+    assert(serializing(microbenchmark::gen_timed_loop(body, 10, {feature::rdtscp})) == 4);
+    assert(serializing(microbenchmark::gen_timed_loop(body, 10, {})) == 5);
+    assert(vzerouppers(microbenchmark::gen_timed_loop(body, 10, {feature::rdtscp})) == 0);
+    assert(vzerouppers(microbenchmark::gen_timed_loop(body, 10, {feature::rdtscp, feature::avx})) == 1);
+    assert(microbenchmark::time_loop(body, 1000, 4) > 0);
+    // a body clobbering r12 to r15 leaves the caller's values alone
+    {
+        auto clobber = std::vector<uint8_t>{};
+        for (uint8_t r = 4; r < 8; r++) {
+            // mov r12d..r15d, 0
+            clobber.append_range(std::to_array<uint8_t>({0x41, static_cast<uint8_t>(0xb8 + r), 0, 0, 0, 0}));
+        }
+        register uint64_t r12 asm("r12") = 12;
+        register uint64_t r15 asm("r15") = 15;
+        asm volatile("" : "+r"(r12), "+r"(r15));
+        assert(microbenchmark::time_loop(clobber, 10, 1) > 0);
+        asm volatile("" : "+r"(r12), "+r"(r15));
+        assert(r12 == 12 && r15 == 15);
+    }
+
+    auto ticks_per_cycle = microbenchmark::ticks_per_cycle();
+    assert(ticks_per_cycle > 0);
+
+    auto ecx = reg<32>{reg32::ecx};
+    auto edi = reg<32>{reg32::edi};
+    auto imul_benchmark = microbenchmark::instruction_benchmark{"imul", to_vector(imul(ecx, ecx, int8_t{3})), {}};
+    for (auto r : {reg32::eax, reg32::ecx, reg32::edx, reg32::ebx, reg32::esi}) {
+        imul_benchmark.independent.emplace_back(to_vector(imul(reg<32>{r}, edi, int8_t{3})));
+    }
+    auto imul_result = microbenchmark::measure(imul_benchmark, ticks_per_cycle);
+    std::cout << "imul: latency " << imul_result.latency
+        << ", reciprocal throughput " << imul_result.reciprocal_throughput << std::endl;
+    // a multiply takes a few cycles, and several are in flight at once;
+    // timings depend on the host and its load, so they only warn
+    if (!(imul_result.latency > 1.5 && imul_result.latency < 6) ||
+            !(imul_result.reciprocal_throughput < imul_result.latency)) {
+        std::cerr << "warning: unexpected imul timings" << std::endl;
+    }
+
+    // a chain of loads through the scratch memory pointing to itself
+    auto load = to_vector(mov(reg<64>{reg64::rdi}, mem<64>{modrm_reg64_address::rdi}));
+    auto load_latency = microbenchmark::measure({load}) / ticks_per_cycle;
+    std::cout << "load: latency " << load_latency << std::endl;
+    if (!(load_latency > 2)) {
+        std::cerr << "warning: unexpected load latency" << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,203 @@
+#include "outlining.hpp"
+
+#include <cassert>
+#include <iostream>
+#include <random>
+#include <span>
+#include <vector>
+
+enum op_t : uint8_t {
+    label,
+    jmp,
+    jcc,
+    mov,
+    add,
+    // addresses the stack
+    push,
+    call,
+    ret,
+    // loads rip-relative
+    load_constant,
+    // stores below rsp
+    spill,
+};
+
+struct instruction {
+    op_t op;
+    std::vector<uint8_t> reads;
+    std::vector<uint8_t> writes;
+    // label defined or jumped to, or function called
+    uint32_t target;
+    uint8_t condition;
+};
+
+auto classify(const instruction& instruction) {
+    using kind = control_flow::control_kind;
+    switch (instruction.op) {
+    case label: return control_flow::control{kind::label, instruction.target};
+    case jmp: return control_flow::control{kind::jump, instruction.target};
+    case jcc: return control_flow::control{kind::conditional_jump, instruction.target, instruction.condition};
+    case ret: return control_flow::control{kind::ret};
+    default: return control_flow::control{kind::other};
+    }
+}
+
+auto get_encoding(const instruction& instruction) {
+    auto bytes = std::vector<uint8_t>{instruction.op};
+    if (instruction.op == call) {
+        bytes.append_range(std::to_array<uint8_t>({static_cast<uint8_t>(instruction.target), 0, 0, 0}));
+    }
+    else if (instruction.op != ret) {
+        bytes.append_range(instruction.reads);
+        bytes.append_range(instruction.writes);
+    }
+    return bytes;
+}
+
+auto get_hazards(const instruction& instruction) {
+    return outlining::hazards{
+        .position_relative = instruction.op == load_constant,
+        .uses_stack = instruction.op == push || instruction.op == call,
+        .uses_red_zone = instruction.op == spill,
+    };
+}
+
+auto outline(const std::vector<std::vector<instruction>>& functions, outlining::options opts = {}) {
+    return outlining::outline_sequences(functions, classify, get_hazards,
+            [](const instruction&) { return true; },
+            get_encoding,
+            [](uint32_t index) { return instruction{call, {}, {}, index}; },
+            []() { return instruction{ret}; },
+            opts);
+}
+
+// the functions with the calls replaced by the outlined bodies
+auto expand(const outlining::outlined_instructions<instruction>& outlined) {
+    auto functions = std::vector<std::vector<instruction>>{};
+    for (const auto& function : outlined.functions) {
+        auto& expanded = functions.emplace_back();
+        for (const auto& i : function) {
+            if (i.op == call) {
+                const auto& body = outlined.outlined[i.target];
+                expanded.insert(expanded.end(), body.begin(), body.end() - 1);
+            }
+            else {
+                expanded.emplace_back(i);
+            }
+        }
+    }
+    return functions;
+}
+
+auto encodings(const std::vector<std::vector<instruction>>& functions) {
+    auto result = std::vector<std::vector<uint8_t>>{};
+    for (const auto& function : functions) {
+        auto& bytes = result.emplace_back();
+        for (const auto& i : function) {
+            bytes.append_range(get_encoding(i));
+        }
+    }
+    return result;
+}
+
+int main() {
+    // suffix and lcp arrays agree with sorting the suffixes
+    {
+        auto engine = std::mt19937{7};
+        for (auto size : {1u, 2u, 10u, 100u, 1000u}) {
+            auto string = std::vector<uint32_t>(size);
+            for (auto& c : string) {
+                c = std::uniform_int_distribution<uint32_t>{0, 3}(engine);
+            }
+            auto sa = outlining::build_suffix_array(string, 4);
+            auto expected = std::vector<uint32_t>(size);
+            std::ranges::iota(expected, 0u);
+            std::ranges::sort(expected, [&](uint32_t l, uint32_t r) {
+                return std::ranges::lexicographical_compare(std::span{string}.subspan(l), std::span{string}.subspan(r));
+            });
+            assert(sa == expected);
+            auto lcp = outlining::build_lcp_array(string, sa);
+            for (uint32_t i = 1; i < size; i++) {
+                auto l = std::span{string}.subspan(sa[i - 1]);
+                auto r = std::span{string}.subspan(sa[i]);
+                auto [l_end, r_end] = std::ranges::mismatch(l, r);
+                assert(lcp[i] == l_end - l.begin());
+            }
+        }
+    }
+
+    // a sequence shared by three functions
+    auto shared = std::vector<instruction>{
+        {add, {0, 1}, {2}},
+        {mov, {2}, {3}},
+        {add, {3, 0}, {4}},
+        {mov, {4}, {5}},
+    };
+    auto functions = std::vector<std::vector<instruction>>(3);
+    for (uint8_t f = 0; f < 3; f++) {
+        functions[f].push_back({mov, {f}, {6}});
+        functions[f].append_range(shared);
+        functions[f].push_back({add, {6, f}, {7}});
+        functions[f].push_back({ret});
+    }
+    {
+        auto outlined = outline(functions);
+        assert(outlined.outlined.size() == 1);
+        assert(outlined.outlined[0].size() == shared.size() + 1 && outlined.outlined[0].back().op == ret);
+        for (const auto& function : outlined.functions) {
+            assert(function.size() == 4 && function[1].op == call);
+        }
+        assert(encodings(expand(outlined)) == encodings(functions));
+        // 14 bytes three times become three calls, 14 bytes and a ret
+        std::cout << "bytes: " << outlined.bytes_before << " -> " << outlined.bytes_after << std::endl;
+        assert(outlined.bytes_before - outlined.bytes_after == 3 * 14 - (3 * 5 + 14 + 1));
+    }
+
+    // hot code: calls that have to save more than they cost stay inline
+    {
+        auto outlined = outline(functions, {.call_penalty = 5});
+        assert(outlined.outlined.empty());
+        assert(encodings(outlined.functions) == encodings(functions));
+    }
+
+    // labels, stack accesses, calls and rip-relative loads split sequences,
+    // and what remains is too short
+    for (auto op : {label, push, call, load_constant}) {
+        auto split = functions;
+        for (auto& function : split) {
+            function.insert(function.begin() + 3, instruction{op, {}, {}, 9});
+        }
+        auto outlined = outline(split);
+        assert(outlined.outlined.empty());
+        assert(outlined.bytes_after == outlined.bytes_before);
+    }
+
+    // nothing is outlined from a function that uses the red zone
+    {
+        auto red_zone = functions;
+        red_zone[0].insert(red_zone[0].begin(), instruction{spill, {6}});
+        auto outlined = outline(red_zone);
+        assert(outlined.outlined.size() == 1);
+        assert(encodings({outlined.functions[0]}) == encodings({red_zone[0]}));
+        assert(outlined.functions[1][1].op == call && outlined.functions[2][1].op == call);
+    }
+
+    // many copies of a short sequence, and repeats within a repeat
+    {
+        auto repeated = std::vector<std::vector<instruction>>(1);
+        for (uint8_t i = 0; i < 40; i++) {
+            repeated[0].push_back({add, {0, 1}, {2}});
+            repeated[0].push_back({mov, {2}, {0}});
+            if (i % 4 == 3) {
+                repeated[0].push_back({jcc, {}, {}, i, 0x4});
+            }
+        }
+        repeated[0].push_back({ret});
+        auto outlined = outline(repeated);
+        assert(!outlined.outlined.empty());
+        assert(outlined.bytes_after < outlined.bytes_before);
+        assert(encodings(expand(outlined)) == encodings(repeated));
+    }
+
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include "perf_jit.hpp"
+
+#include <cassert>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+
+auto read_file(const std::filesystem::path& path) {
+    auto in = std::ifstream{path, std::ios::binary};
+    return std::vector<char>(std::istreambuf_iterator<char>{in}, {});
+}
+
+template<typename T>
+T read_value(const std::vector<char>& bytes, size_t offset) {
+    auto value = T{};
+    std::memcpy(&value, bytes.data() + offset, sizeof(T));
+    return value;
+}
+
+int main() {
+    using namespace amd64;
+    using namespace amd64::register_type;
+
+    // uint32_t one(), uint32_t two()
+    auto buffer = code_buffer::code_buffer{};
+    auto one = buffer.new_label();
+    auto two = buffer.new_label();
+    buffer.begin_function(one);
+    buffer.append(reg_imm_instruction<0xb0, 0xb8>{}(reg<32>{reg32::eax}, uint32_t{1}));
+    buffer.append_branch(ret());
+    buffer.begin_function(two);
+    buffer.append(reg_imm_instruction<0xb0, 0xb8>{}(reg<32>{reg32::eax}, uint32_t{2}));
+    buffer.append_branch(ret());
+    assert(buffer.functions() == std::vector<code_buffer::label>({one, two}));
+    auto memory = executable_memory::executable_memory{buffer.link()};
+    assert(reinterpret_cast<uint32_t(*)()>(const_cast<uint8_t*>(memory.data() + buffer.offset(two)))() == 2);
+
+    auto directory = std::filesystem::temp_directory_path() / ("test_perf_jit_" + std::to_string(getpid()));
+    std::filesystem::create_directories(directory);
+    auto pid = std::to_string(getpid());
+
+    // perf map lines
+    {
+        auto map = perf_jit::perf_map{directory.string()};
+        perf_jit::add_functions(map, memory, buffer, {"one", "two"});
+        map.flush();
+        auto in = std::ifstream{directory / ("perf-" + pid + ".map")};
+        auto line = std::string{};
+        auto lines = std::vector<std::string>{};
+        while (std::getline(in, line)) {
+            lines.emplace_back(line);
+        }
+        std::ranges::for_each(lines, [](auto& l) { std::cout << l << std::endl; });
+        assert(lines.size() == 2);
+        auto expect = [&](size_t i, size_t start, size_t size, const char* name) {
+            auto out = std::ostringstream{};
+            out << std::hex << reinterpret_cast<uintptr_t>(memory.data() + start) << ' ' << size << ' ' << name;
+            assert(lines[i] == out.str());
+        };
+        expect(0, 0, buffer.offset(two), "one");
+        expect(1, buffer.offset(two), memory.size() - buffer.offset(two), "two");
+
+        bool thrown = false;
+        try {
+            perf_jit::add_functions(map, memory, buffer, {"one"});
+        }
+        catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+
+    // jitdump: header, line numbers before the load of their code, and a close record
+    {
+        {
+            auto dump = perf_jit::jitdump{directory.string()};
+            auto lines = std::to_array<perf_jit::line_entry>({{0, 10, "generated.s"}, {5, 11, "generated.s"}});
+            dump.add(memory.data(), buffer.offset(two), "one", lines);
+            dump.add(memory.data() + buffer.offset(two), memory.size() - buffer.offset(two), "two");
+        }
+        auto bytes = read_file(directory / ("jit-" + pid + ".dump"));
+        assert(read_value<uint32_t>(bytes, 0) == 0x4a695444);
+        assert(read_value<uint32_t>(bytes, 8) == 40);
+        assert(read_value<uint32_t>(bytes, 12) == 62);
+        assert(read_value<uint32_t>(bytes, 20) == static_cast<uint32_t>(getpid()));
+
+        auto ids = std::vector<uint32_t>{};
+        auto names = std::vector<std::string>{};
+        size_t offset = 40;
+        while (offset < bytes.size()) {
+            auto id = read_value<uint32_t>(bytes, offset);
+            auto size = read_value<uint32_t>(bytes, offset + 4);
+            ids.emplace_back(id);
+            if (id == 0) {
+                auto address = read_value<uint64_t>(bytes, offset + 16 + 16);
+                auto code_size = read_value<uint64_t>(bytes, offset + 16 + 24);
+                auto name = std::string{bytes.data() + offset + 16 + 40};
+                names.emplace_back(name);
+                auto code = bytes.data() + offset + 16 + 40 + name.size() + 1;
+                assert(std::memcmp(code, reinterpret_cast<const void*>(address), code_size) == 0);
+                assert(offset + 16 + 40 + name.size() + 1 + code_size == offset + size);
+            }
+            if (id == 2) {
+                assert(read_value<uint64_t>(bytes, offset + 16) == reinterpret_cast<uint64_t>(memory.data()));
+                assert(read_value<uint64_t>(bytes, offset + 24) == 2);
+                assert(read_value<uint32_t>(bytes, offset + 32 + 8) == 10);
+                assert(std::string{bytes.data() + offset + 32 + 16} == "generated.s");
+            }
+            offset += size;
+        }
+        assert(offset == bytes.size());
+        assert(ids == std::vector<uint32_t>({2, 0, 0, 3}));
+        assert(names == std::vector<std::string>({"one", "two"}));
+    }
+
+    std::filesystem::remove_all(directory);
+    return 0;
+}
@@ -0,0 +1,186 @@
+#include "performance_model.hpp"
+
+#include <cassert>
+#include <iostream>
+
+int main() {
+    using namespace amd64;
+    using namespace amd64::register_type;
+    using namespace performance_model;
+
+    auto to_vector = [](const auto& codes) {
+        return std::vector<uint8_t>(codes.begin(), codes.end());
+    };
+    auto ecx = reg<32>{reg32::ecx};
+    auto edx = reg<32>{reg32::edx};
+    auto rdx = reg<64>{reg64::rdx};
+    auto rsi = reg<64>{reg64::rsi};
+    auto memory = mem<32>{modrm_reg64_address::rdi};
+    auto vector_memory = mem<256>{modrm_reg64_address::rdi};
+
+    // every encoder's output decodes to one instruction of the same length
+    auto samples = std::vector<std::vector<uint8_t>>{
+        to_vector(add(eax, ebx)), to_vector(adc(ebx, 5)), to_vector(adc(al, 5)),
+        to_vector(sub(rdx, rsi)), to_vector(cmp(ecx, uint32_t{1000})), to_vector(test(ecx, ecx)),
+        to_vector(bit_xor(ecx, ecx)), to_vector(mov(memory, ecx)), to_vector(mov(ecx, memory)),
+        to_vector(mov(rdx, rsi)), to_vector(reg_imm_instruction<0xb0, 0xb8>{}(ecx, uint32_t{63})),
+        to_vector(lea(ecx, mem<64, sib_address>{{reg64::rcx, reg64::rcx, 3}})),
+        to_vector(shl(ecx, 3)), to_vector(shl(ecx)), to_vector(sar(rdx, cl)),
+        to_vector(imul(ecx, ebx, int8_t{10})), to_vector(imul(ecx, ecx, 1000)),
+        to_vector(mul(ecx)), to_vector(amd64::div(rdx)), to_vector(neg(ecx)), to_vector(bit_not(memory)),
+        to_vector(cmovz(ecx, ebx)), to_vector(setb(reg<8>{reg8::cl})),
+        to_vector(push(rdx)), to_vector(pop(rdx)), to_vector(ret()), to_vector(cdq()),
+        to_vector(jnz(uint8_t{5})), to_vector(jnz(int32_t{-100})), to_vector(jmp(int32_t{0})),
+        to_vector(call(int32_t{0})), to_vector(cpuid()), to_vector(xgetbv()), to_vector(clzero()),
+        to_vector(rdtsc()), to_vector(rdtscp()),
+        to_vector(rep_movsb()), to_vector(rep_movsq()), to_vector(rep_stosq()),
+        to_vector(popcnt(ecx, edx)), to_vector(lzcnt(rdx, rsi)), to_vector(tzcnt(ecx, memory)),
+        to_vector(bsf(ecx, edx)), to_vector(bsr(ecx, edx)),
+        to_vector(andn(ecx, edx, ebx)), to_vector(bextr(rdx, rsi, rdx)), to_vector(blsr(ecx, edx)),
+        to_vector(bzhi(ecx, edx, ebx)), to_vector(pdep(rdx, rsi, rdx)), to_vector(pext(ecx, edx, ebx)),
+        to_vector(mulx(ecx, ebx, edx)), to_vector(rorx(rdx, rsi, 5)), to_vector(shlx(ecx, edx, ebx)),
+        to_vector(vmovdqu(ymm1, vector_memory)), to_vector(vmovdqu(vector_memory, ymm9)),
+        to_vector(vpaddd(ymm0, ymm1, ymm2)), to_vector(vpaddd(ymm8, ymm9, ymm10)),
+        to_vector(vfmadd231pd(ymm0, ymm1, ymm11)), to_vector(vpshufd(xmm0, xmm1, 0x1b)),
+        to_vector(vcmpps(ymm0, ymm1, ymm2, 1)), to_vector(vblendvps(ymm0, ymm1, ymm2, ymm3)),
+        to_vector(vpgatherdd(ymm0, mem<32, vsib_address<ymm<>>>{{reg64::rdi, ymm1, 2}}, ymm2)),
+        to_vector(vpermq(ymm0, ymm1, 0x4e)), to_vector(vperm2i128(ymm0, ymm1, ymm2, 0x21)),
+        to_vector(vpmovmskb(ecx, ymm1)), to_vector(vptest(ymm0, ymm1)), to_vector(vdivps(ymm0, ymm1, ymm2)),
+        to_vector(vzeroupper()),
+        to_vector(multi_byte_nop(1)), to_vector(multi_byte_nop(9)), to_vector(multi_byte_nop(15)),
+    };
+    for (const auto& sample : samples) {
+        auto decoded = decode(sample);
+        assert(decoded.size() == 1);
+        assert(decoded[0].length == sample.size());
+    }
+
+    // operands, flags and memory
+    {
+        auto i = decode_instruction(to_vector(add(memory, ecx)));
+        assert(i.kind == instruction_class::alu && i.loads && i.stores);
+        assert(i.reads == (gpr_bit(1) | gpr_bit(7)) && i.writes == flags);
+
+        i = decode_instruction(to_vector(adc(rdx, rsi)));
+        assert(i.kind == instruction_class::alu_carry);
+        assert(i.reads == (gpr_bit(2) | gpr_bit(6) | flags) && i.writes == (gpr_bit(2) | flags));
+
+        i = decode_instruction(to_vector(lea(ecx, mem<64, sib_address>{{reg64::rcx, reg64::rcx, 3}})));
+        assert(i.kind == instruction_class::lea && !i.loads && i.reads == gpr_bit(1) && i.writes == gpr_bit(1));
+
+        i = decode_instruction(to_vector(amd64::div(rdx)));
+        assert(i.kind == instruction_class::div64 && i.writes == (gpr_bit(0) | gpr_bit(2) | flags));
+
+        i = decode_instruction(to_vector(vpaddd(ymm8, ymm9, ymm10)));
+        assert(i.reads == (vec_bit(9) | vec_bit(10)) && i.writes == vec_bit(8));
+
+        i = decode_instruction(to_vector(vblendvps(ymm0, ymm1, ymm2, ymm3)));
+        assert(i.reads == (vec_bit(1) | vec_bit(2) | vec_bit(3)));
+
+        i = decode_instruction(to_vector(vpgatherdd(ymm0, mem<32, vsib_address<ymm<>>>{{reg64::rdi, ymm1, 2}}, ymm2)));
+        assert(i.kind == instruction_class::gather && i.loads);
+        assert(i.reads == (vec_bit(0) | vec_bit(1) | vec_bit(2) | gpr_bit(7)) && i.writes == (vec_bit(0) | vec_bit(2)));
+
+        i = decode_instruction(to_vector(mulx(ecx, ebx, edx)));
+        assert(i.reads == (gpr_bit(2) | gpr_bit(2)) && i.writes == (gpr_bit(1) | gpr_bit(3)));
+
+        // zeroing idioms break dependencies
+        assert(decode_instruction(to_vector(bit_xor(ecx, ecx))).kind == instruction_class::zero_idiom);
+        assert(decode_instruction(to_vector(bit_xor(ecx, edx))).kind == instruction_class::alu);
+        assert(decode_instruction(to_vector(vpxor(ymm0, ymm1, ymm1))).reads == 0);
+    }
+
+    // a chain carried from one iteration to the next bounds the loop
+    {
+        auto chain = std::vector<uint8_t>{};
+        chain.append_range(imul(ecx, ecx, int8_t{3}));
+        chain.append_range(add(edx, uint32_t{1}));
+        auto a = analyze(chain, skylake);
+        assert(a.instructions == 2 && a.uops == 2);
+        assert(a.critical_path == 3);
+        assert(a.dependency_bound == 3);
+        assert(a.cycles_per_iteration == 3);
+        assert(a.port_pressure[1] == 1);
+
+        // independent instructions are bound by the ports
+        auto independent = std::vector<uint8_t>{};
+        for (auto value : {reg32::eax, reg32::ecx, reg32::edx, reg32::ebx}) {
+            independent.append_range(imul(reg<32>{value}, reg<32>{reg32::esi}, int8_t{3}));
+        }
+        a = analyze(independent, skylake);
+        assert(a.dependency_bound == 0);
+        assert(a.throughput_bound == 4);
+        assert(a.critical_path == 3);
+
+        // eight adds level over four ports
+        auto adds = std::vector<uint8_t>{};
+        for (auto i = 0; i < 8; i++) {
+            adds.append_range(add(reg<32>{static_cast<reg32>(i % 4)}, reg<32>{reg32::esi}));
+        }
+        a = analyze(adds, skylake);
+        assert(a.throughput_bound == 2);
+        for (auto p : {0, 1, 5, 6}) {
+            assert(a.port_pressure[p] == 2);
+        }
+
+        // zen3 does three loads a cycle, skylake two
+        auto loads = std::vector<uint8_t>{};
+        for (auto i = 0; i < 6; i++) {
+            loads.append_range(mov(reg<32>{static_cast<reg32>(i % 4)}, memory));
+        }
+        assert(analyze(loads, skylake).throughput_bound == 3);
+        assert(analyze(loads, zen3).throughput_bound == 2);
+
+        // a load adds its latency to the chain
+        auto load_chain = to_vector(mov(reg<64>{reg64::rdi}, mem<64>{modrm_reg64_address::rdi}));
+        a = analyze(load_chain, skylake);
+        assert(a.dependency_bound == skylake.load_latency);
+        assert(analyze(load_chain, zen3).dependency_bound == zen3.load_latency);
+
+        // dividers are not pipelined
+        auto divisions = to_vector(amd64::div(reg<64>{reg64::rcx}));
+        divisions.append_range(mov(rdx, rsi));
+        a = analyze(divisions, skylake);
+        std::cout << "div64: " << a.cycles_per_iteration << " cycles on " << skylake.name
+            << ", " << analyze(divisions, zen3).cycles_per_iteration << " on " << zen3.name << std::endl;
+        assert(a.throughput_bound >= 21);
+    }
+
+    // picking between sequences: x * 9 with lea, or with imul
+    {
+        auto with_lea = multiply_by_constant(ecx, 9);
+        auto with_imul = to_vector(imul(ecx, ecx, int8_t{9}));
+        assert(choose_cheapest({with_imul, with_lea}, skylake) == 1);
+        // a longer lea chain loses to the multiply
+        auto lea_chain = std::vector<uint8_t>{};
+        for (auto i = 0; i < 4; i++) {
+            lea_chain.append_range(multiply_by_constant(ecx, 9));
+        }
+        assert(choose_cheapest({lea_chain, with_imul}, skylake) == 1);
+
+        auto statements = std::vector{
+            statement{operation::mul, std::tuple<reg<32>, uint32_t>(ecx, 24)},
+            statement{operation::div, std::tuple<reg<32>, uint32_t>(ecx, 3)},
+        };
+        auto a = analyze(statements, skylake);
+        std::cout << "x * 24 / 3: " << a.instructions << " instructions, critical path "
+            << a.critical_path << ", " << a.cycles_per_iteration << " cycles per iteration" << std::endl;
+        assert(a.instructions == 6);
+        assert(a.critical_path >= 1 + 1 + 4 + 1);
+    }
+
+    // the same tables drive the scheduler
+    assert(scheduling_timing(skylake, instruction_class::imul).latency == 3);
+    assert(scheduling_timing(skylake, instruction_class::alu, true).latency == 1 + skylake.load_latency);
+
+    bool threw = false;
+    try {
+        decode(std::vector<uint8_t>{0x0f, 0x0b});
+    }
+    catch (std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+
+    return 0;
+}
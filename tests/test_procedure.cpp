@@ -46,58 +46,63 @@ int main() {
         }
     };
 
-    auto instructions = procedure::inline_procedures(procedures, 1,
-            [](auto instruction) {
-                return instruction.callee;
-            },
-            [](std::vector<uint32_t> dests, std::vector<uint32_t> srcs) {
-                assert(dests.size() == srcs.size());
-                if (srcs.size() == 0) {
-                    return std::vector<instruction>{};
+    auto get_callee = [](auto instruction) {
+        return instruction.callee;
+    };
+    auto gen_copy_instructions = [](std::vector<uint32_t> dests, std::vector<uint32_t> srcs) {
+        assert(dests.size() == srcs.size());
+        if (srcs.size() == 0) {
+            return std::vector<instruction>{};
+        }
+        return std::vector{instruction{1, srcs, dests}};
+    };
+    auto is_call = [](auto instruction) { return instruction.op == 0; };
+    auto get_call_reads = [](auto instruction) { return instruction.reads; };
+    auto get_call_writes = [](auto instruction) { return instruction.writes; };
+    auto rename_registers = cpp_helper::overloads{
+        [](procedure<instruction> proc, auto start_register) {
+            for (auto& instruction : proc.instructions) {
+                for (auto& read : instruction.reads) {
+                    read += start_register;
                 }
-                return std::vector{instruction{1, srcs, dests}};
-            },
-            [](auto instruction) { return instruction.op == 0; },
-            [](auto instruction) { return instruction.reads; },
-            [](auto instruction) { return instruction.writes; },
-            cpp_helper::overloads{
-                [](procedure<instruction> proc, auto start_register) {
-                    for (auto& instruction : proc.instructions) {
-                        for (auto& read : instruction.reads) {
-                            read += start_register;
-                        }
-                        for (auto& write : instruction.writes) {
-                            write += start_register;
-                        }
-                    }
-                    return proc;
-                },
-                [](instruction instruction, auto start_register) {
-                    for (auto& read : instruction.reads) {
-                        read += start_register;
-                    }
-                    for (auto& write : instruction.writes) {
-                        write += start_register;
-                    }
-                    return instruction;
-                },
-                [](std::vector<uint32_t> regs, auto  start_register) {
-                    for (auto& reg : regs) {
-                        reg += start_register;
-                    }
-                    return regs;
+                for (auto& write : instruction.writes) {
+                    write += start_register;
                 }
-            },
-            [](auto instruction) {
-                auto max = [](auto range) {
-                    return std::ranges::fold_left(range, 0u,
-                            [](auto l, auto r){
-                                return std::max(l, r)+1;
-                            });
-                };
-                return std::max(max(instruction.reads), max(instruction.writes));
             }
-            );
+            return proc;
+        },
+        [](instruction instruction, auto start_register) {
+            for (auto& read : instruction.reads) {
+                read += start_register;
+            }
+            for (auto& write : instruction.writes) {
+                write += start_register;
+            }
+            return instruction;
+        },
+        [](std::vector<uint32_t> regs, auto  start_register) {
+            for (auto& reg : regs) {
+                reg += start_register;
+            }
+            return regs;
+        }
+    };
+    auto next_register = [](auto instruction) {
+        auto max = [](auto range) {
+            return std::ranges::fold_left(range, 0u,
+                    [](auto l, auto r){
+                        return std::max(l, r)+1;
+                    });
+        };
+        return std::max(max(instruction.reads), max(instruction.writes));
+    };
+    auto inline_procedures = [&](const auto& procedures, uint32_t start_procedure_index) {
+        return procedure::inline_procedures(procedures, start_procedure_index,
+                get_callee, gen_copy_instructions, is_call, get_call_reads, get_call_writes,
+                rename_registers, next_register);
+    };
+
+    auto instructions = inline_procedures(procedures, 1);
 
     for (auto inst : instructions) {
         std::cout << inst.op << ": " ;
@@ -117,6 +122,133 @@ int main() {
 
         std::cout << std::endl;
     }
+    assert(instructions.size() == 6);
+    // the callee's registers must not overlap the caller's
+    assert(std::ranges::min(instructions[2].writes) > 7);
+
+    auto recursive_procedures = procedures;
+    recursive_procedures[0].instructions.push_back({0, {}, {}, {}, {}, 1});
+    auto recursion_detected = false;
+    try {
+        inline_procedures(recursive_procedures, 1);
+    }
+    catch (std::runtime_error&) {
+        recursion_detected = true;
+    }
+    assert(recursion_detected);
+
+    // a callee called from several sites stays out of line once over budget
+    // registers precolored to r0 to r15, and calls reading and writing them
+    auto physical_register = [](amd64::system_v::register_index reg) { return 1000u + reg; };
+    auto gen_call = [](instruction call, std::vector<uint32_t> arguments, std::vector<uint32_t> results) {
+        call.op = 4;
+        call.reads = arguments;
+        call.writes = results;
+        return std::vector{call};
+    };
+    auto gen_ret = []() { return instruction{5}; };
+    auto shared_procedures = procedures;
+    shared_procedures[1].instructions.push_back({0, {}, {}, {}, {}, 0});
+    auto small_budget = procedure::inline_budget{.max_callee_size = 1, .max_growth = 0};
+    auto outlined = procedure::inline_procedures(shared_procedures, 1, small_budget,
+            get_callee, gen_copy_instructions, is_call, get_call_reads, get_call_writes,
+            rename_registers, next_register, physical_register, gen_call, gen_ret);
+    assert((outlined.procedure_indices == std::vector<uint32_t>{1, 0}));
+    assert(std::ranges::count(outlined.instructions[0], 4u, &instruction::op) == 2);
+    assert(outlined.instructions[1].size() == shared_procedures[0].instructions.size() + 1);
+    assert(outlined.instructions[1].back().op == 5);
+    assert((outlined.makes_calls == std::vector<bool>{true, false}));
+
+    auto generous_budget = procedure::inline_budget{};
+    auto all_inlined = procedure::inline_procedures(shared_procedures, 1, generous_budget,
+            get_callee, gen_copy_instructions, is_call, get_call_reads, get_call_writes,
+            rename_registers, next_register, physical_register, gen_call, gen_ret);
+    assert(all_inlined.procedure_indices.size() == 1);
+    assert(std::ranges::count(all_inlined.instructions[0], 4u, &instruction::op) == 0);
+
+    // recursive calls fall back to real calls instead of failing
+    auto recursive_outlined = procedure::inline_procedures(recursive_procedures, 1, generous_budget,
+            get_callee, gen_copy_instructions, is_call, get_call_reads, get_call_writes,
+            rename_registers, next_register, physical_register, gen_call, gen_ret);
+    assert(recursive_outlined.procedure_indices.size() == 2);
+
+    // a wide procedure calling each of many callees several times lists each once
+    {
+        constexpr uint32_t width = 20000;
+        auto wide = std::vector<procedure<instruction>>(width + 1);
+        for (uint32_t round = 0; round < 3; round++) {
+            for (uint32_t callee = 1; callee <= width; callee++) {
+                wide[0].instructions.push_back({0, {}, {}, {}, {}, callee});
+            }
+        }
+        auto graph = procedure::build_call_graph(wide, 0, get_callee, is_call);
+        assert(graph.callees[0].size() == width);
+        assert(graph.order.size() == width + 1 && graph.order.back() == 0);
+    }
+
+    // System V registers at the call sites and at the callee's entry and return
+    {
+        auto with_arguments = std::vector<procedure<instruction>>{
+            {
+                {0, 1},
+                {2},
+                {
+                    {3, {0, 1}, {2}},
+                }
+            },
+            {
+                {},
+                {},
+                {
+                    {1, {}, {0, 1}},
+                    {0, {0, 1}, {5}, {}, {}, 0},
+                    {0, {1, 0}, {6}, {}, {}, 0},
+                    {2, {5, 6}, {7}},
+                }
+            }
+        };
+        auto called = procedure::inline_procedures(with_arguments, 1, small_budget,
+                get_callee, gen_copy_instructions, is_call, get_call_reads, get_call_writes,
+                rename_registers, next_register, physical_register, gen_call, gen_ret);
+        assert((called.procedure_indices == std::vector<uint32_t>{1, 0}));
+        assert((called.assignments[1].argument_registers == std::vector<amd64::system_v::register_index>{7, 6}));
+        const auto& caller = called.instructions[0];
+        assert(caller.size() == 8);
+        assert((caller[1].reads == std::vector<uint32_t>{0, 1} && caller[1].writes == std::vector<uint32_t>{1007, 1006}));
+        assert((caller[2].op == 4 && caller[2].reads == std::vector<uint32_t>{1007, 1006}));
+        assert((caller[2].writes == std::vector<uint32_t>{1000}));
+        assert((caller[3].reads == std::vector<uint32_t>{1000} && caller[3].writes == std::vector<uint32_t>{5}));
+        assert((caller[4].reads == std::vector<uint32_t>{1, 0}));
+        const auto& callee = called.instructions[1];
+        assert(callee.size() == 4);
+        assert((callee[0].reads == std::vector<uint32_t>{1007, 1006} && callee[0].writes == std::vector<uint32_t>{0, 1}));
+        assert((callee[2].reads == std::vector<uint32_t>{2} && callee[2].writes == std::vector<uint32_t>{1000}));
+        assert(callee[3].op == 5);
+
+        // the growth counts the argument and result copies of every inlined call site
+        auto tight_budget = procedure::inline_budget{.max_growth = 4};
+        auto copies_counted = procedure::inline_procedures(with_arguments, 1, tight_budget,
+                get_callee, gen_copy_instructions, is_call, get_call_reads, get_call_writes,
+                rename_registers, next_register, physical_register, gen_call, gen_ret);
+        assert(copies_counted.procedure_indices.size() == 2);
+        tight_budget.max_growth = 5;
+        auto copies_fit = procedure::inline_procedures(with_arguments, 1, tight_budget,
+                get_callee, gen_copy_instructions, is_call, get_call_reads, get_call_writes,
+                rename_registers, next_register, physical_register, gen_call, gen_ret);
+        assert(copies_fit.procedure_indices.size() == 1);
+        // two calls, each an argument copy, the callee and a result copy
+        assert(copies_fit.instructions[0].size() == with_arguments[1].instructions.size() - 2 + 2 * 3);
+
+        // seven arguments do not fit in registers, so the callee is inlined
+        auto many_arguments = with_arguments;
+        many_arguments[0].reads = {0, 1, 2, 3, 4, 5, 8};
+        many_arguments[1].instructions[1].reads = {0, 1, 0, 1, 0, 1, 0};
+        many_arguments[1].instructions[2].reads = {1, 0, 1, 0, 1, 0, 1};
+        auto inlined = procedure::inline_procedures(many_arguments, 1, small_budget,
+                get_callee, gen_copy_instructions, is_call, get_call_reads, get_call_writes,
+                rename_registers, next_register, physical_register, gen_call, gen_ret);
+        assert(inlined.procedure_indices.size() == 1);
+    }
 
     return 0;
 }
@@ -0,0 +1,158 @@
+#include "program_generator.hpp"
+#include "scanner.hpp"
+
+#include <cassert>
+#include <iostream>
+#include <sstream>
+
+int main() {
+    using namespace program_generator;
+
+    // the same seed gives the same program, another seed another one
+    {
+        auto cfg = config{.seed = 7, .instructions = 2000};
+        assert(generate_text(cfg) == generate_text(cfg));
+        auto other = cfg;
+        other.seed = 8;
+        assert(generate_text(cfg) != generate_text(other));
+    }
+
+    // a line per instruction, and a ret, all read by the scanner
+    {
+        auto cfg = config{.instructions = 5000, .register_pressure = 4};
+        auto text = generate_text(cfg);
+        assert(std::ranges::count(text, '\n') == 5001);
+        assert(text.find("r8") == std::string::npos);
+
+        auto in = std::istringstream{text};
+        auto scanner = scanner::scanner{in};
+        size_t tokens = 0;
+        while (scanner.next()) {
+            tokens++;
+        }
+        std::cout << "tokens: " << tokens << std::endl;
+        assert(tokens > 5001);
+    }
+
+    // statements assemble; multiplies and divides keep off eax and edx
+    {
+        auto cfg = config{.instructions = 3000, .register_pressure = 6};
+        auto statements = generate_statements(cfg);
+        assert(statements.size() == 3000);
+        for (const auto& s : statements) {
+            if (s.op == amd64::operation::mul || s.op == amd64::operation::div) {
+                auto dst = std::get<std::tuple<amd64::register_type::reg<32>, uint32_t>>(s.operands);
+                auto r = std::get<0>(dst).r;
+                assert(r != amd64::register_type::reg32::eax && r != amd64::register_type::reg32::edx);
+            }
+        }
+        auto codes = amd64::assemble(statements);
+        std::cout << "statement bytes: " << codes.size() << std::endl;
+        assert(codes.size() >= 3000 * 2);
+    }
+
+    // the operand mix picks the instructions
+    {
+        auto cfg = config{.instructions = 500, .mix = {.register_register = 1, .register_immediate = 0,
+            .memory = 0, .multiply = 0, .divide = 0}};
+        for (const auto& s : generate_statements(cfg)) {
+            assert(s.op == amd64::operation::add);
+        }
+        cfg.mix = {0, 0, 0, 0, 0};
+        bool thrown = false;
+        try {
+            generate_statements(cfg);
+        }
+        catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        assert(thrown);
+
+        // statements skip branches, so all branches would never end
+        for (auto density : {1.0, 2.0, -0.5}) {
+            thrown = false;
+            try {
+                generate_statements(config{.branch_density = density});
+            }
+            catch (const std::runtime_error&) {
+                thrown = true;
+            }
+            assert(thrown);
+        }
+    }
+
+    // procedures: every level calls only the one below, reads stay within
+    // the register pressure, and the whole tree inlines
+    {
+        auto cfg = config{.instructions = 2000, .register_pressure = 5, .call_depth = 3,
+            .procedures_per_level = 3, .call_density = 0.02};
+        auto procedures = generate_procedures(cfg);
+        assert(procedures.size() == 1 + 3 * 3);
+
+        auto level_of = [](uint32_t p) { return p == 0 ? 0u : 1 + (p - 1) / 3; };
+        size_t total = 0;
+        size_t calls = 0;
+        for (uint32_t p = 0; p < procedures.size(); p++) {
+            uint32_t defined = 2;
+            for (const auto& instruction : procedures[p].instructions) {
+                for (auto r : instruction.reads) {
+                    assert(r < defined && r + 5 >= defined);
+                }
+                if (instruction.op == kind::call) {
+                    assert(level_of(instruction.target) == level_of(p) + 1);
+                    calls++;
+                }
+                defined += static_cast<uint32_t>(instruction.writes.size());
+            }
+            if (level_of(p) == 3) {
+                assert(std::ranges::none_of(procedures[p].instructions,
+                            [](const auto& instruction) { return instruction.op == kind::call; }));
+            }
+            total += procedures[p].instructions.size();
+        }
+        assert(total == 2000);
+        assert(calls > 0);
+
+        auto rename = [](auto item, uint32_t offset) {
+            for (auto& r : item.reads) {
+                r += offset;
+            }
+            for (auto& w : item.writes) {
+                w += offset;
+            }
+            return item;
+        };
+        auto inlined = procedure::inline_procedures(procedures, 0,
+                [](const instruction& instruction) { return instruction.target; },
+                [](std::vector<uint32_t> dests, std::vector<uint32_t> srcs) {
+                    return std::vector{instruction{.op = kind::register_register, .reads = srcs, .writes = dests}};
+                },
+                [](const instruction& instruction) { return instruction.op == kind::call; },
+                [](const instruction& instruction) { return instruction.reads; },
+                [](const instruction& instruction) { return instruction.writes; },
+                cpp_helper::overloads{
+                    [rename](instruction instruction, uint32_t offset) { return rename(instruction, offset); },
+                    [](std::vector<uint32_t> registers, uint32_t offset) {
+                        for (auto& r : registers) {
+                            r += offset;
+                        }
+                        return registers;
+                    },
+                },
+                [](const instruction& instruction) {
+                    uint32_t next = 0;
+                    for (auto r : instruction.reads) {
+                        next = std::max(next, r + 1);
+                    }
+                    for (auto w : instruction.writes) {
+                        next = std::max(next, w + 1);
+                    }
+                    return next;
+                });
+        std::cout << "inlined instructions: " << inlined.size() << std::endl;
+        assert(inlined.size() > procedures[0].instructions.size());
+        assert(std::ranges::none_of(inlined, [](const auto& instruction) { return instruction.op == kind::call; }));
+    }
+
+    return 0;
+}
@@ -1,6 +1,10 @@
 #include "register_allocation.hpp"
 
 #include <iostream>
+#include <cassert>
+#include <algorithm>
+#include <ranges>
+#include <iterator>
 
 template<typename Register, size_t Register_count = std::numeric_limits<Register>::max()>
 struct instruction {
@@ -79,18 +83,23 @@ int main() {
         }
     };
 
-    auto instructions = register_allocate<instruction<uint8_t, 17>>(in_instructions,
-            [](auto in_instruction, auto writes, auto reads) {
-                return instruction<uint8_t, 17>{in_instruction.op}
-                    .set_reads(reads).set_writes(writes);
-            },
-            [](auto pr, auto mem) {
-                return instruction<uint8_t, 17>{0}.set_writes({pr}).set_read_memories({mem});
-            },
-            [](auto mem, auto pr) {
-                return instruction<uint8_t, 17>{1}.set_reads({pr}).set_write_memories({mem});
-            }
-            );
+    auto allocate = [](const auto& in_instructions, auto precolor) {
+        return register_allocate<instruction<uint8_t, 17>>(in_instructions,
+                [](auto in_instruction, auto writes, auto reads) {
+                    return instruction<uint8_t, 17>{in_instruction.op}
+                        .set_reads(reads).set_writes(writes);
+                },
+                [](auto pr, auto mem) {
+                    return instruction<uint8_t, 17>{0}.set_writes({pr}).set_read_memories({mem});
+                },
+                [](auto mem, auto pr) {
+                    return instruction<uint8_t, 17>{1}.set_reads({pr}).set_write_memories({mem});
+                },
+                precolor
+                );
+    };
+    auto no_precolor = [](auto) { return std::nullopt; };
+    auto instructions = allocate(in_instructions, no_precolor);
 
     for (const auto& instruction : instructions) {
         std::cout << instruction.op << ":";
@@ -109,5 +118,62 @@ int main() {
         }
         std::cout << std::endl;
     }
+
+    // sparse virtual registers are allocated as if dense, spilled to their own memories
+    {
+        auto sparse_register = [](uint32_t vr) { return vr < 17 ? vr : 0x80000000u + vr; };
+        auto sparse_instructions = in_instructions;
+        for (auto& instruction : sparse_instructions) {
+            std::ranges::transform(instruction.reads, instruction.reads.begin(), sparse_register);
+            std::ranges::transform(instruction.writes, instruction.writes.begin(), sparse_register);
+        }
+        auto sparse = allocate(sparse_instructions, no_precolor);
+        assert(sparse.size() == instructions.size());
+        for (size_t i = 0; i < sparse.size(); i++) {
+            assert(sparse[i].op == instructions[i].op);
+            assert(sparse[i].reads == instructions[i].reads && sparse[i].writes == instructions[i].writes);
+            assert(std::ranges::equal(sparse[i].read_memories, instructions[i].read_memories | std::views::transform(sparse_register)));
+            assert(std::ranges::equal(sparse[i].write_memories, instructions[i].write_memories | std::views::transform(sparse_register)));
+        }
+        assert(std::ranges::any_of(sparse, [](const auto& instruction) { return !instruction.write_memories.empty(); }));
+    }
+
+    // precolored registers get their physical register, which no other one gets
+    {
+        constexpr auto precolored = 0x80000000u;
+        auto precolor = [](uint32_t vr) -> std::optional<uint8_t> {
+            if (vr >= precolored) {
+                return vr - precolored;
+            }
+            return std::nullopt;
+        };
+        auto call_instructions = std::vector<::instruction<uint32_t>>{};
+        for (uint32_t vr = 20; vr < 60; vr++) {
+            call_instructions.push_back({2, {vr - 1}, {vr}});
+        }
+        call_instructions.push_back({2, {58, 59}, {precolored + 3, precolored + 5}});
+        call_instructions.push_back({2, {precolored + 3, precolored + 5}, {precolored + 3}});
+        call_instructions.push_back({2, {precolored + 3}, {60}});
+        call_instructions.push_back({2, {60, 21}, {61}});
+
+        auto allocated = allocate(call_instructions, precolor);
+        auto physical = [&](uint32_t vr, uint8_t pr) {
+            if (auto color = precolor(vr)) {
+                return pr == *color;
+            }
+            return pr != 3 && pr != 5;
+        };
+        auto translated = std::vector<::instruction<uint8_t, 17>>{};
+        std::ranges::copy_if(allocated, std::back_inserter(translated), [](const auto& instruction) { return instruction.op == 2; });
+        assert(translated.size() == call_instructions.size());
+        for (size_t i = 0; i < translated.size(); i++) {
+            for (size_t j = 0; j < translated[i].reads.size(); j++) {
+                assert(physical(call_instructions[i].reads[j], translated[i].reads[j]));
+            }
+            for (size_t j = 0; j < translated[i].writes.size(); j++) {
+                assert(physical(call_instructions[i].writes[j], translated[i].writes[j]));
+            }
+        }
+    }
     return 0;
 }
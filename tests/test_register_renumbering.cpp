@@ -0,0 +1,63 @@
+#include "register_renumbering.hpp"
+
+#include <cassert>
+#include <iostream>
+
+struct instruction {
+    using register_t = uint32_t;
+
+    uint32_t op;
+    std::vector<register_t> reads;
+    std::vector<register_t> writes;
+
+    auto& get_reads() const {
+        return reads;
+    }
+    auto& get_writes() const {
+        return writes;
+    }
+};
+
+int main() {
+    using namespace register_renumbering;
+
+    auto in_instructions = std::vector<instruction>{
+        {.op = 0, .writes = {1000, 70000}},
+        {.op = 1, .reads = {1000, 70000}, .writes = {1000}},
+        {.op = 2, .reads = {5, 1000}, .writes = {90000}},
+        {.op = 3, .reads = {90000, 70000}, .writes = {1000}},
+    };
+    auto translate_registers = [](auto in_instruction, auto writes, auto reads) {
+        return instruction{in_instruction.op, reads, writes};
+    };
+
+    auto dense = renumber_registers(in_instructions, translate_registers);
+    for (const auto& instruction : dense.instructions) {
+        std::cout << instruction.op << ":";
+        for (auto reg : instruction.reads) {
+            std::cout << reg << ", ";
+        }
+        std::cout << "->";
+        for (auto reg : instruction.writes) {
+            std::cout << reg << ", ";
+        }
+        std::cout << std::endl;
+    }
+    assert(dense.register_count() == 4);
+    assert((dense.instructions[1].reads == std::vector<uint32_t>{0, 1}));
+    assert((dense.instructions[1].writes == std::vector<uint32_t>{0}));
+    assert((dense.instructions[2].reads == std::vector<uint32_t>{2, 0}));
+    assert(dense.original_registers[2] == 5);
+    assert(dense.final_registers.at(1000) == 0);
+
+    auto single_definition = renumber_registers(in_instructions, translate_registers,
+            renumbering::single_definition);
+    assert(single_definition.register_count() == 6);
+    assert((single_definition.instructions[1].writes == std::vector<uint32_t>{2}));
+    assert((single_definition.instructions[2].reads == std::vector<uint32_t>{3, 2}));
+    assert((single_definition.instructions[3].reads == std::vector<uint32_t>{4, 1}));
+    assert(single_definition.final_registers.at(1000) == 5);
+    assert(single_definition.original_registers[5] == 1000);
+
+    return 0;
+}
@@ -0,0 +1,244 @@
+#include "scheduling.hpp"
+
+#include <cassert>
+#include <iostream>
+
+struct instruction {
+    using register_t = uint32_t;
+
+    uint32_t op;
+    std::vector<register_t> reads;
+    std::vector<register_t> writes;
+
+    std::vector<uint32_t> read_memories;
+    std::vector<uint32_t> write_memories;
+
+    uint32_t label = 0;
+
+    auto& get_reads() const {
+        return reads;
+    }
+    auto& get_writes() const {
+        return writes;
+    }
+};
+
+enum op : uint32_t {
+    copy,
+    add,
+    imul,
+    load,
+    store,
+    cmp,
+    call,
+    label,
+    jnz,
+};
+
+int main() {
+    using namespace scheduling;
+
+    auto classify = [](const instruction& instruction) {
+        switch (instruction.op) {
+        case label:
+            return control_flow::control{control_flow::control_kind::label, instruction.label, 0};
+        case jnz:
+            return control_flow::control{control_flow::control_kind::conditional_jump, instruction.label, 0x5};
+        default:
+            return control_flow::control{control_flow::control_kind::other, 0, 0};
+        }
+    };
+    auto get_effects = [](const instruction& instruction) {
+        return effects::effects{
+            .reads_flags = instruction.op == jnz,
+            .writes_flags = instruction.op == add || instruction.op == imul || instruction.op == cmp,
+            .read_memories = instruction.read_memories,
+            .write_memories = instruction.write_memories,
+            .has_side_effects = instruction.op == call,
+        };
+    };
+    // loads and multiplies are slow, multiplies only go to port 1
+    auto get_timing = [](const instruction& instruction) {
+        switch (instruction.op) {
+        case load:
+            return timing{5, 0b1100};
+        case imul:
+            return timing{3, 0b0010};
+        case store:
+            return timing{1, 0b0100};
+        default:
+            return timing{1, 0b0001};
+        }
+    };
+    auto position = [](const std::vector<instruction>& instructions, uint32_t written) {
+        for (size_t i = 0; i < instructions.size(); i++) {
+            if (std::ranges::contains(instructions[i].writes, written)) {
+                return i;
+            }
+        }
+        return instructions.size();
+    };
+
+    // two load-use chains back to back: the second load moves up
+    {
+        auto code = std::vector<instruction>{
+            {load, {0}, {1}, {7}},
+            {add, {1, 1}, {2}},
+            {load, {0}, {3}, {8}},
+            {add, {3, 3}, {4}},
+        };
+        auto result = schedule_instructions(code, classify, get_effects, get_timing,
+                options{.issue_width = 1});
+        assert(position(result.instructions, 3) < position(result.instructions, 2));
+        assert(result.cycles == 7);
+    }
+
+    // dependencies are kept: anti and output dependencies, flags and memory
+    {
+        auto code = std::vector<instruction>{
+            {imul, {0, 0}, {1}},
+            {copy, {1}, {2}},
+            {copy, {3}, {1}},                   // writes 1 after it is read
+            {store, {2}, {}, {}, {7}},
+            {load, {4}, {5}, {7}},              // reads memory 7 after the store
+            {load, {4}, {6}, {8}},              // other memory: free to move
+            {cmp, {5, 6}, {}},
+        };
+        auto result = schedule_instructions(code, classify, get_effects, get_timing);
+        auto& scheduled = result.instructions;
+        assert(scheduled.size() == code.size());
+        auto index_of = [&scheduled](uint32_t op, std::vector<uint32_t> memories) {
+            for (size_t i = 0; i < scheduled.size(); i++) {
+                if (scheduled[i].op == op && scheduled[i].read_memories == memories) {
+                    return i;
+                }
+            }
+            return scheduled.size();
+        };
+        auto reads_of = [&scheduled](uint32_t reg) {
+            for (size_t i = 0; i < scheduled.size(); i++) {
+                if (scheduled[i].op == copy && scheduled[i].reads == std::vector<uint32_t>{reg}) {
+                    return i;
+                }
+            }
+            return scheduled.size();
+        };
+        // copy 3 -> 1 stays after copy 1 -> 2 reads 1
+        assert(position(scheduled, 1) < reads_of(1));
+        assert(reads_of(1) < reads_of(3));
+        assert(index_of(store, {}) < index_of(load, {7}));
+        assert(index_of(load, {8}) < index_of(store, {}));
+        assert(scheduled.back().op == cmp);
+    }
+
+    // a call orders every memory access around it
+    {
+        auto code = std::vector<instruction>{
+            {load, {0}, {1}, {7}},
+            {call, {}, {}},
+            {load, {0}, {2}, {8}},
+            {add, {0, 0}, {3}},
+        };
+        auto result = schedule_instructions(code, classify, get_effects, get_timing);
+        auto& scheduled = result.instructions;
+        assert(scheduled[0].op == load && scheduled[0].read_memories == std::vector<uint32_t>{7});
+        auto call_at = std::ranges::find(scheduled, call, &instruction::op) - scheduled.begin();
+        assert(position(scheduled, 2) > static_cast<size_t>(call_at));
+    }
+
+    // labels stay first and jumps last in their blocks
+    {
+        auto code = std::vector<instruction>{
+            {label, {}, {}, {}, {}, 1},
+            {add, {0, 0}, {1}},
+            {load, {0}, {2}, {7}},
+            {cmp, {1, 2}, {}},
+            {jnz, {}, {}, {}, {}, 1},
+            {load, {0}, {3}, {7}},
+        };
+        auto result = schedule_instructions(code, classify, get_effects, get_timing);
+        auto& scheduled = result.instructions;
+        assert(scheduled[0].op == label);
+        assert(scheduled[1].op == load);
+        assert(scheduled[3].op == cmp);
+        assert(scheduled[4].op == jnz);
+        assert(scheduled[5].op == load);
+    }
+
+    // multiplies share port 1, so they issue a cycle apart
+    {
+        auto code = std::vector<instruction>{
+            {imul, {0, 0}, {1}},
+            {imul, {0, 0}, {2}},
+            {imul, {0, 0}, {3}},
+        };
+        auto result = schedule_instructions(code, classify, get_effects, get_timing);
+        assert(result.cycles == 5);
+    }
+
+    // before register allocation, with too many live values, uses are
+    // preferred over new independent loads
+    {
+        auto code = std::vector<instruction>{
+            {load, {0}, {1}, {7}},
+            {load, {0}, {2}, {8}},
+            {load, {0}, {3}, {9}},
+            {add, {1, 2}, {4}},
+            {add, {4, 3}, {5}},
+            {load, {0}, {6}, {10}},
+            {load, {0}, {7}, {11}},
+            {add, {6, 7}, {8}},
+            {add, {5, 8}, {9}},
+        };
+        auto live_at_most = [](const std::vector<instruction>& instructions) {
+            auto last_use = std::unordered_map<uint32_t, size_t>{};
+            for (size_t i = 0; i < instructions.size(); i++) {
+                for (auto r : instructions[i].reads) {
+                    last_use[r] = i;
+                }
+            }
+            size_t most = 0;
+            for (size_t i = 0; i < instructions.size(); i++) {
+                size_t live = 0;
+                for (size_t j = 0; j <= i; j++) {
+                    for (auto w : instructions[j].writes) {
+                        if (last_use.contains(w) && last_use[w] > i) {
+                            live++;
+                        }
+                    }
+                }
+                most = std::max(most, live);
+            }
+            return most;
+        };
+        auto latency_first = schedule_instructions(code, classify, get_effects, get_timing,
+                options{.when = phase::after_register_allocation});
+        auto pressure_first = schedule_instructions(code, classify, get_effects, get_timing,
+                options{.when = phase::before_register_allocation, .max_register_pressure = 2});
+        std::cout << "live values: " << live_at_most(latency_first.instructions)
+            << " after, " << live_at_most(pressure_first.instructions) << " before register allocation" << std::endl;
+        std::cout << "cycles: " << latency_first.cycles << " after, " << pressure_first.cycles << " before" << std::endl;
+        assert(live_at_most(pressure_first.instructions) < live_at_most(latency_first.instructions));
+        assert(latency_first.cycles <= pressure_first.cycles);
+    }
+
+    // a wide block, with every multiply waiting on the single port 1
+    {
+        constexpr uint32_t width = 100000;
+        auto code = std::vector<instruction>{};
+        for (uint32_t i = 0; i < width; i++) {
+            code.push_back({load, {0}, {2 * i + 1}, {i}});
+        }
+        for (uint32_t i = 0; i < width; i++) {
+            code.push_back({imul, {2 * i + 1, 2 * i + 1}, {2 * i + 2}});
+        }
+        for (auto when : {phase::after_register_allocation, phase::before_register_allocation}) {
+            auto result = schedule_instructions(code, classify, get_effects, get_timing, options{.when = when});
+            assert(result.instructions.size() == code.size());
+            assert(result.cycles >= width);
+            assert(position(result.instructions, 1) < position(result.instructions, 2));
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,165 @@
+#include "statistics.hpp"
+#include "scanner.hpp"
+#include "amd64_assembler.hpp"
+#include "register_allocation.hpp"
+#include "procedure.hpp"
+
+#include <cassert>
+#include <iostream>
+#include <sstream>
+
+template<typename Register, size_t Register_count = std::numeric_limits<Register>::max()>
+struct instruction {
+    using register_t = Register;
+
+    static constexpr auto register_count = Register_count;
+
+    uint32_t op;
+    std::vector<register_t> reads;
+    std::vector<register_t> writes;
+
+    auto& get_reads() const {
+        return reads;
+    }
+    auto& get_writes() const {
+        return writes;
+    }
+};
+
+enum op : uint32_t {
+    add,
+    copy,
+    call,
+    load,
+    store,
+};
+
+int main() {
+    auto stats = statistics::statistics{};
+    auto recorder = statistics::recorder{stats};
+
+    // tokens and unique strings
+    {
+        auto in = std::istringstream{"add rax 1\nadd rbx 1\nret\n"};
+        auto scanner = scanner::basic_scanner<statistics::recorder>{.splitter = {in}, .recorder = recorder};
+        auto timer = recorder.time(statistics::phase::scan);
+        while (scanner.next()) {
+        }
+        assert(stats.tokens_scanned == 7);
+        assert(stats.unique_strings == 5);
+    }
+
+    // statements and bytes
+    {
+        using namespace amd64::register_type;
+        auto statements = std::vector<amd64::statement>{
+            {amd64::operation::add, std::tuple<reg<32>, reg<32>>(reg<32>{reg32::ecx}, reg<32>{reg32::ebx})},
+            {amd64::operation::adc, std::tuple<reg<32>, uint32_t>(reg<32>{reg32::ecx}, 1)},
+        };
+        auto codes = amd64::assemble(statements, recorder);
+        assert(codes == amd64::assemble(statements));
+        assert(stats.statements_encoded == 2);
+        assert(stats.bytes_emitted == codes.size());
+    }
+
+    // spills and reloads are the stores and loads the allocator inserts
+    {
+        using in_instruction = instruction<uint32_t>;
+        using out_instruction = instruction<uint8_t, 2>;
+        auto in = std::vector<in_instruction>{
+            {add, {0, 1}, {2}},
+            {add, {0, 2}, {3}},
+            {add, {1, 3}, {4}},
+            {add, {2, 4}, {5}},
+        };
+        auto out = register_allocation::register_allocate<out_instruction>(in,
+                [](const auto& in, auto writes, auto reads) {
+                    return out_instruction{in.op, std::vector<uint8_t>(reads.begin(), reads.end()),
+                        std::vector<uint8_t>(writes.begin(), writes.end())};
+                },
+                [](auto pr, auto) { return out_instruction{load, {}, {pr}}; },
+                [](auto, auto pr) { return out_instruction{store, {pr}, {}}; },
+                [](auto) { return std::nullopt; },
+                recorder);
+        auto loads = std::ranges::count(out, load, &out_instruction::op);
+        auto stores = std::ranges::count(out, store, &out_instruction::op);
+        assert(loads > 0 && stores > 0);
+        assert(stats.reloads == static_cast<uint64_t>(loads));
+        assert(stats.spills == static_cast<uint64_t>(stores));
+        assert(stats.peak_virtual_registers == 6);
+    }
+
+    // copies inserted by inlining: procedure 0 calls 1 twice, 1 calls 2
+    {
+        struct call_instruction {
+            uint32_t op;
+            std::vector<uint32_t> reads;
+            std::vector<uint32_t> writes;
+            uint32_t callee = 0;
+        };
+        auto procedures = std::vector<procedure::procedure<call_instruction>>{
+            {{0}, {2}, {{call, {0}, {1}, 1}, {call, {1}, {2}, 1}}},
+            {{0}, {1}, {{call, {0}, {1}, 2}}},
+            {{0}, {1}, {{add, {0, 0}, {1}}}},
+        };
+        auto rename = [](auto registers, uint32_t offset) {
+            for (auto& r : registers) {
+                r += offset;
+            }
+            return registers;
+        };
+        auto inlined = procedure::inline_procedures(procedures, 0,
+                [](const auto& instruction) { return instruction.callee; },
+                [](std::vector<uint32_t> dests, std::vector<uint32_t> srcs) {
+                    auto copies = std::vector<call_instruction>{};
+                    for (size_t i = 0; i < dests.size(); i++) {
+                        copies.push_back({copy, {srcs[i]}, {dests[i]}});
+                    }
+                    return copies;
+                },
+                [](const auto& instruction) { return instruction.op == call; },
+                [](const auto& instruction) { return instruction.reads; },
+                [](const auto& instruction) { return instruction.writes; },
+                cpp_helper::overloads{
+                    [rename](call_instruction instruction, uint32_t offset) {
+                        instruction.reads = rename(instruction.reads, offset);
+                        instruction.writes = rename(instruction.writes, offset);
+                        return instruction;
+                    },
+                    rename,
+                },
+                [](const auto& instruction) {
+                    uint32_t next = 0;
+                    for (auto r : instruction.reads) {
+                        next = std::max(next, r + 1);
+                    }
+                    for (auto w : instruction.writes) {
+                        next = std::max(next, w + 1);
+                    }
+                    return next;
+                },
+                recorder);
+        auto copies = std::ranges::count(inlined, copy, &call_instruction::op);
+        assert(copies == 8);
+        assert(stats.inline_copies == 8);
+    }
+
+    auto json = std::ostringstream{};
+    statistics::write_json(json, stats);
+    std::cout << json.str();
+    assert(json.str().find("\"inline_copies\": 8,") != std::string::npos);
+    assert(json.str().find("\"phase_seconds\": {\"scan\": ") != std::string::npos);
+
+    auto prometheus = std::ostringstream{};
+    statistics::write_prometheus(prometheus, stats);
+    std::cout << prometheus.str();
+    assert(prometheus.str().find("# TYPE amd64_assembler_spills_total counter\n") != std::string::npos);
+    assert(prometheus.str().find("# TYPE amd64_assembler_peak_virtual_registers gauge\n") != std::string::npos);
+    assert(prometheus.str().find("amd64_assembler_phase_seconds_total{phase=\"inlining\"} ") != std::string::npos);
+
+    // disabled statistics change nothing
+    static_assert(std::is_empty_v<statistics::disabled>);
+    static_assert(sizeof(scanner::scanner) < sizeof(scanner::basic_scanner<statistics::recorder>));
+
+    return 0;
+}
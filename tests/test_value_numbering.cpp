@@ -0,0 +1,138 @@
+#include "value_numbering.hpp"
+
+#include <cassert>
+#include <iostream>
+
+struct instruction {
+    using register_t = uint32_t;
+
+    uint32_t op;
+    std::vector<register_t> reads;
+    std::vector<register_t> writes;
+
+    std::vector<uint32_t> read_memories;
+    std::vector<uint32_t> write_memories;
+
+    uint32_t immediate = 0;
+    // label defined or jumped to
+    uint32_t target = 0;
+
+    auto& get_reads() const {
+        return reads;
+    }
+    auto& get_writes() const {
+        return writes;
+    }
+};
+
+enum op : uint32_t {
+    copy,
+    add,
+    lea,
+    load,
+    store,
+    cmp,
+    adc,
+    label,
+    jcc,
+};
+
+int main() {
+    using namespace value_numbering;
+
+    auto classify = [](const instruction& instruction) {
+        using kind = control_flow::control_kind;
+        switch (instruction.op) {
+        case label: return control_flow::control{kind::label, instruction.target};
+        case jcc: return control_flow::control{kind::conditional_jump, instruction.target, 0x5};
+        default: return control_flow::control{kind::other};
+        }
+    };
+    auto get_opcode = [](const instruction& instruction) {
+        return uint64_t{instruction.op} << 32 | instruction.immediate;
+    };
+    auto get_effects = [](const instruction& instruction) {
+        return effects::effects{
+            .reads_flags = instruction.op == adc,
+            .writes_flags = instruction.op == add || instruction.op == cmp || instruction.op == adc,
+            .read_memories = instruction.read_memories,
+            .write_memories = instruction.write_memories,
+        };
+    };
+    auto gen_copy_instructions = [](std::vector<uint32_t> dests, std::vector<uint32_t> srcs) {
+        if (dests.empty()) {
+            return std::vector<instruction>{};
+        }
+        return std::vector{instruction{copy, srcs, dests}};
+    };
+
+    // address computations repeated on the same base and index
+    auto corpus = std::vector<instruction>{
+        {lea, {0, 1}, {2}},
+        {load, {2}, {3}, {7}},
+        {lea, {0, 1}, {4}},                 // same address: eliminated
+        {load, {4}, {5}, {7}},              // same memory, same address: eliminated
+        {store, {5}, {}, {}, {7}},
+        {load, {4}, {6}, {7}},              // memory 7 changed: kept
+        {lea, {0, 1}, {8}},                 // eliminated
+        {lea, {8, 1}, {9}},                 // different value: kept
+        {add, {0, 1}, {10}},
+        {add, {0, 1}, {11}},                // flags read by adc below: kept
+        {adc, {0, 1}, {12}},
+        {add, {0, 1}, {13}},                // flags dead: eliminated
+        {copy, {1}, {0}},
+        {lea, {0, 1}, {14}},                // register 0 redefined: kept
+    };
+
+    auto numbered = number_values(corpus, classify, get_opcode, get_effects, gen_copy_instructions);
+    for (const auto& instruction : numbered.instructions) {
+        std::cout << instruction.op << ":";
+        for (auto reg : instruction.reads) {
+            std::cout << reg << ", ";
+        }
+        std::cout << "->";
+        for (auto reg : instruction.writes) {
+            std::cout << reg << ", ";
+        }
+        std::cout << std::endl;
+    }
+    std::cout << "eliminated " << numbered.eliminated << " of " << corpus.size() << " instructions" << std::endl;
+
+    assert(numbered.eliminated == 4);
+    assert(numbered.instructions.size() == corpus.size());
+    assert(numbered.instructions[2].op == copy && numbered.instructions[2].reads[0] == 2);
+    assert(numbered.instructions[3].op == copy && numbered.instructions[3].reads[0] == 3);
+    assert(numbered.instructions[5].op == load);
+    assert(numbered.instructions[9].op == add);
+    assert(numbered.instructions[11].op == copy && numbered.instructions[11].reads[0] == 11);
+    assert(numbered.instructions[13].op == lea);
+
+    // immediates are part of the opcode, and blocks are numbered apart
+    {
+        auto blocks = std::vector<instruction>{
+            {lea, {0}, {1}, {}, {}, 5},
+            {lea, {0}, {2}, {}, {}, 7},         // different immediate: kept
+            {lea, {0}, {3}, {}, {}, 5},         // eliminated
+            {label, {}, {}, {}, {}, 0, 0},
+            {lea, {0}, {4}, {}, {}, 5},         // reached from elsewhere: kept
+            {cmp, {0, 4}, {}},
+            {jcc, {}, {}, {}, {}, 0, 0},
+            {lea, {0}, {5}, {}, {}, 5},         // after a jump: kept
+            {lea, {0}, {6}, {}, {}, 5},         // eliminated
+            {add, {0, 5}, {7}},
+            {add, {0, 5}, {8}},                 // flags may be read where the jump goes: kept
+            {jcc, {}, {}, {}, {}, 0, 0},
+            {add, {0, 5}, {9}},                 // after a jump: kept
+        };
+        auto numbered = number_values(blocks, classify, get_opcode, get_effects, gen_copy_instructions);
+        assert(numbered.eliminated == 2);
+        assert(numbered.instructions[1].op == lea && numbered.instructions[1].writes[0] == 2);
+        assert(numbered.instructions[2].op == copy && numbered.instructions[2].reads[0] == 1);
+        assert(numbered.instructions[4].op == lea);
+        assert(numbered.instructions[7].op == lea);
+        assert(numbered.instructions[8].op == copy && numbered.instructions[8].reads[0] == 5);
+        assert(numbered.instructions[10].op == add && numbered.instructions[12].op == add);
+    }
+
+    return 0;
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+#include "effects.hpp"
+#include "control_flow.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <functional>
+#include <algorithm>
+#include <ranges>
+
+namespace value_numbering {
+    struct key_hash {
+        size_t operator()(const std::vector<uint64_t>& key) const noexcept {
+            size_t h = key.size();
+            for (auto k : key) {
+                h ^= std::hash<uint64_t>{}(k) + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2);
+            }
+            return h;
+        }
+    };
+
+    template<typename Instruction>
+    struct numbered_instructions {
+        std::vector<Instruction> instructions;
+        // instructions replaced by copies of an earlier result
+        size_t eliminated;
+    };
+
+    // Local value numbering: an instruction computing the same opcode on the
+    // same values as an earlier one, with the memory and flags it reads
+    // unchanged in between, is replaced by copies of the earlier results.
+    // Instructions with side effects or memory writes are kept, and so are
+    // flag writers whose flags are read later. Values are only followed
+    // within straight-line code: classify returns a control_flow::control,
+    // and everything is forgotten at a label and after a jump. Only the
+    // registers of an instruction are numbered, so get_opcode must encode
+    // everything else it depends on, immediates included.
+    template<
+        typename Instruction,
+        typename Register = Instruction::register_t>
+    auto number_values(const std::vector<Instruction>& instructions,
+            auto classify,
+            auto get_opcode,
+            auto get_effects,
+            auto gen_copy_instructions
+            ) {
+        auto result = numbered_instructions<Instruction>{};
+        result.eliminated = 0;
+
+        using kind = control_flow::control_kind;
+        auto all_effects = std::vector<effects::effects>{};
+        auto controls = std::vector<kind>{};
+        all_effects.reserve(instructions.size());
+        controls.reserve(instructions.size());
+        for (const auto& instruction : instructions) {
+            all_effects.emplace_back(get_effects(instruction));
+            controls.emplace_back(classify(instruction).kind);
+        }
+        // flags written by instruction i are read before being overwritten,
+        // assuming the target of a jump reads them
+        auto flags_used_after = std::vector<bool>(instructions.size());
+        auto flags_needed = false;
+        for (size_t i = instructions.size(); i-- > 0;) {
+            if (controls[i] == kind::jump || controls[i] == kind::conditional_jump) {
+                flags_needed = true;
+            }
+            else if (controls[i] == kind::ret) {
+                flags_needed = false;
+            }
+            flags_used_after[i] = flags_needed;
+            flags_needed = all_effects[i].reads_flags || (flags_needed && !all_effects[i].writes_flags);
+        }
+
+        uint64_t next_value = 0;
+        auto register_values = std::unordered_map<Register, uint64_t>{};
+        auto value_of = [&](Register reg) {
+            auto [it, inserted] = register_values.try_emplace(reg, next_value);
+            if (inserted) {
+                next_value++;
+            }
+            return it->second;
+        };
+
+        uint64_t flags_version = 0;
+        uint64_t memory_epoch = 0;
+        uint64_t next_memory_version = 0;
+        auto memory_versions = std::unordered_map<uint32_t, uint64_t>{};
+
+        struct available {
+            std::vector<Register> registers;
+            std::vector<uint64_t> values;
+        };
+        auto expressions = std::unordered_map<std::vector<uint64_t>, available, key_hash>{};
+        // registers get fresh values, so nothing earlier matches again;
+        // new tables, as clear() costs the bucket count of the old ones
+        auto forget = [&]() {
+            register_values = {};
+            expressions = {};
+            memory_versions = {};
+            flags_version++;
+            memory_epoch++;
+        };
+
+        auto key = std::vector<uint64_t>{};
+        for (size_t i = 0; i < instructions.size(); i++) {
+            const auto& instruction = instructions[i];
+            const auto& effects = all_effects[i];
+            const auto& writes = instruction.get_writes();
+            if (controls[i] == kind::label) {
+                forget();
+            }
+
+            key.clear();
+            key.emplace_back(get_opcode(instruction));
+            for (const auto& reg : instruction.get_reads()) {
+                key.emplace_back(value_of(reg));
+            }
+            if (effects.reads_flags) {
+                key.emplace_back(flags_version);
+            }
+            if (!effects.read_memories.empty()) {
+                key.emplace_back(memory_epoch);
+            }
+            for (auto memory : effects.read_memories) {
+                key.emplace_back(memory);
+                key.emplace_back(memory_versions[memory]);
+            }
+
+            auto pure = !effects.has_side_effects && effects.write_memories.empty() && !writes.empty();
+            auto removable = pure && !(effects.writes_flags && flags_used_after[i]);
+
+            auto found = removable ? expressions.find(key) : expressions.end();
+            auto reusable = found != expressions.end() &&
+                std::ranges::all_of(std::views::iota(size_t{0}, found->second.registers.size()),
+                        [&](auto j) {
+                            return value_of(found->second.registers[j]) == found->second.values[j];
+                        });
+            if (reusable) {
+                auto dests = std::vector<Register>{};
+                auto srcs = std::vector<Register>{};
+                for (size_t j = 0; j < writes.size(); j++) {
+                    if (writes[j] != found->second.registers[j]) {
+                        dests.emplace_back(writes[j]);
+                        srcs.emplace_back(found->second.registers[j]);
+                    }
+                }
+                for (auto& copy : gen_copy_instructions(dests, srcs)) {
+                    result.instructions.emplace_back(std::move(copy));
+                }
+                for (size_t j = 0; j < writes.size(); j++) {
+                    register_values[writes[j]] = found->second.values[j];
+                }
+                result.eliminated++;
+                continue;
+            }
+
+            result.instructions.emplace_back(instruction);
+            auto values = std::vector<uint64_t>{};
+            for (const auto& reg : writes) {
+                register_values[reg] = next_value;
+                values.emplace_back(next_value++);
+            }
+            if (effects.writes_flags) {
+                flags_version++;
+            }
+            for (auto memory : effects.write_memories) {
+                memory_versions[memory] = ++next_memory_version;
+            }
+            if (effects.has_side_effects) {
+                memory_epoch++;
+                flags_version++;
+            }
+            if (pure) {
+                expressions.insert_or_assign(key, available{
+                        std::vector<Register>(writes.begin(), writes.end()),
+                        std::move(values)});
+            }
+            if (controls[i] != kind::label && controls[i] != kind::other) {
+                forget();
+            }
+        }
+        return result;
+    }
+}
@@ -0,0 +1,236 @@
+#pragma once
+
+#include "instruction.hpp"
+#include "vector_register.hpp"
+
+namespace amd64 {
+    // [base + index * 2^scale] for every element of a vector of indices
+    template<typename Index>
+    struct vsib_address {
+        register_type::reg64 base;
+        Index index;
+        bitset<2> scale;
+    };
+
+    template<typename T>
+    concept vector_or_mem = vector_register<T> || memory<T>;
+
+    // VEX.pp.map_select.W opcode, see vex for the field values
+    struct vex_opcode {
+        bit2 pp;
+        bit5 map_select;
+        bit1 w;
+        uint8_t opcode;
+        // VEX.256 only, like permutes across lanes
+        bool only_256 = false;
+    };
+
+    // VEX.R of a ModRM.reg operand, VEX.B of a ModRM.rm operand
+    template<typename T>
+    constexpr bool vex_extension_v = false;
+    template<size_t N>
+    constexpr bool vex_extension_v<register_type::vec<N, register_type::extention::extended>> = true;
+    template<size_t N>
+    constexpr bool vex_extension_v<register_type::reg<N, register_type::extention::extended>> = true;
+
+    // VEX.X of a ModRM.rm operand
+    template<typename T>
+    constexpr bool vex_index_extension_v = false;
+    template<size_t N, size_t M>
+    constexpr bool vex_index_extension_v<mem<N, vsib_address<register_type::vec<M, register_type::extention::extended>>>> = true;
+
+    template<size_t N, register_type::extention Ext>
+    constexpr bit3 modrm_code(register_type::vec<N, Ext> reg) {
+        return reg.r;
+    }
+    template<size_t N>
+    constexpr bit3 modrm_code(register_type::reg<N> reg) {
+        return static_cast<uint8_t>(reg.r);
+    }
+    template<size_t N>
+    constexpr bit3 modrm_code(register_type::ax_r<N>) {
+        return 0;
+    }
+    // an opcode extension in ModRM.reg
+    constexpr bit3 modrm_code(bit3 modrm_reg) {
+        return modrm_reg;
+    }
+
+    template<size_t N, register_type::extention Ext>
+    constexpr auto vex_modrm(bit3 reg, register_type::vec<N, Ext> rm) {
+        return modrm{3, reg, rm.r};
+    }
+    constexpr auto vex_modrm(bit3 reg, gpr auto rm) {
+        return modrm{}.set_reg(reg).set_rm(rm);
+    }
+    template<size_t N, typename Ref>
+    constexpr auto vex_modrm(bit3 reg, mem<N, Ref> rm) {
+        return modrm{}.set_reg(reg).set_rm(rm);
+    }
+    template<size_t N, typename Index>
+    constexpr auto vex_modrm(bit3 reg, mem<N, vsib_address<Index>>) {
+        return modrm{0, reg, 4};
+    }
+
+    constexpr auto sib_for(vector_register auto reg) {
+        return std::array<uint8_t, 0>{};
+    }
+    template<size_t N, typename Index>
+    constexpr auto sib_for(mem<N, vsib_address<Index>> address) {
+        if (address.m_ref.base == register_type::reg64::rbp) {
+            throw std::runtime_error{"rbp can not be a base register without displacement"};
+        }
+        return std::array<uint8_t, 1>{
+            sib{address.m_ref.scale, address.m_ref.index.r, static_cast<uint8_t>(address.m_ref.base)}
+        };
+    }
+
+    // the two byte form whenever X, B, W and the opcode map allow it
+    template<vex_opcode Opcode, bool R, bool X, bool B>
+    constexpr auto gen_vex_prefix(bit4 vvvv, bit1 l) {
+        auto prefix = vex{R, X, B, Opcode.map_select, Opcode.w, vvvv, l, Opcode.pp};
+        if constexpr (Opcode.map_select == 1 && Opcode.w == 0 && !X && !B) {
+            return prefix.two_byte();
+        }
+        else {
+            return prefix.three_byte();
+        }
+    }
+
+    template<vex_opcode Opcode>
+    constexpr auto gen_vex_instruction(auto reg, bit4 vvvv, bit1 l, auto regmem) {
+        using Reg = decltype(reg);
+        using Regmem = decltype(regmem);
+        return cat(
+                gen_vex_prefix<Opcode, vex_extension_v<Reg>, vex_index_extension_v<Regmem>, vex_extension_v<Regmem>>(vvvv, l),
+                std::array<uint8_t, 1>{Opcode.opcode},
+                std::array<uint8_t, 1>{vex_modrm(modrm_code(reg), regmem)},
+                sib_for(regmem)
+                );
+    }
+
+    template<vex_opcode Opcode>
+    constexpr auto vector_length(vector_register auto reg) {
+        static_assert(reg.size() == 128 || reg.size() == 256);
+        static_assert(!Opcode.only_256 || reg.size() == 256);
+        return bit1{reg.size() == 256};
+    }
+
+    // operands of the same length, or memory of that size
+    constexpr auto check_operand_sizes(vector_register auto reg, vector_or_mem auto... others) {
+        static_assert(((others.size() == reg.size()) && ...));
+    }
+
+    // ModRM.reg = dst, VEX.vvvv = src1, ModRM.rm = src2
+    template<vex_opcode Opcode>
+    struct vex_rvm_instruction {
+        constexpr static auto operator ()(vector_register auto dst, vector_register auto src1, vector_or_mem auto src2) {
+            check_operand_sizes(dst, src1, src2);
+            return gen_vex_instruction<Opcode>(dst, src1.index(), vector_length<Opcode>(dst), src2);
+        }
+    };
+
+    // ModRM.reg = dst, VEX.vvvv = src1, ModRM.rm = src2, imm8
+    template<vex_opcode Opcode>
+    struct vex_rvmi_instruction {
+        constexpr static auto operator ()(vector_register auto dst, vector_register auto src1, vector_or_mem auto src2, uint8_t imm) {
+            check_operand_sizes(dst, src1, src2);
+            return cat(
+                    gen_vex_instruction<Opcode>(dst, src1.index(), vector_length<Opcode>(dst), src2),
+                    to_codes(imm)
+                    );
+        }
+    };
+
+    // ModRM.reg = dst, VEX.vvvv = src1, ModRM.rm = src2, imm8[7:4] = src3
+    template<vex_opcode Opcode>
+    struct vex_rvmr_instruction {
+        constexpr static auto operator ()(vector_register auto dst, vector_register auto src1, vector_or_mem auto src2, vector_register auto src3) {
+            check_operand_sizes(dst, src1, src2, src3);
+            return cat(
+                    gen_vex_instruction<Opcode>(dst, src1.index(), vector_length<Opcode>(dst), src2),
+                    std::array<uint8_t, 1>{static_cast<uint8_t>(src3.index() << 4)}
+                    );
+        }
+    };
+
+    // ModRM.reg = dst, ModRM.rm = src. Broadcasts read a single element,
+    // so their source is not of the destination size.
+    template<vex_opcode Opcode, bool Same_size = true>
+    struct vex_rm_instruction {
+        constexpr static auto operator ()(vector_register auto dst, vector_or_mem auto src) {
+            if constexpr (Same_size) {
+                check_operand_sizes(dst, src);
+            }
+            return gen_vex_instruction<Opcode>(dst, 0, vector_length<Opcode>(dst), src);
+        }
+    };
+
+    // ModRM.reg = dst, ModRM.rm = src, imm8
+    template<vex_opcode Opcode>
+    struct vex_rmi_instruction {
+        constexpr static auto operator ()(vector_register auto dst, vector_or_mem auto src, uint8_t imm) {
+            check_operand_sizes(dst, src);
+            return cat(
+                    gen_vex_instruction<Opcode>(dst, 0, vector_length<Opcode>(dst), src),
+                    to_codes(imm)
+                    );
+        }
+    };
+
+    // ModRM.rm = dst, ModRM.reg = src, for stores
+    template<vex_opcode Opcode>
+    struct vex_mr_instruction {
+        constexpr static auto operator ()(memory auto dst, vector_register auto src) {
+            check_operand_sizes(src, dst);
+            return gen_vex_instruction<Opcode>(src, 0, vector_length<Opcode>(src), dst);
+        }
+    };
+
+    // loads with vex_rm_instruction, stores with vex_mr_instruction
+    template<vex_opcode Opcode_load, vex_opcode Opcode_store>
+    struct vex_move_instruction
+        :
+            public vex_rm_instruction<Opcode_load>,
+            public vex_mr_instruction<Opcode_store>
+    {
+        using vex_rm_instruction<Opcode_load>::operator();
+        using vex_mr_instruction<Opcode_store>::operator();
+    };
+
+    // ModRM.reg = general purpose dst, ModRM.rm = vector src
+    template<vex_opcode Opcode>
+    struct vex_movmsk_instruction {
+        constexpr static auto operator ()(gpr auto dst, vector_register auto src) {
+            static_assert(dst.size() == 32 || dst.size() == 64);
+            return gen_vex_instruction<Opcode>(dst, 0, vector_length<Opcode>(src), src);
+        }
+    };
+
+    // ModRM.reg = dst, VSIB = addresses, VEX.vvvv = mask.
+    // Elements whose mask sign bit is set are loaded, the mask is cleared.
+    template<vex_opcode Opcode>
+    struct vex_gather_instruction {
+        template<size_t N, typename Index>
+        constexpr static auto operator ()(vector_register auto dst, mem<N, vsib_address<Index>> address, vector_register auto mask) {
+            static_assert(dst.size() == mask.size());
+            // either the data or the indices fill a ymm register
+            auto length = bit1{dst.size() == 256 || Index::size() == 256};
+            auto index = address.m_ref.index.index();
+            if (dst.index() == mask.index() || dst.index() == index || mask.index() == index) {
+                throw std::runtime_error{"destination, index and mask of a gather must be different registers"};
+            }
+            return gen_vex_instruction<Opcode>(dst, mask.index(), length, address);
+        }
+    };
+
+    template<vex_opcode Opcode, bit1 L = 0>
+    struct vex_opcode_instruction {
+        constexpr static auto operator ()() {
+            return cat(
+                    gen_vex_prefix<Opcode, false, false, false>(0, L),
+                    std::array<uint8_t, 1>{Opcode.opcode}
+                    );
+        }
+    };
+}
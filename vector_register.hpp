@@ -0,0 +1,72 @@
+#pragma once
+
+#include "general_purpose_register.hpp"
+
+namespace amd64{
+    template<typename T>
+    struct is_vector_register {
+        constexpr static bool value = false;
+    };
+    template<typename T>
+    constexpr bool is_vector_register_v = is_vector_register<T>::value;
+    template<typename T>
+    concept vector_register = is_vector_register_v<T>;
+
+    namespace register_type {
+        // xmm0-xmm7/ymm0-ymm7, or xmm8-xmm15/ymm8-ymm15 when extended,
+        // which need the VEX R, X or B bit
+        template<size_t N, extention Ext = extention::legacy>
+        struct vec {
+            uint8_t r;
+
+            static constexpr auto size() { return N; }
+            static constexpr auto extended() { return Ext == extention::extended; }
+            // register number as in VEX.vvvv
+            constexpr uint8_t index() const { return r + (extended() ? 8 : 0); }
+        };
+
+        template<extention Ext = extention::legacy>
+        using xmm = vec<128, Ext>;
+        template<extention Ext = extention::legacy>
+        using ymm = vec<256, Ext>;
+    }
+
+    template<size_t N, register_type::extention Ext>
+    struct is_vector_register<register_type::vec<N, Ext>> {
+        constexpr static bool value = true;
+    };
+
+    constexpr auto xmm0 = register_type::xmm<>{0};
+    constexpr auto xmm1 = register_type::xmm<>{1};
+    constexpr auto xmm2 = register_type::xmm<>{2};
+    constexpr auto xmm3 = register_type::xmm<>{3};
+    constexpr auto xmm4 = register_type::xmm<>{4};
+    constexpr auto xmm5 = register_type::xmm<>{5};
+    constexpr auto xmm6 = register_type::xmm<>{6};
+    constexpr auto xmm7 = register_type::xmm<>{7};
+    constexpr auto xmm8 = register_type::xmm<register_type::extention::extended>{0};
+    constexpr auto xmm9 = register_type::xmm<register_type::extention::extended>{1};
+    constexpr auto xmm10 = register_type::xmm<register_type::extention::extended>{2};
+    constexpr auto xmm11 = register_type::xmm<register_type::extention::extended>{3};
+    constexpr auto xmm12 = register_type::xmm<register_type::extention::extended>{4};
+    constexpr auto xmm13 = register_type::xmm<register_type::extention::extended>{5};
+    constexpr auto xmm14 = register_type::xmm<register_type::extention::extended>{6};
+    constexpr auto xmm15 = register_type::xmm<register_type::extention::extended>{7};
+
+    constexpr auto ymm0 = register_type::ymm<>{0};
+    constexpr auto ymm1 = register_type::ymm<>{1};
+    constexpr auto ymm2 = register_type::ymm<>{2};
+    constexpr auto ymm3 = register_type::ymm<>{3};
+    constexpr auto ymm4 = register_type::ymm<>{4};
+    constexpr auto ymm5 = register_type::ymm<>{5};
+    constexpr auto ymm6 = register_type::ymm<>{6};
+    constexpr auto ymm7 = register_type::ymm<>{7};
+    constexpr auto ymm8 = register_type::ymm<register_type::extention::extended>{0};
+    constexpr auto ymm9 = register_type::ymm<register_type::extention::extended>{1};
+    constexpr auto ymm10 = register_type::ymm<register_type::extention::extended>{2};
+    constexpr auto ymm11 = register_type::ymm<register_type::extention::extended>{3};
+    constexpr auto ymm12 = register_type::ymm<register_type::extention::extended>{4};
+    constexpr auto ymm13 = register_type::ymm<register_type::extention::extended>{5};
+    constexpr auto ymm14 = register_type::ymm<register_type::extention::extended>{6};
+    constexpr auto ymm15 = register_type::ymm<register_type::extention::extended>{7};
+}